@@ -155,6 +155,7 @@ LOCAL_SRC_FILES := \
 	../../../src/mesh_generator_thread.cpp         \
 	../../../src/metadata.cpp                      \
 	../../../src/mg_biome.cpp                      \
+	../../../src/mg_chunkcache.cpp                 \
 	../../../src/mg_decoration.cpp                 \
 	../../../src/mg_ore.cpp                        \
 	../../../src/mg_schematic.cpp                  \
@@ -1,15 +1,23 @@
 
 core.log("info", "Initializing Asynchronous environment")
 
-function core.job_processor(serialized_func, serialized_param)
-	local func = loadstring(serialized_func)
+-- Jobs of server mods get the helpers to work on their VoxelManip
+if core.get_content_id then
+	local scriptpath = core.get_builtin_path()
+	dofile(scriptpath .. "common" .. DIR_DELIM .. "vector.lua")
+	dofile(scriptpath .. "game" .. DIR_DELIM .. "voxelarea.lua")
+end
+
+function core.job_processor(func, serialized_param, vm)
 	local param = core.deserialize(serialized_param)
 	local retval
 
-	if type(func) == "function" then
-		retval = core.serialize(func(param))
-	else
+	if type(func) ~= "function" then
 		core.log("error", "ASYNC WORKER: Unable to deserialize function")
+	elseif vm then
+		retval = core.serialize(func(vm, param))
+	else
+		retval = core.serialize(func(param))
 	end
 
 	return retval or core.serialize(nil)
@@ -17,7 +17,7 @@
 --   2. Recursively dump the value into a string.
 -- @param x Value to serialize (nil is allowed).
 -- @return load()able string containing the value.
-function core.serialize(x)
+local function serialize(x)
 	local local_index  = 1  -- Top index of the "_" local table in the dump
 	-- table->nil/1/2 set of tables seen.
 	-- nil = not seen, 1 = seen once, 2 = seen multiple times.
@@ -189,14 +189,7 @@ end
 
 local function dummy_func() end
 
-function core.deserialize(str, safe)
-	if type(str) ~= "string" then
-		return nil, "Cannot deserialize type '"..type(str)
-			.."'. Argument must be a string."
-	end
-	if str:byte(1) == 0x1B then
-		return nil, "Bytecode prohibited"
-	end
+local function deserialize(str, safe)
 	local f, err = loadstring(str)
 	if not f then return nil, err end
 
@@ -211,3 +204,38 @@ function core.deserialize(str, safe)
 		return nil, data
 	end
 end
+
+-- The native functions handle the common cases much faster and leave the
+-- others to the Lua ones
+local serialize_native = core.serialize_native
+local deserialize_native = core.deserialize_native
+
+function core.serialize(x)
+	if serialize_native then
+		local str = serialize_native(x)
+		if str then
+			return str
+		end
+	end
+	return serialize(x)
+end
+
+function core.deserialize(str, safe)
+	if type(str) ~= "string" then
+		return nil, "Cannot deserialize type '"..type(str)
+			.."'. Argument must be a string."
+	end
+	if str:byte(1) == 0x1B then
+		return nil, "Bytecode prohibited"
+	end
+	if deserialize_native then
+		-- Also reads the output of core.serialize_binary()
+		local done, data = deserialize_native(str)
+		if done then
+			return data
+		elseif done == false then
+			return nil, data
+		end
+	end
+	return deserialize(str, safe)
+end
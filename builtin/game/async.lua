@@ -0,0 +1,25 @@
+-- Minetest: builtin/game/async.lua
+
+--
+-- Asynchronous VoxelManip jobs
+--
+
+local jobs = {}
+
+function core.handle_async_vmanip(pos1, pos2, func, param, callback, light)
+	assert(type(func) == "string",
+		"handle_async_vmanip: func must be Lua source code")
+
+	local jobid = core.do_async_vmanip(func,
+		core.serialize(param), pos1, pos2, light ~= false)
+	jobs[jobid] = callback
+	return jobid
+end
+
+function core.async_event_handler(jobid, serialized_retval, written)
+	local callback = jobs[jobid]
+	jobs[jobid] = nil
+	if callback then
+		callback(written, core.deserialize(serialized_retval))
+	end
+end
@@ -600,6 +600,77 @@ core.register_chatcommand("mods", {
 	end
 })
 
+local function format_profile(profile, modname)
+	local elapsed = math.max(profile.elapsed, 1)
+	local rows = {}
+	local by_key = {}
+	for _, entry in ipairs(profile.entries) do
+		-- Sum the callbacks of each mod, or show those of one mod
+		local key
+		if not modname then
+			key = entry.mod
+		elseif entry.mod == modname then
+			key = entry.callback
+		end
+		if key then
+			local row = by_key[key]
+			if not row then
+				row = {name = key, calls = 0, time = 0, alloc = 0}
+				by_key[key] = row
+				rows[#rows + 1] = row
+			end
+			row.calls = row.calls + entry.calls
+			row.time = row.time + entry.time
+			row.alloc = row.alloc + entry.alloc
+		end
+	end
+	if #rows == 0 then
+		return "No profiling data" .. (modname and " for " .. modname or "")
+	end
+	table.sort(rows, function(a, b) return a.time > b.time end)
+
+	local lines = {string.format("Profiled %.1f s%s:", elapsed / 1e6,
+			profile.enabled and "" or " (stopped)")}
+	for i = 1, math.min(#rows, 20) do
+		local row = rows[i]
+		lines[#lines + 1] = string.format("%-32s %9.1f ms %5.1f%% %8d calls %10.1f KiB",
+				row.name == "" and "??" or row.name, row.time / 1e3,
+				row.time * 100 / elapsed, row.calls, row.alloc / 1024)
+	end
+	return table.concat(lines, "\n")
+end
+
+core.register_chatcommand("profile", {
+	params = "start | stop | reset | print [<mod>] | dump",
+	description = "Measure the time each mod spends in its callbacks",
+	privs = {server = true},
+	func = function(name, param)
+		local command, arg = param:match("^(%S*)%s*(.-)%s*$")
+		if command == "start" then
+			core.set_mod_profiling(true)
+			return true, "Mod profiling started"
+		elseif command == "stop" then
+			core.set_mod_profiling(false)
+			return true, "Mod profiling stopped"
+		elseif command == "reset" then
+			core.reset_mod_profile()
+			return true, "Mod profile cleared"
+		elseif command == "print" or command == "" then
+			return true, format_profile(core.get_mod_profile(),
+					arg ~= "" and arg or nil)
+		elseif command == "dump" then
+			local path = core.get_worldpath() .. DIR_DELIM .. "profile-" ..
+					os.date("%Y%m%d-%H%M%S") .. ".json"
+			local json = core.write_json(core.get_mod_profile(), true)
+			if not json or not core.safe_file_write(path, json) then
+				return false, "Failed to write " .. path
+			end
+			return true, "Mod profile written to " .. path
+		end
+		return false, "Invalid parameters (see /help profile)"
+	end
+})
+
 local function handle_give_command(cmd, giver, receiver, stackstring)
 	core.log("action", giver .. " invoked " .. cmd
 			.. ', stackstring="' .. stackstring .. '"')
@@ -27,6 +27,7 @@ dofile(gamepath .. "static_spawn.lua")
 dofile(gamepath .. "detached_inventory.lua")
 assert(loadfile(gamepath .. "falling.lua"))(builtin_shared)
 dofile(gamepath .. "voxelarea.lua")
+dofile(gamepath .. "async.lua")
 dofile(gamepath .. "forceloading.lua")
 dofile(gamepath .. "hud.lua")
 dofile(gamepath .. "statbars.lua")
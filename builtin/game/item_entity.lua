@@ -63,6 +63,9 @@ core.register_entity(":__builtin:throwing_item", {
 	end
 })
 
+-- Set below, the engine steps items whose on_step is not overridden
+local item_on_step
+
 core.register_entity(":__builtin:item", {
 	initial_properties = {
 		hp_max = 1,
@@ -140,6 +143,9 @@ core.register_entity(":__builtin:item", {
 		self.object:set_velocity({x = 0, y = 2, z = 0})
 		self.object:set_acceleration({x = 0, y = -gravity, z = 0})
 		self:set_item()
+		if self.on_step == item_on_step then
+			self.object:set_native_item(true, gravity, time_to_live)
+		end
 	end,
 
 	try_merge_with = function(self, own_stack, object, entity)
@@ -310,6 +316,8 @@ core.register_entity(":__builtin:item", {
 	end
 })
 
+item_on_step = core.registered_entities["__builtin:item"].on_step
+
 -- Item Collection
 if collection then
 	local function collect_items(player)
@@ -276,3 +276,38 @@ end
 function core.cancel_shutdown_requests()
 	core.request_shutdown("", false, -1)
 end
+
+-- Content ids do not change once the mods are loaded, cache them from
+-- the first server step on
+do
+	local get_content_id = core.get_content_id
+	local get_name_from_content_id = core.get_name_from_content_id
+	local ids, names = {}, {}
+	local loaded = false
+
+	function core.get_content_id(name)
+		local id = ids[name]
+		if not id then
+			id = get_content_id(name)
+			if loaded then
+				ids[name] = id
+			end
+		end
+		return id
+	end
+
+	function core.get_name_from_content_id(id)
+		local name = names[id]
+		if not name then
+			name = get_name_from_content_id(id)
+			if loaded then
+				names[id] = name
+			end
+		end
+		return name
+	end
+
+	core.after(0, function()
+		loaded = true
+	end)
+end
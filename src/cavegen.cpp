@@ -46,8 +46,7 @@ CavesNoiseIntersection::CavesNoiseIntersection(
 	m_csize = chunksize;
 	m_cave_width = cave_width;
 
-	m_ystride    = m_csize.X;
-	m_zstride_1d = m_csize.X * (m_csize.Y + 1);
+	m_ystride = m_csize.X;
 
 	// Noises are created using 1-down overgeneration
 	// A Nx-by-1-by-Nz-sized plane is at the bottom of the desired for
@@ -70,20 +69,67 @@ void CavesNoiseIntersection::generateCaves(MMVManip *vm,
 	assert(vm);
 	assert(biomemap);
 
+	v3s16 em = vm->m_area.getExtent();
+	u32 index2d = 0;  // Biomemap index
+
+	// Only ground is excavated. Find the top ground node of each column,
+	// the air and water above it only matter for the column state.
+	std::vector<s16> ground_top(m_csize.X * m_csize.Z);
+	std::vector<u8> under_river(m_csize.X * m_csize.Z);
+	s16 max_ground_y = nmin.Y - 2;
+
+	for (s16 z = nmin.Z; z <= nmax.Z; z++)
+	for (s16 x = nmin.X; x <= nmax.X; x++, index2d++) {
+		Biome *biome = (Biome *)m_bmgr->getRaw(biomemap[index2d]);
+		u32 vi = vm->m_area.index(x, nmax.Y, z);
+		bool is_under_river = false;
+		s16 y;
+		for (y = nmax.Y; y >= nmin.Y - 1; y--, vm->m_area.add_y(em, vi, -1)) {
+			content_t c = vm->m_data[vi].getContent();
+			if (c == CONTENT_AIR || c == biome->c_water_top ||
+					c == biome->c_water)
+				continue;
+			if (c != biome->c_river_water)
+				break;
+			is_under_river = true;
+		}
+		ground_top[index2d] = y;
+		under_river[index2d] = is_under_river;
+		max_ground_y = MYMAX(max_ground_y, y);
+	}
+
+	if (max_ground_y < nmin.Y - 1)
+		return;
+
+	// The noise rows start at nmin.Y - 1, leaving out the rows above the
+	// highest ground node does not change the values of the others
+	u16 ny = max_ground_y - (nmin.Y - 1) + 1;
+	if (noise_cave1->sy != ny) {
+		noise_cave1->setSize(m_csize.X, ny, m_csize.Z);
+		noise_cave2->setSize(m_csize.X, ny, m_csize.Z);
+	}
+	u32 zstride = m_csize.X * ny;
+
 	noise_cave1->perlinMap3D(nmin.X, nmin.Y - 1, nmin.Z);
 	noise_cave2->perlinMap3D(nmin.X, nmin.Y - 1, nmin.Z);
 
-	v3s16 em = vm->m_area.getExtent();
-	u32 index2d = 0;  // Biomemap index
+	std::vector<u8> in_tunnel(zstride * m_csize.Z);
+	contour_intersection_mask(&in_tunnel[0], noise_cave1->result,
+		noise_cave2->result, in_tunnel.size(), m_cave_width);
 
+	index2d = 0;
 	for (s16 z = nmin.Z; z <= nmax.Z; z++)
 	for (s16 x = nmin.X; x <= nmax.X; x++, index2d++) {
-		bool column_is_open = false;  // Is column open to overground
-		bool is_under_river = false;  // Is column under river water
+		s16 top = ground_top[index2d];
+		if (top < nmin.Y - 1)
+			continue;
+
+		bool column_is_open = top < nmax.Y;  // Is column open to overground
+		bool is_under_river = under_river[index2d];  // Is column under river water
 		bool is_under_tunnel = false;  // Is tunnel or is under tunnel
-		// Indexes at column top
-		u32 vi = vm->m_area.index(x, nmax.Y, z);
-		u32 index3d = (z - nmin.Z) * m_zstride_1d + m_csize.Y * m_ystride +
+		// Indexes at column ground top
+		u32 vi = vm->m_area.index(x, top, z);
+		u32 index3d = (z - nmin.Z) * zstride + (top - (nmin.Y - 1)) * m_ystride +
 			(x - nmin.X);  // 3D noise index
 		// Biome of column
 		Biome *biome = (Biome *)m_bmgr->getRaw(biomemap[index2d]);
@@ -95,7 +141,7 @@ void CavesNoiseIntersection::generateCaves(MMVManip *vm,
 		// this creates a 'roof' over the tunnel, preventing light in
 		// tunnels at mapchunk borders when generating mapchunks upwards.
 		// This 'roof' is removed when the mapchunk above is generated.
-		for (s16 y = nmax.Y; y >= nmin.Y - 1; y--,
+		for (s16 y = top; y >= nmin.Y - 1; y--,
 				index3d -= m_ystride,
 				vm->m_area.add_y(em, vi, -1)) {
 
@@ -110,10 +156,7 @@ void CavesNoiseIntersection::generateCaves(MMVManip *vm,
 				continue;
 			}
 			// Ground
-			float d1 = contour(noise_cave1->result[index3d]);
-			float d2 = contour(noise_cave2->result[index3d]);
-
-			if (d1 * d2 > m_cave_width && m_ndef->get(c).is_ground_content) {
+			if (in_tunnel[index3d] && m_ndef->get(c).is_ground_content) {
 				// In tunnel and ground content, excavate
 				vm->m_data[vi] = MapNode(CONTENT_AIR);
 				is_under_tunnel = true;
@@ -168,7 +211,6 @@ CavernsNoise::CavernsNoise(
 	m_cavern_threshold = cavern_threshold;
 
 	m_ystride = m_csize.X;
-	m_zstride_1d = m_csize.X * (m_csize.Y + 1);
 
 	// Noise is created using 1-down overgeneration
 	// A Nx-by-1-by-Nz-sized plane is at the bottom of the desired for
@@ -195,13 +237,28 @@ bool CavernsNoise::generateCaverns(MMVManip *vm, v3s16 nmin, v3s16 nmax)
 {
 	assert(vm);
 
+	// At and above cavern_limit the amplitude is not positive, so with a
+	// usual threshold nothing happens there and the noise rows are skipped.
+	// The rows start at nmin.Y - 1, leaving out the top ones does not
+	// change the values of the others.
+	s16 y_top = nmax.Y;
+	if (m_cavern_threshold - 0.1f >= 0.0f)
+		y_top = MYMIN(y_top, (s16)ceil(m_cavern_limit) - 1);
+	if (y_top < nmin.Y - 1)
+		return false;
+
+	u16 ny = y_top - (nmin.Y - 1) + 1;
+	if (noise_cavern->sy != ny)
+		noise_cavern->setSize(m_csize.X, ny, m_csize.Z);
+	u32 zstride = m_csize.X * ny;
+
 	// Calculate noise
 	noise_cavern->perlinMap3D(nmin.X, nmin.Y - 1, nmin.Z);
 
 	// Cache cavern_amp values
-	float *cavern_amp = new float[m_csize.Y + 1];
+	float *cavern_amp = new float[ny];
 	u8 cavern_amp_index = 0;  // Index zero at column top
-	for (s16 y = nmax.Y; y >= nmin.Y - 1; y--, cavern_amp_index++) {
+	for (s16 y = y_top; y >= nmin.Y - 1; y--, cavern_amp_index++) {
 		cavern_amp[cavern_amp_index] =
 			MYMIN((m_cavern_limit - y) / (float)m_cavern_taper, 1.0f);
 	}
@@ -216,15 +273,15 @@ bool CavernsNoise::generateCaverns(MMVManip *vm, v3s16 nmin, v3s16 nmax)
 		// Reset cave_amp index to column top
 		cavern_amp_index = 0;
 		// Initial voxelmanip index at column top
-		u32 vi = vm->m_area.index(x, nmax.Y, z);
+		u32 vi = vm->m_area.index(x, y_top, z);
 		// Initial 3D noise index at column top
-		u32 index3d = (z - nmin.Z) * m_zstride_1d + m_csize.Y * m_ystride +
+		u32 index3d = (z - nmin.Z) * zstride + (ny - 1) * m_ystride +
 			(x - nmin.X);
 		// Don't excavate the overgenerated stone at node_max.Y + 1,
 		// this creates a 'roof' over the cavern, preventing light in
 		// caverns at mapchunk borders when generating mapchunks upwards.
 		// This 'roof' is excavated when the mapchunk above is generated.
-		for (s16 y = nmax.Y; y >= nmin.Y - 1; y--,
+		for (s16 y = y_top; y >= nmin.Y - 1; y--,
 				index3d -= m_ystride,
 				vm->m_area.add_y(em, vi, -1),
 				cavern_amp_index++) {
@@ -493,6 +550,24 @@ void CavesRandomWalk::carveRoute(v3f vec, float f, bool randomize_xz)
 
 	bool flat_cave_floor = !large_cave && ps->range(0, 2) == 2;
 
+	// Vertical extent carved in every column, relative to cp
+	s16 y0_min = -rs;
+	s16 y0_max = rs;
+	// Make better floors in small caves
+	if (flat_cave_floor && rs <= 7)
+		y0_min = -rs / 2 + 1;
+	// Make large caves not so tall
+	if (large_cave_is_flat && rs > 7) {
+		y0_min = MYMAX(y0_min, -(rs / 3 - 1));
+		y0_max = rs / 3 - 1;
+	}
+
+	const VoxelArea &area = vm->m_area;
+	const v3s16 em = area.getExtent();
+	const s16 full_ymin = node_min.Y - MAP_BLOCKSIZE;
+	const s16 full_ymax = node_max.Y + MAP_BLOCKSIZE;
+	const s16 py0 = cp.Y + of.Y;
+
 	for (s16 z0 = d0; z0 <= d1; z0++) {
 		s16 si = rs / 2 - MYMAX(0, abs(z0) - rs / 7 - 1);
 		for (s16 x0 = -si - ps->range(0,1); x0 <= si - 1 + ps->range(0,1); x0++) {
@@ -500,36 +575,30 @@ void CavesRandomWalk::carveRoute(v3f vec, float f, bool randomize_xz)
 
 			s16 si2 = rs / 2 - MYMAX(0, maxabsxz - rs / 7 - 1);
 
-			for (s16 y0 = -si2; y0 <= si2; y0++) {
-				// Make better floors in small caves
-				if (flat_cave_floor && y0 <= -rs / 2 && rs <= 7)
-					continue;
-
-				if (large_cave_is_flat) {
-					// Make large caves not so tall
-					if (rs > 7 && abs(y0) >= rs / 3)
-						continue;
-				}
-
-				v3s16 p(cp.X + x0, cp.Y + y0, cp.Z + z0);
-				p += of;
+			// Carve the column as one span
+			s16 px = cp.X + x0 + of.X;
+			s16 pz = cp.Z + z0 + of.Z;
+			if (px < area.MinEdge.X || px > area.MaxEdge.X ||
+					pz < area.MinEdge.Z || pz > area.MaxEdge.Z)
+				continue;
 
-				if (vm->m_area.contains(p) == false)
-					continue;
+			s16 ymin = MYMAX(MYMAX(-si2, y0_min), area.MinEdge.Y - py0);
+			s16 ymax = MYMIN(MYMIN(si2, y0_max), area.MaxEdge.Y - py0);
+			if (ymin > ymax)
+				continue;
 
-				u32 i = vm->m_area.index(p);
+			u32 i = area.index(px, py0 + ymin, pz);
+			for (s16 y0 = ymin; y0 <= ymax; y0++, i += em.X) {
 				content_t c = vm->m_data[i].getContent();
 				if (!ndef->get(c).is_ground_content)
 					continue;
 
 				if (large_cave) {
-					int full_ymin = node_min.Y - MAP_BLOCKSIZE;
-					int full_ymax = node_max.Y + MAP_BLOCKSIZE;
-
+					s16 py = py0 + y0;
 					if (flooded && full_ymin < water_level && full_ymax > water_level)
-						vm->m_data[i] = (p.Y <= water_level) ? waternode : airnode;
+						vm->m_data[i] = (py <= water_level) ? waternode : airnode;
 					else if (flooded && full_ymax < water_level)
-						vm->m_data[i] = (p.Y < startp.Y - 4) ? liquidnode : airnode;
+						vm->m_data[i] = (py < startp.Y - 4) ? liquidnode : airnode;
 					else
 						vm->m_data[i] = airnode;
 				} else {
@@ -57,7 +57,6 @@ class CavesNoiseIntersection
 
 	// intermediate state variables
 	u16 m_ystride;
-	u16 m_zstride_1d;
 
 	Noise *noise_cave1;
 	Noise *noise_cave2;
@@ -87,7 +86,6 @@ class CavernsNoise
 
 	// intermediate state variables
 	u16 m_ystride;
-	u16 m_zstride_1d;
 
 	Noise *noise_cavern;
 
@@ -125,6 +125,8 @@ void RemoteClient::GetNextBlocks (
 		m_last_center = center;
 	}
 
+	emerge->setPeerFocus(peer_id, center);
+
 	/*infostream<<"m_nearest_unsent_reset_timer="
 			<<m_nearest_unsent_reset_timer<<std::endl;*/
 
@@ -248,7 +248,19 @@ LuaEntitySAO::LuaEntitySAO(ServerEnvironment *env, v3f pos,
 	m_last_sent_velocity(0,0,0),
 	m_last_sent_position_timer(0),
 	m_last_sent_move_precision(0),
-	m_current_texture_modifier("")
+	m_current_texture_modifier(""),
+	m_sleeping(false),
+	m_sleep_time(0),
+	m_native_item(false),
+	m_item_asleep(false),
+	m_item_sync_timer(0),
+	m_item_gravity(0),
+	m_item_ttl(0),
+	m_item_age(0),
+	m_item_synced_age(0),
+	m_item_stuck(false),
+	m_item_moving(true),
+	m_item_slippery(false)
 {
 	// Only register type if no environment supplied
 	if(env == NULL){
@@ -259,6 +271,9 @@ LuaEntitySAO::LuaEntitySAO(ServerEnvironment *env, v3f pos,
 
 LuaEntitySAO::~LuaEntitySAO()
 {
+	if (m_sleeping)
+		m_env->removeSleepingObject(m_id, m_sleep_blockpos);
+
 	if(m_registered){
 		m_env->getScriptIface()->luaentity_Remove(m_id);
 	}
@@ -349,6 +364,16 @@ void LuaEntitySAO::step(float dtime, bool send_recommended)
 
 	m_last_sent_position_timer += dtime;
 
+	if (m_sleeping) {
+		if (isAttached() || (m_prop.max_sleep_time > 0 &&
+				m_sleep_time + dtime >= m_prop.max_sleep_time))
+			wakeUp();
+		else
+			m_sleep_time += dtime;
+	}
+
+	bool touching_ground = false;
+
 	// Each frame, parent position is copied if the object is attached, otherwise it's calculated normally
 	// If the object gets detached this comes into effect automatically from the last known origin
 	if(isAttached())
@@ -358,6 +383,10 @@ void LuaEntitySAO::step(float dtime, bool send_recommended)
 		m_velocity = v3f(0,0,0);
 		m_acceleration = v3f(0,0,0);
 	}
+	else if (m_sleeping || m_item_asleep)
+	{
+		// Objects at rest do not move, see sleep() and stepNativeItem()
+	}
 	else
 	{
 		if(m_prop.physical){
@@ -378,6 +407,7 @@ void LuaEntitySAO::step(float dtime, bool send_recommended)
 			m_base_position = p_pos;
 			m_velocity = p_velocity;
 			m_acceleration = p_acceleration;
+			touching_ground = moveresult.touching_ground;
 		} else {
 			m_base_position += dtime * m_velocity + 0.5 * dtime
 					* dtime * m_acceleration;
@@ -402,10 +432,31 @@ void LuaEntitySAO::step(float dtime, bool send_recommended)
 		}
 	}
 
-	if(m_registered){
-		m_env->getScriptIface()->luaentity_Step(m_id, dtime);
+	if(m_registered && !m_sleeping){
+		if (!m_native_item) {
+			// With the time spent sleeping, given apart so a long sleep
+			// does not look like one huge step
+			m_env->getScriptIface()->luaentity_Step(m_id, dtime,
+				m_sleep_time);
+			m_sleep_time = 0;
+		} else if (!stepNativeItem(dtime)) {
+			// Leave this step to on_step, with the state it expects
+			writeItemState();
+			m_item_asleep = false;
+			m_env->getScriptIface()->luaentity_Step(m_id, dtime);
+			if (m_native_item)
+				readItemState();
+		}
 	}
 
+
+	// Only stopped objects and those held on the ground by gravity sleep
+	if (m_prop.can_sleep && !m_sleeping && !isAttached() &&
+			m_velocity == v3f(0, 0, 0) &&
+			(m_acceleration == v3f(0, 0, 0) ||
+			(touching_ground && m_acceleration.X == 0 &&
+			m_acceleration.Z == 0 && m_acceleration.Y < 0)))
+		sleep();
 	if(send_recommended == false)
 		return;
 
@@ -551,6 +602,8 @@ int LuaEntitySAO::punch(v3f dir,
 	if (isAttached())
 		return 0;
 
+	wakeUp();
+
 	ItemStack *punchitem = NULL;
 	ItemStack punchitem_static;
 	if (puncher) {
@@ -601,6 +654,7 @@ void LuaEntitySAO::rightClick(ServerActiveObject *clicker)
 	// It's best that attachments cannot be clicked
 	if (isAttached())
 		return;
+	wakeUp();
 	m_env->getScriptIface()->luaentity_Rightclick(m_id, clicker);
 }
 
@@ -609,6 +663,7 @@ void LuaEntitySAO::setPos(const v3f &pos)
 	if(isAttached())
 		return;
 	m_base_position = pos;
+	wakeUp();
 	sendPosition(false, true);
 }
 
@@ -617,6 +672,7 @@ void LuaEntitySAO::moveTo(v3f pos, bool continuous)
 	if(isAttached())
 		return;
 	m_base_position = pos;
+	wakeUp();
 	if(!continuous)
 		sendPosition(true, true);
 }
@@ -650,6 +706,8 @@ s16 LuaEntitySAO::getHP() const
 
 void LuaEntitySAO::setVelocity(v3f velocity)
 {
+	if (velocity != m_velocity)
+		wakeUp();
 	m_velocity = velocity;
 }
 
@@ -660,6 +718,8 @@ v3f LuaEntitySAO::getVelocity()
 
 void LuaEntitySAO::setAcceleration(v3f acceleration)
 {
+	if (acceleration != m_acceleration)
+		wakeUp();
 	m_acceleration = acceleration;
 }
 
@@ -758,6 +818,226 @@ bool LuaEntitySAO::collideWithObjects() const
 	return m_prop.collideWithObjects;
 }
 
+void LuaEntitySAO::notifyObjectPropertiesModified()
+{
+	UnitSAO::notifyObjectPropertiesModified();
+	wakeUp();
+}
+
+/*
+	Entities with the can_sleep property that stopped, or rest on the
+	ground, are neither moved nor stepped until something could make them
+	move again: being punched or right-clicked, getting a new velocity,
+	acceleration, position or properties, a node change next to them or
+	max_sleep_time passing. on_step then gets the time spent sleeping as its
+	third argument.
+*/
+void LuaEntitySAO::sleep()
+{
+	// The clients have to know where it stopped
+	if (m_base_position != m_last_sent_position ||
+			m_velocity != m_last_sent_velocity)
+		sendPosition(false, true);
+
+	// A node touches the collision box if it is at most its extent plus
+	// half a node away from the node of the position
+	const aabb3f &box = m_prop.collisionbox;
+	f32 extent = MYMAX(MYMAX(box.MaxEdge.X, box.MaxEdge.Y), box.MaxEdge.Z);
+	extent = MYMAX(extent,
+		-MYMIN(MYMIN(box.MinEdge.X, box.MinEdge.Y), box.MinEdge.Z));
+	extent = rangelim(extent, 0, MAX_MAP_GENERATION_LIMIT);
+	s16 reach = (s16)extent + 1;
+
+	m_sleeping = true;
+	m_sleep_blockpos = getNodeBlockPos(floatToInt(m_base_position, BS));
+	m_env->addSleepingObject(m_id, m_sleep_blockpos, reach);
+}
+
+void LuaEntitySAO::wakeUp()
+{
+	m_item_asleep = false;
+	if (!m_sleeping)
+		return;
+
+	m_sleeping = false;
+	m_env->removeSleepingObject(m_id, m_sleep_blockpos);
+}
+
+// Interval at which the state of a native item is synced with its Lua entity
+// and a resting one checks whether it should start moving again
+#define ITEM_SYNC_INTERVAL 0.5f
+
+void LuaEntitySAO::setNativeItem(bool native, float gravity, float ttl)
+{
+	m_native_item = native;
+	m_item_asleep = false;
+	m_item_gravity = gravity;
+	m_item_ttl = ttl;
+	m_item_sync_timer = 0;
+	if (native) {
+		m_item_synced_age = -1;
+		readItemState();
+	}
+}
+
+void LuaEntitySAO::readItemState()
+{
+	float age;
+	std::string itemstring;
+	if (!m_env->getScriptIface()->luaentity_GetItemState(m_id,
+			&age, &m_item_stuck, &itemstring)) {
+		m_native_item = false;
+		m_item_asleep = false;
+		return;
+	}
+
+	// Keep the age unless Lua code changed it
+	if (age != m_item_synced_age)
+		m_item_age = age;
+
+	if (itemstring != m_item_string) {
+		m_item_string = itemstring;
+		m_item_asleep = false;
+		try {
+			m_item_stack.deSerialize(itemstring,
+				m_env->getGameDef()->idef());
+		} catch (SerializationError &e) {
+			m_item_stack.clear();
+		}
+	}
+}
+
+void LuaEntitySAO::writeItemState()
+{
+	m_env->getScriptIface()->luaentity_SetItemState(m_id,
+		m_item_age, m_item_moving, m_item_slippery);
+	m_item_synced_age = m_item_age;
+	m_item_sync_timer = 0;
+}
+
+/*
+	Does what the on_step of "__builtin:item" does, leaving the uncommon
+	cases to it: returns false without changing anything if the item is to
+	be removed, is in lava or flowing liquid, is stuck in a node, slides on
+	a slippery node or may merge with another item.
+
+	The Lua entity keeps the item state, the age and the moving state are
+	written to it every ITEM_SYNC_INTERVAL and before Lua code of the item
+	runs. Items at rest sleep: they are not moved and only check the nodes
+	around them every ITEM_SYNC_INTERVAL.
+*/
+bool LuaEntitySAO::stepNativeItem(float dtime)
+{
+	m_item_sync_timer += dtime;
+	bool sync = m_item_sync_timer >= ITEM_SYNC_INTERVAL;
+	if (sync) {
+		readItemState();
+		if (!m_native_item)
+			return false;
+	}
+
+	float age = m_item_age + dtime;
+	if ((m_item_ttl > 0 && age > m_item_ttl) || m_item_string.empty())
+		return false;
+
+	if (m_item_asleep && !sync) {
+		m_item_age = age;
+		return true;
+	}
+
+	INodeDefManager *ndef = m_env->getGameDef()->ndef();
+	Map &map = m_env->getMap();
+	v3f pos = m_base_position / BS;
+
+	bool below_valid;
+	MapNode n_below = map.getNodeNoEx(floatToInt(v3f(pos.X,
+		pos.Y + m_prop.collisionbox.MinEdge.Y - 0.05f, pos.Z), 1.0f),
+		&below_valid);
+	if (below_valid && n_below.getContent() == CONTENT_IGNORE)
+		return false;
+
+	bool inside_valid;
+	MapNode n_inside = map.getNodeNoEx(floatToInt(pos, 1.0f), &inside_valid);
+	if (inside_valid) {
+		const ContentFeatures &f = ndef->get(n_inside);
+		if (f.groups.find("lava") != f.groups.end() ||
+				f.liquid_type == LIQUID_FLOWING)
+			return false;
+		if (!m_item_stuck && f.walkable && f.drawtype == NDT_NORMAL &&
+				n_inside.getContent() != CONTENT_AIR)
+			return false;
+	}
+
+	v3f vel = m_velocity / BS;
+	bool moving = vel.X != 0 || vel.Y != 0 || vel.Z != 0;
+	bool slippery = false;
+	if (below_valid) {
+		const ContentFeatures &f = ndef->get(n_below);
+		if (!f.walkable) {
+			moving = true;
+		} else {
+			slippery = itemgroup_get(f.groups, "slippery") != 0;
+			if (slippery && (fabs(vel.X) > 0.2f || fabs(vel.Z) > 0.2f))
+				return false;
+			if (vel.Y == 0)
+				moving = false;
+		}
+	}
+
+	// Sleeping items were checked when they came to rest
+	if (!m_item_asleep && hasItemMergeCandidate())
+		return false;
+
+	m_item_age = age;
+	m_item_moving = moving;
+	m_item_slippery = slippery;
+	if (moving) {
+		m_acceleration = v3f(0, -m_item_gravity * BS, 0);
+		m_item_asleep = false;
+	} else {
+		m_acceleration = v3f(0, 0, 0);
+		m_velocity = v3f(0, 0, 0);
+		m_item_asleep = true;
+	}
+
+	if (sync)
+		writeItemState();
+	return true;
+}
+
+bool LuaEntitySAO::hasItemMergeCandidate()
+{
+	IItemDefManager *idef = m_env->getGameDef()->idef();
+	u16 max = m_item_stack.getStackMax(idef);
+	if (m_item_stack.count >= max)
+		return false;
+
+	std::vector<u16> objects;
+	m_env->getObjectsInsideRadius(objects, m_base_position, 0.5f * BS);
+	for (std::vector<u16>::const_iterator it = objects.begin();
+			it != objects.end(); ++it) {
+		ServerActiveObject *obj = m_env->getActiveObject(*it);
+		if (*it == m_id || !obj || obj->isGone() ||
+				obj->getType() != ACTIVEOBJECT_TYPE_LUAENTITY)
+			continue;
+
+		LuaEntitySAO *other = (LuaEntitySAO *)obj;
+		if (other->m_init_name != m_init_name)
+			continue;
+		// on_step knows whether it can merge
+		if (!other->m_native_item)
+			return true;
+
+		const ItemStack &stack = other->m_item_stack;
+		if (stack.name == m_item_stack.name &&
+				stack.wear == m_item_stack.wear &&
+				stack.metadata == m_item_stack.metadata &&
+				stack.count + m_item_stack.count <= max)
+			return true;
+	}
+	return false;
+}
+
 /*
 	PlayerSAO
 */
@@ -24,6 +24,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "serverobject.h"
 #include "itemgroup.h"
 #include "object_properties.h"
+#include "inventory.h"
 
 class UnitSAO: public ServerActiveObject
 {
@@ -127,10 +128,23 @@ class LuaEntitySAO : public UnitSAO
 	std::string getName();
 	bool getCollisionBox(aabb3f *toset) const;
 	bool collideWithObjects() const;
+
+	// Steps the builtin dropped item natively, see stepNativeItem()
+	void setNativeItem(bool native, float gravity, float ttl);
+
+	void notifyObjectPropertiesModified();
+	// Ends the sleep of an entity at rest, see sleep()
+	void wakeUp();
 private:
 	std::string getPropertyPacket();
 	void sendPosition(bool do_interpolate, bool is_movement_end);
 
+	void sleep();
+	bool stepNativeItem(float dtime);
+	bool hasItemMergeCandidate();
+	void readItemState();
+	void writeItemState();
+
 	std::string m_init_name;
 	std::string m_init_state;
 	bool m_registered;
@@ -144,6 +158,26 @@ class LuaEntitySAO : public UnitSAO
 	float m_last_sent_position_timer;
 	float m_last_sent_move_precision;
 	std::string m_current_texture_modifier;
+
+	bool m_sleeping;
+	// Time not yet given to on_step
+	float m_sleep_time;
+	v3s16 m_sleep_blockpos;
+
+	// Native dropped item, the state mirrors the fields of the Lua entity
+	bool m_native_item;
+	bool m_item_asleep;
+	float m_item_sync_timer;
+	float m_item_gravity;
+	float m_item_ttl;
+	float m_item_age;
+	// Age last written to the Lua entity
+	float m_item_synced_age;
+	bool m_item_stuck;
+	bool m_item_moving;
+	bool m_item_slippery;
+	std::string m_item_string;
+	ItemStack m_item_stack;
 };
 
 /*
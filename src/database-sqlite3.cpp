@@ -201,8 +201,9 @@ Database_SQLite3::~Database_SQLite3()
  * Map database
  */
 
-MapDatabaseSQLite3::MapDatabaseSQLite3(const std::string &savedir):
-	Database_SQLite3(savedir, "map"),
+MapDatabaseSQLite3::MapDatabaseSQLite3(const std::string &savedir,
+		const std::string &dbname):
+	Database_SQLite3(savedir, dbname),
 	MapDatabase(),
 	m_stmt_read(NULL),
 	m_stmt_write(NULL),
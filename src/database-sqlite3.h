@@ -134,7 +134,8 @@ class Database_SQLite3 : public Database
 class MapDatabaseSQLite3 : private Database_SQLite3, public MapDatabase
 {
 public:
-	MapDatabaseSQLite3(const std::string &savedir);
+	MapDatabaseSQLite3(const std::string &savedir,
+		const std::string &dbname = "map");
 	virtual ~MapDatabaseSQLite3();
 
 	bool saveBlock(const v3s16 &pos, const std::string &data);
@@ -305,6 +305,7 @@ void set_default_settings(Settings *settings) {
 	settings->setDefault("kamikaze", "false");
 
 	settings->setDefault("profiler_print_interval", "0");
+	settings->setDefault("profiler.mod_accounting", "false");
 	settings->setDefault("active_object_send_range_blocks", "4");
 	settings->setDefault("active_block_range", "3");
 	//settings->setDefault("max_simultaneous_block_sends_per_client", "1");
@@ -323,6 +324,8 @@ void set_default_settings(Settings *settings) {
 	settings->setDefault("sqlite_synchronous", "2");
 	settings->setDefault("full_block_send_enable_min_time_from_building", "2.0");
 	settings->setDefault("dedicated_server_step", "0.1");
+	settings->setDefault("lua_gc_step_budget", "0.0");
+	settings->setDefault("lua_gc_pause", "200");
 	settings->setDefault("active_block_mgmt_interval", "2.0");
 	settings->setDefault("abm_interval", "1.0");
 	settings->setDefault("nodetimer_interval", "0.2");
@@ -333,6 +336,12 @@ void set_default_settings(Settings *settings) {
 	settings->setDefault("emergequeue_limit_diskonly", "64");
 	settings->setDefault("emergequeue_limit_generate", "64");
 	settings->setDefault("num_emerge_threads", "1");
+	settings->setDefault("num_emerge_load_threads", "0");
+	settings->setDefault("num_async_threads", "0");
+	settings->setDefault("noise_map_cache_size", "32");
+	settings->setDefault("mapgen_placement_threads", "0");
+	settings->setDefault("mapgen_lighting_threads", "0");
+	settings->setDefault("mapgen_chunk_cache", "false");
 	settings->setDefault("secure.enable_security", "true");
 	settings->setDefault("secure.trusted_mods", "");
 	settings->setDefault("secure.http_mods", "");
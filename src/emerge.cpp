@@ -21,24 +21,32 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include "emerge.h"
 
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
 #include <iostream>
-#include <queue>
 
 #include "util/container.h"
+#include "util/numeric.h"
+#include "util/serialize.h"
 #include "util/thread.h"
 #include "threading/event.h"
 
 #include "config.h"
 #include "constants.h"
 #include "environment.h"
+#include "filesys.h"
 #include "log.h"
 #include "map.h"
 #include "mapblock.h"
 #include "mg_biome.h"
+#include "mg_chunkcache.h"
 #include "mg_ore.h"
 #include "mg_decoration.h"
 #include "mg_schematic.h"
+#include "network/networkprotocol.h"
 #include "nodedef.h"
+#include "noise.h"
 #include "profiler.h"
 #include "scripting_server.h"
 #include "server.h"
@@ -51,14 +59,14 @@ class EmergeThread : public Thread {
 	bool enable_mapgen_debug_info;
 	int id;
 
-	EmergeThread(Server *server, int ethreadid);
+	EmergeThread(Server *server, int ethreadid, bool load_only);
 	~EmergeThread();
 
 	void *run();
 	void signal();
 
 	// Requires queue mutex held
-	bool pushBlock(v3s16 pos);
+	bool pushChunk(v3s16 chunkpos);
 
 	void cancelPendingItems();
 
@@ -72,11 +80,22 @@ class EmergeThread : public Thread {
 	EmergeManager *m_emerge;
 	Mapgen *m_mapgen;
 
+	// Load-only threads serve blocks from memory or disk and hand blocks
+	// that need generating over to the mapgen threads
+	bool m_load_only;
+
 	Event m_queue_event;
-	std::queue<v3s16> m_block_queue;
+
+	// Mapchunks assigned to this thread; idle threads steal from these.
+	// Guarded by EmergeManager::m_queue_mutex.
+	std::deque<v3s16> m_chunk_queue;
+	v3s16 m_chunk_current;
+	bool m_chunk_busy;
 
 	bool popBlockEmerge(v3s16 *pos, BlockEmergeData *bedata);
+	bool finishBlockEmerge(v3s16 pos, BlockEmergeData *bedata);
 
+	EmergeAction getBlockOrLoad(v3s16 pos, MapBlock **block);
 	EmergeAction getBlockOrStartGen(
 		v3s16 pos, bool allow_gen, MapBlock **block, BlockMakeData *data);
 	MapBlock *finishGen(v3s16 pos, BlockMakeData *bmdata,
@@ -91,12 +110,16 @@ class EmergeThread : public Thread {
 
 EmergeManager::EmergeManager(Server *server)
 {
+	this->m_server  = server;
 	this->ndef      = server->getNodeDefManager();
 	this->biomemgr  = new BiomeManager(server);
 	this->oremgr    = new OreManager(server);
 	this->decomgr   = new DecorationManager(server);
 	this->schemmgr  = new SchematicManager(server);
 	this->gen_notify_on = 0;
+	this->mgparams = NULL;
+	this->chunk_cache = NULL;
+	this->m_chunk_seqnum = 0;
 
 	// Note that accesses to this variable are not synchronized.
 	// This is because the *only* thread ever starting or stopping
@@ -127,10 +150,41 @@ EmergeManager::EmergeManager(Server *server)
 	if (m_qlimit_generate < 1)
 		m_qlimit_generate = 1;
 
+	// Emerges requested by a peer further away from it than this (in blocks)
+	// are dropped; the client will simply request them again when needed
+	m_cancel_distance = g_settings->getS16("max_block_send_distance") +
+		g_settings->getS16("chunksize") * 2;
+
+	// Load threads mostly wait for the database, so there can be many
+	s16 nloadthreads = g_settings->getS16("num_emerge_load_threads");
+	if (nloadthreads <= 0)
+		nloadthreads = Thread::getNumberOfProcessors();
+	if (nloadthreads < 1)
+		nloadthreads = 1;
+
 	for (s16 i = 0; i < nthreads; i++)
-		m_threads.push_back(new EmergeThread(server, i));
+		m_threads.push_back(new EmergeThread(server, i, false));
+
+	for (s16 i = 0; i < nloadthreads; i++)
+		m_load_threads.push_back(new EmergeThread(server, i, true));
+
+	infostream << "EmergeManager: using " << nthreads << " mapgen threads and "
+		<< nloadthreads << " load threads" << std::endl;
+
+	s32 noise_cache_size = g_settings->getS32("noise_map_cache_size");
+	g_noise_map_cache->setMaxSize((size_t)MYMAX(noise_cache_size, 0) * 1024 * 1024);
+
+	// Lighting, ores and decorations of a mapchunk are done by several
+	// threads, by default sharing the processors left between the emerge
+	// threads
+	s32 nplacethreads = g_settings->getS32("mapgen_placement_threads");
+	if (nplacethreads <= 0)
+		nplacethreads = Thread::getNumberOfProcessors() / nthreads;
+	mapgen_threads = MYMAX(nplacethreads, 1);
 
-	infostream << "EmergeManager: using " << nthreads << " threads" << std::endl;
+	s32 nlightthreads = g_settings->getS32("mapgen_lighting_threads");
+	mapgen_lighting_threads = (nlightthreads <= 0) ?
+		mapgen_threads : nlightthreads;
 }
 
 
@@ -152,10 +206,31 @@ EmergeManager::~EmergeManager()
 			delete m_mapgens[i];
 	}
 
+	for (u32 i = 0; i != m_load_threads.size(); i++) {
+		EmergeThread *thread = m_load_threads[i];
+
+		if (m_threads_active) {
+			thread->stop();
+			thread->signal();
+			thread->wait();
+		}
+
+		delete thread;
+	}
+
 	delete biomemgr;
 	delete oremgr;
 	delete decomgr;
 	delete schemmgr;
+	delete chunk_cache;
+
+	u64 noise_cache_hits, noise_cache_misses;
+	g_noise_map_cache->getStats(&noise_cache_hits, &noise_cache_misses);
+	infostream << "EmergeManager: noise map cache hits: " << noise_cache_hits
+		<< ", misses: " << noise_cache_misses << std::endl;
+
+	// Free the memory, the maps of another world would be of no use
+	g_noise_map_cache->setMaxSize(0);
 }
 
 
@@ -166,15 +241,122 @@ bool EmergeManager::initMapgens(MapgenParams *params)
 
 	this->mgparams = params;
 
+	// All biomes are registered by now
+	biomemgr->updateLookup();
+
 	for (u32 i = 0; i != m_threads.size(); i++) {
 		Mapgen *mg = Mapgen::createMapgen(params->mgtype, i, params, this);
 		m_mapgens.push_back(mg);
 	}
 
+	if (g_settings->getBool("mapgen_chunk_cache")) {
+		chunk_cache = new MapgenChunkCache(ndef,
+			m_server->getWorldPath() + DIR_DELIM + "mapgen_cache",
+			getMapgenFingerprint());
+	}
+
 	return true;
 }
 
 
+static bool compare_dir_list_nodes(const fs::DirListNode &a,
+	const fs::DirListNode &b)
+{
+	return a.name < b.name;
+}
+
+
+// Adds the hashes of the files of a mod that may affect the mapgen, i.e.
+// everything but its media, in a stable order
+static void hash_mod_files(std::ostream &os, const std::string &path,
+	const std::string &relpath)
+{
+	std::vector<fs::DirListNode> list = fs::GetDirListing(path);
+	std::sort(list.begin(), list.end(), compare_dir_list_nodes);
+
+	for (size_t i = 0; i != list.size(); i++) {
+		const fs::DirListNode &n = list[i];
+		if (n.name.empty() || n.name[0] == '.')
+			continue;
+
+		std::string filepath = path + DIR_DELIM + n.name;
+		std::string filerelpath = relpath + "/" + n.name;
+		if (n.dir) {
+			if (relpath.empty() && (n.name == "textures" ||
+					n.name == "sounds" || n.name == "models" ||
+					n.name == "media" || n.name == "locale"))
+				continue;
+			hash_mod_files(os, filepath, filerelpath);
+			continue;
+		}
+
+		std::string data;
+		std::ifstream is(filepath.c_str(), std::ios_base::binary);
+		if (is.good()) {
+			std::ostringstream tmp(std::ios_base::binary);
+			tmp << is.rdbuf();
+			data = tmp.str();
+		}
+		os << "file " << filerelpath << " " << data.size() << " "
+			<< murmur_hash_64_ua(data.c_str(), data.size(), 0) << "\n";
+	}
+}
+
+
+std::string EmergeManager::getMapgenFingerprint()
+{
+	Settings params;
+	mgparams->writeParams(&params);
+
+	std::ostringstream os(std::ios_base::binary);
+	params.writeLines(os);
+
+	// The code registering the biomes, ores, decorations and schematics,
+	// and the schematic files they read
+	const std::vector<ModSpec> &mods = m_server->getMods();
+	for (size_t i = 0; i != mods.size(); i++) {
+		os << "mod " << mods[i].name << "\n";
+		hash_mod_files(os, mods[i].path, "");
+	}
+
+	// Content ids of the nodes, and what the mapgen reads from their
+	// definitions (e.g. light propagation)
+	ndef->serialize(os, LATEST_PROTOCOL_VERSION);
+
+	ObjDefManager *mgrs[] = {biomemgr, oremgr, decomgr, schemmgr};
+	for (size_t i = 0; i != ARRLEN(mgrs); i++)
+	for (u32 j = 0; j != mgrs[i]->getNumObjects(); j++) {
+		ObjDef *obj = mgrs[i]->getRaw(j);
+		if (obj)
+			os << "objdef " << i << " " << obj->name << "\n";
+	}
+
+	// Schematics may also come from Lua tables built at runtime
+	for (u32 j = 0; j != schemmgr->getNumObjects(); j++) {
+		Schematic *schem = (Schematic *)schemmgr->getRaw(j);
+		if (!schem || !schem->schemdata)
+			continue;
+
+		writeV3S16(os, schem->size);
+		if (schem->slice_probs)
+			os.write((const char *)schem->slice_probs, schem->size.Y);
+		u32 volume = schem->size.X * schem->size.Y * schem->size.Z;
+		for (u32 k = 0; k != volume; k++) {
+			const MapNode &n = schem->schemdata[k];
+			writeU16(os, n.getContent());
+			writeU8(os, n.param1);
+			writeU8(os, n.param2);
+		}
+	}
+
+	std::string fingerprint = os.str();
+	std::ostringstream id;
+	id << std::hex << std::setfill('0') << std::setw(16)
+		<< murmur_hash_64_ua(fingerprint.c_str(), fingerprint.size(), 0);
+	return id.str();
+}
+
+
 Mapgen *EmergeManager::getCurrentMapgen()
 {
 	if (!m_threads_active)
@@ -197,6 +379,9 @@ void EmergeManager::startThreads()
 	for (u32 i = 0; i != m_threads.size(); i++)
 		m_threads[i]->start();
 
+	for (u32 i = 0; i != m_load_threads.size(); i++)
+		m_load_threads[i]->start();
+
 	m_threads_active = true;
 }
 
@@ -206,6 +391,16 @@ void EmergeManager::stopThreads()
 	if (!m_threads_active)
 		return;
 
+	// The load threads go first, so that nothing is handed over to the
+	// mapgen threads after they have cancelled their queues
+	for (u32 i = 0; i != m_load_threads.size(); i++) {
+		m_load_threads[i]->stop();
+		m_load_threads[i]->signal();
+	}
+
+	for (u32 i = 0; i != m_load_threads.size(); i++)
+		m_load_threads[i]->wait();
+
 	// Request thread stop in parallel
 	for (u32 i = 0; i != m_threads.size(); i++) {
 		m_threads[i]->stop();
@@ -216,6 +411,8 @@ void EmergeManager::stopThreads()
 	for (u32 i = 0; i != m_threads.size(); i++)
 		m_threads[i]->wait();
 
+	cancelLoadQueue();
+
 	m_threads_active = false;
 }
 
@@ -249,7 +446,6 @@ bool EmergeManager::enqueueBlockEmergeEx(
 	EmergeCompletionCallback callback,
 	void *callback_param)
 {
-	EmergeThread *thread = NULL;
 	bool entry_already_exists = false;
 
 	{
@@ -262,16 +458,57 @@ bool EmergeManager::enqueueBlockEmergeEx(
 		if (entry_already_exists)
 			return true;
 
-		thread = getOptimalThread();
-		thread->pushBlock(blockpos);
+		// Every block goes through the load stage first, blocks that turn
+		// out to need generating are then passed on to the mapgen threads
+		m_load_queue.push_back(blockpos);
 	}
 
-	thread->signal();
+	for (size_t i = 0; i != m_load_threads.size(); i++)
+		m_load_threads[i]->signal();
 
 	return true;
 }
 
 
+void EmergeManager::setPeerFocus(u16 peer_id, v3s16 blockpos)
+{
+	MutexAutoLock queuelock(m_queue_mutex);
+
+	UNORDERED_MAP<u16, v3s16>::iterator it = m_peer_focus.find(peer_id);
+	if (it != m_peer_focus.end() && it->second == blockpos)
+		return;
+	m_peer_focus[peer_id] = blockpos;
+
+	u32 ncancelled = cancelOutOfRangeChunks(peer_id);
+	if (ncancelled > 0)
+		g_profiler->add("EmergeThread: blocks cancelled (out of range)",
+			ncancelled);
+}
+
+
+void EmergeManager::removePeer(u16 peer_id)
+{
+	MutexAutoLock queuelock(m_queue_mutex);
+	m_peer_focus.erase(peer_id);
+
+	// The chunks of the peer are generated anyway, like the ones requested
+	// by scripts
+	UNORDERED_MAP<u16, std::set<v3s16> >::iterator it =
+		m_peer_chunks.find(peer_id);
+	if (it == m_peer_chunks.end())
+		return;
+
+	for (std::set<v3s16>::iterator i = it->second.begin();
+			i != it->second.end(); ++i) {
+		std::map<v3s16, ChunkEmergeData>::iterator cit =
+			m_chunks_enqueued.find(*i);
+		if (cit != m_chunks_enqueued.end())
+			cit->second.peer_requested = PEER_ID_INEXISTENT;
+	}
+	m_peer_chunks.erase(it);
+}
+
+
 //
 // Mapgen-related helper functions
 //
@@ -345,12 +582,10 @@ bool EmergeManager::pushBlockEmergeData(
 		if (m_blocks_enqueued.size() >= m_qlimit_total)
 			return false;
 
-		if (peer_requested != PEER_ID_INEXISTENT) {
-			u16 qlimit_peer = (flags & BLOCK_EMERGE_ALLOW_GEN) ?
-				m_qlimit_generate : m_qlimit_diskonly;
-			if (count_peer >= qlimit_peer)
-				return false;
-		}
+		// The generate limit is checked once a block leaves the load stage
+		if (peer_requested != PEER_ID_INEXISTENT &&
+				count_peer >= m_qlimit_diskonly)
+			return false;
 	}
 
 	std::pair<std::map<v3s16, BlockEmergeData>::iterator, bool> findres;
@@ -367,6 +602,7 @@ bool EmergeManager::pushBlockEmergeData(
 	} else {
 		bedata.flags = flags;
 		bedata.peer_requested = peer_requested;
+		bedata.stage = EMERGE_STAGE_LOAD;
 
 		count_peer++;
 	}
@@ -386,8 +622,12 @@ bool EmergeManager::popBlockEmergeData(v3s16 pos, BlockEmergeData *bedata)
 
 	*bedata = it->second;
 
-	it2 = m_peer_queue_count.find(bedata->peer_requested);
-	if (it2 == m_peer_queue_count.end())
+	UNORDERED_MAP<u16, u16> &peer_count =
+		(bedata->stage == EMERGE_STAGE_GENERATE) ?
+		m_peer_gen_count : m_peer_queue_count;
+
+	it2 = peer_count.find(bedata->peer_requested);
+	if (it2 == peer_count.end())
 		return false;
 
 	u16 &count_peer = it2->second;
@@ -400,6 +640,107 @@ bool EmergeManager::popBlockEmergeData(v3s16 pos, BlockEmergeData *bedata)
 }
 
 
+bool EmergeManager::popLoadBlock(v3s16 *pos, u16 *flags)
+{
+	while (!m_load_queue.empty()) {
+		*pos = m_load_queue.front();
+		m_load_queue.pop_front();
+
+		std::map<v3s16, BlockEmergeData>::iterator it =
+			m_blocks_enqueued.find(*pos);
+		if (it == m_blocks_enqueued.end())
+			continue;
+
+		*flags = it->second.flags;
+		return true;
+	}
+
+	return false;
+}
+
+
+void EmergeManager::cancelLoadQueue()
+{
+	std::vector<std::pair<v3s16, BlockEmergeData> > cancelled;
+
+	{
+		MutexAutoLock queuelock(m_queue_mutex);
+
+		v3s16 pos;
+		u16 flags;
+		while (popLoadBlock(&pos, &flags)) {
+			cancelled.push_back(std::make_pair(pos, BlockEmergeData()));
+			popBlockEmergeData(pos, &cancelled.back().second);
+		}
+	}
+
+	// Lets the callbacks free their parameters
+	for (size_t i = 0; i != cancelled.size(); i++) {
+		EmergeThread::runCompletionCallbacks(cancelled[i].first,
+			EMERGE_CANCELLED, cancelled[i].second.callbacks);
+	}
+}
+
+
+bool EmergeManager::promoteBlockEmergeData(v3s16 pos)
+{
+	bool new_chunk;
+
+	{
+		MutexAutoLock queuelock(m_queue_mutex);
+
+		std::map<v3s16, BlockEmergeData>::iterator it =
+			m_blocks_enqueued.find(pos);
+		if (it == m_blocks_enqueued.end())
+			return false;
+
+		BlockEmergeData &bedata = it->second;
+		u16 &count_gen = m_peer_gen_count[bedata.peer_requested];
+
+		// Once the generate queue of a peer is full, its blocks are dropped;
+		// they will be requested again after some of the others are done
+		if ((bedata.flags & BLOCK_EMERGE_FORCE_QUEUE) == 0 &&
+				bedata.peer_requested != PEER_ID_INEXISTENT &&
+				count_gen >= m_qlimit_generate)
+			return false;
+
+		u16 &count_load = m_peer_queue_count[bedata.peer_requested];
+		assert(count_load != 0);
+		count_load--;
+		count_gen++;
+		bedata.stage = EMERGE_STAGE_GENERATE;
+
+		v3s16 chunkpos = mgparams ? getContainingChunk(pos) : pos;
+
+		std::pair<std::map<v3s16, ChunkEmergeData>::iterator, bool> findres;
+		findres = m_chunks_enqueued.insert(
+			std::make_pair(chunkpos, ChunkEmergeData()));
+
+		ChunkEmergeData &cdata = findres.first->second;
+		cdata.blocks.push_back(pos);
+
+		// Otherwise the chunk is already waiting in (or being processed by)
+		// a thread
+		new_chunk = findres.second;
+		if (new_chunk) {
+			setChunkPeer(&cdata, chunkpos, bedata.peer_requested);
+			cdata.seqnum = m_chunk_seqnum++;
+			cdata.queued_in = getOptimalThread();
+			cdata.queued_in->pushChunk(chunkpos);
+		}
+	}
+
+	// Wake up every thread, so that idle ones can steal the new chunk
+	// if the thread it was assigned to is busy
+	if (new_chunk) {
+		for (size_t i = 0; i != m_threads.size(); i++)
+			m_threads[i]->signal();
+	}
+
+	return true;
+}
+
+
 EmergeThread *EmergeManager::getOptimalThread()
 {
 	size_t nthreads = m_threads.size();
@@ -407,10 +748,10 @@ EmergeThread *EmergeManager::getOptimalThread()
 	FATAL_ERROR_IF(nthreads == 0, "No emerge threads!");
 
 	size_t index = 0;
-	size_t nitems_lowest = m_threads[0]->m_block_queue.size();
+	size_t nitems_lowest = m_threads[0]->m_chunk_queue.size();
 
 	for (size_t i = 1; i < nthreads; i++) {
-		size_t nitems = m_threads[i]->m_block_queue.size();
+		size_t nitems = m_threads[i]->m_chunk_queue.size();
 		if (nitems < nitems_lowest) {
 			index = i;
 			nitems_lowest = nitems;
@@ -421,19 +762,228 @@ EmergeThread *EmergeManager::getOptimalThread()
 }
 
 
+EmergeThread *EmergeManager::getBusiestThread()
+{
+	size_t index = 0;
+	size_t nitems_highest = m_threads[0]->m_chunk_queue.size();
+
+	for (size_t i = 1; i < m_threads.size(); i++) {
+		size_t nitems = m_threads[i]->m_chunk_queue.size();
+		if (nitems > nitems_highest) {
+			index = i;
+			nitems_highest = nitems;
+		}
+	}
+
+	return m_threads[index];
+}
+
+
+s32 EmergeManager::getChunkPriority(v3s16 chunkpos,
+	const ChunkEmergeData &cdata)
+{
+	s16 csize = mgparams ? mgparams->chunksize : 1;
+	v3s32 center(
+		chunkpos.X + csize / 2,
+		chunkpos.Y + csize / 2,
+		chunkpos.Z + csize / 2);
+
+	// Chunks requested by a peer are ordered by the distance to that peer,
+	// other ones (scripts, map loading) by the distance to the nearest peer
+	UNORDERED_MAP<u16, v3s16>::const_iterator it;
+	if (cdata.peer_requested != PEER_ID_INEXISTENT) {
+		it = m_peer_focus.find(cdata.peer_requested);
+		if (it == m_peer_focus.end())
+			return 0;
+		v3s32 d = center - v3s32(it->second.X, it->second.Y, it->second.Z);
+		return d.X * d.X + d.Y * d.Y + d.Z * d.Z;
+	}
+
+	s32 priority = 0;
+	for (it = m_peer_focus.begin(); it != m_peer_focus.end(); ++it) {
+		v3s32 d = center - v3s32(it->second.X, it->second.Y, it->second.Z);
+		s32 dist = d.X * d.X + d.Y * d.Y + d.Z * d.Z;
+		if (it == m_peer_focus.begin() || dist < priority)
+			priority = dist;
+	}
+
+	return priority;
+}
+
+
+bool EmergeManager::isChunkOutOfRange(v3s16 chunkpos,
+	const ChunkEmergeData &cdata)
+{
+	if (cdata.peer_requested == PEER_ID_INEXISTENT)
+		return false;
+
+	UNORDERED_MAP<u16, v3s16>::const_iterator it =
+		m_peer_focus.find(cdata.peer_requested);
+	if (it == m_peer_focus.end())
+		return false;
+
+	s32 maxdist = (s32)m_cancel_distance * m_cancel_distance;
+	return getChunkPriority(chunkpos, cdata) > maxdist;
+}
+
+
+u32 EmergeManager::cancelOutOfRangeChunks(u16 peer_id)
+{
+	UNORDERED_MAP<u16, std::set<v3s16> >::iterator pit =
+		m_peer_chunks.find(peer_id);
+	if (pit == m_peer_chunks.end())
+		return 0;
+
+	u32 ncancelled = 0;
+
+	// The set of the peer changes while the chunks are cancelled
+	std::vector<v3s16> chunks(pit->second.begin(), pit->second.end());
+	for (size_t j = 0; j != chunks.size(); j++) {
+		std::map<v3s16, ChunkEmergeData>::iterator cit =
+			m_chunks_enqueued.find(chunks[j]);
+		if (cit == m_chunks_enqueued.end())
+			continue;
+
+		// Chunks a thread already works on are finished
+		ChunkEmergeData &cdata = cit->second;
+		if (!cdata.queued_in || !isChunkOutOfRange(chunks[j], cdata))
+			continue;
+
+		// Blocks somebody is waiting on, or that were explicitly forced
+		// into the queue, are kept
+		std::deque<v3s16> blocks_kept;
+		for (size_t i = 0; i != cdata.blocks.size(); i++) {
+			v3s16 pos = cdata.blocks[i];
+			std::map<v3s16, BlockEmergeData>::iterator bit =
+				m_blocks_enqueued.find(pos);
+			if (bit != m_blocks_enqueued.end() &&
+					(!bit->second.callbacks.empty() ||
+					(bit->second.flags & BLOCK_EMERGE_FORCE_QUEUE))) {
+				blocks_kept.push_back(pos);
+				continue;
+			}
+
+			BlockEmergeData bedata;
+			popBlockEmergeData(pos, &bedata);
+			ncancelled++;
+		}
+
+		if (blocks_kept.empty()) {
+			std::deque<v3s16> &queue = cdata.queued_in->m_chunk_queue;
+			std::deque<v3s16>::iterator it =
+				std::find(queue.begin(), queue.end(), chunks[j]);
+			if (it != queue.end())
+				queue.erase(it);
+			eraseChunk(cit);
+		} else {
+			cdata.blocks.swap(blocks_kept);
+			setChunkPeer(&cdata, chunks[j], PEER_ID_INEXISTENT);
+		}
+	}
+
+	return ncancelled;
+}
+
+
+void EmergeManager::setChunkPeer(ChunkEmergeData *cdata, v3s16 chunkpos,
+	u16 peer_id)
+{
+	if (cdata->peer_requested != PEER_ID_INEXISTENT) {
+		UNORDERED_MAP<u16, std::set<v3s16> >::iterator it =
+			m_peer_chunks.find(cdata->peer_requested);
+		if (it != m_peer_chunks.end())
+			it->second.erase(chunkpos);
+	}
+
+	cdata->peer_requested = peer_id;
+	if (peer_id != PEER_ID_INEXISTENT)
+		m_peer_chunks[peer_id].insert(chunkpos);
+}
+
+
+void EmergeManager::eraseChunk(std::map<v3s16, ChunkEmergeData>::iterator cit)
+{
+	setChunkPeer(&cit->second, cit->first, PEER_ID_INEXISTENT);
+	m_chunks_enqueued.erase(cit);
+}
+
+
+bool EmergeManager::popChunkBlock(EmergeThread *thread, v3s16 *pos)
+{
+	std::map<v3s16, ChunkEmergeData>::iterator cit;
+
+	// Finish the chunk this thread is working on first
+	if (thread->m_chunk_busy) {
+		cit = m_chunks_enqueued.find(thread->m_chunk_current);
+		if (cit != m_chunks_enqueued.end()) {
+			if (!cit->second.blocks.empty()) {
+				*pos = cit->second.blocks.front();
+				cit->second.blocks.pop_front();
+				return true;
+			}
+			eraseChunk(cit);
+		}
+		thread->m_chunk_busy = false;
+	}
+
+	// Steal from the most loaded thread when there is nothing left to do
+	EmergeThread *victim = thread;
+	if (thread->m_chunk_queue.empty())
+		victim = getBusiestThread();
+
+	std::deque<v3s16> &queue = victim->m_chunk_queue;
+	if (queue.empty())
+		return false;
+
+	if (victim != thread)
+		g_profiler->add("EmergeThread: chunks stolen", 1);
+
+	// Highest priority is the lowest distance, oldest request on ties
+	size_t best = 0;
+	s32 best_priority = 0;
+	u32 best_seqnum = 0;
+	for (size_t i = 0; i != queue.size(); i++) {
+		const ChunkEmergeData &cdata = m_chunks_enqueued[queue[i]];
+		s32 priority = getChunkPriority(queue[i], cdata);
+		if (i == 0 || priority < best_priority ||
+				(priority == best_priority && cdata.seqnum < best_seqnum)) {
+			best = i;
+			best_priority = priority;
+			best_seqnum = cdata.seqnum;
+		}
+	}
+
+	thread->m_chunk_current = queue[best];
+	thread->m_chunk_busy = true;
+	queue.erase(queue.begin() + best);
+
+	ChunkEmergeData &cdata = m_chunks_enqueued[thread->m_chunk_current];
+	cdata.queued_in = NULL;
+	if (cdata.blocks.empty())
+		return false;
+
+	*pos = cdata.blocks.front();
+	cdata.blocks.pop_front();
+
+	return true;
+}
+
+
 ////
 //// EmergeThread
 ////
 
-EmergeThread::EmergeThread(Server *server, int ethreadid) :
+EmergeThread::EmergeThread(Server *server, int ethreadid, bool load_only) :
 	enable_mapgen_debug_info(false),
 	id(ethreadid),
 	m_server(server),
 	m_map(NULL),
 	m_emerge(NULL),
-	m_mapgen(NULL)
+	m_mapgen(NULL),
+	m_load_only(load_only),
+	m_chunk_busy(false)
 {
-	m_name = "Emerge-" + itos(ethreadid);
+	m_name = (load_only ? "EmergeLoad-" : "Emerge-") + itos(ethreadid);
 }
 
 
@@ -449,27 +999,51 @@ void EmergeThread::signal()
 }
 
 
-bool EmergeThread::pushBlock(v3s16 pos)
+bool EmergeThread::pushChunk(v3s16 chunkpos)
 {
-	m_block_queue.push(pos);
+	m_chunk_queue.push_back(chunkpos);
 	return true;
 }
 
 
 void EmergeThread::cancelPendingItems()
 {
-	MutexAutoLock queuelock(m_emerge->m_queue_mutex);
+	std::vector<std::pair<v3s16, BlockEmergeData> > cancelled;
 
-	while (!m_block_queue.empty()) {
-		BlockEmergeData bedata;
-		v3s16 pos;
+	{
+		MutexAutoLock queuelock(m_emerge->m_queue_mutex);
+
+		// The rest of the chunk being worked on is cancelled too
+		if (m_chunk_busy) {
+			m_chunk_queue.push_front(m_chunk_current);
+			m_chunk_busy = false;
+		}
 
-		pos = m_block_queue.front();
-		m_block_queue.pop();
+		while (!m_chunk_queue.empty()) {
+			v3s16 chunkpos = m_chunk_queue.front();
+			m_chunk_queue.pop_front();
+
+			std::map<v3s16, ChunkEmergeData>::iterator cit =
+				m_emerge->m_chunks_enqueued.find(chunkpos);
+			if (cit == m_emerge->m_chunks_enqueued.end())
+				continue;
+
+			std::deque<v3s16> &blocks = cit->second.blocks;
+			for (size_t i = 0; i != blocks.size(); i++) {
+				cancelled.push_back(std::make_pair(blocks[i],
+					BlockEmergeData()));
+				m_emerge->popBlockEmergeData(blocks[i],
+					&cancelled.back().second);
+			}
 
-		m_emerge->popBlockEmergeData(pos, &bedata);
+			m_emerge->eraseChunk(cit);
+		}
+	}
 
-		runCompletionCallbacks(pos, EMERGE_CANCELLED, bedata.callbacks);
+	// Callbacks may queue emerges again
+	for (size_t i = 0; i != cancelled.size(); i++) {
+		runCompletionCallbacks(cancelled[i].first, EMERGE_CANCELLED,
+			cancelled[i].second.callbacks);
 	}
 }
 
@@ -495,18 +1069,65 @@ bool EmergeThread::popBlockEmerge(v3s16 *pos, BlockEmergeData *bedata)
 {
 	MutexAutoLock queuelock(m_emerge->m_queue_mutex);
 
-	if (m_block_queue.empty())
+	if (!m_emerge->popChunkBlock(this, pos))
 		return false;
 
-	*pos = m_block_queue.front();
-	m_block_queue.pop();
-
 	m_emerge->popBlockEmergeData(*pos, bedata);
 
 	return true;
 }
 
 
+bool EmergeThread::finishBlockEmerge(v3s16 pos, BlockEmergeData *bedata)
+{
+	MutexAutoLock queuelock(m_emerge->m_queue_mutex);
+
+	return m_emerge->popBlockEmergeData(pos, bedata);
+}
+
+
+EmergeAction EmergeThread::getBlockOrLoad(v3s16 pos, MapBlock **block)
+{
+	ScopeProfiler sp(g_profiler, "EmergeThread: load block", SPT_AVG);
+
+	// 1). Attempt to fetch block from memory
+	{
+		MutexAutoLock envlock(m_server->m_env_mutex);
+		*block = m_map->getBlockNoCreateNoEx(pos);
+		if (*block && !(*block)->isDummy()) {
+			if ((*block)->isGenerated())
+				return EMERGE_FROM_MEMORY;
+			*block = NULL;
+			return EMERGE_CANCELLED;
+		}
+	}
+
+	// 2). Read it from the database, without holding up the environment
+	std::string blob;
+	u32 save_count = m_map->loadBlockData(pos, &blob);
+
+	MutexAutoLock envlock(m_server->m_env_mutex);
+
+	// Somebody else may have loaded or generated it meanwhile
+	*block = m_map->getBlockNoCreateNoEx(pos);
+	if (*block && !(*block)->isDummy()) {
+		if ((*block)->isGenerated())
+			return EMERGE_FROM_MEMORY;
+	} else {
+		// Or even loaded, modified, saved and unloaded it
+		if (m_map->getSaveCount() != save_count)
+			*block = m_map->loadBlock(pos);
+		else
+			*block = m_map->loadBlockFromData(pos, &blob);
+		if (*block && (*block)->isGenerated())
+			return EMERGE_FROM_DISK;
+	}
+
+	*block = NULL;
+	return EMERGE_CANCELLED;
+}
+
+
 EmergeAction EmergeThread::getBlockOrStartGen(
 	v3s16 pos, bool allow_gen, MapBlock **block, BlockMakeData *bmdata)
 {
@@ -599,7 +1220,7 @@ void *EmergeThread::run()
 
 	m_map    = (ServerMap *)&(m_server->m_env->getMap());
 	m_emerge = m_server->m_emerge;
-	m_mapgen = m_emerge->m_mapgens[id];
+	m_mapgen = m_load_only ? NULL : m_emerge->m_mapgens[id];
 	enable_mapgen_debug_info = m_emerge->enable_mapgen_debug_info;
 
 	try {
@@ -610,6 +1231,43 @@ void *EmergeThread::run()
 		EmergeAction action;
 		MapBlock *block;
 
+		if (m_load_only) {
+			u16 flags;
+			bool found;
+			{
+				MutexAutoLock queuelock(m_emerge->m_queue_mutex);
+				found = m_emerge->popLoadBlock(&pos, &flags);
+			}
+
+			if (!found) {
+				m_queue_event.wait();
+				continue;
+			}
+
+			block  = NULL;
+			action = EMERGE_CANCELLED;
+			if (!blockpos_over_max_limit(pos)) {
+				action = getBlockOrLoad(pos, &block);
+
+				// Not available yet, leave it to the mapgen threads
+				if (action == EMERGE_CANCELLED &&
+						(flags & BLOCK_EMERGE_ALLOW_GEN) &&
+						m_emerge->promoteBlockEmergeData(pos))
+					continue;
+			}
+
+			if (!finishBlockEmerge(pos, &bedata))
+				continue;
+
+			runCompletionCallbacks(pos, action, bedata.callbacks);
+
+			if (block) {
+				modified_blocks[pos] = block;
+				m_server->SetBlocksNotSent(modified_blocks);
+			}
+			continue;
+		}
+
 		if (!popBlockEmerge(&pos, &bedata)) {
 			m_queue_event.wait();
 			continue;
@@ -628,7 +1286,15 @@ void *EmergeThread::run()
 					"EmergeThread: Mapgen::makeChunk", SPT_AVG);
 				TimeTaker t("mapgen::make_block()");
 
-				m_mapgen->makeChunk(&bmdata);
+				MapgenChunkCache *cache = m_emerge->chunk_cache;
+				if (cache && cache->load(&bmdata, m_mapgen)) {
+					EMERGE_DBG_OUT("mapchunk " PP(bmdata.blockpos_min)
+						" read from the chunk cache");
+				} else {
+					m_mapgen->makeChunk(&bmdata);
+					if (cache)
+						cache->save(&bmdata, m_mapgen);
+				}
 
 				if (enable_mapgen_debug_info == false)
 					t.stop(true); // Hide output
@@ -645,6 +1311,10 @@ void *EmergeThread::run()
 		if (modified_blocks.size() > 0)
 			m_server->SetBlocksNotSent(modified_blocks);
 	}
+
+	// Nobody will process the chunks of a stopped thread
+	if (!m_load_only)
+		cancelPendingItems();
 	} catch (VersionMismatchException &e) {
 		std::ostringstream err;
 		err << "World data version mismatch in MapBlock " << PP(pos) << std::endl
@@ -21,6 +21,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #define EMERGE_HEADER
 
 #include <map>
+#include <deque>
 #include "irr_v3d.h"
 #include "util/container.h"
 #include "mapgen.h" // for MapgenParams
@@ -42,6 +43,7 @@ class BiomeManager;
 class OreManager;
 class DecorationManager;
 class SchematicManager;
+class MapgenChunkCache;
 class Server;
 
 // Structure containing inputs/outputs for chunk generation
@@ -83,17 +85,45 @@ typedef std::vector<
 	>
 > EmergeCallbackList;
 
+// Stage of the emerge pipeline a queued block is in
+enum EmergeStage {
+	EMERGE_STAGE_LOAD,
+	EMERGE_STAGE_GENERATE,
+};
+
 struct BlockEmergeData {
 	u16 peer_requested;
 	u16 flags;
+	u8 stage;
 	EmergeCallbackList callbacks;
 };
 
+// Blocks of one mapchunk waiting to be emerged.  A chunk is owned by exactly
+// one EmergeThread at a time, so it is never generated twice concurrently.
+struct ChunkEmergeData {
+	std::deque<v3s16> blocks;
+	u16 peer_requested;
+	u32 seqnum;
+	// Thread whose queue holds the chunk, NULL once a thread works on it
+	EmergeThread *queued_in;
+
+	ChunkEmergeData():
+		peer_requested(PEER_ID_INEXISTENT),
+		seqnum(0),
+		queued_in(NULL)
+	{}
+};
+
 class EmergeManager {
 public:
 	INodeDefManager *ndef;
 	bool enable_mapgen_debug_info;
 
+	// Threads each mapgen may use to place ores and decorations, and to
+	// light a mapchunk
+	u32 mapgen_threads;
+	u32 mapgen_lighting_threads;
+
 	// Generation Notify
 	u32 gen_notify_on;
 	std::set<u32> gen_notify_on_deco_ids;
@@ -115,6 +145,9 @@ class EmergeManager {
 	DecorationManager *decomgr;
 	SchematicManager *schemmgr;
 
+	// Generated mapchunks kept on disk, NULL if disabled
+	MapgenChunkCache *chunk_cache;
+
 	// Methods
 	EmergeManager(Server *server);
 	~EmergeManager();
@@ -138,6 +171,11 @@ class EmergeManager {
 		EmergeCompletionCallback callback,
 		void *callback_param);
 
+	// Remember where a peer currently is, so that its pending emerges can be
+	// prioritized by distance and cancelled once it moves away
+	void setPeerFocus(u16 peer_id, v3s16 blockpos);
+	void removePeer(u16 peer_id);
+
 	v3s16 getContainingChunk(v3s16 blockpos);
 
 	Mapgen *getCurrentMapgen();
@@ -151,20 +189,42 @@ class EmergeManager {
 	static v3s16 getContainingChunk(v3s16 blockpos, s16 chunksize);
 
 private:
+	Server *m_server;
 	std::vector<Mapgen *> m_mapgens;
 	std::vector<EmergeThread *> m_threads;
+	std::vector<EmergeThread *> m_load_threads;
 	bool m_threads_active;
 
 	Mutex m_queue_mutex;
 	std::map<v3s16, BlockEmergeData> m_blocks_enqueued;
+	std::deque<v3s16> m_load_queue;
+	std::map<v3s16, ChunkEmergeData> m_chunks_enqueued;
 	UNORDERED_MAP<u16, u16> m_peer_queue_count;
+	UNORDERED_MAP<u16, u16> m_peer_gen_count;
+	UNORDERED_MAP<u16, v3s16> m_peer_focus;
+	// Queued chunks by the peer that requested them
+	UNORDERED_MAP<u16, std::set<v3s16> > m_peer_chunks;
+	u32 m_chunk_seqnum;
 
 	u16 m_qlimit_total;
 	u16 m_qlimit_diskonly;
 	u16 m_qlimit_generate;
+	s16 m_cancel_distance;
+
+	// Runs the callbacks of the blocks still waiting for a load thread
+	void cancelLoadQueue();
 
 	// Requires m_queue_mutex held
 	EmergeThread *getOptimalThread();
+	EmergeThread *getBusiestThread();
+	s32 getChunkPriority(v3s16 chunkpos, const ChunkEmergeData &cdata);
+	bool isChunkOutOfRange(v3s16 chunkpos, const ChunkEmergeData &cdata);
+	u32 cancelOutOfRangeChunks(u16 peer_id);
+	void setChunkPeer(ChunkEmergeData *cdata, v3s16 chunkpos, u16 peer_id);
+	void eraseChunk(std::map<v3s16, ChunkEmergeData>::iterator cit);
+	bool popChunkBlock(EmergeThread *thread, v3s16 *pos);
+	bool popLoadBlock(v3s16 *pos, u16 *flags);
+	bool promoteBlockEmergeData(v3s16 pos);
 
 	bool pushBlockEmergeData(
 		v3s16 pos,
@@ -176,6 +236,9 @@ class EmergeManager {
 
 	bool popBlockEmergeData(v3s16 pos, BlockEmergeData *bedata);
 
+	// Identifies everything the output of the mapgens depends on
+	std::string getMapgenFingerprint();
+
 	friend class EmergeThread;
 
 	DISABLE_CLASS_COPY(EmergeManager);
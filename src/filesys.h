@@ -22,6 +22,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include <string>
 #include <vector>
+#include "irrlichttypes.h"
 #include "exceptions.h"
 
 #ifdef _WIN32 // WINDOWS
@@ -56,6 +57,10 @@ bool IsPathAbsolute(const std::string &path);
 
 bool IsDir(const std::string &path);
 
+// Gets the size and the modification time (in an unspecified, platform
+// dependent unit) of a file, returns false if it can't be accessed
+bool GetFileInfo(const std::string &path, u64 *size, u64 *mtime);
+
 bool IsDirDelimiter(char c);
 
 // Only pass full paths to this one. True on success.
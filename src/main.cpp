@@ -40,6 +40,8 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "fontengine.h"
 #include "gameparams.h"
 #include "database.h"
+#include "emerge.h"
+#include "serverenvironment.h"
 #include "config.h"
 #include "porting.h"
 #if USE_CURSES
@@ -104,6 +106,7 @@ static bool determine_subgame(GameParams *game_params);
 
 static bool run_dedicated_server(const GameParams &game_params, const Settings &cmd_args);
 static bool migrate_map_database(const GameParams &game_params, const Settings &cmd_args);
+static bool pregenerate_map(const GameParams &game_params, const Settings &cmd_args);
 
 /**********************************************************************/
 
@@ -286,6 +289,8 @@ static void set_allowed_options(OptionList *allowed_options)
 			_("Migrate from current map backend to another (Only works when using minetestserver or with --server)"))));
 	allowed_options->insert(std::make_pair("migrate-players", ValueSpec(VALUETYPE_STRING,
 		_("Migrate from current players backend to another (Only works when using minetestserver or with --server)"))));
+	allowed_options->insert(std::make_pair("pregenerate", ValueSpec(VALUETYPE_STRING,
+		_("Generate the map between two positions \"(x1,y1,z1) (x2,y2,z2)\" and exit (Only works when using minetestserver or with --server)"))));
 	allowed_options->insert(std::make_pair("terminal", ValueSpec(VALUETYPE_FLAG,
 			_("Feature an interactive terminal (Only works when using minetestserver or with --server)"))));
 #ifndef SERVER
@@ -817,6 +822,10 @@ static bool run_dedicated_server(const GameParams &game_params, const Settings &
 	else if (cmd_args.exists("migrate-players"))
 		return ServerEnvironment::migratePlayersDatabase(game_params, cmd_args);
 
+	// Map pre-generation
+	if (cmd_args.exists("pregenerate"))
+		return pregenerate_map(game_params, cmd_args);
+
 	if (cmd_args.exists("terminal")) {
 #if USE_CURSES
 		bool name_ok = true;
@@ -966,3 +975,225 @@ static bool migrate_map_database(const GameParams &game_params, const Settings &
 
 	return true;
 }
+
+struct PregenerateState {
+	Mutex mutex;
+	std::vector<bool> chunks_done;
+	u32 num_done;
+	u32 num_failed;
+	u32 num_in_flight;
+};
+
+static void pregenerate_chunk_callback(v3s16 blockpos,
+	EmergeAction action, void *param)
+{
+	std::pair<PregenerateState *, u32> *item =
+		(std::pair<PregenerateState *, u32> *)param;
+	PregenerateState *state = item->first;
+
+	{
+		MutexAutoLock lock(state->mutex);
+		// Chunks that were not generated are left for the next run
+		if (action == EMERGE_CANCELLED || action == EMERGE_ERRORED)
+			state->num_failed++;
+		else
+			state->chunks_done[item->second] = true;
+		state->num_done++;
+		state->num_in_flight--;
+	}
+
+	delete item;
+}
+
+static bool pregenerate_map(const GameParams &game_params, const Settings &cmd_args)
+{
+	v3s16 minp, maxp;
+	std::string area = cmd_args.get("pregenerate");
+	if (sscanf(area.c_str(), " ( %hd , %hd , %hd ) ( %hd , %hd , %hd )",
+			&minp.X, &minp.Y, &minp.Z, &maxp.X, &maxp.Y, &maxp.Z) != 6) {
+		errorstream << "Invalid area for --pregenerate, expected "
+			"\"(x1,y1,z1) (x2,y2,z2)\"" << std::endl;
+		return false;
+	}
+	sortBoxVerticies(minp, maxp);
+
+	// Unless configured otherwise, generate on every core
+	g_settings->setDefault("num_emerge_threads",
+		itos(MYMAX(Thread::getNumberOfProcessors(), 1)));
+
+	bool &kill = *porting::signal_handler_killstatus();
+
+	try {
+		Server server(game_params.world_path, game_params.game_spec,
+			false, false, true);
+
+		EmergeManager *emerge = server.getEmergeManager();
+		ServerMap &map = server.getEnv().getServerMap();
+		s16 csize = emerge->mgparams->chunksize;
+
+		// Every mapchunk is generated as a whole, so emerging its first
+		// block is enough to get all of it
+		v3s16 cmin = EmergeManager::getContainingChunk(
+			getNodeBlockPos(minp), csize);
+		v3s16 cmax = EmergeManager::getContainingChunk(
+			getNodeBlockPos(maxp), csize);
+
+		std::vector<v3s16> chunks;
+		for (s16 z = cmin.Z; z <= cmax.Z; z += csize)
+		for (s16 x = cmin.X; x <= cmax.X; x += csize)
+		for (s16 y = cmin.Y; y <= cmax.Y; y += csize)
+			chunks.push_back(v3s16(x, y, z));
+
+		// Chunks before next_chunk are on disk already if an earlier run
+		// over the same area has been interrupted
+		std::string progress_path = game_params.world_path + DIR_DELIM
+			+ "pregenerate_progress.txt";
+		Settings progress;
+		u32 next_chunk = 0;
+		if (progress.readConfigFile(progress_path.c_str()) &&
+				progress.get("area") == area) {
+			next_chunk = MYMIN(progress.getU64("next_chunk"), (u64)chunks.size());
+			actionstream << "Resuming map pre-generation at chunk "
+				<< next_chunk << "/" << chunks.size() << std::endl;
+		}
+		progress.set("area", area);
+
+		PregenerateState state;
+		state.chunks_done.resize(chunks.size(), false);
+		for (u32 i = 0; i < next_chunk; i++)
+			state.chunks_done[i] = true;
+		state.num_done = next_chunk;
+		state.num_failed = 0;
+		state.num_in_flight = 0;
+
+		const u32 max_in_flight = emerge->mgparams->chunksize *
+			MYMAX(Thread::getNumberOfProcessors(), 1) * 4;
+		const float unload_timeout =
+			g_settings->getFloat("server_unload_unused_data_timeout");
+
+		emerge->startThreads();
+
+		u64 time_start = porting::getTimeMs();
+		u64 time_last_save = time_start;
+		u32 num_done_start = next_chunk;
+		u32 chunk_index = next_chunk;
+
+		while (!kill) {
+			u32 num_done, num_in_flight;
+			{
+				MutexAutoLock lock(state.mutex);
+				num_done = state.num_done;
+				num_in_flight = state.num_in_flight;
+			}
+
+			if (num_done == chunks.size())
+				break;
+
+			for (; chunk_index < chunks.size() &&
+					num_in_flight < max_in_flight; chunk_index++) {
+				{
+					MutexAutoLock lock(state.mutex);
+					state.num_in_flight++;
+				}
+				num_in_flight++;
+
+				emerge->enqueueBlockEmergeEx(chunks[chunk_index],
+					PEER_ID_INEXISTENT,
+					BLOCK_EMERGE_ALLOW_GEN | BLOCK_EMERGE_FORCE_QUEUE,
+					pregenerate_chunk_callback,
+					new std::pair<PregenerateState *, u32>(&state, chunk_index));
+			}
+
+			sleep_ms(100);
+
+			// Let the liquids of the generated chunks flow, like the server
+			// step would
+			{
+				MutexAutoLock envlock(server.m_env_mutex);
+				std::map<v3s16, MapBlock *> modified_blocks;
+				map.transformLiquids(modified_blocks, &server.getEnv());
+			}
+
+			u64 time_now = porting::getTimeMs();
+			if (time_now - time_last_save < 2000)
+				continue;
+
+			// Everything finished before this point is written out by the
+			// save below, all in one database transaction
+			{
+				MutexAutoLock lock(state.mutex);
+				while (next_chunk < chunks.size() && state.chunks_done[next_chunk])
+					next_chunk++;
+			}
+
+			{
+				MutexAutoLock envlock(server.m_env_mutex);
+				map.save(MOD_STATE_WRITE_NEEDED);
+				map.timerUpdate((time_now - time_last_save) / 1000.0f,
+					unload_timeout, U32_MAX);
+			}
+
+			progress.setU64("next_chunk", next_chunk);
+			progress.updateConfigFile(progress_path.c_str());
+
+			float chunks_per_sec = (num_done - num_done_start) * 1000.0f /
+				MYMAX(time_now - time_start, 1);
+			std::cerr << " Generated " << num_done << "/" << chunks.size()
+				<< " chunks, " << chunks_per_sec << " chunks/s, "
+				<< (100.0 * num_done / chunks.size()) << "% completed.\r";
+
+			time_last_save = time_now;
+		}
+		std::cerr << std::endl;
+
+		// Let the chunks in progress finish, then write out everything
+		emerge->stopThreads();
+		{
+			MutexAutoLock lock(state.mutex);
+			while (next_chunk < chunks.size() && state.chunks_done[next_chunk])
+				next_chunk++;
+		}
+		{
+			MutexAutoLock envlock(server.m_env_mutex);
+
+			// Settle the remaining liquids. Every round moves them by one
+			// node, liquids flowing further than that are left queued and
+			// lost, as are the ones that reached unloaded blocks.
+			for (u32 i = 0; i < 1000 && !kill &&
+					map.getTransformingLiquidsCount() != 0; i++) {
+				std::map<v3s16, MapBlock *> modified_blocks;
+				map.transformLiquids(modified_blocks, &server.getEnv());
+			}
+
+			map.save(MOD_STATE_WRITE_NEEDED);
+		}
+
+		u64 time_total = MYMAX(porting::getTimeMs() - time_start, 1);
+		actionstream << "Generated " << (state.num_done - num_done_start)
+			<< " chunks in " << (time_total / 1000.0f) << "s ("
+			<< ((state.num_done - num_done_start) * 1000.0f / time_total)
+			<< " chunks/s), " << state.num_failed << " failed" << std::endl;
+
+		if (next_chunk < chunks.size()) {
+			progress.setU64("next_chunk", next_chunk);
+			progress.updateConfigFile(progress_path.c_str());
+			if (kill)
+				actionstream << "Map pre-generation interrupted, run the "
+					"same command again to resume" << std::endl;
+			else
+				actionstream << "Some chunks failed to generate, run the "
+					"same command again to retry them" << std::endl;
+			return false;
+		}
+
+		fs::DeleteSingleFileOrEmptyDirectory(progress_path);
+	} catch (const ModError &e) {
+		errorstream << "ModError: " << e.what() << std::endl;
+		return false;
+	} catch (const ServerError &e) {
+		errorstream << "ServerError: " << e.what() << std::endl;
+		return false;
+	}
+
+	return true;
+}
@@ -341,6 +341,101 @@ bool Map::addNodeWithEvent(v3s16 p, MapNode n, bool remove_metadata)
 	return succeeded;
 }
 
+u32 Map::addNodesWithEvent(const std::vector<v3s16> &positions, MapNode n,
+		bool remove_metadata)
+{
+	// Never allow placing CONTENT_IGNORE, see setNode()
+	if (n.getContent() == CONTENT_IGNORE) {
+		errorstream << "Map::addNodesWithEvent(): Not allowing to place "
+				<< "CONTENT_IGNORE" << std::endl;
+		return 0;
+	}
+
+	// Ignore light (because calling voxalgo::update_lighting_nodes)
+	n.setLight(LIGHTBANK_DAY, 0, m_nodedef);
+	n.setLight(LIGHTBANK_NIGHT, 0, m_nodedef);
+
+	bool rollback = m_gamedef->rollback() != NULL;
+	std::vector<RollbackNode> rollback_oldnodes;
+	std::vector<std::pair<v3s16, MapNode> > oldnodes;
+	oldnodes.reserve(positions.size());
+	std::map<v3s16, MapBlock*> modified_blocks;
+
+	for (std::vector<v3s16>::const_iterator it = positions.begin();
+			it != positions.end(); ++it) {
+		v3s16 p = *it;
+		v3s16 blockpos = getNodeBlockPos(p);
+		MapBlock *block = getBlockNoCreateNoEx(blockpos);
+		if (!block || block->isDummy())
+			continue;
+
+		// Collect old node for rollback
+		if (rollback)
+			rollback_oldnodes.push_back(RollbackNode(this, p, m_gamedef));
+
+		v3s16 relpos = p - blockpos * MAP_BLOCKSIZE;
+		if (remove_metadata)
+			block->m_node_metadata.remove(relpos);
+
+		bool is_valid_position;
+		oldnodes.push_back(std::pair<v3s16, MapNode>(p,
+			block->getNodeNoCheck(relpos, &is_valid_position)));
+		block->setNodeNoCheck(relpos, n);
+		modified_blocks[blockpos] = block;
+	}
+
+	if (oldnodes.empty())
+		return 0;
+
+	// Update lighting
+	voxalgo::update_lighting_nodes(this, oldnodes, modified_blocks);
+
+	MapEditEvent event;
+	event.type = MEET_OTHER;
+	for (std::map<v3s16, MapBlock*>::iterator i = modified_blocks.begin();
+			i != modified_blocks.end(); ++i) {
+		i->second->expireDayNightDiff();
+		event.modified_blocks.insert(i->first);
+	}
+
+	// Report for rollback
+	for (size_t i = 0; i < rollback_oldnodes.size(); i++) {
+		v3s16 p = oldnodes[i].first;
+		RollbackNode rollback_newnode(this, p, m_gamedef);
+		RollbackAction action;
+		action.setSetNode(p, rollback_oldnodes[i], rollback_newnode);
+		m_gamedef->rollback()->reportAction(action);
+	}
+
+	// Add neighboring liquid nodes and the nodes to transform queue,
+	// each node last like in addNodeAndUpdate()
+	v3s16 dirs[7] = {
+		v3s16(0,0,1), // back
+		v3s16(0,1,0), // top
+		v3s16(1,0,0), // right
+		v3s16(0,0,-1), // front
+		v3s16(0,-1,0), // bottom
+		v3s16(-1,0,0), // left
+		v3s16(0,0,0), // self
+	};
+	for (size_t i = 0; i < oldnodes.size(); i++) {
+		v3s16 p = oldnodes[i].first;
+		for (u16 j = 0; j < 7; j++) {
+			v3s16 p2 = p + dirs[j];
+			bool is_valid_position;
+			MapNode n2 = getNodeNoEx(p2, &is_valid_position);
+			if (is_valid_position &&
+					(m_nodedef->get(n2).isLiquid() ||
+					n2.getContent() == CONTENT_AIR))
+				m_transforming_liquid.push_back(p2);
+		}
+	}
+
+	dispatchEvent(&event);
+
+	return oldnodes.size();
+}
+
 bool Map::removeNodeWithEvent(v3s16 p)
 {
 	MapEditEvent event;
@@ -1243,7 +1338,8 @@ ServerMap::ServerMap(const std::string &savedir, IGameDef *gamedef,
 	Map(dout_server, gamedef),
 	settings_mgr(g_settings, savedir + DIR_DELIM + "map_meta.txt"),
 	m_emerge(emerge),
-	m_map_metadata_changed(true)
+	m_map_metadata_changed(true),
+	m_db_save_count(0)
 {
 	verbosestream<<FUNCTION_NAME<<std::endl;
 
@@ -1907,6 +2003,7 @@ s16 ServerMap::findGroundLevel(v2s16 p2d)
 }
 
 bool ServerMap::loadFromFolders() {
+	MutexAutoLock lock(m_db_mutex);
 	if (!dbase->initialized() &&
 			!fs::PathExists(m_savedir + DIR_DELIM + "map.sqlite"))
 		return true;
@@ -2089,6 +2186,7 @@ void ServerMap::listAllLoadableBlocks(std::vector<v3s16> &dst)
 		errorstream << "Map::listAllLoadableBlocks(): Result will be missing "
 				<< "all blocks that are stored in flat files." << std::endl;
 	}
+	MutexAutoLock lock(m_db_mutex);
 	dbase->listAllLoadableBlocks(dst);
 }
 
@@ -2317,16 +2415,20 @@ MapDatabase *ServerMap::createDatabase(
 
 void ServerMap::beginSave()
 {
+	MutexAutoLock lock(m_db_mutex);
 	dbase->beginSave();
 }
 
 void ServerMap::endSave()
 {
+	MutexAutoLock lock(m_db_mutex);
 	dbase->endSave();
 }
 
 bool ServerMap::saveBlock(MapBlock *block)
 {
+	MutexAutoLock lock(m_db_mutex);
+	m_db_save_count++;
 	return saveBlock(block, dbase);
 }
 
@@ -2503,7 +2605,27 @@ void ServerMap::loadBlock(std::string *blob, v3s16 p3d, MapSector *sector, bool
 	}
 }
 
+u32 ServerMap::loadBlockData(v3s16 blockpos, std::string *blob)
+{
+	MutexAutoLock lock(m_db_mutex);
+	dbase->loadBlock(blockpos, blob);
+	return m_db_save_count;
+}
+
+u32 ServerMap::getSaveCount()
+{
+	MutexAutoLock lock(m_db_mutex);
+	return m_db_save_count;
+}
+
 MapBlock* ServerMap::loadBlock(v3s16 blockpos)
+{
+	std::string blob;
+	loadBlockData(blockpos, &blob);
+	return loadBlockFromData(blockpos, &blob);
+}
+
+MapBlock *ServerMap::loadBlockFromData(v3s16 blockpos, std::string *blob)
 {
 	DSTACK(FUNCTION_NAME);
 
@@ -2511,10 +2633,8 @@ MapBlock* ServerMap::loadBlock(v3s16 blockpos)
 
 	v2s16 p2d(blockpos.X, blockpos.Z);
 
-	std::string ret;
-	dbase->loadBlock(blockpos, &ret);
-	if (ret != "") {
-		loadBlock(&ret, blockpos, createSector(p2d), false);
+	if (*blob != "") {
+		loadBlock(blob, blockpos, createSector(p2d), false);
 	} else {
 		// Not found in database, try the files
 
@@ -2585,8 +2705,12 @@ MapBlock* ServerMap::loadBlock(v3s16 blockpos)
 
 bool ServerMap::deleteBlock(v3s16 blockpos)
 {
-	if (!dbase->deleteBlock(blockpos))
-		return false;
+	{
+		MutexAutoLock lock(m_db_mutex);
+		m_db_save_count++;
+		if (!dbase->deleteBlock(blockpos))
+			return false;
+	}
 
 	MapBlock *block = getBlockNoCreateNoEx(blockpos);
 	if (block) {
@@ -2619,7 +2743,9 @@ MMVManip::MMVManip(Map *map):
 		VoxelManipulator(),
 		m_is_dirty(false),
 		m_create_area(false),
-		m_map(map)
+		m_map(map),
+		m_blocks_not_copied(0),
+		m_blocks_unmodified(0)
 {
 }
 
@@ -2628,7 +2754,7 @@ MMVManip::~MMVManip()
 }
 
 void MMVManip::initialEmerge(v3s16 blockpos_min, v3s16 blockpos_max,
-	bool load_if_inexistent)
+	bool load_if_inexistent, bool copy_on_access)
 {
 	TimeTaker timer1("initialEmerge", &emerge_time);
 
@@ -2670,6 +2796,8 @@ void MMVManip::initialEmerge(v3s16 blockpos_min, v3s16 blockpos_max,
 			block = m_map->getBlockNoCreate(p);
 			if(block->isDummy())
 				block_data_inexistent = true;
+			else if (copy_on_access)
+				flags |= VMANIP_BLOCK_NOT_COPIED | VMANIP_BLOCK_UNMODIFIED;
 			else
 				block->copyTo(*this);
 		}
@@ -2687,20 +2815,11 @@ void MMVManip::initialEmerge(v3s16 blockpos_min, v3s16 blockpos_max,
 				if (block == NULL)
 					block = svrmap->createBlock(p);
 				block->copyTo(*this);
+				if (copy_on_access)
+					flags |= VMANIP_BLOCK_UNMODIFIED;
 			} else {
 				flags |= VMANIP_BLOCK_DATA_INEXIST;
-
-				/*
-					Mark area inexistent
-				*/
-				VoxelArea a(p*MAP_BLOCKSIZE, (p+1)*MAP_BLOCKSIZE-v3s16(1,1,1));
-				// Fill with VOXELFLAG_NO_DATA
-				for(s32 z=a.MinEdge.Z; z<=a.MaxEdge.Z; z++)
-				for(s32 y=a.MinEdge.Y; y<=a.MaxEdge.Y; y++)
-				{
-					s32 i = m_area.index(a.MinEdge.X,y,z);
-					memset(&m_flags[i], VOXELFLAG_NO_DATA, MAP_BLOCKSIZE);
-				}
+				setBlockInexistent(p);
 			}
 		}
 		/*else if (block->getNode(0, 0, 0).getContent() == CONTENT_IGNORE)
@@ -2709,12 +2828,97 @@ void MMVManip::initialEmerge(v3s16 blockpos_min, v3s16 blockpos_max,
 			flags |= VMANIP_BLOCK_CONTAINS_CIGNORE;
 		}*/
 
+		if (flags & VMANIP_BLOCK_NOT_COPIED)
+			m_blocks_not_copied++;
+		if (flags & VMANIP_BLOCK_UNMODIFIED)
+			m_blocks_unmodified++;
+
 		m_loaded_blocks[p] = flags;
 	}
 
 	m_is_dirty = false;
 }
 
+void MMVManip::setBlockInexistent(v3s16 blockpos)
+{
+	// Fill with VOXELFLAG_NO_DATA
+	VoxelArea a(blockpos * MAP_BLOCKSIZE,
+		(blockpos + 1) * MAP_BLOCKSIZE - v3s16(1,1,1));
+	for(s32 z=a.MinEdge.Z; z<=a.MaxEdge.Z; z++)
+	for(s32 y=a.MinEdge.Y; y<=a.MaxEdge.Y; y++)
+	{
+		s32 i = m_area.index(a.MinEdge.X,y,z);
+		memset(&m_flags[i], VOXELFLAG_NO_DATA, MAP_BLOCKSIZE);
+	}
+}
+
+bool MMVManip::getBlockRange(const VoxelArea &area, v3s16 *bpmin, v3s16 *bpmax)
+{
+	v3s16 nmin(MYMAX(area.MinEdge.X, m_area.MinEdge.X),
+		MYMAX(area.MinEdge.Y, m_area.MinEdge.Y),
+		MYMAX(area.MinEdge.Z, m_area.MinEdge.Z));
+	v3s16 nmax(MYMIN(area.MaxEdge.X, m_area.MaxEdge.X),
+		MYMIN(area.MaxEdge.Y, m_area.MaxEdge.Y),
+		MYMIN(area.MaxEdge.Z, m_area.MaxEdge.Z));
+	if (nmin.X > nmax.X || nmin.Y > nmax.Y || nmin.Z > nmax.Z)
+		return false;
+
+	*bpmin = getNodeBlockPos(nmin);
+	*bpmax = getNodeBlockPos(nmax);
+	return true;
+}
+
+void MMVManip::copyBlocksIn(const VoxelArea &area)
+{
+	v3s16 bpmin, bpmax;
+	if (m_blocks_not_copied == 0 || !getBlockRange(area, &bpmin, &bpmax))
+		return;
+
+	TimeTaker timer1("copyBlocksIn", &emerge_time);
+
+	for (s16 z = bpmin.Z; z <= bpmax.Z; z++)
+	for (s16 y = bpmin.Y; y <= bpmax.Y; y++)
+	for (s16 x = bpmin.X; x <= bpmax.X; x++) {
+		v3s16 p(x, y, z);
+		std::map<v3s16, u8>::iterator n = m_loaded_blocks.find(p);
+		if (n == m_loaded_blocks.end() || !(n->second & VMANIP_BLOCK_NOT_COPIED))
+			continue;
+
+		n->second &= ~VMANIP_BLOCK_NOT_COPIED;
+		m_blocks_not_copied--;
+
+		// The block may have been unloaded since initialEmerge()
+		MapBlock *block = m_map->getBlockNoCreateNoEx(p);
+		if (!block || block->isDummy())
+			block = ((ServerMap *)m_map)->emergeBlock(p, false);
+
+		if (block && !block->isDummy()) {
+			block->copyTo(*this);
+		} else {
+			n->second |= VMANIP_BLOCK_DATA_INEXIST;
+			setBlockInexistent(p);
+		}
+	}
+}
+
+void MMVManip::setModified(const VoxelArea &area)
+{
+	v3s16 bpmin, bpmax;
+	if (m_blocks_unmodified == 0 || !getBlockRange(area, &bpmin, &bpmax))
+		return;
+
+	for (s16 z = bpmin.Z; z <= bpmax.Z; z++)
+	for (s16 y = bpmin.Y; y <= bpmax.Y; y++)
+	for (s16 x = bpmin.X; x <= bpmax.X; x++) {
+		std::map<v3s16, u8>::iterator n = m_loaded_blocks.find(v3s16(x, y, z));
+		if (n == m_loaded_blocks.end() || !(n->second & VMANIP_BLOCK_UNMODIFIED))
+			continue;
+
+		n->second &= ~VMANIP_BLOCK_UNMODIFIED;
+		m_blocks_unmodified--;
+	}
+}
+
 void MMVManip::blitBackAll(std::map<v3s16, MapBlock*> *modified_blocks,
 	bool overwrite_generated)
 {
@@ -2728,6 +2932,10 @@ void MMVManip::blitBackAll(std::map<v3s16, MapBlock*> *modified_blocks,
 			i = m_loaded_blocks.begin();
 			i != m_loaded_blocks.end(); ++i)
 	{
+		// Nothing to write back, the map has the same nodes
+		if (i->second & (VMANIP_BLOCK_NOT_COPIED | VMANIP_BLOCK_UNMODIFIED))
+			continue;
+
 		v3s16 p = i->first;
 		MapBlock *block = m_map->getBlockNoCreateNoEx(p);
 		bool existed = !(i->second & VMANIP_BLOCK_DATA_INEXIST);
@@ -225,6 +225,15 @@ class Map /*: public NodeContainer*/
 	bool addNodeWithEvent(v3s16 p, MapNode n, bool remove_metadata = true);
 	bool removeNodeWithEvent(v3s16 p);
 
+	/*
+		Sets n at all the given distinct positions, updating the lighting
+		once and sending a single MEET_OTHER event for all of them.
+		Positions outside of the loaded blocks are skipped.
+		Returns the number of nodes set.
+	*/
+	u32 addNodesWithEvent(const std::vector<v3s16> &positions, MapNode n,
+			bool remove_metadata = true);
+
 	/*
 		Takes the blocks at the edges into account
 	*/
@@ -268,6 +277,8 @@ class Map /*: public NodeContainer*/
 
 	void transformLiquids(std::map<v3s16, MapBlock*> & modified_blocks,
 			ServerEnvironment *env);
+	u32 getTransformingLiquidsCount() const
+		{ return m_transforming_liquid.size(); }
 
 	/*
 		Node metadata
@@ -460,6 +471,13 @@ class ServerMap : public Map
 	void loadBlock(const std::string &sectordir, const std::string &blockfile,
 			MapSector *sector, bool save_after_load=false);
 	MapBlock* loadBlock(v3s16 p);
+	// Like loadBlock(p), with the data already read by loadBlockData()
+	MapBlock *loadBlockFromData(v3s16 p, std::string *blob);
+	// Reads the data of a block from the database, does not touch the map so
+	// the environment does not need to be locked. Returns the number of saves
+	// so far, compare with getSaveCount() to see if the data is outdated.
+	u32 loadBlockData(v3s16 p, std::string *blob);
+	u32 getSaveCount();
 	// Database version
 	void loadBlock(std::string *blob, v3s16 p3d, MapSector *sector, bool save_after_load=false);
 
@@ -508,11 +526,18 @@ class ServerMap : public Map
 	*/
 	bool m_map_metadata_changed;
 	MapDatabase *dbase;
+	// Guards dbase, which is also read without the environment locked
+	Mutex m_db_mutex;
+	u32 m_db_save_count;
 };
 
 
 #define VMANIP_BLOCK_DATA_INEXIST     1
 #define VMANIP_BLOCK_CONTAINS_CIGNORE 2
+// Not copied in from the map yet (copy_on_access)
+#define VMANIP_BLOCK_NOT_COPIED       4
+// Not modified since it was copied in (copy_on_access)
+#define VMANIP_BLOCK_UNMODIFIED       8
 
 class MMVManip : public VoxelManipulator
 {
@@ -524,13 +549,30 @@ class MMVManip : public VoxelManipulator
 	{
 		VoxelManipulator::clear();
 		m_loaded_blocks.clear();
+		m_blocks_not_copied = 0;
+		m_blocks_unmodified = 0;
 	}
 
 	void setMap(Map *map)
 	{m_map = map;}
 
+	/*
+		With copy_on_access, the nodes of the blocks already loaded are only
+		copied from the map once copyBlocksIn() is called for them, and
+		blitBackAll() only writes back the blocks passed to setModified().
+		Readers touching a few nodes of a large area then don't pay for
+		copying all of it, twice.
+	*/
 	void initialEmerge(v3s16 blockpos_min, v3s16 blockpos_max,
-		bool load_if_inexistent = true);
+		bool load_if_inexistent = true, bool copy_on_access = false);
+
+	// Copies in the not yet copied blocks touching area
+	void copyBlocksIn(const VoxelArea &area);
+	void copyBlocksIn() { copyBlocksIn(m_area); }
+
+	// Marks the blocks touching area to be written back by blitBackAll()
+	void setModified(const VoxelArea &area);
+	void setModified() { setModified(m_area); }
 
 	// This is much faster with big chunks of generated data
 	void blitBackAll(std::map<v3s16, MapBlock*> * modified_blocks,
@@ -546,6 +588,12 @@ class MMVManip : public VoxelManipulator
 		value = flags describing the block
 	*/
 	std::map<v3s16, u8> m_loaded_blocks;
+	// Number of blocks having VMANIP_BLOCK_NOT_COPIED/UNMODIFIED set
+	u32 m_blocks_not_copied;
+	u32 m_blocks_unmodified;
+
+	void setBlockInexistent(v3s16 blockpos);
+	bool getBlockRange(const VoxelArea &area, v3s16 *bpmin, v3s16 *bpmax);
 };
 
 #endif
@@ -19,6 +19,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include "mapblock.h"
 
+#include <algorithm>
 #include <sstream>
 #include "map.h"
 #include "light.h"
@@ -76,6 +77,7 @@ MapBlock::MapBlock(Map *parent, v3s16 pos, IGameDef *gamedef, bool dummy):
 		m_lighting_complete(0xFFFF),
 		m_day_night_differs(false),
 		m_day_night_differs_expired(true),
+		m_contents_expired(true),
 		m_generated(false),
 		m_timestamp(BLOCK_TIMESTAMP_UNDEFINED),
 		m_disk_timestamp(BLOCK_TIMESTAMP_UNDEFINED),
@@ -369,6 +371,7 @@ void MapBlock::copyFrom(VoxelManipulator &dst)
 	// Copy from VoxelManipulator to data
 	dst.copyTo(data, data_area, v3s16(0,0,0),
 			getPosRelative(), data_size);
+	m_contents_expired = true;
 }
 
 void MapBlock::actuallyUpdateDayNightDiff()
@@ -417,6 +420,31 @@ void MapBlock::actuallyUpdateDayNightDiff()
 	m_day_night_differs = differs;
 }
 
+void MapBlock::actuallyUpdateContents()
+{
+	m_contents_expired = false;
+	m_contents.clear();
+
+	if (data == NULL) {
+		m_contents.push_back(CONTENT_IGNORE);
+		return;
+	}
+
+	// Blocks mostly contain runs of few different contents
+	content_t last = data[0].getContent();
+	m_contents.push_back(last);
+	for (u32 i = 1; i < nodecount; i++) {
+		content_t c = data[i].getContent();
+		if (c == last)
+			continue;
+		last = c;
+		if (std::find(m_contents.begin(), m_contents.end(), c) ==
+				m_contents.end())
+			m_contents.push_back(c);
+	}
+	std::sort(m_contents.begin(), m_contents.end());
+}
+
 void MapBlock::expireDayNightDiff()
 {
 	//INodeDefManager *nodemgr = m_gamedef->ndef();
@@ -659,6 +687,7 @@ void MapBlock::deSerialize(std::istream &is, u8 version, bool disk)
 	TRACESTREAM(<<"MapBlock::deSerialize "<<PP(getPos())<<std::endl);
 
 	m_day_night_differs_expired = false;
+	m_contents_expired = true;
 
 	if(version <= 21)
 	{
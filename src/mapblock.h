@@ -21,6 +21,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #define MAPBLOCK_HEADER
 
 #include <set>
+#include <vector>
 #include "debug.h"
 #include "irr_v3d.h"
 #include "mapnode.h"
@@ -165,6 +166,7 @@ class MapBlock /*: public NodeContainer*/
 	////
 	void raiseModified(u32 mod, u32 reason=MOD_REASON_UNKNOWN)
 	{
+		m_contents_expired = true;
 		if (mod > m_modified) {
 			m_modified = mod;
 			m_modified_reason = reason;
@@ -433,6 +435,22 @@ class MapBlock /*: public NodeContainer*/
 		return m_day_night_differs;
 	}
 
+	// Update the sorted list of the distinct contents of the nodes.
+	// A dummy block contains only CONTENT_IGNORE.
+	void actuallyUpdateContents();
+
+	// Whether any node has a content c with filter[c] set, filter being
+	// indexed by content id
+	inline bool containsAny(const std::vector<bool> &filter)
+	{
+		if (m_contents_expired)
+			actuallyUpdateContents();
+		for (size_t i = 0; i < m_contents.size(); i++)
+			if (filter[m_contents[i]])
+				return true;
+		return false;
+	}
+
 	////
 	//// Miscellaneous stuff
 	////
@@ -650,6 +668,10 @@ class MapBlock /*: public NodeContainer*/
 	bool m_day_night_differs;
 	bool m_day_night_differs_expired;
 
+	// Distinct contents of the nodes, expired by raiseModified()
+	std::vector<content_t> m_contents;
+	bool m_contents_expired;
+
 	bool m_generated;
 
 	/*
@@ -50,6 +50,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "mapgen_singlenode.h"
 #include "cavegen.h"
 #include "dungeongen.h"
+#include "exceptions.h"
 
 FlagDesc flagdesc_mapgen[] = {
 	{"caves",       MG_CAVES},
@@ -125,6 +126,10 @@ Mapgen::Mapgen()
 	biomegen  = NULL;
 	biomemap  = NULL;
 	heightmap = NULL;
+
+	num_threads      = 1;
+	lighting_threads = 1;
+	m_workers        = NULL;
 }
 
 
@@ -158,11 +163,53 @@ Mapgen::Mapgen(int mapgenid, MapgenParams *params, EmergeManager *emerge) :
 	biomegen  = NULL;
 	biomemap  = NULL;
 	heightmap = NULL;
+
+	num_threads      = 1;
+	lighting_threads = 1;
+	m_workers        = NULL;
+	setNumThreads(emerge->mapgen_threads, emerge->mapgen_lighting_threads);
 }
 
 
 Mapgen::~Mapgen()
 {
+	delete m_workers;
+}
+
+
+void Mapgen::setNumThreads(u32 threads, u32 lighting)
+{
+	threads  = MYMAX(threads, 1);
+	lighting = lighting ? lighting : threads;
+
+	// One pool serves both, the smaller stage just uses part of it
+	u32 pool_threads = MYMAX(threads, lighting);
+	u32 cur_threads = m_workers ? m_workers->getNumThreads() : 1;
+	if (pool_threads != cur_threads) {
+		delete m_workers;
+		m_workers = (pool_threads > 1) ?
+			new WorkerPool("MapgenWorker", pool_threads) : NULL;
+		cur_threads = m_workers ? m_workers->getNumThreads() : 1;
+	}
+
+	num_threads      = MYMIN(threads, cur_threads);
+	lighting_threads = MYMIN(lighting, cur_threads);
+}
+
+
+void Mapgen::runParallel(u32 num_jobs, WorkerJobFunc func, void *data,
+	u32 max_threads)
+{
+	if (max_threads == 0)
+		max_threads = num_threads;
+
+	if (m_workers && max_threads > 1) {
+		m_workers->run(num_jobs, func, data, max_threads);
+		return;
+	}
+
+	for (u32 i = 0; i != num_jobs; i++)
+		func(i, data);
 }
 
 
@@ -442,47 +489,6 @@ void Mapgen::setLighting(u8 light, v3s16 nmin, v3s16 nmax)
 }
 
 
-void Mapgen::lightSpread(VoxelArea &a, v3s16 p, u8 light)
-{
-	if (light <= 1 || !a.contains(p))
-		return;
-
-	u32 vi = vm->m_area.index(p);
-	MapNode &n = vm->m_data[vi];
-
-	// Decay light in each of the banks separately
-	u8 light_day = light & 0x0F;
-	if (light_day > 0)
-		light_day -= 0x01;
-
-	u8 light_night = light & 0xF0;
-	if (light_night > 0)
-		light_night -= 0x10;
-
-	// Bail out only if we have no more light from either bank to propogate, or
-	// we hit a solid block that light cannot pass through.
-	if ((light_day  <= (n.param1 & 0x0F) &&
-		light_night <= (n.param1 & 0xF0)) ||
-		!ndef->get(n).light_propagates)
-		return;
-
-	// Since this recursive function only terminates when there is no light from
-	// either bank left, we need to take the max of both banks into account for
-	// the case where spreading has stopped for one light bank but not the other.
-	light = MYMAX(light_day, n.param1 & 0x0F) |
-			MYMAX(light_night, n.param1 & 0xF0);
-
-	n.param1 = light;
-
-	lightSpread(a, p + v3s16(0, 0, 1), light);
-	lightSpread(a, p + v3s16(0, 1, 0), light);
-	lightSpread(a, p + v3s16(1, 0, 0), light);
-	lightSpread(a, p - v3s16(0, 0, 1), light);
-	lightSpread(a, p - v3s16(0, 1, 0), light);
-	lightSpread(a, p - v3s16(1, 0, 0), light);
-}
-
-
 void Mapgen::calcLighting(v3s16 nmin, v3s16 nmax, v3s16 full_nmin, v3s16 full_nmax,
 	bool propagate_shadow)
 {
@@ -496,25 +502,39 @@ void Mapgen::calcLighting(v3s16 nmin, v3s16 nmax, v3s16 full_nmin, v3s16 full_nm
 }
 
 
-void Mapgen::propagateSunlight(v3s16 nmin, v3s16 nmax, bool propagate_shadow)
+struct SunlightBatch {
+	Mapgen *mg;
+	VoxelArea a;
+	bool block_is_underground;
+	bool propagate_shadow;
+	u32 num_jobs;
+};
+
+// Every job does a slice of the columns, which don't depend on each other
+static void propagate_sunlight_job(u32 job, void *data)
 {
-	//TimeTaker t("propagateSunlight");
-	VoxelArea a(nmin, nmax);
-	bool block_is_underground = (water_level >= nmax.Y);
+	SunlightBatch *batch = (SunlightBatch *)data;
+	MMVManip *vm = batch->mg->vm;
+	INodeDefManager *ndef = batch->mg->ndef;
+	const VoxelArea &a = batch->a;
 	v3s16 em = vm->m_area.getExtent();
 
+	s32 zsize = a.getExtent().Z;
+	s16 z_min = a.MinEdge.Z + zsize * job / batch->num_jobs;
+	s16 z_max = a.MinEdge.Z + zsize * (job + 1) / batch->num_jobs - 1;
+
 	// NOTE: Direct access to the low 4 bits of param1 is okay here because,
 	// by definition, sunlight will never be in the night lightbank.
 
-	for (int z = a.MinEdge.Z; z <= a.MaxEdge.Z; z++) {
+	for (int z = z_min; z <= z_max; z++) {
 		for (int x = a.MinEdge.X; x <= a.MaxEdge.X; x++) {
 			// see if we can get a light value from the overtop
 			u32 i = vm->m_area.index(x, a.MaxEdge.Y + 1, z);
 			if (vm->m_data[i].getContent() == CONTENT_IGNORE) {
-				if (block_is_underground)
+				if (batch->block_is_underground)
 					continue;
 			} else if ((vm->m_data[i].param1 & 0x0F) != LIGHT_SUN &&
-					propagate_shadow) {
+					batch->propagate_shadow) {
 				continue;
 			}
 			vm->m_area.add_y(em, i, -1);
@@ -528,44 +548,134 @@ void Mapgen::propagateSunlight(v3s16 nmin, v3s16 nmax, bool propagate_shadow)
 			}
 		}
 	}
+}
+
+
+void Mapgen::propagateSunlight(v3s16 nmin, v3s16 nmax, bool propagate_shadow)
+{
+	//TimeTaker t("propagateSunlight");
+	SunlightBatch batch;
+	batch.mg                   = this;
+	batch.a                    = VoxelArea(nmin, nmax);
+	batch.block_is_underground = (water_level >= nmax.Y);
+	batch.propagate_shadow     = propagate_shadow;
+	batch.num_jobs = MYMIN(lighting_threads, (u32)batch.a.getExtent().Z);
+
+	runParallel(batch.num_jobs, propagate_sunlight_job, &batch,
+		lighting_threads);
 	//printf("propagateSunlight: %dms\n", t.stop());
 }
 
 
+/*
+	The light banks of the spread area, extracted from param1 into one byte
+	per node.  The area is padded by one node that never lets light through,
+	so neighbours can be reached without bounds checks.
+*/
+struct LightSpreadBatch {
+	u32 volume;
+	s32 offsets[6];
+	const u8 *propagates;
+	u8 *light[2];
+};
+
+// Spreads the light of one bank, brightest nodes first, so every node is
+// queued at most once: when it gets its final light.
+static void spread_light_job(u32 bank, void *data)
+{
+	LightSpreadBatch *batch = (LightSpreadBatch *)data;
+	const u8 *propagates = batch->propagates;
+	const s32 *offsets = batch->offsets;
+	u8 *light = batch->light[bank];
+
+	std::vector<u32> queue[LIGHT_SUN + 1];
+	for (u32 i = 0; i != batch->volume; i++) {
+		if (light[i] > 1)
+			queue[light[i]].push_back(i);
+	}
+
+	for (u8 l = LIGHT_SUN; l > 1; l--) {
+		u8 spread = l - 1;
+		std::vector<u32> &front = queue[l];
+		std::vector<u32> &next = queue[spread];
+		for (size_t j = 0; j != front.size(); j++) {
+			u32 i = front[j];
+			for (u8 k = 0; k != 6; k++) {
+				u32 ni = i + offsets[k];
+				if (propagates[ni] && light[ni] < spread) {
+					light[ni] = spread;
+					next.push_back(ni);
+				}
+			}
+		}
+		std::vector<u32>().swap(front);
+	}
+}
+
+
 void Mapgen::spreadLight(v3s16 nmin, v3s16 nmax)
 {
 	//TimeTaker t("spreadLight");
 	VoxelArea a(nmin, nmax);
+	v3s16 pe = a.getExtent() + v3s16(2, 2, 2);
+	u32 ystride = pe.X;
+	u32 zstride = pe.X * pe.Y;
+	u32 volume  = zstride * pe.Z;
+
+	std::vector<u8> propagates(volume, 0);
+	std::vector<u8> light_day(volume, 0);
+	std::vector<u8> light_night(volume, 0);
+
+	for (s16 z = a.MinEdge.Z; z <= a.MaxEdge.Z; z++)
+	for (s16 y = a.MinEdge.Y; y <= a.MaxEdge.Y; y++) {
+		u32 vi = vm->m_area.index(a.MinEdge.X, y, z);
+		u32 li = (z - a.MinEdge.Z + 1) * zstride +
+			(y - a.MinEdge.Y + 1) * ystride + 1;
+		for (s16 x = a.MinEdge.X; x <= a.MaxEdge.X; x++, vi++, li++) {
+			MapNode &n = vm->m_data[vi];
+			if (n.getContent() == CONTENT_IGNORE)
+				continue;
 
-	for (int z = a.MinEdge.Z; z <= a.MaxEdge.Z; z++) {
-		for (int y = a.MinEdge.Y; y <= a.MaxEdge.Y; y++) {
-			u32 i = vm->m_area.index(a.MinEdge.X, y, z);
-			for (int x = a.MinEdge.X; x <= a.MaxEdge.X; x++, i++) {
-				MapNode &n = vm->m_data[i];
-				if (n.getContent() == CONTENT_IGNORE)
-					continue;
+			const ContentFeatures &cf = ndef->get(n);
+			if (!cf.light_propagates)
+				continue;
 
-				const ContentFeatures &cf = ndef->get(n);
-				if (!cf.light_propagates)
-					continue;
+			// TODO(hmmmmm): Abstract away direct param1 accesses with a
+			// wrapper, but something lighter than MapNode::get/setLight
 
-				// TODO(hmmmmm): Abstract away direct param1 accesses with a
-				// wrapper, but something lighter than MapNode::get/setLight
-
-				u8 light_produced = cf.light_source;
-				if (light_produced)
-					n.param1 = light_produced | (light_produced << 4);
-
-				u8 light = n.param1;
-				if (light) {
-					lightSpread(a, v3s16(x,     y,     z + 1), light);
-					lightSpread(a, v3s16(x,     y + 1, z    ), light);
-					lightSpread(a, v3s16(x + 1, y,     z    ), light);
-					lightSpread(a, v3s16(x,     y,     z - 1), light);
-					lightSpread(a, v3s16(x,     y - 1, z    ), light);
-					lightSpread(a, v3s16(x - 1, y,     z    ), light);
-				}
-			}
+			u8 light_produced = cf.light_source;
+			if (light_produced)
+				n.param1 = light_produced | (light_produced << 4);
+
+			propagates[li]  = 1;
+			light_day[li]   = n.param1 & 0x0F;
+			light_night[li] = n.param1 >> 4;
+		}
+	}
+
+	LightSpreadBatch batch;
+	batch.volume     = volume;
+	batch.offsets[0] = 1;
+	batch.offsets[1] = -1;
+	batch.offsets[2] = ystride;
+	batch.offsets[3] = -(s32)ystride;
+	batch.offsets[4] = zstride;
+	batch.offsets[5] = -(s32)zstride;
+	batch.propagates = &propagates[0];
+	batch.light[0]   = &light_day[0];
+	batch.light[1]   = &light_night[0];
+
+	// The banks don't depend on each other
+	runParallel(2, spread_light_job, &batch, lighting_threads);
+
+	for (s16 z = a.MinEdge.Z; z <= a.MaxEdge.Z; z++)
+	for (s16 y = a.MinEdge.Y; y <= a.MaxEdge.Y; y++) {
+		u32 vi = vm->m_area.index(a.MinEdge.X, y, z);
+		u32 li = (z - a.MinEdge.Z + 1) * zstride +
+			(y - a.MinEdge.Y + 1) * ystride + 1;
+		for (s16 x = a.MinEdge.X; x <= a.MaxEdge.X; x++, vi++, li++) {
+			if (propagates[li])
+				vm->m_data[vi].param1 = light_day[li] | (light_night[li] << 4);
 		}
 	}
 
@@ -1026,6 +1136,71 @@ void GenerateNotifier::clearEvents()
 }
 
 
+void GenerateNotifier::serialize(std::ostream &os) const
+{
+	writeU32(os, m_notify_events.size());
+
+	std::list<GenNotifyEvent>::const_iterator it;
+	for (it = m_notify_events.begin(); it != m_notify_events.end(); ++it) {
+		writeU8(os, it->type);
+		writeV3S16(os, it->pos);
+		writeU32(os, it->id);
+	}
+}
+
+
+void GenerateNotifier::deSerialize(std::istream &is)
+{
+	// The events were filtered when they were added
+	u32 count = readU32(is);
+	for (u32 i = 0; i != count; i++) {
+		GenNotifyEvent gne;
+		gne.type = (GenNotifyType)readU8(is);
+		gne.pos  = readV3S16(is);
+		gne.id   = readU32(is);
+		if (gne.type >= NUM_GENNOTIFY_TYPES)
+			throw SerializationError("Invalid generate notify event");
+		m_notify_events.push_back(gne);
+	}
+}
+
+
+////
+//// MapgenTiles
+////
+
+MapgenTiles::MapgenTiles(v3s16 nmin, v3s16 nmax) :
+	nmin(nmin),
+	nmax(nmax)
+{
+	nx = MYMAX((nmax.X - nmin.X + 1) / MAPGEN_TILE_SIZE, 1);
+	nz = MYMAX((nmax.Z - nmin.Z + 1) / MAPGEN_TILE_SIZE, 1);
+}
+
+
+void MapgenTiles::getTile(u32 i, v3s16 *tmin, v3s16 *tmax) const
+{
+	u16 tx = i % nx;
+	u16 tz = i / nx;
+
+	tmin->X = nmin.X + tx * MAPGEN_TILE_SIZE;
+	tmin->Y = nmin.Y;
+	tmin->Z = nmin.Z + tz * MAPGEN_TILE_SIZE;
+	tmax->X = (tx == nx - 1) ? nmax.X : tmin->X + MAPGEN_TILE_SIZE - 1;
+	tmax->Y = nmax.Y;
+	tmax->Z = (tz == nz - 1) ? nmax.Z : tmin->Z + MAPGEN_TILE_SIZE - 1;
+}
+
+
+u32 MapgenTiles::getIndex(s16 x, s16 z) const
+{
+	u32 tx = MYMIN((x - nmin.X) / MAPGEN_TILE_SIZE, nx - 1);
+	u32 tz = MYMIN((z - nmin.Z) / MAPGEN_TILE_SIZE, nz - 1);
+
+	return tz * nx + tx;
+}
+
+
 ////
 //// MapgenParams
 ////
@@ -27,6 +27,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "mapnode.h"
 #include "util/string.h"
 #include "util/container.h"
+#include "util/workerpool.h"
 
 #define MAPGEN_DEFAULT MAPGEN_V7P
 #define MAPGEN_DEFAULT_NAME "v7p"
@@ -104,12 +105,43 @@ class GenerateNotifier {
 	void getEvents(std::map<std::string, std::vector<v3s16> > &event_map);
 	void clearEvents();
 
+	// Adds the serialized events to the current ones
+	void serialize(std::ostream &os) const;
+	void deSerialize(std::istream &is);
+
 private:
 	u32 m_notify_on;
 	std::set<u32> *m_notify_on_deco_ids;
 	std::list<GenNotifyEvent> m_notify_events;
 };
 
+/*
+	Splits the x/z extent of an area into square tiles of MAPGEN_TILE_SIZE
+	nodes, the remainder being added to the last tile of each row/column.
+	The layout only depends on the area, so anything seeded per tile stays
+	deterministic no matter how many threads process the tiles.
+*/
+#define MAPGEN_TILE_SIZE 16
+
+struct MapgenTiles {
+	v3s16 nmin;
+	v3s16 nmax;
+	u16 nx;
+	u16 nz;
+
+	MapgenTiles(v3s16 nmin, v3s16 nmax);
+
+	inline u32 count() const { return (u32)nx * nz; }
+	void getTile(u32 i, v3s16 *tmin, v3s16 *tmax) const;
+	u32 getIndex(s16 x, s16 z) const;
+
+	// Tiles of the same color (0-3) never share an edge or a corner
+	inline u8 getColor(u32 i) const
+	{
+		return ((i % nx) & 1) | (((i / nx) & 1) << 1);
+	}
+};
+
 enum MapgenType {
 	MAPGEN_V7P,
 	MAPGEN_FLAT,
@@ -193,12 +225,25 @@ class Mapgen {
 	BiomeGen *biomegen;
 	GenerateNotifier gennotify;
 
+	// Threads placing ores and decorations and threads lighting a mapchunk,
+	// see setNumThreads()
+	u32 num_threads;
+	u32 lighting_threads;
+
 	Mapgen();
 	Mapgen(int mapgenid, MapgenParams *params, EmergeManager *emerge);
 	virtual ~Mapgen();
 
 	virtual MapgenType getType() const { return MAPGEN_INVALID; }
 
+	// Starts the threads kept for the parallel stages of this mapgen,
+	// lighting_threads being 0 to light with as many as placing
+	void setNumThreads(u32 threads, u32 lighting_threads = 0);
+	// Runs the jobs on up to max_threads (0: num_threads) threads of this
+	// mapgen, see WorkerPool::run()
+	void runParallel(u32 num_jobs, WorkerJobFunc func, void *data,
+		u32 max_threads = 0);
+
 	static u32 getBlockSeed(v3s16 p, s32 seed);
 	static u32 getBlockSeed2(v3s16 p, s32 seed);
 	s16 findGroundLevelFull(v2s16 p2d);
@@ -208,7 +253,6 @@ class Mapgen {
 	void updateLiquid(UniqueQueue<v3s16> *trans_liquid, v3s16 nmin, v3s16 nmax);
 
 	void setLighting(u8 light, v3s16 nmin, v3s16 nmax);
-	void lightSpread(VoxelArea &a, v3s16 p, u8 light);
 	void calcLighting(v3s16 nmin, v3s16 nmax, v3s16 full_nmin, v3s16 full_nmax,
 		bool propagate_shadow = true);
 	void propagateSunlight(v3s16 nmin, v3s16 nmax, bool propagate_shadow);
@@ -237,6 +281,10 @@ class Mapgen {
 	// that checks whether there are floodable nodes without liquid beneath
 	// the node at index vi.
 	inline bool isLiquidHorizontallyFlowable(u32 vi, v3s16 em);
+
+	// Kept for the lifetime of the mapgen, NULL when running single threaded
+	WorkerPool *m_workers;
+
 	DISABLE_CLASS_COPY(Mapgen);
 };
 
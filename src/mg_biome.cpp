@@ -27,6 +27,9 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "util/numeric.h"
 #include "porting.h"
 #include "settings.h"
+#include "util/basic_macros.h"
+#include <algorithm>
+#include <float.h>
 
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -36,6 +39,7 @@ BiomeManager::BiomeManager(Server *server) :
 	ObjDefManager(server, OBJDEF_BIOME)
 {
 	m_server = server;
+	m_lookup = NULL;
 
 	// Create default biome to be used in case none exist
 	Biome *b = new Biome;
@@ -59,7 +63,8 @@ BiomeManager::BiomeManager(Server *server) :
 	b->m_nodenames.push_back("mapgen_river_water_source");
 	b->m_nodenames.push_back("mapgen_stone");
 	b->m_nodenames.push_back("ignore");
-	m_ndef->pendNodeResolve(b);
+	if (m_ndef)
+		m_ndef->pendNodeResolve(b);
 
 	add(b);
 }
@@ -67,11 +72,56 @@ BiomeManager::BiomeManager(Server *server) :
 
 BiomeManager::~BiomeManager()
 {
+	delete (BiomeLookup *)m_lookup;
+	for (size_t i = 0; i != m_retired_lookups.size(); i++)
+		delete m_retired_lookups[i];
+}
+
+
+ObjDefHandle BiomeManager::add(ObjDef *obj)
+{
+	retireLookup();
+
+	return ObjDefManager::add(obj);
+}
+
+
+ObjDef *BiomeManager::set(ObjDefHandle handle, ObjDef *obj)
+{
+	retireLookup();
+
+	return ObjDefManager::set(handle, obj);
+}
+
+
+void BiomeManager::updateLookup()
+{
+	retireLookup();
+
+	// biome_t can't refer to any more
+	if (m_objects.size() > 256)
+		return;
+
+	std::vector<Biome *> biomes;
+	for (size_t i = 0; i != m_objects.size(); i++)
+		biomes.push_back((Biome *)m_objects[i]);
+
+	m_lookup = new BiomeLookup(biomes);
+}
+
+
+void BiomeManager::retireLookup()
+{
+	BiomeLookup *lookup = m_lookup.exchange(NULL);
+	if (lookup)
+		m_retired_lookups.push_back(lookup);
 }
 
 
 void BiomeManager::clear()
 {
+	retireLookup();
+
 	EmergeManager *emerge = m_server->getEmergeManager();
 
 	// Remove all dangling references in Decorations
@@ -174,6 +224,13 @@ void BiomeGenOriginal::calcBiomeNoise(v3s16 pmin)
 
 biome_t *BiomeGenOriginal::getBiomes(s16 *heightmap)
 {
+	const BiomeLookup *lookup = m_bmgr->getLookup();
+	if (lookup) {
+		lookup->getBiomes(noise_heat->result, noise_humidity->result,
+			heightmap, biomemap, m_csize.X * m_csize.Z);
+		return biomemap;
+	}
+
 	for (s32 i = 0; i != m_csize.X * m_csize.Z; i++) {
 		Biome *biome = calcBiomeFromNoise(
 			noise_heat->result[i],
@@ -206,6 +263,10 @@ Biome *BiomeGenOriginal::getBiomeAtIndex(size_t index, s16 y) const
 
 Biome *BiomeGenOriginal::calcBiomeFromNoise(float heat, float humidity, s16 y) const
 {
+	const BiomeLookup *lookup = m_bmgr->getLookup();
+	if (lookup)
+		return (Biome *)m_bmgr->getRaw(lookup->getBiome(heat, humidity, y));
+
 	Biome *b, *biome_closest = NULL;
 	float dist_min = FLT_MAX;
 
@@ -228,6 +289,231 @@ Biome *BiomeGenOriginal::calcBiomeFromNoise(float heat, float humidity, s16 y) c
 }
 
 
+////////////////////////////////////////////////////////////////////////////////
+
+BiomeLookup::BiomeLookup(const std::vector<Biome *> &biomes)
+{
+	m_heat_points.resize(biomes.size(), 0.0f);
+	m_humidity_points.resize(biomes.size(), 0.0f);
+
+	// The y values where the available biomes change split the y axis into
+	// bands. As in the linear search, biome 0 is only used if no other fits.
+	float heat_max = 0.0f;
+	float humidity_max = 0.0f;
+	m_heat_min = 0.0f;
+	m_humidity_min = 0.0f;
+	bool first = true;
+
+	std::vector<s32> y_edges;
+	y_edges.push_back(S16_MIN);
+	for (size_t i = 1; i < biomes.size(); i++) {
+		Biome *b = biomes[i];
+		if (!b)
+			continue;
+
+		m_heat_points[i] = b->heat_point;
+		m_humidity_points[i] = b->humidity_point;
+		y_edges.push_back(b->y_min);
+		y_edges.push_back((s32)b->y_max + 1);
+
+		if (first || b->heat_point < m_heat_min)
+			m_heat_min = b->heat_point;
+		if (first || b->heat_point > heat_max)
+			heat_max = b->heat_point;
+		if (first || b->humidity_point < m_humidity_min)
+			m_humidity_min = b->humidity_point;
+		if (first || b->humidity_point > humidity_max)
+			humidity_max = b->humidity_point;
+		first = false;
+	}
+
+	std::sort(y_edges.begin(), y_edges.end());
+	y_edges.erase(std::unique(y_edges.begin(), y_edges.end()), y_edges.end());
+
+	// Let the grid reach half its extent beyond the outermost biomes so that
+	// most noise values fall inside; the rest are searched like before
+	float heat_pad = MYMAX(heat_max - m_heat_min, 1.0f) / 2;
+	float humidity_pad = MYMAX(humidity_max - m_humidity_min, 1.0f) / 2;
+	m_heat_min -= heat_pad;
+	m_humidity_min -= humidity_pad;
+	m_heat_scale = BIOME_LOOKUP_GRID_SIZE /
+		(heat_max + heat_pad - m_heat_min);
+	m_humidity_scale = BIOME_LOOKUP_GRID_SIZE /
+		(humidity_max + humidity_pad - m_humidity_min);
+
+	for (size_t e = 0; e != y_edges.size(); e++) {
+		if (y_edges[e] > S16_MAX)
+			break;
+
+		m_band_y_min.push_back(y_edges[e]);
+		m_bands.push_back(Band());
+		Band &band = m_bands.back();
+
+		s32 y = y_edges[e];
+		for (size_t i = 1; i < biomes.size(); i++) {
+			Biome *b = biomes[i];
+			if (b && y >= b->y_min && y <= b->y_max)
+				band.biomes.push_back(i);
+		}
+
+		buildGrid(&band);
+	}
+}
+
+
+void BiomeLookup::buildGrid(Band *band)
+{
+	if (band->biomes.size() < 2)
+		return;
+
+	const u32 grid_size = BIOME_LOOKUP_GRID_SIZE;
+	double cell_heat = 1.0 / m_heat_scale;
+	double cell_humidity = 1.0 / m_humidity_scale;
+
+	std::vector<double> max_dists(band->biomes.size());
+	band->cell_start.reserve(grid_size * grid_size + 1);
+
+	for (u32 z = 0; z != grid_size; z++)
+	for (u32 x = 0; x != grid_size; x++) {
+		// Slightly enlarged, so points rounded into the cell are covered
+		double x0 = m_heat_min + (x - 0.01) * cell_heat;
+		double x1 = m_heat_min + (x + 1.01) * cell_heat;
+		double z0 = m_humidity_min + (z - 0.01) * cell_humidity;
+		double z1 = m_humidity_min + (z + 1.01) * cell_humidity;
+
+		// No point of the cell is further away from its closest biome
+		// than the biome whose furthest corner is the closest
+		double max_dist_min = DBL_MAX;
+		for (size_t i = 0; i != band->biomes.size(); i++) {
+			biome_t b = band->biomes[i];
+			double dx = MYMAX(fabs(m_heat_points[b] - x0), fabs(m_heat_points[b] - x1));
+			double dz = MYMAX(fabs(m_humidity_points[b] - z0),
+				fabs(m_humidity_points[b] - z1));
+			max_dists[i] = dx * dx + dz * dz;
+			max_dist_min = MYMIN(max_dist_min, max_dists[i]);
+		}
+
+		// So only biomes with a nearest point within that distance matter
+		band->cell_start.push_back(band->cell_biomes.size());
+		for (size_t i = 0; i != band->biomes.size(); i++) {
+			biome_t b = band->biomes[i];
+			double dx = MYMAX(MYMAX(x0 - m_heat_points[b], m_heat_points[b] - x1), 0.0);
+			double dz = MYMAX(MYMAX(z0 - m_humidity_points[b],
+				m_humidity_points[b] - z1), 0.0);
+			if (dx * dx + dz * dz <= max_dist_min * 1.0001 + 1e-6)
+				band->cell_biomes.push_back(b);
+		}
+	}
+	band->cell_start.push_back(band->cell_biomes.size());
+}
+
+
+u32 BiomeLookup::getBand(s16 y) const
+{
+	std::vector<s32>::const_iterator it =
+		std::upper_bound(m_band_y_min.begin(), m_band_y_min.end(), (s32)y);
+	return (it - m_band_y_min.begin()) - 1;
+}
+
+
+biome_t BiomeLookup::searchBiomes(const biome_t *biomes, size_t count,
+	float heat, float humidity) const
+{
+	// Must give the same results as BiomeGenOriginal::calcBiomeFromNoise
+	biome_t biome_closest = BIOME_NONE;
+	float dist_min = FLT_MAX;
+
+	for (size_t i = 0; i != count; i++) {
+		biome_t b = biomes[i];
+		float d_heat     = heat     - m_heat_points[b];
+		float d_humidity = humidity - m_humidity_points[b];
+		float dist = (d_heat * d_heat) +
+					 (d_humidity * d_humidity);
+		if (dist < dist_min) {
+			dist_min = dist;
+			biome_closest = b;
+		}
+	}
+
+	return biome_closest;
+}
+
+
+inline biome_t BiomeLookup::getBiomeInBand(const Band &band, s32 cell,
+	float heat, float humidity) const
+{
+	if (band.biomes.size() < 2)
+		return band.biomes.empty() ? BIOME_NONE : band.biomes[0];
+
+	if (cell < 0 || cell >= BIOME_LOOKUP_GRID_SIZE * BIOME_LOOKUP_GRID_SIZE)
+		return searchBiomes(&band.biomes[0], band.biomes.size(), heat, humidity);
+
+	u32 start = band.cell_start[cell];
+	u32 count = band.cell_start[cell + 1] - start;
+	if (count == 1)
+		return band.cell_biomes[start];
+
+	return searchBiomes(&band.cell_biomes[start], count, heat, humidity);
+}
+
+
+biome_t BiomeLookup::getBiome(float heat, float humidity, s16 y) const
+{
+	float fx = (heat - m_heat_min) * m_heat_scale;
+	float fz = (humidity - m_humidity_min) * m_humidity_scale;
+
+	s32 cell = -1;
+	if (fx >= 0.0f && fx < BIOME_LOOKUP_GRID_SIZE &&
+			fz >= 0.0f && fz < BIOME_LOOKUP_GRID_SIZE)
+		cell = (s32)fz * BIOME_LOOKUP_GRID_SIZE + (s32)fx;
+
+	return getBiomeInBand(m_bands[getBand(y)], cell, heat, humidity);
+}
+
+
+void BiomeLookup::getBiomes(const float *heat, const float *humidity,
+	const s16 *y, biome_t *biomemap, u32 count) const
+{
+	s32 cells[256];
+	u32 band = 0;
+	s32 band_y_min = 1;
+	s32 band_y_max = 0;
+
+	for (u32 start = 0; start < count; start += ARRLEN(cells)) {
+		u32 n = MYMIN(count - start, (u32)ARRLEN(cells));
+		const float *heat_n = heat + start;
+		const float *humidity_n = humidity + start;
+
+		// Find the grid cells first, in a branch free loop the compiler
+		// can vectorize
+		for (u32 i = 0; i != n; i++) {
+			float fx = (heat_n[i] - m_heat_min) * m_heat_scale;
+			float fz = (humidity_n[i] - m_humidity_min) * m_humidity_scale;
+			bool inside = fx >= 0.0f && fx < BIOME_LOOKUP_GRID_SIZE &&
+				fz >= 0.0f && fz < BIOME_LOOKUP_GRID_SIZE;
+			fx = inside ? fx : 0.0f;
+			fz = inside ? fz : 0.0f;
+			s32 cell = (s32)fz * BIOME_LOOKUP_GRID_SIZE + (s32)fx;
+			cells[i] = inside ? cell : -1;
+		}
+
+		for (u32 i = 0; i != n; i++) {
+			// Neighbouring columns mostly share the band
+			s16 y_i = y[start + i];
+			if (y_i < band_y_min || y_i > band_y_max) {
+				band = getBand(y_i);
+				band_y_min = m_band_y_min[band];
+				band_y_max = (band + 1 < m_band_y_min.size()) ?
+					m_band_y_min[band + 1] - 1 : S16_MAX;
+			}
+
+			biomemap[start + i] = getBiomeInBand(m_bands[band], cells[i],
+				heat_n[i], humidity_n[i]);
+		}
+	}
+}
+
+
 ////////////////////////////////////////////////////////////////////////////////
 
 void Biome::resolveNodeNames()
@@ -24,6 +24,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "objdef.h"
 #include "nodedef.h"
 #include "noise.h"
+#include "threading/atomic.h"
 
 class Server;
 class Settings;
@@ -73,6 +74,62 @@ class Biome : public ObjDef, public NodeResolver {
 };
 
 
+////
+//// BiomeLookup
+////
+
+#define BIOME_LOOKUP_GRID_SIZE 64
+
+/*
+	Speeds up finding the biome closest to a heat/humidity point at some y.
+	The y axis is split into bands with the same biomes available, each band
+	covering the heat/humidity plane with a grid whose cells list the only
+	biomes that can be closest to a point within. Searching those in index
+	order gives exactly the result of searching all biomes.
+*/
+class BiomeLookup {
+public:
+	// biomes[i] is the biome with index i, or NULL
+	BiomeLookup(const std::vector<Biome *> &biomes);
+
+	biome_t getBiome(float heat, float humidity, s16 y) const;
+
+	// Same as getBiome() for count columns at once
+	void getBiomes(const float *heat, const float *humidity, const s16 *y,
+		biome_t *biomemap, u32 count) const;
+
+private:
+	struct Band {
+		// All biomes of the band
+		std::vector<biome_t> biomes;
+		// The biomes of grid cell i are cell_biomes[cell_start[i]] up to
+		// cell_biomes[cell_start[i + 1] - 1]. Empty if the band has less
+		// than two biomes.
+		std::vector<u32> cell_start;
+		std::vector<biome_t> cell_biomes;
+	};
+
+	void buildGrid(Band *band);
+	u32 getBand(s16 y) const;
+	biome_t getBiomeInBand(const Band &band, s32 cell,
+		float heat, float humidity) const;
+	biome_t searchBiomes(const biome_t *biomes, size_t count,
+		float heat, float humidity) const;
+
+	std::vector<float> m_heat_points;
+	std::vector<float> m_humidity_points;
+
+	// Band i covers the y values from m_band_y_min[i] up to the next one
+	std::vector<s32> m_band_y_min;
+	std::vector<Band> m_bands;
+
+	float m_heat_min;
+	float m_humidity_min;
+	float m_heat_scale;     // grid cells per heat unit
+	float m_humidity_scale;
+};
+
+
 ////
 //// BiomeGen
 ////
@@ -222,10 +279,26 @@ class BiomeManager : public ObjDefManager {
 		}
 	}
 
+	virtual ObjDefHandle add(ObjDef *obj);
+	virtual ObjDef *set(ObjDefHandle handle, ObjDef *obj);
 	virtual void clear();
 
+	/*
+		Builds the lookup used by BiomeGenOriginal, before the mapgens start.
+		Once built it is never changed: adding or removing biomes later
+		makes BiomeGenOriginal search all biomes again, while the mapgens
+		still using the old lookup can finish safely.
+	*/
+	void updateLookup();
+	const BiomeLookup *getLookup() const { return m_lookup; }
+
 private:
+	void retireLookup();
+
 	Server *m_server;
+	mutable Atomic<BiomeLookup *> m_lookup;
+	// Lookups mapgens may still be reading, freed with the manager
+	std::vector<BiomeLookup *> m_retired_lookups;
 
 };
 
@@ -0,0 +1,322 @@
+/*
+Minetest
+Copyright (C) 2017 MultiCraft Development Team
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 3.0 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "mg_chunkcache.h"
+#include <cstring>
+#include <sstream>
+#include "database-sqlite3.h"
+#include "emerge.h"
+#include "exceptions.h"
+#include "log.h"
+#include "map.h"
+#include "mapgen.h"
+#include "mg_biome.h"
+#include "nameidmapping.h"
+#include "nodedef.h"
+#include "serialization.h"
+#include "threading/mutex_auto_lock.h"
+#include "util/serialize.h"
+
+/*
+	Format of a cached mapchunk, everything but the version zlib compressed:
+	u8 version
+	v3s16 extent of the mapchunk in blocks - 1
+	u32 blockseed
+	generate notify events, see GenerateNotifier::serialize()
+	u8 maps the mapgen has (CHUNK_CACHE_*MAP), followed by each of them:
+		s16 heightmap[x/z area], biome_t biomemap[x/z area],
+		f32 heatmap[x/z area], f32 humidmap[x/z area] (as u32 bits)
+	u32 number of liquid nodes to transform, v3s16 position of each
+	NameIdMapping of the content ids
+	u16 content[volume], u8 param1[volume], u8 param2[volume]
+		nodes in VoxelArea order
+*/
+#define CHUNK_CACHE_VERSION 2
+
+#define CHUNK_CACHE_HEIGHTMAP  0x01
+#define CHUNK_CACHE_BIOMEMAP   0x02
+#define CHUNK_CACHE_CLIMATEMAP 0x04
+
+
+MapgenChunkCache::MapgenChunkCache(INodeDefManager *ndef,
+	const std::string &savedir, const std::string &id) :
+	m_ndef(ndef),
+	m_db(new MapDatabaseSQLite3(savedir, id))
+{
+}
+
+
+MapgenChunkCache::~MapgenChunkCache()
+{
+	delete m_db;
+}
+
+
+static VoxelArea get_chunk_area(BlockMakeData *data)
+{
+	return VoxelArea(data->blockpos_min * MAP_BLOCKSIZE,
+		(data->blockpos_max + v3s16(1, 1, 1)) * MAP_BLOCKSIZE - v3s16(1, 1, 1));
+}
+
+
+// The maps Lua on_generated callbacks can get of the mapchunk
+static u8 get_mapgen_maps(Mapgen *mg, float **heatmap, float **humidmap)
+{
+	u8 maps = 0;
+	*heatmap  = NULL;
+	*humidmap = NULL;
+
+	if (mg->heightmap)
+		maps |= CHUNK_CACHE_HEIGHTMAP;
+	if (mg->biomegen) {
+		maps |= CHUNK_CACHE_BIOMEMAP;
+		if (mg->biomegen->getType() == BIOMEGEN_ORIGINAL) {
+			BiomeGenOriginal *bg = (BiomeGenOriginal *)mg->biomegen;
+			*heatmap  = bg->heatmap;
+			*humidmap = bg->humidmap;
+			maps |= CHUNK_CACHE_CLIMATEMAP;
+		}
+	}
+
+	return maps;
+}
+
+
+static void write_f32_map(std::ostream &os, const float *map, u32 len)
+{
+	for (u32 i = 0; i != len; i++) {
+		u32 bits;
+		memcpy(&bits, &map[i], sizeof(bits));
+		writeU32(os, bits);
+	}
+}
+
+
+static void read_f32_map(std::istream &is, std::vector<float> *map, u32 len)
+{
+	map->resize(len);
+	for (u32 i = 0; i != len; i++) {
+		u32 bits = readU32(is);
+		memcpy(&(*map)[i], &bits, sizeof(bits));
+	}
+}
+
+
+bool MapgenChunkCache::load(BlockMakeData *data, Mapgen *mg)
+{
+	std::string blob;
+	try {
+		MutexAutoLock lock(m_mutex);
+		m_db->loadBlock(data->blockpos_min, &blob);
+	} catch (BaseException &e) {
+		errorstream << "MapgenChunkCache: " << e.what() << std::endl;
+		return false;
+	}
+
+	if (blob.empty())
+		return false;
+
+	MMVManip *vm = data->vmanip;
+	VoxelArea area = get_chunk_area(data);
+	u32 volume = area.getVolume();
+	std::vector<v3s16> liquids;
+	std::string nodes;
+	u32 maplen = mg->csize.X * mg->csize.Z;
+	float *heatmap, *humidmap;
+	u8 maps = get_mapgen_maps(mg, &heatmap, &humidmap);
+	std::vector<s16> heights;
+	std::vector<biome_t> biomes;
+	std::vector<float> heats, humidities;
+	// Content ids of the cache by the ones of the node definitions
+	std::vector<content_t> ids(0x10000, CONTENT_IGNORE);
+
+	try {
+		std::istringstream is(blob, std::ios_base::binary);
+		if (readU8(is) != CHUNK_CACHE_VERSION)
+			return false;
+
+		std::ostringstream os(std::ios_base::binary);
+		decompressZlib(is, os);
+		std::istringstream ds(os.str(), std::ios_base::binary);
+
+		if (readV3S16(ds) != data->blockpos_max - data->blockpos_min)
+			return false;
+
+		u32 blockseed = readU32(ds);
+		mg->gennotify.deSerialize(ds);
+
+		// Saved by the same mapgen, given the id of the cache
+		if (readU8(ds) != maps)
+			throw SerializationError("mapgen maps differ");
+		if (maps & CHUNK_CACHE_HEIGHTMAP) {
+			heights.resize(maplen);
+			for (u32 i = 0; i != maplen; i++)
+				heights[i] = readS16(ds);
+		}
+		if (maps & CHUNK_CACHE_BIOMEMAP) {
+			biomes.resize(maplen);
+			for (u32 i = 0; i != maplen; i++)
+				biomes[i] = readU8(ds);
+		}
+		if (maps & CHUNK_CACHE_CLIMATEMAP) {
+			read_f32_map(ds, &heats, maplen);
+			read_f32_map(ds, &humidities, maplen);
+		}
+
+		u32 nliquids = readU32(ds);
+		for (u32 i = 0; i != nliquids && ds.good(); i++)
+			liquids.push_back(readV3S16(ds));
+
+		NameIdMapping nimap;
+		nimap.deSerialize(ds);
+
+		nodes.resize(volume * 4);
+		ds.read(&nodes[0], nodes.size());
+		if (ds.gcount() != (std::streamsize)nodes.size())
+			throw SerializationError("truncated data");
+
+		// All the nodes must still be defined
+		const u8 *contents = (const u8 *)&nodes[0];
+		for (u32 i = 0; i != volume; i++) {
+			u16 id = readU16(contents + i * 2);
+			if (ids[id] != CONTENT_IGNORE)
+				continue;
+
+			std::string name;
+			content_t c;
+			if (!nimap.getName(id, name) || !m_ndef->getId(name, c)) {
+				mg->gennotify.clearEvents();
+				return false;
+			}
+			ids[id] = c;
+		}
+
+		mg->blockseed = blockseed;
+	} catch (SerializationError &e) {
+		warningstream << "MapgenChunkCache: Invalid mapchunk at "
+			<< PP(data->blockpos_min) << ": " << e.what() << std::endl;
+		mg->gennotify.clearEvents();
+		return false;
+	}
+
+	const u8 *contents = (const u8 *)&nodes[0];
+	const u8 *param1 = contents + volume * 2;
+	const u8 *param2 = contents + volume * 3;
+	u32 i = 0;
+	for (s16 z = area.MinEdge.Z; z <= area.MaxEdge.Z; z++)
+	for (s16 y = area.MinEdge.Y; y <= area.MaxEdge.Y; y++) {
+		u32 vi = vm->m_area.index(area.MinEdge.X, y, z);
+		for (s16 x = area.MinEdge.X; x <= area.MaxEdge.X; x++, vi++, i++) {
+			vm->m_data[vi] = MapNode(ids[readU16(contents + i * 2)],
+				param1[i], param2[i]);
+		}
+	}
+
+	for (size_t j = 0; j != liquids.size(); j++)
+		data->transforming_liquid.push_back(liquids[j]);
+
+	// Restore what on_generated callbacks see of the mapchunk
+	if (maps & CHUNK_CACHE_HEIGHTMAP)
+		memcpy(mg->heightmap, &heights[0], maplen * sizeof(s16));
+	if (maps & CHUNK_CACHE_BIOMEMAP)
+		memcpy(mg->biomegen->biomemap, &biomes[0], maplen * sizeof(biome_t));
+	if (maps & CHUNK_CACHE_CLIMATEMAP) {
+		memcpy(heatmap, &heats[0], maplen * sizeof(float));
+		memcpy(humidmap, &humidities[0], maplen * sizeof(float));
+	}
+
+	return true;
+}
+
+
+void MapgenChunkCache::save(BlockMakeData *data, Mapgen *mg)
+{
+	MMVManip *vm = data->vmanip;
+	VoxelArea area = get_chunk_area(data);
+	u32 volume = area.getVolume();
+
+	std::ostringstream os(std::ios_base::binary);
+	writeV3S16(os, data->blockpos_max - data->blockpos_min);
+	writeU32(os, mg->blockseed);
+	mg->gennotify.serialize(os);
+
+	u32 maplen = mg->csize.X * mg->csize.Z;
+	float *heatmap, *humidmap;
+	u8 maps = get_mapgen_maps(mg, &heatmap, &humidmap);
+	writeU8(os, maps);
+	if (maps & CHUNK_CACHE_HEIGHTMAP) {
+		for (u32 i = 0; i != maplen; i++)
+			writeS16(os, mg->heightmap[i]);
+	}
+	if (maps & CHUNK_CACHE_BIOMEMAP) {
+		for (u32 i = 0; i != maplen; i++)
+			writeU8(os, mg->biomegen->biomemap[i]);
+	}
+	if (maps & CHUNK_CACHE_CLIMATEMAP) {
+		write_f32_map(os, heatmap, maplen);
+		write_f32_map(os, humidmap, maplen);
+	}
+
+	// Taking the positions out of the queue and back keeps its order
+	u32 nliquids = data->transforming_liquid.size();
+	writeU32(os, nliquids);
+	for (u32 i = 0; i != nliquids; i++) {
+		v3s16 p = data->transforming_liquid.front();
+		data->transforming_liquid.pop_front();
+		writeV3S16(os, p);
+		data->transforming_liquid.push_back(p);
+	}
+
+	NameIdMapping nimap;
+	std::vector<bool> mapped(0x10000, false);
+	std::string nodes(volume * 4, '\0');
+	u8 *contents = (u8 *)&nodes[0];
+	u8 *param1 = contents + volume * 2;
+	u8 *param2 = contents + volume * 3;
+	u32 i = 0;
+	for (s16 z = area.MinEdge.Z; z <= area.MaxEdge.Z; z++)
+	for (s16 y = area.MinEdge.Y; y <= area.MaxEdge.Y; y++) {
+		u32 vi = vm->m_area.index(area.MinEdge.X, y, z);
+		for (s16 x = area.MinEdge.X; x <= area.MaxEdge.X; x++, vi++, i++) {
+			const MapNode &n = vm->m_data[vi];
+			content_t c = n.getContent();
+			if (!mapped[c]) {
+				nimap.set(c, m_ndef->get(c).name);
+				mapped[c] = true;
+			}
+			writeU16(contents + i * 2, c);
+			param1[i] = n.param1;
+			param2[i] = n.param2;
+		}
+	}
+
+	nimap.serialize(os);
+	os.write(nodes.c_str(), nodes.size());
+
+	std::ostringstream blob(std::ios_base::binary);
+	writeU8(blob, CHUNK_CACHE_VERSION);
+	compressZlib(os.str(), blob);
+
+	try {
+		MutexAutoLock lock(m_mutex);
+		m_db->saveBlock(data->blockpos_min, blob.str());
+	} catch (BaseException &e) {
+		errorstream << "MapgenChunkCache: " << e.what() << std::endl;
+	}
+}
@@ -0,0 +1,64 @@
+/*
+Minetest
+Copyright (C) 2017 MultiCraft Development Team
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 3.0 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#ifndef MG_CHUNKCACHE_HEADER
+#define MG_CHUNKCACHE_HEADER
+
+#include <string>
+#include "irrlichttypes.h"
+#include "threading/mutex.h"
+#include "util/basic_macros.h"
+
+class INodeDefManager;
+class MapDatabase;
+class Mapgen;
+struct BlockMakeData;
+
+/*
+	Keeps the mapchunks as they were generated, before anything else (Lua
+	on_generated callbacks, players) modified them, so that generating a
+	deleted mapchunk again only needs a database read.
+
+	The cache lives in the directory given to the constructor, one database
+	per id.  The id must change whenever the mapgen output might, e.g. with
+	the mapgen parameters.  Only the blocks of the mapchunk itself are kept,
+	nodes placed by the mapgen into the neighbouring blocks are not restored.
+*/
+class MapgenChunkCache {
+public:
+	MapgenChunkCache(INodeDefManager *ndef, const std::string &savedir,
+		const std::string &id);
+	~MapgenChunkCache();
+
+	// Replaces the result of Mapgen::makeChunk() for data by the cached one,
+	// returns false if the mapchunk is not cached
+	bool load(BlockMakeData *data, Mapgen *mg);
+
+	// Stores the result of Mapgen::makeChunk() for data
+	void save(BlockMakeData *data, Mapgen *mg);
+
+private:
+	INodeDefManager *m_ndef;
+	Mutex m_mutex;
+	MapDatabase *m_db;
+
+	DISABLE_CLASS_COPY(MapgenChunkCache);
+};
+
+#endif
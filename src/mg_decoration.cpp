@@ -24,6 +24,8 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "noise.h"
 #include "map.h"
 #include "log.h"
+#include "porting.h"
+#include "profiler.h"
 #include "util/numeric.h"
 #include <algorithm>
 
@@ -47,18 +49,159 @@ DecorationManager::DecorationManager(IGameDef *gamedef) :
 }
 
 
+// A run of consecutive decorations that are placed together
+struct DecoBatch {
+	Mapgen *mg;
+	v3s16 nmin;
+	v3s16 nmax;
+	MapgenTiles *tiles;           // NULL to place in the whole area at once
+	std::vector<Decoration *> decos;
+	std::vector<u32> blockseeds;
+
+	// Positions per decoration and tile
+	std::vector<std::vector<DecoPlacement> > placements;
+	// Placed decorations per tile, passed to gennotify afterwards
+	std::vector<std::vector<GenNotifyEvent> > events;
+	// Per tile and decoration, in microseconds
+	std::vector<u64> times;
+	// Tiles placed by the current Mapgen::runParallel() call
+	std::vector<u32> jobs;
+	size_t nplaced;
+
+	inline u32 numTiles() const { return tiles ? tiles->count() : 1; }
+};
+
+
+static void get_deco_placements_job(u32 job, void *data)
+{
+	DecoBatch *batch = (DecoBatch *)data;
+	Decoration *deco = batch->decos[job];
+	u32 ntiles = batch->numTiles();
+
+	u64 t = porting::getTimeUs();
+
+	std::vector<DecoPlacement> placements;
+	deco->getPlacements(batch->blockseeds[job], batch->nmin, batch->nmax,
+		&placements);
+
+	for (size_t i = 0; i != placements.size(); i++) {
+		const DecoPlacement &dp = placements[i];
+		u32 tile = batch->tiles ? batch->tiles->getIndex(dp.x, dp.z) : 0;
+		batch->placements[job * ntiles + tile].push_back(dp);
+	}
+
+	batch->times[job] += porting::getTimeUs() - t;
+}
+
+
+static void place_decos_job(u32 job, void *data)
+{
+	DecoBatch *batch = (DecoBatch *)data;
+	Mapgen *mg = batch->mg;
+	size_t ndecos = batch->decos.size();
+	u32 ntiles = batch->numTiles();
+	u32 tile = batch->jobs[job];
+
+	for (size_t i = 0; i != ndecos; i++) {
+		Decoration *deco = batch->decos[i];
+		const std::vector<DecoPlacement> &placements =
+			batch->placements[i * ntiles + tile];
+
+		u64 t = porting::getTimeUs();
+
+		for (size_t j = 0; j != placements.size(); j++) {
+			GenNotifyEvent gne;
+			if (!deco->placeDeco(mg, placements[j], batch->nmin, batch->nmax, &gne.pos))
+				continue;
+
+			gne.type = GENNOTIFY_DECORATION;
+			gne.id   = deco->index;
+			batch->events[tile].push_back(gne);
+		}
+
+		batch->times[tile * ndecos + i] += porting::getTimeUs() - t;
+	}
+}
+
+
 size_t DecorationManager::placeAllDecos(Mapgen *mg, u32 blockseed,
 	v3s16 nmin, v3s16 nmax)
 {
 	size_t nplaced = 0;
+	MapgenTiles tiles(nmin, nmax);
+
+	size_t i = 0;
+	while (i != m_objects.size()) {
+		/*
+			Consecutive decorations small enough are placed tile by tile,
+			tiles of the same color in parallel as they can't reach each
+			other. Any other decoration is placed on its own.
+		*/
+		DecoBatch batch;
+		batch.mg    = mg;
+		batch.nmin  = nmin;
+		batch.nmax  = nmax;
+		batch.tiles = NULL;
+
+		for (; i != m_objects.size(); i++) {
+			Decoration *deco = (Decoration *)m_objects[i];
+			if (!deco)
+				continue;
 
-	for (size_t i = 0; i != m_objects.size(); i++) {
-		Decoration *deco = (Decoration *)m_objects[i];
-		if (!deco)
-			continue;
+			if (!deco->isTileable()) {
+				if (batch.decos.empty()) {
+					batch.decos.push_back(deco);
+					batch.blockseeds.push_back(blockseed++);
+					i++;
+				}
+				break;
+			}
+
+			batch.tiles = &tiles;
+			batch.decos.push_back(deco);
+			batch.blockseeds.push_back(blockseed++);
+		}
+
+		size_t ndecos = batch.decos.size();
+		if (ndecos == 0)
+			break;
+
+		u32 ntiles = batch.numTiles();
+		batch.placements.resize(ndecos * ntiles);
+		batch.events.resize(ntiles);
+		batch.times.resize(ntiles * ndecos, 0);
+
+		mg->runParallel(ndecos, get_deco_placements_job, &batch);
+
+		for (u8 color = 0; color != 4; color++) {
+			batch.jobs.clear();
+			for (u32 tile = 0; tile != ntiles; tile++) {
+				if (!batch.tiles || batch.tiles->getColor(tile) == color)
+					batch.jobs.push_back(tile);
+			}
+
+			mg->runParallel(batch.jobs.size(), place_decos_job, &batch);
+
+			if (!batch.tiles)
+				break;
+		}
 
-		nplaced += deco->placeDeco(mg, blockseed, nmin, nmax);
-		blockseed++;
+		for (u32 tile = 0; tile != ntiles; tile++) {
+			const std::vector<GenNotifyEvent> &events = batch.events[tile];
+			for (size_t j = 0; j != events.size(); j++)
+				mg->gennotify.addEvent(events[j].type, events[j].pos, events[j].id);
+			nplaced += events.size();
+		}
+
+		for (size_t j = 0; j != ndecos; j++) {
+			u64 time = 0;
+			for (u32 tile = 0; tile != ntiles; tile++)
+				time += batch.times[tile * ndecos + j];
+
+			Decoration *deco = batch.decos[j];
+			g_profiler->avg("Mapgen: decoration " + (deco->name.empty() ?
+				"#" + itos(deco->index) : deco->name), time / 1000.0f);
+		}
 	}
 
 	return nplaced;
@@ -138,32 +281,35 @@ bool Decoration::canPlaceDecoration(MMVManip *vm, v3s16 p)
 }
 
 
-size_t Decoration::placeDeco(Mapgen *mg, u32 blockseed, v3s16 nmin, v3s16 nmax)
+void Decoration::getPlacements(u32 blockseed, v3s16 nmin, v3s16 nmax,
+	std::vector<DecoPlacement> *placements)
 {
-	PcgRandom ps(blockseed + 53);
 	int carea_size = nmax.X - nmin.X + 1;
 
 	// Divide area into parts
 	// If chunksize is changed it may no longer be divisable by sidelen
-	if (carea_size % sidelen)
-		sidelen = carea_size;
+	s16 divsize = (carea_size % sidelen) ? carea_size : sidelen;
 
-	s16 divlen = carea_size / sidelen;
-	int area = sidelen * sidelen;
+	s16 divlen = carea_size / divsize;
+	int area = divsize * divsize;
 
 	for (s16 z0 = 0; z0 < divlen; z0++)
 	for (s16 x0 = 0; x0 < divlen; x0++) {
+		// Each division has its own sequence, so the positions don't depend
+		// on the order the divisions are processed in
+		PcgRandom ps(blockseed + 53, z0 * divlen + x0);
+
 		v2s16 p2d_center( // Center position of part of division
-			nmin.X + sidelen / 2 + sidelen * x0,
-			nmin.Z + sidelen / 2 + sidelen * z0
+			nmin.X + divsize / 2 + divsize * x0,
+			nmin.Z + divsize / 2 + divsize * z0
 		);
 		v2s16 p2d_min( // Minimum edge of part of division
-			nmin.X + sidelen * x0,
-			nmin.Z + sidelen * z0
+			nmin.X + divsize * x0,
+			nmin.Z + divsize * z0
 		);
 		v2s16 p2d_max( // Maximum edge of part of division
-			nmin.X + sidelen + sidelen * x0 - 1,
-			nmin.Z + sidelen + sidelen * z0 - 1
+			nmin.X + divsize + divsize * x0 - 1,
+			nmin.Z + divsize + divsize * z0 - 1
 		);
 
 		// Amount of decorations
@@ -181,50 +327,59 @@ size_t Decoration::placeDeco(Mapgen *mg, u32 blockseed, v3s16 nmin, v3s16 nmax)
 		}
 
 		for (u32 i = 0; i < deco_count; i++) {
-			s16 x = ps.range(p2d_min.X, p2d_max.X);
-			s16 z = ps.range(p2d_min.Y, p2d_max.Y);
+			DecoPlacement dp;
+			dp.x    = ps.range(p2d_min.X, p2d_max.X);
+			dp.z    = ps.range(p2d_min.Y, p2d_max.Y);
+			dp.seed = ps.next();
+			placements->push_back(dp);
+		}
+	}
+}
 
-			int mapindex = carea_size * (z - nmin.Z) + (x - nmin.X);
 
-			s16 y = -MAX_MAP_GENERATION_LIMIT;
-			if (flags & DECO_LIQUID_SURFACE)
-				y = mg->findLiquidSurface(v2s16(x, z), nmin.Y, nmax.Y);
-			else if (mg->heightmap)
-				y = mg->heightmap[mapindex];
-			else
-				y = mg->findGroundLevel(v2s16(x, z), nmin.Y, nmax.Y);
+bool Decoration::placeDeco(Mapgen *mg, const DecoPlacement &dp,
+	v3s16 nmin, v3s16 nmax, v3s16 *pos)
+{
+	s16 x = dp.x;
+	s16 z = dp.z;
+	int mapindex = (nmax.X - nmin.X + 1) * (z - nmin.Z) + (x - nmin.X);
+
+	s16 y = -MAX_MAP_GENERATION_LIMIT;
+	if (flags & DECO_LIQUID_SURFACE)
+		y = mg->findLiquidSurface(v2s16(x, z), nmin.Y, nmax.Y);
+	else if (mg->heightmap)
+		y = mg->heightmap[mapindex];
+	else
+		y = mg->findGroundLevel(v2s16(x, z), nmin.Y, nmax.Y);
 
-			if (y < nmin.Y || y > nmax.Y ||
-				y < y_min  || y > y_max)
-				continue;
+	if (y < nmin.Y || y > nmax.Y ||
+		y < y_min  || y > y_max)
+		return false;
 
-			if (y + getHeight() > mg->vm->m_area.MaxEdge.Y) {
-				continue;
+	if (y + getHeight() > mg->vm->m_area.MaxEdge.Y) {
+		return false;
 #if 0
-				printf("Decoration at (%d %d %d) cut off\n", x, y, z);
-				//add to queue
-				MutexAutoLock cutofflock(cutoff_mutex);
-				cutoffs.push_back(CutoffData(x, y, z, height));
+		printf("Decoration at (%d %d %d) cut off\n", x, y, z);
+		//add to queue
+		MutexAutoLock cutofflock(cutoff_mutex);
+		cutoffs.push_back(CutoffData(x, y, z, height));
 #endif
-			}
-
-			if (mg->biomemap) {
-				UNORDERED_SET<u8>::iterator iter;
+	}
 
-				if (!biomes.empty()) {
-					iter = biomes.find(mg->biomemap[mapindex]);
-					if (iter == biomes.end())
-						continue;
-				}
-			}
+	if (mg->biomemap) {
+		UNORDERED_SET<u8>::iterator iter;
 
-			v3s16 pos(x, y, z);
-			if (generate(mg->vm, &ps, pos))
-				mg->gennotify.addEvent(GENNOTIFY_DECORATION, pos, index);
+		if (!biomes.empty()) {
+			iter = biomes.find(mg->biomemap[mapindex]);
+			if (iter == biomes.end())
+				return false;
 		}
 	}
 
-	return 0;
+	PcgRandom pr(dp.seed);
+	*pos = v3s16(x, y, z);
+
+	return generate(mg->vm, &pr, *pos) != 0;
 }
 
 
@@ -375,7 +530,7 @@ size_t DecoSchematic::generate(MMVManip *vm, PcgRandom *pr, v3s16 p)
 
 	bool force_placement = (flags & DECO_FORCE_PLACEMENT);
 
-	schematic->blitToVManip(vm, p, rot, force_placement);
+	schematic->blitToVManip(vm, p, rot, force_placement, pr);
 
 	return 1;
 }
@@ -389,3 +544,20 @@ int DecoSchematic::getHeight()
 	return (flags & DECO_PLACE_CENTER_Y) ?
 		(schematic->size.Y - 1) / 2 : schematic->size.Y - 1 + place_offset_y;
 }
+
+
+int DecoSchematic::getExtent()
+{
+	if (schematic == NULL)
+		return Decoration::getExtent();
+
+	// Either side of the schematic may end up along any axis when rotated,
+	// while centering shifts it by the unrotated size as in generate().
+	// The neighbours checked by canPlaceDecoration() are 1 node away.
+	int size = MYMAX(schematic->size.X, schematic->size.Z);
+	int left_x = (flags & DECO_PLACE_CENTER_X) ? (schematic->size.X - 1) / 2 : 0;
+	int left_z = (flags & DECO_PLACE_CENTER_Z) ? (schematic->size.Z - 1) / 2 : 0;
+	int extent = MYMAX(size - 1 - MYMIN(left_x, left_z), MYMAX(left_x, left_z));
+
+	return MYMAX(extent, 1);
+}
@@ -25,6 +25,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "objdef.h"
 #include "noise.h"
 #include "nodedef.h"
+#include "mapgen.h"
 
 class Mapgen;
 class MMVManip;
@@ -46,6 +47,13 @@ enum DecorationType {
 
 extern FlagDesc flagdesc_deco[];
 
+// A position chosen for a decoration, and the seed to place it with
+struct DecoPlacement {
+	s16 x;
+	s16 z;
+	u32 seed;
+};
+
 
 #if 0
 struct CutoffData {
@@ -70,12 +78,25 @@ class Decoration : public ObjDef, public NodeResolver {
 	virtual void resolveNodeNames();
 
 	bool canPlaceDecoration(MMVManip *vm, v3s16 p);
-	size_t placeDeco(Mapgen *mg, u32 blockseed, v3s16 nmin, v3s16 nmax);
+
+	// Chooses the decoration positions in nmin - nmax, each division of
+	// sidelen * sidelen nodes using its own random sequence
+	void getPlacements(u32 blockseed, v3s16 nmin, v3s16 nmax,
+		std::vector<DecoPlacement> *placements);
+	// Places the decoration at a position chosen by getPlacements()
+	bool placeDeco(Mapgen *mg, const DecoPlacement &dp,
+		v3s16 nmin, v3s16 nmax, v3s16 *pos);
 	//size_t placeCutoffs(Mapgen *mg, u32 blockseed, v3s16 nmin, v3s16 nmax);
 
 	virtual size_t generate(MMVManip *vm, PcgRandom *pr, v3s16 p) = 0;
 	virtual int getHeight() = 0;
 
+	// Distance from its position along x and z, on either side, up to
+	// which placing the decoration may read or change nodes
+	virtual int getExtent() { return 1; }
+	// Tiles of the same color are MAPGEN_TILE_SIZE nodes apart
+	inline bool isTileable() { return getExtent() <= MAPGEN_TILE_SIZE / 2; }
+
 	u32 flags;
 	int mapseed;
 	std::vector<content_t> c_place_on;
@@ -111,6 +132,7 @@ class DecoSchematic : public Decoration {
 
 	virtual size_t generate(MMVManip *vm, PcgRandom *pr, v3s16 p);
 	virtual int getHeight();
+	virtual int getExtent();
 
 	Rotation rotation;
 	Schematic *schematic;
@@ -23,6 +23,8 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "noise.h"
 #include "map.h"
 #include "log.h"
+#include "porting.h"
+#include "profiler.h"
 #include <algorithm>
 
 
@@ -43,17 +45,110 @@ OreManager::OreManager(IGameDef *gamedef) :
 }
 
 
+// A run of consecutive ores that are generated together
+struct OreBatch {
+	Mapgen *mg;
+	v3s16 nmin;
+	v3s16 nmax;
+	MapgenTiles *tiles;           // NULL to generate the whole area at once
+	std::vector<Ore *> ores;
+	std::vector<u32> blockseeds;
+	std::vector<u64> times;       // per tile and ore, in microseconds
+};
+
+
+static void place_ores_job(u32 job, void *data)
+{
+	OreBatch *batch = (OreBatch *)data;
+	Mapgen *mg = batch->mg;
+	size_t nores = batch->ores.size();
+
+	v3s16 tmin = batch->nmin;
+	v3s16 tmax = batch->nmax;
+	if (batch->tiles)
+		batch->tiles->getTile(job, &tmin, &tmax);
+
+	for (size_t i = 0; i != nores; i++) {
+		Ore *ore = batch->ores[i];
+
+		OreArea area;
+		area.chunk_min = batch->nmin;
+		area.chunk_max = batch->nmax;
+		if (!ore->getPlaceRange(&area.chunk_min, &area.chunk_max))
+			continue;
+
+		area.nmin = v3s16(tmin.X, area.chunk_min.Y, tmin.Z);
+		area.nmax = v3s16(tmax.X, area.chunk_max.Y, tmax.Z);
+		area.seed = batch->blockseeds[i] + job * 0x9E3779B9U;
+		area.biomemap = mg->biomemap;
+
+		u64 t = porting::getTimeUs();
+		ore->generate(mg->vm, mg->seed, batch->blockseeds[i], area);
+		batch->times[job * nores + i] += porting::getTimeUs() - t;
+	}
+}
+
+
 size_t OreManager::placeAllOres(Mapgen *mg, u32 blockseed, v3s16 nmin, v3s16 nmax)
 {
 	size_t nplaced = 0;
+	MapgenTiles tiles(nmin, nmax);
+
+	size_t i = 0;
+	while (i != m_objects.size()) {
+		/*
+			Consecutive ores that fit into a tile are generated tile by
+			tile in parallel; any other ore is generated on its own.
+		*/
+		OreBatch batch;
+		batch.mg    = mg;
+		batch.nmin  = nmin;
+		batch.nmax  = nmax;
+		batch.tiles = NULL;
+
+		for (; i != m_objects.size(); i++) {
+			Ore *ore = (Ore *)m_objects[i];
+			if (!ore)
+				continue;
 
-	for (size_t i = 0; i != m_objects.size(); i++) {
-		Ore *ore = (Ore *)m_objects[i];
-		if (!ore)
-			continue;
+			if (!ore->isTileable()) {
+				if (batch.ores.empty()) {
+					batch.ores.push_back(ore);
+					batch.blockseeds.push_back(blockseed++);
+					i++;
+				}
+				break;
+			}
+
+			batch.tiles = &tiles;
+			batch.ores.push_back(ore);
+			batch.blockseeds.push_back(blockseed++);
+		}
+
+		size_t nores = batch.ores.size();
+		if (nores == 0)
+			break;
+
+		for (size_t j = 0; j != nores; j++) {
+			v3s16 pmin = nmin;
+			v3s16 pmax = nmax;
+			if (batch.ores[j]->getPlaceRange(&pmin, &pmax))
+				nplaced++;
+		}
+
+		u32 njobs = batch.tiles ? tiles.count() : 1;
+		batch.times.resize(njobs * nores, 0);
+		mg->runParallel(njobs, place_ores_job, &batch);
+
+		for (size_t j = 0; j != nores; j++) {
+			u64 time = 0;
+			for (u32 job = 0; job != njobs; job++)
+				time += batch.times[job * nores + j];
 
-		nplaced += ore->placeOre(mg, blockseed, nmin, nmax);
-		blockseed++;
+			Ore *ore = batch.ores[j];
+			g_profiler->avg("Mapgen: ore " + (ore->name.empty() ?
+				"#" + itos(ore->index) : ore->name), time / 1000.0f);
+		}
 	}
 
 	return nplaced;
@@ -76,13 +171,11 @@ void OreManager::clear()
 Ore::Ore()
 {
 	flags = 0;
-	noise = NULL;
 }
 
 
 Ore::~Ore()
 {
-	delete noise;
 }
 
 
@@ -93,32 +186,31 @@ void Ore::resolveNodeNames()
 }
 
 
-size_t Ore::placeOre(Mapgen *mg, u32 blockseed, v3s16 nmin, v3s16 nmax)
+bool Ore::getPlaceRange(v3s16 *nmin, v3s16 *nmax)
 {
 	int in_range = 0;
 
-	in_range |= (nmin.Y <= y_max && nmax.Y >= y_min);
+	in_range |= (nmin->Y <= y_max && nmax->Y >= y_min);
 	if (flags & OREFLAG_ABSHEIGHT)
-		in_range |= (nmin.Y >= -y_max && nmax.Y <= -y_min) << 1;
+		in_range |= (nmin->Y >= -y_max && nmax->Y <= -y_min) << 1;
 	if (!in_range)
-		return 0;
+		return false;
 
 	int actual_ymin, actual_ymax;
 	if (in_range & ORE_RANGE_MIRROR) {
-		actual_ymin = MYMAX(nmin.Y, -y_max);
-		actual_ymax = MYMIN(nmax.Y, -y_min);
+		actual_ymin = MYMAX(nmin->Y, -y_max);
+		actual_ymax = MYMIN(nmax->Y, -y_min);
 	} else {
-		actual_ymin = MYMAX(nmin.Y, y_min);
-		actual_ymax = MYMIN(nmax.Y, y_max);
+		actual_ymin = MYMAX(nmin->Y, y_min);
+		actual_ymax = MYMIN(nmax->Y, y_max);
 	}
 	if (clust_size >= actual_ymax - actual_ymin + 1)
-		return 0;
+		return false;
 
-	nmin.Y = actual_ymin;
-	nmax.Y = actual_ymax;
-	generate(mg->vm, mg->seed, blockseed, nmin, nmax, mg->biomemap);
+	nmin->Y = actual_ymin;
+	nmax->Y = actual_ymax;
 
-	return 1;
+	return true;
 }
 
 
@@ -126,18 +218,22 @@ size_t Ore::placeOre(Mapgen *mg, u32 blockseed, v3s16 nmin, v3s16 nmax)
 
 
 void OreScatter::generate(MMVManip *vm, int mapseed, u32 blockseed,
-	v3s16 nmin, v3s16 nmax, u8 *biomemap)
+	const OreArea &area)
 {
-	PcgRandom pr(blockseed);
+	PcgRandom pr(area.seed);
 	MapNode n_ore(c_ore, 0, ore_param2);
 
-	u32 sizex  = (nmax.X - nmin.X + 1);
+	const v3s16 &nmin = area.nmin;
+	const v3s16 &nmax = area.nmax;
 	u32 volume = (nmax.X - nmin.X + 1) *
 				 (nmax.Y - nmin.Y + 1) *
 				 (nmax.Z - nmin.Z + 1);
 	u32 csize     = clust_size;
 	u32 cvolume    = csize * csize * csize;
 	u32 nclusters = volume / clust_scarcity;
+	// Keep the expected count when the area is small compared to the scarcity
+	if (pr.range(clust_scarcity) < volume % clust_scarcity)
+		nclusters++;
 
 	for (u32 i = 0; i != nclusters; i++) {
 		int x0 = pr.range(nmin.X, nmax.X - csize + 1);
@@ -148,9 +244,9 @@ void OreScatter::generate(MMVManip *vm, int mapseed, u32 blockseed,
 			(NoisePerlin3D(&np, x0, y0, z0, mapseed) < nthresh))
 			continue;
 
-		if (biomemap && !biomes.empty()) {
-			u32 index = sizex * (z0 - nmin.Z) + (x0 - nmin.X);
-			UNORDERED_SET<u8>::iterator it = biomes.find(biomemap[index]);
+		if (area.biomemap && !biomes.empty()) {
+			u32 index = area.biomeIndex(x0, z0);
+			UNORDERED_SET<u8>::iterator it = biomes.find(area.biomemap[index]);
 			if (it == biomes.end())
 				continue;
 		}
@@ -175,36 +271,39 @@ void OreScatter::generate(MMVManip *vm, int mapseed, u32 blockseed,
 
 
 void OreSheet::generate(MMVManip *vm, int mapseed, u32 blockseed,
-	v3s16 nmin, v3s16 nmax, u8 *biomemap)
+	const OreArea &area)
 {
-	PcgRandom pr(blockseed + 4234);
+	// The sheet height is chosen per mapchunk so that it is continuous
+	// across the areas of a mapchunk
+	PcgRandom pr_chunk(blockseed + 4234);
+	PcgRandom pr(area.seed + 4234);
 	MapNode n_ore(c_ore, 0, ore_param2);
 
+	const v3s16 &nmin = area.nmin;
+	const v3s16 &nmax = area.nmax;
 	u16 max_height = column_height_max;
 	int y_start_min = nmin.Y + max_height;
 	int y_start_max = nmax.Y - max_height;
 
 	int y_start = y_start_min < y_start_max ?
-		pr.range(y_start_min, y_start_max) :
+		pr_chunk.range(y_start_min, y_start_max) :
 		(y_start_min + y_start_max) / 2;
 
-	if (!noise) {
-		int sx = nmax.X - nmin.X + 1;
-		int sz = nmax.Z - nmin.Z + 1;
-		noise = new Noise(&np, 0, sx, sz);
-	}
-	noise->seed = mapseed + y_start;
-	noise->perlinMap2D(nmin.X, nmin.Z);
+	int sx = nmax.X - nmin.X + 1;
+	int sz = nmax.Z - nmin.Z + 1;
+	Noise noise(&np, mapseed + y_start, sx, sz);
+	noise.perlinMap2D(nmin.X, nmin.Z);
 
 	size_t index = 0;
 	for (int z = nmin.Z; z <= nmax.Z; z++)
 	for (int x = nmin.X; x <= nmax.X; x++, index++) {
-		float noiseval = noise->result[index];
+		float noiseval = noise.result[index];
 		if (noiseval < nthresh)
 			continue;
 
-		if (biomemap && !biomes.empty()) {
-			UNORDERED_SET<u8>::iterator it = biomes.find(biomemap[index]);
+		if (area.biomemap && !biomes.empty()) {
+			UNORDERED_SET<u8>::iterator it =
+				biomes.find(area.biomemap[area.biomeIndex(x, z)]);
 			if (it == biomes.end())
 				continue;
 		}
@@ -229,62 +328,48 @@ void OreSheet::generate(MMVManip *vm, int mapseed, u32 blockseed,
 
 ///////////////////////////////////////////////////////////////////////////////
 
-OrePuff::OrePuff() :
-	Ore()
-{
-	noise_puff_top    = NULL;
-	noise_puff_bottom = NULL;
-}
-
-
-OrePuff::~OrePuff()
-{
-	delete noise_puff_top;
-	delete noise_puff_bottom;
-}
-
-
 void OrePuff::generate(MMVManip *vm, int mapseed, u32 blockseed,
-	v3s16 nmin, v3s16 nmax, u8 *biomemap)
+	const OreArea &area)
 {
-	PcgRandom pr(blockseed + 4234);
+	// Same per mapchunk height as in OreSheet
+	PcgRandom pr_chunk(blockseed + 4234);
 	MapNode n_ore(c_ore, 0, ore_param2);
 
-	int y_start = pr.range(nmin.Y, nmax.Y);
+	const v3s16 &nmin = area.nmin;
+	const v3s16 &nmax = area.nmax;
+	int y_start = pr_chunk.range(nmin.Y, nmax.Y);
 
-	if (!noise) {
-		int sx = nmax.X - nmin.X + 1;
-		int sz = nmax.Z - nmin.Z + 1;
-		noise = new Noise(&np, 0, sx, sz);
-		noise_puff_top = new Noise(&np_puff_top, 0, sx, sz);
-		noise_puff_bottom = new Noise(&np_puff_bottom, 0, sx, sz);
-	}
+	int sx = nmax.X - nmin.X + 1;
+	int sz = nmax.Z - nmin.Z + 1;
+	Noise noise(&np, mapseed + y_start, sx, sz);
+	Noise noise_puff_top(&np_puff_top, 0, sx, sz);
+	Noise noise_puff_bottom(&np_puff_bottom, 0, sx, sz);
 
-	noise->seed = mapseed + y_start;
-	noise->perlinMap2D(nmin.X, nmin.Z);
+	noise.perlinMap2D(nmin.X, nmin.Z);
 	bool noise_generated = false;
 
 	size_t index = 0;
 	for (int z = nmin.Z; z <= nmax.Z; z++)
 	for (int x = nmin.X; x <= nmax.X; x++, index++) {
-		float noiseval = noise->result[index];
+		float noiseval = noise.result[index];
 		if (noiseval < nthresh)
 			continue;
 
-		if (biomemap && !biomes.empty()) {
-			UNORDERED_SET<u8>::iterator it = biomes.find(biomemap[index]);
+		if (area.biomemap && !biomes.empty()) {
+			UNORDERED_SET<u8>::iterator it =
+				biomes.find(area.biomemap[area.biomeIndex(x, z)]);
 			if (it == biomes.end())
 				continue;
 		}
 
 		if (!noise_generated) {
 			noise_generated = true;
-			noise_puff_top->perlinMap2D(nmin.X, nmin.Z);
-			noise_puff_bottom->perlinMap2D(nmin.X, nmin.Z);
+			noise_puff_top.perlinMap2D(nmin.X, nmin.Z);
+			noise_puff_bottom.perlinMap2D(nmin.X, nmin.Z);
 		}
 
-		float ntop    = noise_puff_top->result[index];
-		float nbottom = noise_puff_bottom->result[index];
+		float ntop    = noise_puff_top.result[index];
+		float nbottom = noise_puff_bottom.result[index];
 
 		if (!(flags & OREFLAG_PUFF_CLIFFS)) {
 			float ndiff = noiseval - nthresh;
@@ -318,35 +403,38 @@ void OrePuff::generate(MMVManip *vm, int mapseed, u32 blockseed,
 
 
 void OreBlob::generate(MMVManip *vm, int mapseed, u32 blockseed,
-	v3s16 nmin, v3s16 nmax, u8 *biomemap)
+	const OreArea &area)
 {
-	PcgRandom pr(blockseed + 2404);
+	PcgRandom pr(area.seed + 2404);
 	MapNode n_ore(c_ore, 0, ore_param2);
 
-	u32 sizex  = (nmax.X - nmin.X + 1);
+	const v3s16 &nmin = area.nmin;
+	const v3s16 &nmax = area.nmax;
 	u32 volume = (nmax.X - nmin.X + 1) *
 				 (nmax.Y - nmin.Y + 1) *
 				 (nmax.Z - nmin.Z + 1);
 	u32 csize  = clust_size;
 	u32 nblobs = volume / clust_scarcity;
+	// Same expected count correction as in OreScatter
+	if (pr.range(clust_scarcity) < volume % clust_scarcity)
+		nblobs++;
 
-	if (!noise)
-		noise = new Noise(&np, mapseed, csize, csize, csize);
+	Noise noise(&np, mapseed, csize, csize, csize);
 
 	for (u32 i = 0; i != nblobs; i++) {
 		int x0 = pr.range(nmin.X, nmax.X - csize + 1);
 		int y0 = pr.range(nmin.Y, nmax.Y - csize + 1);
 		int z0 = pr.range(nmin.Z, nmax.Z - csize + 1);
 
-		if (biomemap && !biomes.empty()) {
-			u32 bmapidx = sizex * (z0 - nmin.Z) + (x0 - nmin.X);
-			UNORDERED_SET<u8>::iterator it = biomes.find(biomemap[bmapidx]);
+		if (area.biomemap && !biomes.empty()) {
+			u32 bmapidx = area.biomeIndex(x0, z0);
+			UNORDERED_SET<u8>::iterator it = biomes.find(area.biomemap[bmapidx]);
 			if (it == biomes.end())
 				continue;
 		}
 
 		bool noise_generated = false;
-		noise->seed = blockseed + i;
+		noise.seed = area.seed + i;
 
 		size_t index = 0;
 		for (u32 z1 = 0; z1 != csize; z1++)
@@ -360,10 +448,10 @@ void OreBlob::generate(MMVManip *vm, int mapseed, u32 blockseed,
 			// This simple optimization makes calls 6x faster on average
 			if (!noise_generated) {
 				noise_generated = true;
-				noise->perlinMap3D(x0, y0, z0);
+				noise.perlinMap3D(x0, y0, z0);
 			}
 
-			float noiseval = noise->result[index];
+			float noiseval = noise.result[index];
 
 			float xdist = (s32)x1 - (s32)csize / 2;
 			float ydist = (s32)y1 - (s32)csize / 2;
@@ -382,34 +470,19 @@ void OreBlob::generate(MMVManip *vm, int mapseed, u32 blockseed,
 
 ///////////////////////////////////////////////////////////////////////////////
 
-OreVein::OreVein() :
-	Ore()
-{
-	noise2 = NULL;
-}
-
-
-OreVein::~OreVein()
-{
-	delete noise2;
-}
-
-
 void OreVein::generate(MMVManip *vm, int mapseed, u32 blockseed,
-	v3s16 nmin, v3s16 nmax, u8 *biomemap)
+	const OreArea &area)
 {
-	PcgRandom pr(blockseed + 520);
+	PcgRandom pr(area.seed + 520);
 	MapNode n_ore(c_ore, 0, ore_param2);
 
-	u32 sizex = (nmax.X - nmin.X + 1);
-
-	if (!noise) {
-		int sx = nmax.X - nmin.X + 1;
-		int sy = nmax.Y - nmin.Y + 1;
-		int sz = nmax.Z - nmin.Z + 1;
-		noise  = new Noise(&np, mapseed, sx, sy, sz);
-		noise2 = new Noise(&np, mapseed + 436, sx, sy, sz);
-	}
+	const v3s16 &nmin = area.nmin;
+	const v3s16 &nmax = area.nmax;
+	int sx = nmax.X - nmin.X + 1;
+	int sy = nmax.Y - nmin.Y + 1;
+	int sz = nmax.Z - nmin.Z + 1;
+	Noise noise(&np, mapseed, sx, sy, sz);
+	Noise noise2(&np, mapseed + 436, sx, sy, sz);
 	bool noise_generated = false;
 
 	size_t index = 0;
@@ -422,9 +495,9 @@ void OreVein::generate(MMVManip *vm, int mapseed, u32 blockseed,
 		if (!CONTAINS(c_wherein, vm->m_data[i].getContent()))
 			continue;
 
-		if (biomemap && !biomes.empty()) {
-			u32 bmapidx = sizex * (z - nmin.Z) + (x - nmin.X);
-			UNORDERED_SET<u8>::iterator it = biomes.find(biomemap[bmapidx]);
+		if (area.biomemap && !biomes.empty()) {
+			u32 bmapidx = area.biomeIndex(x, z);
+			UNORDERED_SET<u8>::iterator it = biomes.find(area.biomemap[bmapidx]);
 			if (it == biomes.end())
 				continue;
 		}
@@ -432,14 +505,14 @@ void OreVein::generate(MMVManip *vm, int mapseed, u32 blockseed,
 		// Same lazy generation optimization as in OreBlob
 		if (!noise_generated) {
 			noise_generated = true;
-			noise->perlinMap3D(nmin.X, nmin.Y, nmin.Z);
-			noise2->perlinMap3D(nmin.X, nmin.Y, nmin.Z);
+			noise.perlinMap3D(nmin.X, nmin.Y, nmin.Z);
+			noise2.perlinMap3D(nmin.X, nmin.Y, nmin.Z);
 		}
 
 		// randval ranges from -1..1
 		float randval   = (float)pr.next() / (pr.RANDOM_RANGE / 2) - 1.f;
-		float noiseval  = contour(noise->result[index]);
-		float noiseval2 = contour(noise2->result[index]);
+		float noiseval  = contour(noise.result[index]);
+		float noiseval2 = contour(noise2.result[index]);
 		if (noiseval * noiseval2 + randval * random_factor < nthresh)
 			continue;
 
@@ -25,6 +25,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "objdef.h"
 #include "noise.h"
 #include "nodedef.h"
+#include "mapgen.h"
 
 class Noise;
 class Mapgen;
@@ -50,6 +51,27 @@ enum OreType {
 
 extern FlagDesc flagdesc_ore[];
 
+/*
+	The part of a mapchunk an ore is generated in. Mapchunks are split into
+	columns of MAPGEN_TILE_SIZE nodes that are generated in parallel, each
+	with its own random seed; chunk_min/chunk_max describe the whole
+	mapchunk, which biomemap covers.
+*/
+struct OreArea {
+	v3s16 nmin;
+	v3s16 nmax;
+	v3s16 chunk_min;
+	v3s16 chunk_max;
+	u32 seed;
+	u8 *biomemap;
+
+	inline u32 biomeIndex(s16 x, s16 z) const
+	{
+		return (chunk_max.X - chunk_min.X + 1) * (z - chunk_min.Z) +
+			(x - chunk_min.X);
+	}
+};
+
 class Ore : public ObjDef, public NodeResolver {
 public:
 	static const bool NEEDS_NOISE = false;
@@ -65,7 +87,6 @@ class Ore : public ObjDef, public NodeResolver {
 	u32 flags;          // attributes for this ore
 	float nthresh;      // threshold for noise at which an ore is placed
 	NoiseParams np;     // noise for distribution of clusters (NULL for uniform scattering)
-	Noise *noise;
 	UNORDERED_SET<u8> biomes;
 
 	Ore();
@@ -73,17 +94,29 @@ class Ore : public ObjDef, public NodeResolver {
 
 	virtual void resolveNodeNames();
 
-	size_t placeOre(Mapgen *mg, u32 blockseed, v3s16 nmin, v3s16 nmax);
+	// Clamps the y range of nmin/nmax to the ore's, false if nothing is left
+	bool getPlaceRange(v3s16 *nmin, v3s16 *nmax);
+
+	// Whether the ore can be generated in areas of MAPGEN_TILE_SIZE columns
+	virtual bool isTileable() const { return true; }
+
+	/*
+		Generates the ore in area.nmin - area.nmax, only ever changing nodes
+		in the x/z columns of that area. blockseed is the same for all areas
+		of a mapchunk.
+	*/
 	virtual void generate(MMVManip *vm, int mapseed, u32 blockseed,
-		v3s16 nmin, v3s16 nmax, u8 *biomemap) = 0;
+		const OreArea &area) = 0;
 };
 
 class OreScatter : public Ore {
 public:
 	static const bool NEEDS_NOISE = false;
 
+	virtual bool isTileable() const { return clust_size <= MAPGEN_TILE_SIZE; }
+
 	virtual void generate(MMVManip *vm, int mapseed, u32 blockseed,
-		v3s16 nmin, v3s16 nmax, u8 *biomemap);
+		const OreArea &area);
 };
 
 class OreSheet : public Ore {
@@ -95,7 +128,7 @@ class OreSheet : public Ore {
 	float column_midpoint_factor;
 
 	virtual void generate(MMVManip *vm, int mapseed, u32 blockseed,
-		v3s16 nmin, v3s16 nmax, u8 *biomemap);
+		const OreArea &area);
 };
 
 class OrePuff : public Ore {
@@ -104,22 +137,19 @@ class OrePuff : public Ore {
 
 	NoiseParams np_puff_top;
 	NoiseParams np_puff_bottom;
-	Noise *noise_puff_top;
-	Noise *noise_puff_bottom;
-
-	OrePuff();
-	virtual ~OrePuff();
 
 	virtual void generate(MMVManip *vm, int mapseed, u32 blockseed,
-		v3s16 nmin, v3s16 nmax, u8 *biomemap);
+		const OreArea &area);
 };
 
 class OreBlob : public Ore {
 public:
 	static const bool NEEDS_NOISE = true;
 
+	virtual bool isTileable() const { return clust_size <= MAPGEN_TILE_SIZE; }
+
 	virtual void generate(MMVManip *vm, int mapseed, u32 blockseed,
-		v3s16 nmin, v3s16 nmax, u8 *biomemap);
+		const OreArea &area);
 };
 
 class OreVein : public Ore {
@@ -127,13 +157,9 @@ class OreVein : public Ore {
 	static const bool NEEDS_NOISE = true;
 
 	float random_factor;
-	Noise *noise2;
-
-	OreVein();
-	virtual ~OreVein();
 
 	virtual void generate(MMVManip *vm, int mapseed, u32 blockseed,
-		v3s16 nmin, v3s16 nmax, u8 *biomemap);
+		const OreArea &area);
 };
 
 class OreManager : public ObjDefManager {
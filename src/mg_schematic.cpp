@@ -19,6 +19,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 */
 
 #include <fstream>
+#include <cstring>
 #include <typeinfo>
 #include "mg_schematic.h"
 #include "server.h"
@@ -73,6 +74,8 @@ Schematic::Schematic()
 	slice_probs = NULL;
 	flags       = 0;
 	size        = v3s16(0, 0, 0);
+
+	m_rotations_valid = false;
 }
 
 
@@ -93,12 +96,33 @@ void Schematic::resolveNodeNames()
 		content_t c_new = c_nodes[c_original];
 		schemdata[i].setContent(c_new);
 	}
+
+	updateRotations();
 }
 
 
-void Schematic::blitToVManip(MMVManip *vm, v3s16 p, Rotation rot, bool force_place)
+void Schematic::updateRotations()
 {
-	sanity_check(m_ndef != NULL);
+	// param2 can't be rotated without the node definitions, the rotations
+	// are built once the node names are resolved
+	m_rotations_valid = false;
+	if (!m_ndef)
+		return;
+
+	for (int rot = ROTATE_0; rot <= ROTATE_270; rot++)
+		buildRotation((Rotation)rot);
+
+	m_rotations_valid = true;
+}
+
+
+void Schematic::buildRotation(Rotation rot)
+{
+	SchematicRotation &sr = m_rotations[rot];
+	sr.nodes.clear();
+	sr.probs.clear();
+	sr.row_start.clear();
+	sr.spans.clear();
 
 	int xstride = 1;
 	int ystride = size.X;
@@ -133,46 +157,117 @@ void Schematic::blitToVManip(MMVManip *vm, v3s16 p, Rotation rot, bool force_pla
 			i_step_z = zstride;
 	}
 
-	s16 y_map = p.Y;
-	for (s16 y = 0; y != sy; y++) {
+	sr.size = v3s16(sx, sy, sz);
+
+	for (s16 y = 0; y != sy; y++)
+	for (s16 z = 0; z != sz; z++) {
+		sr.row_start.push_back(sr.spans.size());
+
+		u32 i = z * i_step_z + y * ystride + i_start;
+		SchematicSpan *span = NULL;
+		for (s16 x = 0; x != sx; x++, i += i_step_x) {
+			u8 param1 = schemdata[i].param1;
+			if (schemdata[i].getContent() == CONTENT_IGNORE ||
+					(param1 & MTSCHEM_PROB_MASK) == MTSCHEM_PROB_NEVER) {
+				span = NULL;
+				continue;
+			}
+
+			if (!span) {
+				SchematicSpan s;
+				s.x     = x;
+				s.count = 0;
+				s.index = sr.nodes.size();
+				s.plain = true;
+				sr.spans.push_back(s);
+				span = &sr.spans.back();
+			}
+
+			MapNode n = schemdata[i];
+			n.param1 = 0;
+			if (rot)
+				n.rotateAlongYAxis(m_ndef, rot);
+
+			sr.nodes.push_back(n);
+			sr.probs.push_back(param1);
+			span->count++;
+			if (param1 != MTSCHEM_PROB_ALWAYS)
+				span->plain = false;
+		}
+	}
+	sr.row_start.push_back(sr.spans.size());
+}
+
+
+void Schematic::blitToVManip(MMVManip *vm, v3s16 p, Rotation rot, bool force_place,
+	PcgRandom *pr)
+{
+	sanity_check(m_ndef != NULL);
+
+	// Only reads the schematic, so mapgens can place it concurrently
+	sanity_check(m_rotations_valid);
+
+	const SchematicRotation &sr = m_rotations[(rot <= ROTATE_270) ? rot : ROTATE_0];
+	const VoxelArea &area = vm->m_area;
+
+	// Part of the rows within the voxel manipulator
+	s16 x_min = MYMAX(area.MinEdge.X - p.X, 0);
+	s16 x_max = MYMIN(area.MaxEdge.X - p.X, sr.size.X - 1);
+
+	// Skipped slices take no room, the ones above move down
+	s16 y_map = p.Y - 1;
+	for (s16 y = 0; y != sr.size.Y; y++) {
 		if ((slice_probs[y] != MTSCHEM_PROB_ALWAYS) &&
-			(slice_probs[y] <= myrand_range(1, MTSCHEM_PROB_ALWAYS)))
+			(slice_probs[y] <= (pr ? pr->range(1, MTSCHEM_PROB_ALWAYS) :
+				myrand_range(1, MTSCHEM_PROB_ALWAYS))))
 			continue;
 
-		for (s16 z = 0; z != sz; z++) {
-			u32 i = z * i_step_z + y * ystride + i_start;
-			for (s16 x = 0; x != sx; x++, i += i_step_x) {
-				u32 vi = vm->m_area.index(p.X + x, y_map, p.Z + z);
-				if (!vm->m_area.contains(vi))
-					continue;
+		y_map++;
+		if (y_map < area.MinEdge.Y || y_map > area.MaxEdge.Y)
+			continue;
 
-				if (schemdata[i].getContent() == CONTENT_IGNORE)
+		for (s16 z = 0; z != sr.size.Z; z++) {
+			s16 z_map = p.Z + z;
+			if (z_map < area.MinEdge.Z || z_map > area.MaxEdge.Z)
+				continue;
+
+			u32 row = y * sr.size.Z + z;
+			for (u32 s = sr.row_start[row]; s != sr.row_start[row + 1]; s++) {
+				const SchematicSpan &span = sr.spans[s];
+				s16 x0 = MYMAX((s16)span.x, x_min);
+				s16 x1 = MYMIN((s16)(span.x + span.count - 1), x_max);
+				if (x0 > x1)
 					continue;
 
-				u8 placement_prob     = schemdata[i].param1 & MTSCHEM_PROB_MASK;
-				bool force_place_node = schemdata[i].param1 & MTSCHEM_FORCE_PLACE;
+				u32 vi = area.index(p.X + x0, y_map, z_map);
+				u32 k = span.index + (x0 - span.x);
 
-				if (placement_prob == MTSCHEM_PROB_NEVER)
+				// Most spans of most schematics are just copied
+				if (span.plain && force_place) {
+					memcpy(&vm->m_data[vi], &sr.nodes[k],
+						(x1 - x0 + 1) * sizeof(MapNode));
 					continue;
-
-				if (!force_place && !force_place_node) {
-					content_t c = vm->m_data[vi].getContent();
-					if (c != CONTENT_AIR && c != CONTENT_IGNORE)
-						continue;
 				}
 
-				if ((placement_prob != MTSCHEM_PROB_ALWAYS) &&
-					(placement_prob <= myrand_range(1, MTSCHEM_PROB_ALWAYS)))
-					continue;
+				for (s16 x = x0; x <= x1; x++, vi++, k++) {
+					u8 param1 = sr.probs[k];
 
-				vm->m_data[vi] = schemdata[i];
-				vm->m_data[vi].param1 = 0;
+					if (!force_place && !(param1 & MTSCHEM_FORCE_PLACE)) {
+						content_t c = vm->m_data[vi].getContent();
+						if (c != CONTENT_AIR && c != CONTENT_IGNORE)
+							continue;
+					}
+
+					u8 placement_prob = param1 & MTSCHEM_PROB_MASK;
+					if ((placement_prob != MTSCHEM_PROB_ALWAYS) &&
+						(placement_prob <= (pr ? pr->range(1, MTSCHEM_PROB_ALWAYS) :
+							myrand_range(1, MTSCHEM_PROB_ALWAYS))))
+						continue;
 
-				if (rot)
-					vm->m_data[vi].rotateAlongYAxis(m_ndef, rot);
+					vm->m_data[vi] = sr.nodes[k];
+				}
 			}
 		}
-		y_map++;
 	}
 }
 
@@ -329,6 +424,8 @@ bool Schematic::deserializeFromMts(std::istream *is,
 			schemdata[i].param1 >>= 1;
 	}
 
+	updateRotations();
+
 	return true;
 }
 
@@ -530,6 +627,8 @@ bool Schematic::getSchematicFromMap(Map *map, v3s16 p1, v3s16 p2)
 	}
 
 	delete vm;
+
+	updateRotations();
 	return true;
 }
 
@@ -555,6 +654,8 @@ void Schematic::applyProbabilities(v3s16 p0,
 		s16 y = (*splist)[i].first - p0.Y;
 		slice_probs[y] = (*splist)[i].second;
 	}
+
+	updateRotations();
 }
 
 
@@ -91,6 +91,28 @@ enum SchematicFormatType {
 	SCHEM_FMT_LUA,
 };
 
+// A run of nodes of a schematic row that may be placed
+struct SchematicSpan {
+	u16 x;        // of the first node, within the row
+	u16 count;
+	u32 index;    // of the first node in SchematicRotation::nodes
+	bool plain;   // all nodes are always placed and none is force placed
+};
+
+/*
+	A schematic turned by one of the four rotations, ready to be placed: the
+	nodes have param1 cleared and their param2 rotated. Nodes that are never
+	placed (ignore or probability 0) are left out, each row of the schematic
+	being a list of spans of the remaining ones.
+*/
+struct SchematicRotation {
+	v3s16 size;
+	std::vector<MapNode> nodes;
+	std::vector<u8> probs;           // param1 of the nodes
+	std::vector<u32> row_start;      // first span of row (y * size.Z + z)
+	std::vector<SchematicSpan> spans;
+};
+
 class Schematic : public ObjDef, public NodeResolver {
 public:
 	Schematic();
@@ -108,7 +130,9 @@ class Schematic : public ObjDef, public NodeResolver {
 	bool serializeToLua(std::ostream *os, const std::vector<std::string> &names,
 		bool use_comments, u32 indent_spaces);
 
-	void blitToVManip(MMVManip *vm, v3s16 p, Rotation rot, bool force_place);
+	// Uses pr for the node probabilities if given, myrand otherwise
+	void blitToVManip(MMVManip *vm, v3s16 p, Rotation rot, bool force_place,
+		PcgRandom *pr = NULL);
 	bool placeOnVManip(MMVManip *vm, v3s16 p, u32 flags, Rotation rot, bool force_place);
 	void placeOnMap(ServerMap *map, v3s16 p, u32 flags, Rotation rot, bool force_place);
 
@@ -116,11 +140,22 @@ class Schematic : public ObjDef, public NodeResolver {
 		std::vector<std::pair<v3s16, u8> > *plist,
 		std::vector<std::pair<s16, u8> > *splist);
 
+	// Prepares the rotations used by blitToVManip(). Called whenever the
+	// schematic changes schemdata, and must be called by anyone else
+	// changing it, before placing the schematic again.
+	void updateRotations();
+
 	std::vector<content_t> c_nodes;
 	u32 flags;
 	v3s16 size;
 	MapNode *schemdata;
 	u8 *slice_probs;
+
+private:
+	void buildRotation(Rotation rot);
+
+	SchematicRotation m_rotations[4];
+	bool m_rotations_valid;
 };
 
 class SchematicManager : public ObjDefManager {
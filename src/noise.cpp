@@ -31,21 +31,32 @@
 #include "util/numeric.h"
 #include "util/string.h"
 #include "exceptions.h"
+#include "profiler.h"
+#include "threading/mutex_auto_lock.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+		(defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#define NOISE_HAVE_SSE2 1
+	#include <emmintrin.h>
+#else
+	#define NOISE_HAVE_SSE2 0
+#endif
+
+// AVX2 kernels are compiled for a specific target and selected at runtime,
+// this needs GCC/Clang function attributes and builtins
+#if NOISE_HAVE_SSE2 && (defined(__x86_64__) || defined(__i386__)) && \
+		(defined(__clang__) || (defined(__GNUC__) && __GNUC__ >= 5))
+	#define NOISE_HAVE_AVX2 1
+	#include <immintrin.h>
+#else
+	#define NOISE_HAVE_AVX2 0
+#endif
 
 #define NOISE_MAGIC_X    1619
 #define NOISE_MAGIC_Y    31337
 #define NOISE_MAGIC_Z    52591
 #define NOISE_MAGIC_SEED 1013
 
-typedef float (*Interp2dFxn)(
-		float v00, float v10, float v01, float v11,
-		float x, float y);
-
-typedef float (*Interp3dFxn)(
-		float v000, float v100, float v010, float v110,
-		float v001, float v101, float v011, float v111,
-		float x, float y, float z);
-
 float cos_lookup[16] = {
 	1.0,  0.9238,  0.7071,  0.3826, 0, -0.3826, -0.7071, -0.9238,
 	1.0, -0.9238, -0.7071, -0.3826, 0,  0.3826,  0.7071,  0.9238
@@ -246,6 +257,499 @@ float triLinearInterpolationNoEase(
 	return linearInterpolation(u, v, z);
 }
 
+///////////////////////////////////////////////////////////////////////////////
+
+/*
+	Bulk kernels for the Noise class.
+
+	The SIMD variants must produce results bit-identical to the scalar ones,
+	so that a world generates the same on every CPU: operations are done in
+	the same order and never fused (no FMA).
+*/
+
+struct NoiseKernels {
+	// out[i] = noise3d(x0 + i, y, z, seed), with base derived from y, z, seed
+	void (*lattice_row)(float *out, u32 count, s32 x0, u32 base);
+
+	void (*interp_row_2d)(float *out, u32 count,
+		const u32 *lx, const float *tx,
+		const float *r0, const float *r1, float ty);
+
+	void (*interp_row_3d)(float *out, u32 count,
+		const u32 *lx, const float *tx,
+		const float *r00, const float *r10,
+		const float *r01, const float *r11, float ty, float tz);
+
+	void (*accumulate)(float *result, const float *gradient,
+		float g, size_t count, bool absvalue);
+
+	void (*accumulate_persist)(float *result, float *gmap,
+		const float *gradient, const float *persistence_map,
+		size_t count, bool absvalue);
+
+	void (*scale_offset)(float *result, size_t count,
+		float scale, float offset);
+};
+
+
+inline u32 lattice_base(s32 y, s32 z, s32 seed)
+{
+	return NOISE_MAGIC_Y * (u32)y + NOISE_MAGIC_Z * (u32)z +
+		NOISE_MAGIC_SEED * (u32)seed;
+}
+
+
+inline float lattice_hash(u32 n)
+{
+	n &= 0x7fffffff;
+	n = (n >> 13) ^ n;
+	n = (n * (n * n * 60493 + 19990303) + 1376312589) & 0x7fffffff;
+	return 1.f - (float)(int)n / 0x40000000;
+}
+
+
+static void lattice_row_scalar(float *out, u32 count, s32 x0, u32 base)
+{
+	for (u32 i = 0; i != count; i++)
+		out[i] = lattice_hash(NOISE_MAGIC_X * (u32)(x0 + i) + base);
+}
+
+
+static void interp_row_2d_scalar(float *out, u32 count,
+	const u32 *lx, const float *tx,
+	const float *r0, const float *r1, float ty)
+{
+	for (u32 i = 0; i != count; i++) {
+		u32 x = lx[i];
+		float u = linearInterpolation(r0[x], r0[x + 1], tx[i]);
+		float v = linearInterpolation(r1[x], r1[x + 1], tx[i]);
+		out[i] = linearInterpolation(u, v, ty);
+	}
+}
+
+
+static void interp_row_3d_scalar(float *out, u32 count,
+	const u32 *lx, const float *tx,
+	const float *r00, const float *r10,
+	const float *r01, const float *r11, float ty, float tz)
+{
+	for (u32 i = 0; i != count; i++) {
+		u32 x = lx[i];
+		float u = biLinearInterpolationNoEase(
+			r00[x], r00[x + 1], r10[x], r10[x + 1], tx[i], ty);
+		float v = biLinearInterpolationNoEase(
+			r01[x], r01[x + 1], r11[x], r11[x + 1], tx[i], ty);
+		out[i] = linearInterpolation(u, v, tz);
+	}
+}
+
+
+static void accumulate_scalar(float *result, const float *gradient,
+	float g, size_t count, bool absvalue)
+{
+	// This looks very ugly, but it is 50-70% faster than having
+	// conditional statements inside the loop
+	if (absvalue) {
+		for (size_t i = 0; i != count; i++)
+			result[i] += g * fabs(gradient[i]);
+	} else {
+		for (size_t i = 0; i != count; i++)
+			result[i] += g * gradient[i];
+	}
+}
+
+
+static void accumulate_persist_scalar(float *result, float *gmap,
+	const float *gradient, const float *persistence_map,
+	size_t count, bool absvalue)
+{
+	if (absvalue) {
+		for (size_t i = 0; i != count; i++) {
+			result[i] += gmap[i] * fabs(gradient[i]);
+			gmap[i] *= persistence_map[i];
+		}
+	} else {
+		for (size_t i = 0; i != count; i++) {
+			result[i] += gmap[i] * gradient[i];
+			gmap[i] *= persistence_map[i];
+		}
+	}
+}
+
+
+static void scale_offset_scalar(float *result, size_t count,
+	float scale, float offset)
+{
+	for (size_t i = 0; i != count; i++)
+		result[i] = result[i] * scale + offset;
+}
+
+
+static const NoiseKernels noise_kernels_scalar = {
+	lattice_row_scalar,
+	interp_row_2d_scalar,
+	interp_row_3d_scalar,
+	accumulate_scalar,
+	accumulate_persist_scalar,
+	scale_offset_scalar,
+};
+
+
+#if NOISE_HAVE_SSE2
+
+// SSE2 lacks a 32 bit multiplication keeping the low halves
+inline __m128i mullo_epi32_sse2(__m128i a, __m128i b)
+{
+	__m128i even = _mm_mul_epu32(a, b);
+	__m128i odd  = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+	return _mm_unpacklo_epi32(
+		_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+		_mm_shuffle_epi32(odd,  _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+
+inline __m128 lerp_sse2(__m128 v0, __m128 v1, __m128 t)
+{
+	return _mm_add_ps(v0, _mm_mul_ps(_mm_sub_ps(v1, v0), t));
+}
+
+
+static void lattice_row_sse2(float *out, u32 count, s32 x0, u32 base)
+{
+	const __m128i mask     = _mm_set1_epi32(0x7fffffff);
+	const __m128i magic_x  = _mm_set1_epi32(NOISE_MAGIC_X);
+	const __m128i vbase    = _mm_set1_epi32(base);
+	const __m128i c1       = _mm_set1_epi32(60493);
+	const __m128i c2       = _mm_set1_epi32(19990303);
+	const __m128i c3       = _mm_set1_epi32(1376312589);
+	const __m128i four     = _mm_set1_epi32(4);
+	const __m128 one       = _mm_set1_ps(1.f);
+	const __m128 inv_range = _mm_set1_ps(1.f / 0x40000000);
+
+	__m128i x = _mm_add_epi32(_mm_set1_epi32(x0), _mm_setr_epi32(0, 1, 2, 3));
+
+	u32 i = 0;
+	for (; i + 4 <= count; i += 4) {
+		__m128i n = _mm_add_epi32(mullo_epi32_sse2(x, magic_x), vbase);
+		n = _mm_and_si128(n, mask);
+		n = _mm_xor_si128(_mm_srli_epi32(n, 13), n);
+
+		__m128i t = mullo_epi32_sse2(mullo_epi32_sse2(n, n), c1);
+		t = mullo_epi32_sse2(n, _mm_add_epi32(t, c2));
+		n = _mm_and_si128(_mm_add_epi32(t, c3), mask);
+
+		// Scaling by a power of two is exact, just like the division
+		__m128 f = _mm_mul_ps(_mm_cvtepi32_ps(n), inv_range);
+		_mm_storeu_ps(out + i, _mm_sub_ps(one, f));
+
+		x = _mm_add_epi32(x, four);
+	}
+
+	for (; i != count; i++)
+		out[i] = lattice_hash(NOISE_MAGIC_X * (u32)(x0 + i) + base);
+}
+
+
+static void interp_row_2d_sse2(float *out, u32 count,
+	const u32 *lx, const float *tx,
+	const float *r0, const float *r1, float ty)
+{
+	const __m128 vty = _mm_set1_ps(ty);
+
+	u32 i = 0;
+	for (; i + 4 <= count; i += 4) {
+		const u32 *l = lx + i;
+		__m128 v00 = _mm_setr_ps(r0[l[0]], r0[l[1]], r0[l[2]], r0[l[3]]);
+		__m128 v10 = _mm_setr_ps(r0[l[0] + 1], r0[l[1] + 1],
+			r0[l[2] + 1], r0[l[3] + 1]);
+		__m128 v01 = _mm_setr_ps(r1[l[0]], r1[l[1]], r1[l[2]], r1[l[3]]);
+		__m128 v11 = _mm_setr_ps(r1[l[0] + 1], r1[l[1] + 1],
+			r1[l[2] + 1], r1[l[3] + 1]);
+
+		__m128 t = _mm_loadu_ps(tx + i);
+		__m128 u = lerp_sse2(v00, v10, t);
+		__m128 v = lerp_sse2(v01, v11, t);
+		_mm_storeu_ps(out + i, lerp_sse2(u, v, vty));
+	}
+
+	interp_row_2d_scalar(out + i, count - i, lx + i, tx + i, r0, r1, ty);
+}
+
+
+static void interp_row_3d_sse2(float *out, u32 count,
+	const u32 *lx, const float *tx,
+	const float *r00, const float *r10,
+	const float *r01, const float *r11, float ty, float tz)
+{
+	const __m128 vty = _mm_set1_ps(ty);
+	const __m128 vtz = _mm_set1_ps(tz);
+
+#define GATHER(r, o) _mm_setr_ps(r[l[0] + (o)], r[l[1] + (o)], \
+	r[l[2] + (o)], r[l[3] + (o)])
+
+	u32 i = 0;
+	for (; i + 4 <= count; i += 4) {
+		const u32 *l = lx + i;
+		__m128 t = _mm_loadu_ps(tx + i);
+
+		__m128 u = lerp_sse2(
+			lerp_sse2(GATHER(r00, 0), GATHER(r00, 1), t),
+			lerp_sse2(GATHER(r10, 0), GATHER(r10, 1), t), vty);
+		__m128 v = lerp_sse2(
+			lerp_sse2(GATHER(r01, 0), GATHER(r01, 1), t),
+			lerp_sse2(GATHER(r11, 0), GATHER(r11, 1), t), vty);
+		_mm_storeu_ps(out + i, lerp_sse2(u, v, vtz));
+	}
+
+#undef GATHER
+
+	interp_row_3d_scalar(out + i, count - i, lx + i, tx + i,
+		r00, r10, r01, r11, ty, tz);
+}
+
+
+static void accumulate_sse2(float *result, const float *gradient,
+	float g, size_t count, bool absvalue)
+{
+	const __m128 vg = _mm_set1_ps(g);
+	const __m128 absmask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+	const __m128 mask = absvalue ? absmask : _mm_castsi128_ps(_mm_set1_epi32(-1));
+
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4) {
+		__m128 grad = _mm_and_ps(_mm_loadu_ps(gradient + i), mask);
+		__m128 r = _mm_add_ps(_mm_loadu_ps(result + i), _mm_mul_ps(vg, grad));
+		_mm_storeu_ps(result + i, r);
+	}
+
+	accumulate_scalar(result + i, gradient + i, g, count - i, absvalue);
+}
+
+
+static void accumulate_persist_sse2(float *result, float *gmap,
+	const float *gradient, const float *persistence_map,
+	size_t count, bool absvalue)
+{
+	const __m128 absmask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+	const __m128 mask = absvalue ? absmask : _mm_castsi128_ps(_mm_set1_epi32(-1));
+
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4) {
+		__m128 g = _mm_loadu_ps(gmap + i);
+		__m128 grad = _mm_and_ps(_mm_loadu_ps(gradient + i), mask);
+		__m128 r = _mm_add_ps(_mm_loadu_ps(result + i), _mm_mul_ps(g, grad));
+		_mm_storeu_ps(result + i, r);
+		_mm_storeu_ps(gmap + i,
+			_mm_mul_ps(g, _mm_loadu_ps(persistence_map + i)));
+	}
+
+	accumulate_persist_scalar(result + i, gmap + i, gradient + i,
+		persistence_map + i, count - i, absvalue);
+}
+
+
+static void scale_offset_sse2(float *result, size_t count,
+	float scale, float offset)
+{
+	const __m128 vscale  = _mm_set1_ps(scale);
+	const __m128 voffset = _mm_set1_ps(offset);
+
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4) {
+		__m128 r = _mm_mul_ps(_mm_loadu_ps(result + i), vscale);
+		_mm_storeu_ps(result + i, _mm_add_ps(r, voffset));
+	}
+
+	scale_offset_scalar(result + i, count - i, scale, offset);
+}
+
+
+static const NoiseKernels noise_kernels_sse2 = {
+	lattice_row_sse2,
+	interp_row_2d_sse2,
+	interp_row_3d_sse2,
+	accumulate_sse2,
+	accumulate_persist_sse2,
+	scale_offset_sse2,
+};
+
+#endif // NOISE_HAVE_SSE2
+
+
+#if NOISE_HAVE_AVX2
+
+#define NOISE_TARGET_AVX2 __attribute__((target("avx2")))
+
+// The tails are handed to the SSE2 kernels, avoid the AVX-SSE transition
+// penalty by clearing the upper register halves before calling them
+
+NOISE_TARGET_AVX2
+static void lattice_row_avx2(float *out, u32 count, s32 x0, u32 base)
+{
+	const __m256i mask     = _mm256_set1_epi32(0x7fffffff);
+	const __m256i magic_x  = _mm256_set1_epi32(NOISE_MAGIC_X);
+	const __m256i vbase    = _mm256_set1_epi32(base);
+	const __m256i c1       = _mm256_set1_epi32(60493);
+	const __m256i c2       = _mm256_set1_epi32(19990303);
+	const __m256i c3       = _mm256_set1_epi32(1376312589);
+	const __m256i eight    = _mm256_set1_epi32(8);
+	const __m256 one       = _mm256_set1_ps(1.f);
+	const __m256 inv_range = _mm256_set1_ps(1.f / 0x40000000);
+
+	__m256i x = _mm256_add_epi32(_mm256_set1_epi32(x0),
+		_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+
+	u32 i = 0;
+	for (; i + 8 <= count; i += 8) {
+		__m256i n = _mm256_add_epi32(_mm256_mullo_epi32(x, magic_x), vbase);
+		n = _mm256_and_si256(n, mask);
+		n = _mm256_xor_si256(_mm256_srli_epi32(n, 13), n);
+
+		__m256i t = _mm256_mullo_epi32(_mm256_mullo_epi32(n, n), c1);
+		t = _mm256_mullo_epi32(n, _mm256_add_epi32(t, c2));
+		n = _mm256_and_si256(_mm256_add_epi32(t, c3), mask);
+
+		__m256 f = _mm256_mul_ps(_mm256_cvtepi32_ps(n), inv_range);
+		_mm256_storeu_ps(out + i, _mm256_sub_ps(one, f));
+
+		x = _mm256_add_epi32(x, eight);
+	}
+
+	_mm256_zeroupper();
+	lattice_row_sse2(out + i, count - i, x0 + i, base);
+}
+
+
+NOISE_TARGET_AVX2
+static void accumulate_avx2(float *result, const float *gradient,
+	float g, size_t count, bool absvalue)
+{
+	const __m256 vg = _mm256_set1_ps(g);
+	const __m256 mask = _mm256_castsi256_ps(
+		_mm256_set1_epi32(absvalue ? 0x7fffffff : -1));
+
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8) {
+		__m256 grad = _mm256_and_ps(_mm256_loadu_ps(gradient + i), mask);
+		__m256 r = _mm256_add_ps(_mm256_loadu_ps(result + i),
+			_mm256_mul_ps(vg, grad));
+		_mm256_storeu_ps(result + i, r);
+	}
+
+	_mm256_zeroupper();
+	accumulate_sse2(result + i, gradient + i, g, count - i, absvalue);
+}
+
+
+NOISE_TARGET_AVX2
+static void accumulate_persist_avx2(float *result, float *gmap,
+	const float *gradient, const float *persistence_map,
+	size_t count, bool absvalue)
+{
+	const __m256 mask = _mm256_castsi256_ps(
+		_mm256_set1_epi32(absvalue ? 0x7fffffff : -1));
+
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8) {
+		__m256 g = _mm256_loadu_ps(gmap + i);
+		__m256 grad = _mm256_and_ps(_mm256_loadu_ps(gradient + i), mask);
+		__m256 r = _mm256_add_ps(_mm256_loadu_ps(result + i),
+			_mm256_mul_ps(g, grad));
+		_mm256_storeu_ps(result + i, r);
+		_mm256_storeu_ps(gmap + i,
+			_mm256_mul_ps(g, _mm256_loadu_ps(persistence_map + i)));
+	}
+
+	_mm256_zeroupper();
+	accumulate_persist_sse2(result + i, gmap + i, gradient + i,
+		persistence_map + i, count - i, absvalue);
+}
+
+
+NOISE_TARGET_AVX2
+static void scale_offset_avx2(float *result, size_t count,
+	float scale, float offset)
+{
+	const __m256 vscale  = _mm256_set1_ps(scale);
+	const __m256 voffset = _mm256_set1_ps(offset);
+
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8) {
+		__m256 r = _mm256_mul_ps(_mm256_loadu_ps(result + i), vscale);
+		_mm256_storeu_ps(result + i, _mm256_add_ps(r, voffset));
+	}
+
+	_mm256_zeroupper();
+	scale_offset_sse2(result + i, count - i, scale, offset);
+}
+
+
+// Interpolation is bound by the scattered loads of the lattice points, wider
+// vectors do not speed it up
+static const NoiseKernels noise_kernels_avx2 = {
+	lattice_row_avx2,
+	interp_row_2d_sse2,
+	interp_row_3d_sse2,
+	accumulate_avx2,
+	accumulate_persist_avx2,
+	scale_offset_avx2,
+};
+
+#undef NOISE_TARGET_AVX2
+
+#endif // NOISE_HAVE_AVX2
+
+
+NoiseSimdLevel noise_get_simd_support()
+{
+#if NOISE_HAVE_AVX2
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return NOISE_SIMD_AVX2;
+#endif
+#if NOISE_HAVE_SSE2
+	return NOISE_SIMD_SSE2;
+#else
+	return NOISE_SIMD_NONE;
+#endif
+}
+
+
+static NoiseSimdLevel g_noise_simd_level = noise_get_simd_support();
+
+
+static const NoiseKernels *get_noise_kernels()
+{
+	switch (g_noise_simd_level) {
+#if NOISE_HAVE_AVX2
+	case NOISE_SIMD_AVX2:
+		return &noise_kernels_avx2;
+#endif
+#if NOISE_HAVE_SSE2
+	case NOISE_SIMD_SSE2:
+		return &noise_kernels_sse2;
+#endif
+	default:
+		return &noise_kernels_scalar;
+	}
+}
+
+
+NoiseSimdLevel noise_get_simd_level()
+{
+	return g_noise_simd_level;
+}
+
+
+NoiseSimdLevel noise_set_simd_level(NoiseSimdLevel level)
+{
+	g_noise_simd_level = MYMIN(level, noise_get_simd_support());
+	return g_noise_simd_level;
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+
 float noise2d_gradient(float x, float y, s32 seed, bool eased)
 {
 	// Calculate the integer coordinates
@@ -371,6 +875,34 @@ float contour(float v)
 }
 
 
+void contour_intersection_mask(u8 *out, const float *n1, const float *n2,
+	size_t count, float threshold)
+{
+	size_t i = 0;
+
+#if NOISE_HAVE_SSE2
+	// Same operations as contour(), 1 - v is exact in float for |v| < 1
+	const __m128 sign = _mm_set1_ps(-0.f);
+	const __m128 one  = _mm_set1_ps(1.f);
+	const __m128 thr  = _mm_set1_ps(threshold);
+	for (; i + 4 <= count; i += 4) {
+		__m128 v1 = _mm_andnot_ps(sign, _mm_loadu_ps(n1 + i));
+		__m128 v2 = _mm_andnot_ps(sign, _mm_loadu_ps(n2 + i));
+		__m128 d1 = _mm_andnot_ps(_mm_cmpge_ps(v1, one), _mm_sub_ps(one, v1));
+		__m128 d2 = _mm_andnot_ps(_mm_cmpge_ps(v2, one), _mm_sub_ps(one, v2));
+		int m = _mm_movemask_ps(_mm_cmpgt_ps(_mm_mul_ps(d1, d2), thr));
+		out[i]     = m & 1;
+		out[i + 1] = (m >> 1) & 1;
+		out[i + 2] = (m >> 2) & 1;
+		out[i + 3] = (m >> 3) & 1;
+	}
+#endif
+
+	for (; i != count; i++)
+		out[i] = contour(n1[i]) * contour(n2[i]) > threshold;
+}
+
+
 ///////////////////////// [ New noise ] ////////////////////////////
 
 
@@ -439,6 +971,9 @@ Noise::Noise(NoiseParams *np_, s32 seed, u32 sx, u32 sy, u32 sz)
 	this->gradient_buf = NULL;
 	this->result       = NULL;
 
+	this->lattice_x_buf = NULL;
+	this->weight_x_buf  = NULL;
+
 	allocBuffers();
 }
 
@@ -449,6 +984,8 @@ Noise::~Noise()
 	delete[] persist_buf;
 	delete[] noise_buf;
 	delete[] result;
+	delete[] lattice_x_buf;
+	delete[] weight_x_buf;
 }
 
 
@@ -467,12 +1004,16 @@ void Noise::allocBuffers()
 	delete[] gradient_buf;
 	delete[] persist_buf;
 	delete[] result;
+	delete[] lattice_x_buf;
+	delete[] weight_x_buf;
 
 	try {
 		size_t bufsize = sx * sy * sz;
-		this->persist_buf  = NULL;
-		this->gradient_buf = new float[bufsize];
-		this->result       = new float[bufsize];
+		this->persist_buf   = NULL;
+		this->gradient_buf  = new float[bufsize];
+		this->result        = new float[bufsize];
+		this->lattice_x_buf = new u32[sx];
+		this->weight_x_buf  = new float[sx];
 	} catch (std::bad_alloc &e) {
 		throw InvalidNoiseParamsException();
 	}
@@ -556,53 +1097,48 @@ void Noise::gradientMap2D(
 		float step_x, float step_y,
 		s32 seed)
 {
-	float v00, v01, v10, v11, u, v, orig_u;
+	float u, v, ty;
 	u32 index, i, j, noisex, noisey;
 	u32 nlx, nly;
 	s32 x0, y0;
 
+	const NoiseKernels *kernels = get_noise_kernels();
 	bool eased = np.flags & (NOISE_FLAG_DEFAULTS | NOISE_FLAG_EASED);
-	Interp2dFxn interpolate = eased ?
-		biLinearInterpolation : biLinearInterpolationNoEase;
 
 	x0 = floor(x);
 	y0 = floor(y);
 	u = x - (float)x0;
 	v = y - (float)y0;
-	orig_u = u;
 
 	//calculate noise point lattice
 	nlx = (u32)(u + sx * step_x) + 2;
 	nly = (u32)(v + sy * step_y) + 2;
-	index = 0;
 	for (j = 0; j != nly; j++)
-		for (i = 0; i != nlx; i++)
-			noise_buf[index++] = noise2d(x0 + i, y0 + j, seed);
+		kernels->lattice_row(&noise_buf[idx(0, j)], nlx, x0,
+			lattice_base(y0 + j, 0, seed));
+
+	//calculate the lattice column and weight of each x, same for all rows
+	noisex = 0;
+	for (i = 0; i != sx; i++) {
+		lattice_x_buf[i] = noisex;
+		weight_x_buf[i]  = eased ? easeCurve(u) : u;
+
+		u += step_x;
+		if (u >= 1.0) {
+			u -= 1.0;
+			noisex++;
+		}
+	}
 
 	//calculate interpolations
 	index  = 0;
 	noisey = 0;
 	for (j = 0; j != sy; j++) {
-		v00 = noise_buf[idx(0, noisey)];
-		v10 = noise_buf[idx(1, noisey)];
-		v01 = noise_buf[idx(0, noisey + 1)];
-		v11 = noise_buf[idx(1, noisey + 1)];
-
-		u = orig_u;
-		noisex = 0;
-		for (i = 0; i != sx; i++) {
-			gradient_buf[index++] = interpolate(v00, v10, v01, v11, u, v);
-
-			u += step_x;
-			if (u >= 1.0) {
-				u -= 1.0;
-				noisex++;
-				v00 = v10;
-				v01 = v11;
-				v10 = noise_buf[idx(noisex + 1, noisey)];
-				v11 = noise_buf[idx(noisex + 1, noisey + 1)];
-			}
-		}
+		ty = eased ? easeCurve(v) : v;
+		kernels->interp_row_2d(&gradient_buf[index], sx,
+			lattice_x_buf, weight_x_buf,
+			&noise_buf[idx(0, noisey)], &noise_buf[idx(0, noisey + 1)], ty);
+		index += sx;
 
 		v += step_y;
 		if (v >= 1.0) {
@@ -620,15 +1156,13 @@ void Noise::gradientMap3D(
 		float step_x, float step_y, float step_z,
 		s32 seed)
 {
-	float v000, v010, v100, v110;
-	float v001, v011, v101, v111;
-	float u, v, w, orig_u, orig_v;
+	float u, v, w, orig_v, ty, tz;
 	u32 index, i, j, k, noisex, noisey, noisez;
 	u32 nlx, nly, nlz;
 	s32 x0, y0, z0;
 
-	Interp3dFxn interpolate = (np.flags & NOISE_FLAG_EASED) ?
-		triLinearInterpolation : triLinearInterpolationNoEase;
+	const NoiseKernels *kernels = get_noise_kernels();
+	bool eased = np.flags & NOISE_FLAG_EASED;
 
 	x0 = floor(x);
 	y0 = floor(y);
@@ -636,58 +1170,47 @@ void Noise::gradientMap3D(
 	u = x - (float)x0;
 	v = y - (float)y0;
 	w = z - (float)z0;
-	orig_u = u;
 	orig_v = v;
 
 	//calculate noise point lattice
 	nlx = (u32)(u + sx * step_x) + 2;
 	nly = (u32)(v + sy * step_y) + 2;
 	nlz = (u32)(w + sz * step_z) + 2;
-	index = 0;
 	for (k = 0; k != nlz; k++)
 		for (j = 0; j != nly; j++)
-			for (i = 0; i != nlx; i++)
-				noise_buf[index++] = noise3d(x0 + i, y0 + j, z0 + k, seed);
+			kernels->lattice_row(&noise_buf[idx(0, j, k)], nlx, x0,
+				lattice_base(y0 + j, z0 + k, seed));
+
+	//calculate the lattice column and weight of each x, same for all rows
+	noisex = 0;
+	for (i = 0; i != sx; i++) {
+		lattice_x_buf[i] = noisex;
+		weight_x_buf[i]  = eased ? easeCurve(u) : u;
+
+		u += step_x;
+		if (u >= 1.0) {
+			u -= 1.0;
+			noisex++;
+		}
+	}
 
 	//calculate interpolations
 	index  = 0;
-	noisey = 0;
 	noisez = 0;
 	for (k = 0; k != sz; k++) {
+		tz = eased ? easeCurve(w) : w;
 		v = orig_v;
 		noisey = 0;
 		for (j = 0; j != sy; j++) {
-			v000 = noise_buf[idx(0, noisey,     noisez)];
-			v100 = noise_buf[idx(1, noisey,     noisez)];
-			v010 = noise_buf[idx(0, noisey + 1, noisez)];
-			v110 = noise_buf[idx(1, noisey + 1, noisez)];
-			v001 = noise_buf[idx(0, noisey,     noisez + 1)];
-			v101 = noise_buf[idx(1, noisey,     noisez + 1)];
-			v011 = noise_buf[idx(0, noisey + 1, noisez + 1)];
-			v111 = noise_buf[idx(1, noisey + 1, noisez + 1)];
-
-			u = orig_u;
-			noisex = 0;
-			for (i = 0; i != sx; i++) {
-				gradient_buf[index++] = interpolate(
-					v000, v100, v010, v110,
-					v001, v101, v011, v111,
-					u, v, w);
-
-				u += step_x;
-				if (u >= 1.0) {
-					u -= 1.0;
-					noisex++;
-					v000 = v100;
-					v010 = v110;
-					v100 = noise_buf[idx(noisex + 1, noisey,     noisez)];
-					v110 = noise_buf[idx(noisex + 1, noisey + 1, noisez)];
-					v001 = v101;
-					v011 = v111;
-					v101 = noise_buf[idx(noisex + 1, noisey,     noisez + 1)];
-					v111 = noise_buf[idx(noisex + 1, noisey + 1, noisez + 1)];
-				}
-			}
+			ty = eased ? easeCurve(v) : v;
+			kernels->interp_row_3d(&gradient_buf[index], sx,
+				lattice_x_buf, weight_x_buf,
+				&noise_buf[idx(0, noisey,     noisez)],
+				&noise_buf[idx(0, noisey + 1, noisez)],
+				&noise_buf[idx(0, noisey,     noisez + 1)],
+				&noise_buf[idx(0, noisey + 1, noisez + 1)],
+				ty, tz);
+			index += sx;
 
 			v += step_y;
 			if (v >= 1.0) {
@@ -711,6 +1234,14 @@ float *Noise::perlinMap2D(float x, float y, float *persistence_map)
 	float f = 1.0, g = 1.0;
 	size_t bufsize = sx * sy;
 
+	bool use_cache = !persistence_map && g_noise_map_cache->isEnabled();
+	NoiseMapKey key;
+	if (use_cache) {
+		key = getMapKey(x, y, 0, false);
+		if (g_noise_map_cache->get(key, result, bufsize))
+			return result;
+	}
+
 	x /= np.spread.X;
 	y /= np.spread.Y;
 
@@ -734,10 +1265,11 @@ float *Noise::perlinMap2D(float x, float y, float *persistence_map)
 		g *= np.persist;
 	}
 
-	if (fabs(np.offset - 0.f) > 0.00001 || fabs(np.scale - 1.f) > 0.00001) {
-		for (size_t i = 0; i != bufsize; i++)
-			result[i] = result[i] * np.scale + np.offset;
-	}
+	if (fabs(np.offset - 0.f) > 0.00001 || fabs(np.scale - 1.f) > 0.00001)
+		get_noise_kernels()->scale_offset(result, bufsize, np.scale, np.offset);
+
+	if (use_cache)
+		g_noise_map_cache->put(key, result, bufsize);
 
 	return result;
 }
@@ -772,39 +1304,210 @@ float *Noise::perlinMap3D(float x, float y, float z, float *persistence_map)
 		g *= np.persist;
 	}
 
-	if (fabs(np.offset - 0.f) > 0.00001 || fabs(np.scale - 1.f) > 0.00001) {
-		for (size_t i = 0; i != bufsize; i++)
-			result[i] = result[i] * np.scale + np.offset;
-	}
+	if (fabs(np.offset - 0.f) > 0.00001 || fabs(np.scale - 1.f) > 0.00001)
+		get_noise_kernels()->scale_offset(result, bufsize, np.scale, np.offset);
 
 	return result;
 }
 
 
+NoiseMapKey Noise::getMapKey(float x, float y, float z, bool is3d)
+{
+	NoiseMapKey key;
+	key.np     = np;
+	key.seed   = seed;
+	key.origin = v3f(x, y, z);
+	key.sx     = sx;
+	key.sy     = sy;
+	key.sz     = is3d ? sz : 1;
+	key.is3d   = is3d;
+	return key;
+}
+
+
 void Noise::updateResults(float g, float *gmap,
 	float *persistence_map, size_t bufsize)
 {
-	// This looks very ugly, but it is 50-70% faster than having
-	// conditional statements inside the loop
-	if (np.flags & NOISE_FLAG_ABSVALUE) {
-		if (persistence_map) {
-			for (size_t i = 0; i != bufsize; i++) {
-				result[i] += gmap[i] * fabs(gradient_buf[i]);
-				gmap[i] *= persistence_map[i];
-			}
-		} else {
-			for (size_t i = 0; i != bufsize; i++)
-				result[i] += g * fabs(gradient_buf[i]);
-		}
+	const NoiseKernels *kernels = get_noise_kernels();
+	bool absvalue = np.flags & NOISE_FLAG_ABSVALUE;
+
+	if (persistence_map) {
+		kernels->accumulate_persist(result, gmap, gradient_buf,
+			persistence_map, bufsize, absvalue);
 	} else {
-		if (persistence_map) {
-			for (size_t i = 0; i != bufsize; i++) {
-				result[i] += gmap[i] * gradient_buf[i];
-				gmap[i] *= persistence_map[i];
-			}
+		kernels->accumulate(result, gradient_buf, g, bufsize, absvalue);
+	}
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+
+static NoiseMapCache main_noise_map_cache;
+NoiseMapCache *g_noise_map_cache = &main_noise_map_cache;
+
+
+bool NoiseMapKey::operator==(const NoiseMapKey &other) const
+{
+	return np.offset == other.np.offset &&
+		np.scale      == other.np.scale &&
+		np.spread     == other.np.spread &&
+		np.seed       == other.np.seed &&
+		np.octaves    == other.np.octaves &&
+		np.persist    == other.np.persist &&
+		np.lacunarity == other.np.lacunarity &&
+		np.flags      == other.np.flags &&
+		seed   == other.seed &&
+		origin == other.origin &&
+		sx == other.sx && sy == other.sy && sz == other.sz &&
+		is3d == other.is3d;
+}
+
+
+inline void hash_combine(u64 &hash, u32 value)
+{
+	// FNV-1a, one 32 bit word at a time
+	hash ^= value;
+	hash *= 0x100000001b3ULL;
+}
+
+
+inline void hash_combine(u64 &hash, float value)
+{
+	u32 bits;
+	memcpy(&bits, &value, sizeof(bits));
+	hash_combine(hash, bits);
+}
+
+
+u64 NoiseMapKey::getHash() const
+{
+	u64 hash = 0xcbf29ce484222325ULL;
+	hash_combine(hash, np.offset);
+	hash_combine(hash, np.scale);
+	hash_combine(hash, np.spread.X);
+	hash_combine(hash, np.spread.Y);
+	hash_combine(hash, np.spread.Z);
+	hash_combine(hash, (u32)np.seed);
+	hash_combine(hash, (u32)np.octaves);
+	hash_combine(hash, np.persist);
+	hash_combine(hash, np.lacunarity);
+	hash_combine(hash, np.flags);
+	hash_combine(hash, (u32)seed);
+	hash_combine(hash, origin.X);
+	hash_combine(hash, origin.Y);
+	hash_combine(hash, origin.Z);
+	hash_combine(hash, sx);
+	hash_combine(hash, sy);
+	hash_combine(hash, sz);
+	hash_combine(hash, (u32)is3d);
+	return hash;
+}
+
+
+NoiseMapCache::NoiseMapCache() :
+	m_enabled(false),
+	m_max_size(0),
+	m_size(0),
+	m_hits(0),
+	m_misses(0)
+{
+}
+
+
+void NoiseMapCache::setMaxSize(size_t max_bytes)
+{
+	MutexAutoLock lock(m_mutex);
+
+	m_max_size = max_bytes;
+	m_enabled = max_bytes != 0;
+	while (m_size > m_max_size) {
+		Entry &entry = m_entries.back();
+		m_size -= entry.map.size() * sizeof(float);
+		m_index.erase(entry.key.getHash());
+		m_entries.pop_back();
+	}
+}
+
+
+void NoiseMapCache::clear()
+{
+	MutexAutoLock lock(m_mutex);
+
+	m_entries.clear();
+	m_index.clear();
+	m_size = 0;
+}
+
+
+bool NoiseMapCache::get(const NoiseMapKey &key, float *out, size_t count)
+{
+	bool found = false;
+
+	{
+		MutexAutoLock lock(m_mutex);
+
+		if (m_max_size == 0)
+			return false;
+
+		UNORDERED_MAP<u64, EntryList::iterator>::iterator it =
+			m_index.find(key.getHash());
+		found = it != m_index.end() && it->second->key == key &&
+			it->second->map.size() == count;
+
+		if (found) {
+			memcpy(out, &it->second->map[0], count * sizeof(float));
+			// Move to the front, this keeps the iterator valid
+			m_entries.splice(m_entries.begin(), m_entries, it->second);
+			m_hits++;
 		} else {
-			for (size_t i = 0; i != bufsize; i++)
-				result[i] += g * gradient_buf[i];
+			m_misses++;
 		}
 	}
+
+	g_profiler->add(found ? "NoiseMapCache: hits" : "NoiseMapCache: misses", 1);
+	return found;
+}
+
+
+void NoiseMapCache::put(const NoiseMapKey &key, const float *map, size_t count)
+{
+	size_t size = count * sizeof(float);
+
+	MutexAutoLock lock(m_mutex);
+
+	if (size > m_max_size)
+		return;
+
+	// Replace an entry with the same hash, whether it is the same map
+	// computed concurrently or a collision
+	u64 hash = key.getHash();
+	UNORDERED_MAP<u64, EntryList::iterator>::iterator it = m_index.find(hash);
+	if (it != m_index.end()) {
+		m_size -= it->second->map.size() * sizeof(float);
+		m_entries.erase(it->second);
+		m_index.erase(it);
+	}
+
+	while (m_size + size > m_max_size) {
+		Entry &entry = m_entries.back();
+		m_size -= entry.map.size() * sizeof(float);
+		m_index.erase(entry.key.getHash());
+		m_entries.pop_back();
+	}
+
+	m_entries.push_front(Entry());
+	Entry &entry = m_entries.front();
+	entry.key = key;
+	entry.map.assign(map, map + count);
+	m_index[hash] = m_entries.begin();
+	m_size += size;
+}
+
+
+void NoiseMapCache::getStats(u64 *hits, u64 *misses)
+{
+	MutexAutoLock lock(m_mutex);
+
+	*hits   = m_hits;
+	*misses = m_misses;
 }
@@ -26,8 +26,13 @@
 #ifndef NOISE_HEADER
 #define NOISE_HEADER
 
+#include <list>
+#include <vector>
 #include "irr_v3d.h"
 #include "exceptions.h"
+#include "threading/atomic.h"
+#include "threading/mutex.h"
+#include "util/cpp11_container.h"
 #include "util/string.h"
 
 extern FlagDesc flagdesc_noiseparams[];
@@ -139,12 +144,85 @@ struct NoiseParams {
 };
 
 
+// Instruction sets the bulk noise functions (Noise::perlinMap2D/3D) may use.
+// All of them give bit-identical results.
+enum NoiseSimdLevel {
+	NOISE_SIMD_NONE,
+	NOISE_SIMD_SSE2,
+	NOISE_SIMD_AVX2,
+};
+
+// Best instruction set supported by both the build and the running CPU
+NoiseSimdLevel noise_get_simd_support();
+NoiseSimdLevel noise_get_simd_level();
+// Limits the instruction set in use, returns the level actually selected
+NoiseSimdLevel noise_set_simd_level(NoiseSimdLevel level);
+
+
 // Convenience macros for getting/setting NoiseParams in Settings as a string
 // WARNING:  Deprecated, use Settings::getNoiseParamsFromValue() instead
 #define NOISEPARAMS_FMT_STR "f,f,v3,s32,u16,f"
 //#define getNoiseParams(x, y) getStruct((x), NOISEPARAMS_FMT_STR, &(y), sizeof(y))
 //#define setNoiseParams(x, y) setStruct((x), NOISEPARAMS_FMT_STR, &(y))
 
+/*
+	Cache of computed 2D noise maps, shared by every Noise object (mapgens as
+	well as the Lua API) so that identical maps (e.g. biome heat and
+	humidity) are only calculated once. 3D maps are too large to copy around
+	and rarely asked for twice, maps calculated with a persistence map are
+	never cached.
+*/
+struct NoiseMapKey {
+	NoiseParams np;
+	s32 seed;
+	v3f origin;
+	u32 sx, sy, sz;
+	bool is3d;
+
+	bool operator==(const NoiseMapKey &other) const;
+	u64 getHash() const;
+};
+
+class NoiseMapCache {
+public:
+	NoiseMapCache();
+
+	// Maximum amount of memory used by cached maps, 0 disables the cache
+	void setMaxSize(size_t max_bytes);
+	void clear();
+
+	// Does not lock, check before building a key
+	inline bool isEnabled() { return m_enabled; }
+
+	// Copies a cached map into out, which holds count values
+	bool get(const NoiseMapKey &key, float *out, size_t count);
+	void put(const NoiseMapKey &key, const float *map, size_t count);
+
+	void getStats(u64 *hits, u64 *misses);
+
+private:
+	struct Entry {
+		NoiseMapKey key;
+		std::vector<float> map;
+	};
+	typedef std::list<Entry> EntryList;
+
+	Atomic<bool> m_enabled;
+	Mutex m_mutex;
+	size_t m_max_size;
+	size_t m_size;
+	// Most recently used first
+	EntryList m_entries;
+	// Keyed by NoiseMapKey::getHash(), the entry holds the full key
+	UNORDERED_MAP<u64, EntryList::iterator> m_index;
+
+	u64 m_hits;
+	u64 m_misses;
+};
+
+extern NoiseMapCache *g_noise_map_cache;
+
+
 class Noise {
 public:
 	NoiseParams np;
@@ -196,8 +274,14 @@ class Noise {
 	}
 
 private:
+	// Per-column lattice index and interpolation weight, these are the same
+	// for every row of a gradient map
+	u32 *lattice_x_buf;
+	float *weight_x_buf;
+
 	void allocBuffers();
 	void resizeNoiseBuf(bool is3d);
+	NoiseMapKey getMapKey(float x, float y, float z, bool is3d);
 	void updateResults(float g, float *gmap, float *persistence_map, size_t bufsize);
 
 };
@@ -250,5 +334,9 @@ inline float easeCurve(float t)
 
 float contour(float v);
 
+// out[i] = contour(n1[i]) * contour(n2[i]) > threshold
+void contour_intersection_mask(u8 *out, const float *n1, const float *n2,
+	size_t count, float threshold);
+
 #endif
 
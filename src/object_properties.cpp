@@ -44,7 +44,9 @@ ObjectProperties::ObjectProperties():
 	backface_culling(true),
 	nametag(""),
 	nametag_color(255, 255, 255, 255),
-	automatic_face_movement_max_rotation_per_sec(-1)
+	automatic_face_movement_max_rotation_per_sec(-1),
+	can_sleep(false),
+	max_sleep_time(0)
 {
 	textures.push_back("unknown_object.png");
 	colors.push_back(video::SColor(255,255,255,255));
@@ -81,6 +83,8 @@ std::string ObjectProperties::dump()
 	os << ", nametag=" << nametag;
 	os << ", nametag_color=" << "\"" << nametag_color.getAlpha() << "," << nametag_color.getRed()
 			<< "," << nametag_color.getGreen() << "," << nametag_color.getBlue() << "\" ";
+	os << ", can_sleep=" << can_sleep;
+	os << ", max_sleep_time=" << max_sleep_time;
 	return os.str();
 }
 
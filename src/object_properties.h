@@ -55,6 +55,9 @@ struct ObjectProperties
 	std::string infotext;
 	//! For dropped items, this contains item information.
 	std::string wield_item;
+	// Server side only, see LuaEntitySAO::sleep()
+	bool can_sleep;
+	f32 max_sleep_time;
 
 	ObjectProperties();
 	std::string dump();
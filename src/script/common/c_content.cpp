@@ -279,6 +279,8 @@ void read_object_properties(lua_State *L, int index,
 	if (!lua_isnil(L, -1))
 		prop->wield_item = read_item(L, -1, idef).getItemString();
 	lua_pop(L, 1);
+	getboolfield(L, -1, "can_sleep", prop->can_sleep);
+	getfloatfield(L, -1, "max_sleep_time", prop->max_sleep_time);
 }
 
 /******************************************************************************/
@@ -351,6 +353,10 @@ void push_object_properties(lua_State *L, ObjectProperties *prop)
 	lua_setfield(L, -2, "infotext");
 	lua_pushlstring(L, prop->wield_item.c_str(), prop->wield_item.size());
 	lua_setfield(L, -2, "wield_item");
+	lua_pushboolean(L, prop->can_sleep);
+	lua_setfield(L, -2, "can_sleep");
+	lua_pushnumber(L, prop->max_sleep_time);
+	lua_setfield(L, -2, "max_sleep_time");
 }
 
 /******************************************************************************/
@@ -0,0 +1,883 @@
+/*
+Minetest
+Copyright (C) 2013 celeron55, Perttu Ahola <celeron55@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 3.0 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "common/c_serialize.h"
+#include "common/c_types.h"
+#include "exceptions.h"
+#include "util/basic_macros.h"
+#include "util/serialize.h"
+#include "util/string.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <map>
+#include <set>
+#include <vector>
+
+extern "C" {
+#include <lauxlib.h>
+}
+
+// Deeper tables are left to the Lua implementation
+#define SERIALIZE_MAX_DEPTH 180
+// LFIELDS_PER_FLUSH of the Lua parser, see LuaTextDeserializer::readTable()
+#define SERIALIZE_FIELDS_PER_FLUSH 50
+
+class LuaTextSerializer {
+public:
+	LuaTextSerializer(lua_State *L) :
+		L(L),
+		m_local_index(1)
+	{
+	}
+
+	// Returns false if the value at index needs the Lua implementation
+	bool serialize(int index, std::string &out)
+	{
+		std::string top;
+		if (!markOccurences(index, 0) || !dumpOrRefVal(index, top, 0))
+			return false;
+
+		if (m_local_defs.empty()) {
+			out = "return " + top;
+			return true;
+		}
+		out = "local _ = {}\n";
+		for (size_t i = 0; i < m_local_defs.size(); i++)
+			out.append(m_local_defs[i]).append("\n");
+		out.append("return ").append(top);
+		return true;
+	}
+
+private:
+	// First phase, find the tables which appear more than once
+	bool markOccurences(int index, int depth)
+	{
+		int type = lua_type(L, index);
+		if (type == LUA_TFUNCTION || type == LUA_TTHREAD)
+			return false;
+		if (type != LUA_TTABLE)
+			return true;
+		if (depth > SERIALIZE_MAX_DEPTH || !lua_checkstack(L, 3))
+			return false;
+
+		const void *ptr = lua_topointer(L, index);
+		std::map<const void *, u8>::iterator it = m_seen.find(ptr);
+		if (it != m_seen.end()) {
+			it->second = 2;
+			return true;
+		}
+		m_seen[ptr] = 1;
+
+		m_nested.insert(ptr);
+		lua_pushnil(L);
+		while (lua_next(L, index) != 0) {
+			int top = lua_gettop(L);
+			// Key at top - 1, value at top
+			if (isNested(top - 1) || isNested(top) ||
+					!markOccurences(top - 1, depth + 1) ||
+					!markOccurences(top, depth + 1)) {
+				lua_pop(L, 2);
+				return false;
+			}
+			lua_pop(L, 1);
+		}
+		m_nested.erase(ptr);
+		return true;
+	}
+
+	inline bool isNested(int index)
+	{
+		return lua_istable(L, index) &&
+			m_nested.count(lua_topointer(L, index)) != 0;
+	}
+
+	// Second phase, dump the value, the tables occuring multiple times
+	// being dumped as local variables
+	bool dumpOrRefVal(int index, std::string &out, int depth)
+	{
+		if (!lua_istable(L, index))
+			return dumpVal(index, out, depth);
+
+		const void *ptr = lua_topointer(L, index);
+		if (m_seen[ptr] != 2)
+			return dumpVal(index, out, depth);
+
+		std::map<const void *, u32>::iterator it = m_dumped.find(ptr);
+		if (it == m_dumped.end()) {
+			std::string val;
+			if (!dumpVal(index, val, depth))
+				return false;
+			u32 i = m_local_index++;
+			it = m_dumped.insert(std::make_pair(ptr, i)).first;
+			m_local_defs.push_back("_[" + itos(i) + "] = " + val);
+		}
+		out.append("_[").append(itos(it->second)).append("]");
+		return true;
+	}
+
+	bool dumpVal(int index, std::string &out, int depth)
+	{
+		switch (lua_type(L, index)) {
+		case LUA_TNIL:
+		case LUA_TUSERDATA:
+		case LUA_TLIGHTUSERDATA:
+			out.append("nil");
+			return true;
+		case LUA_TBOOLEAN:
+			out.append(lua_toboolean(L, index) ? "true" : "false");
+			return true;
+		case LUA_TSTRING: {
+			size_t len;
+			const char *str = lua_tolstring(L, index, &len);
+			dumpString(str, len, out);
+			return true;
+		}
+		case LUA_TNUMBER:
+			return dumpNumber(lua_tonumber(L, index), out);
+		case LUA_TTABLE:
+			return dumpTable(index, out, depth);
+		default:
+			return false;
+		}
+	}
+
+	// Like string.format("%q")
+	static void dumpString(const char *str, size_t len, std::string &out)
+	{
+		out.reserve(out.size() + len + 2);
+		out.push_back('"');
+		for (size_t i = 0; i < len; i++) {
+			char c = str[i];
+			switch (c) {
+			case '"':
+			case '\\':
+			case '\n':
+				out.push_back('\\');
+				out.push_back(c);
+				break;
+			case '\r':
+				out.append("\\r");
+				break;
+			case '\0':
+				out.append("\\000");
+				break;
+			default:
+				out.push_back(c);
+			}
+		}
+		out.push_back('"');
+	}
+
+	static bool dumpNumber(lua_Number x, std::string &out)
+	{
+		char buf[32];
+		if (x != x || x - x != 0)
+			// NaN or infinite, the Lua code writes these as names
+			return false;
+		if (floor(x) == x) {
+			// Integers as string.format("%d"), which cannot write
+			// every integral double
+			if (x < -9.2e18 || x > 9.2e18)
+				return false;
+			snprintf(buf, sizeof(buf), "%lld", (long long)x);
+		} else {
+			// tostring()
+			snprintf(buf, sizeof(buf), "%.14g", x);
+		}
+		out.append(buf);
+		return true;
+	}
+
+	bool dumpTable(int index, std::string &out, int depth)
+	{
+		if (!lua_checkstack(L, 3))
+			return false;
+
+		out.push_back('{');
+		bool first = true;
+
+		// Array part, like ipairs()
+		int n = 0;
+		for (;;) {
+			lua_rawgeti(L, index, n + 1);
+			if (lua_isnil(L, -1)) {
+				lua_pop(L, 1);
+				break;
+			}
+			n++;
+			if (!first)
+				out.append(", ");
+			first = false;
+			bool ok = dumpOrRefVal(lua_gettop(L), out, depth + 1);
+			lua_pop(L, 1);
+			if (!ok)
+				return false;
+		}
+
+		lua_pushnil(L);
+		while (lua_next(L, index) != 0) {
+			int top = lua_gettop(L);
+			if (lua_type(L, top - 1) == LUA_TNUMBER) {
+				lua_Number k = lua_tonumber(L, top - 1);
+				if (k >= 1 && k <= n && floor(k) == k) {
+					lua_pop(L, 1);
+					continue;
+				}
+			}
+			if (!first)
+				out.append(", ");
+			first = false;
+			out.push_back('[');
+			bool ok = dumpOrRefVal(top - 1, out, depth + 1);
+			out.append("] = ");
+			ok = ok && dumpOrRefVal(top, out, depth + 1);
+			lua_pop(L, 1);
+			if (!ok) {
+				lua_pop(L, 1);
+				return false;
+			}
+		}
+
+		out.push_back('}');
+		return true;
+	}
+
+	lua_State *L;
+	// Tables seen once (1) or more (2)
+	std::map<const void *, u8> m_seen;
+	// Tables being traversed
+	std::set<const void *> m_nested;
+	// Local variables of the tables dumped already
+	std::map<const void *, u32> m_dumped;
+	u32 m_local_index;
+	std::vector<std::string> m_local_defs;
+};
+
+/*
+	Parses the Lua code written by core.serialize(): a return statement,
+	possibly preceded by assignments to the local table "_". Everything
+	is pushed to the stack of L.
+*/
+class LuaTextDeserializer {
+public:
+	LuaTextDeserializer(lua_State *L, const char *str, size_t len) :
+		L(L),
+		m_p(str),
+		m_end(str + len),
+		m_locals(0)
+	{
+	}
+
+	// Pushes the value, returns false if the code needs the Lua
+	// implementation
+	bool deserialize()
+	{
+		skipSpace();
+		if (readKeyword("local")) {
+			skipSpace();
+			if (!readChar('_') || !readChar('=') || !readChar('{') ||
+					!readChar('}'))
+				return false;
+			lua_newtable(L);
+			m_locals = lua_gettop(L);
+		}
+
+		for (;;) {
+			skipSpace();
+			if (readKeyword("return"))
+				break;
+			// _[i] = value
+			if (!readLocal())
+				return false;
+			if (!readChar('=') || !readValue(0))
+				return false;
+			lua_rawset(L, m_locals);
+			readChar(';');
+		}
+
+		skipSpace();
+		if (m_p == m_end) {
+			lua_pushnil(L);
+		} else {
+			if (!readValue(0))
+				return false;
+			readChar(';');
+			skipSpace();
+			if (m_p != m_end)
+				return false;
+		}
+		if (m_locals)
+			lua_remove(L, m_locals);
+		return true;
+	}
+
+private:
+	inline void skipSpace()
+	{
+		while (m_p != m_end && isspace((unsigned char)*m_p))
+			m_p++;
+	}
+
+	inline static bool isNameChar(char c)
+	{
+		return isalnum((unsigned char)c) || c == '_';
+	}
+
+	// Skips space, then c
+	bool readChar(char c)
+	{
+		skipSpace();
+		if (m_p == m_end || *m_p != c)
+			return false;
+		// Neither "==" nor a comment
+		if ((c == '=' || c == '-') && m_p + 1 != m_end && m_p[1] == c)
+			return false;
+		m_p++;
+		return true;
+	}
+
+	bool readKeyword(const char *word)
+	{
+		size_t len = strlen(word);
+		if ((size_t)(m_end - m_p) < len || strncmp(m_p, word, len) != 0 ||
+				(m_p + len != m_end && isNameChar(m_p[len])))
+			return false;
+		m_p += len;
+		return true;
+	}
+
+	bool readName(size_t *len)
+	{
+		const char *start = m_p;
+		if (m_p == m_end || !(isalpha((unsigned char)*m_p) || *m_p == '_'))
+			return false;
+		while (m_p != m_end && isNameChar(*m_p))
+			m_p++;
+		*len = m_p - start;
+		return true;
+	}
+
+	// Pushes the key of _[key]
+	bool readLocal()
+	{
+		skipSpace();
+		if (!m_locals || !readKeyword("_") || !readChar('['))
+			return false;
+		skipSpace();
+		if (!readNumber(false) || !readChar(']'))
+			return false;
+		return true;
+	}
+
+	bool readValue(int depth)
+	{
+		skipSpace();
+		if (m_p == m_end)
+			return false;
+
+		char c = *m_p;
+		if (c == '{')
+			return readTable(depth);
+		if (c == '"' || c == '\'')
+			return readString();
+		if (isdigit((unsigned char)c) || (c == '.' && m_p + 1 != m_end &&
+				isdigit((unsigned char)m_p[1])))
+			return readNumber(false);
+		if (c == '-') {
+			if (!readChar('-'))
+				return false;
+			skipSpace();
+			return m_p != m_end && (isdigit((unsigned char)*m_p) ||
+				*m_p == '.') && readNumber(true);
+		}
+		if (c == '_' && (m_p + 1 == m_end || !isNameChar(m_p[1]))) {
+			if (!readLocal())
+				return false;
+			lua_rawget(L, m_locals);
+			return true;
+		}
+		if (readKeyword("nil")) {
+			lua_pushnil(L);
+			return true;
+		}
+		if (readKeyword("true")) {
+			lua_pushboolean(L, true);
+			return true;
+		}
+		if (readKeyword("false")) {
+			lua_pushboolean(L, false);
+			return true;
+		}
+		// Other names are globals of the sandbox (loadstring)
+		return false;
+	}
+
+	// Like the numerals of the Lua lexer
+	bool readNumber(bool negate)
+	{
+		const char *start = m_p;
+		while (m_p != m_end && (isdigit((unsigned char)*m_p) || *m_p == '.'))
+			m_p++;
+		if (m_p != m_end && (*m_p == 'e' || *m_p == 'E')) {
+			m_p++;
+			if (m_p != m_end && (*m_p == '+' || *m_p == '-'))
+				m_p++;
+		}
+		while (m_p != m_end && isNameChar(*m_p))
+			m_p++;
+
+		// Lua strings end with a null character, strtod() cannot read
+		// past the numeral
+		if (std::find(start, m_p, 'x') != m_p ||
+				std::find(start, m_p, 'X') != m_p)
+			return false;
+		char *endptr;
+		lua_Number x = strtod(start, &endptr);
+		if (endptr != m_p)
+			return false;
+		lua_pushnumber(L, negate ? -x : x);
+		return true;
+	}
+
+	bool readString()
+	{
+		char quote = *m_p++;
+
+		// Most strings have no escape sequences
+		const char *start = m_p;
+		while (m_p != m_end && *m_p != quote && *m_p != '\\' &&
+				*m_p != '\n' && *m_p != '\r')
+			m_p++;
+		if (m_p != m_end && *m_p == quote) {
+			lua_pushlstring(L, start, m_p - start);
+			m_p++;
+			return true;
+		}
+
+		std::string str(start, m_p - start);
+		for (;;) {
+			if (m_p == m_end)
+				return false;
+			char c = *m_p++;
+			if (c == quote)
+				break;
+			if (c == '\n' || c == '\r')
+				return false;
+			if (c != '\\') {
+				str.push_back(c);
+				continue;
+			}
+
+			if (m_p == m_end)
+				return false;
+			c = *m_p++;
+			switch (c) {
+			case 'a': str.push_back('\a'); break;
+			case 'b': str.push_back('\b'); break;
+			case 'f': str.push_back('\f'); break;
+			case 'n': str.push_back('\n'); break;
+			case 'r': str.push_back('\r'); break;
+			case 't': str.push_back('\t'); break;
+			case 'v': str.push_back('\v'); break;
+			case '\\':
+			case '"':
+			case '\'':
+				str.push_back(c);
+				break;
+			case '\n':
+			case '\r':
+				// An escaped line break, \r\n and \n\r count as one
+				str.push_back('\n');
+				if (m_p != m_end && (*m_p == '\n' || *m_p == '\r') &&
+						*m_p != c)
+					m_p++;
+				break;
+			default: {
+				// The other escapes depend on the Lua implementation
+				if (!isdigit((unsigned char)c))
+					return false;
+				int value = c - '0';
+				for (int i = 0; i < 2 && m_p != m_end &&
+						isdigit((unsigned char)*m_p); i++)
+					value = value * 10 + (*m_p++ - '0');
+				if (value > 255)
+					return false;
+				str.push_back((char)value);
+			}
+			}
+		}
+		lua_pushlstring(L, str.c_str(), str.size());
+		return true;
+	}
+
+	bool readTable(int depth)
+	{
+		if (depth > SERIALIZE_MAX_DEPTH || !lua_checkstack(L, 3))
+			return false;
+		m_p++;
+		lua_newtable(L);
+		int table = lua_gettop(L);
+		int n = 0;
+		// Like Lua, positional values wait on the stack and are stored by
+		// batches, after the keyed ones preceding them: {1, [1] = 2}
+		// gives 1
+		int pending = 0;
+
+		for (;;) {
+			skipSpace();
+			if (m_p == m_end)
+				return false;
+			if (*m_p == '}')
+				break;
+
+			if (*m_p == '[') {
+				// [key] = value, "[[" starts a long string
+				if (m_p + 1 != m_end && (m_p[1] == '[' || m_p[1] == '='))
+					return false;
+				m_p++;
+				if (!readValue(depth + 1) || !readChar(']') ||
+						!readChar('=') || !readValue(depth + 1))
+					return false;
+				if (lua_isnil(L, -2))
+					return false;
+				lua_rawset(L, table);
+			} else if (readField()) {
+				// name = value
+				if (!readValue(depth + 1))
+					return false;
+				lua_rawset(L, table);
+			} else {
+				if (m_p == m_end || !lua_checkstack(L, 3) ||
+						!readValue(depth + 1))
+					return false;
+				if (++pending == SERIALIZE_FIELDS_PER_FLUSH) {
+					storePending(table, n, pending);
+					n += pending;
+					pending = 0;
+				}
+			}
+
+			skipSpace();
+			if (m_p != m_end && (*m_p == ',' || *m_p == ';'))
+				m_p++;
+			else if (m_p == m_end || *m_p != '}')
+				return false;
+		}
+		storePending(table, n, pending);
+		m_p++;
+		return true;
+	}
+
+	// Pops the count values on top of the stack to table[n + 1] ...
+	// table[n + count]
+	void storePending(int table, int n, int count)
+	{
+		for (int i = count; i > 0; i--)
+			lua_rawseti(L, table, n + i);
+	}
+
+	// Reads and pushes the name of name = value if there is one, an invalid
+	// name moves to the end
+	bool readField()
+	{
+		const char *start = m_p;
+		size_t len;
+		if (!readName(&len) || !readChar('=')) {
+			m_p = start;
+			return false;
+		}
+
+		static const char *reserved[] = {"and", "break", "do", "else",
+			"elseif", "end", "false", "for", "function", "if", "in",
+			"local", "nil", "not", "or", "repeat", "return", "then",
+			"true", "until", "while"};
+		for (size_t i = 0; i < ARRLEN(reserved); i++) {
+			if (strlen(reserved[i]) == len &&
+					strncmp(start, reserved[i], len) == 0) {
+				// A syntax error, e.g. {nil = 1}
+				m_p = m_end;
+				return false;
+			}
+		}
+
+		lua_pushlstring(L, start, len);
+		return true;
+	}
+
+	lua_State *L;
+	const char *m_p;
+	const char *m_end;
+	// Stack index of the table "_"
+	int m_locals;
+};
+
+/*
+	Binary format:
+	u8 0
+	u8 version
+	value:
+		u8 type
+		BIN_INTEGER: s32
+		BIN_NUMBER: u64 bits of the IEEE 754 double
+		BIN_STRING: u32 length, bytes
+		BIN_TABLE: (key value)* BIN_NIL, the table gets the next id from 1
+		BIN_REF: u32 id of a table read before
+*/
+#define BINARY_SERIALIZE_VERSION 1
+#define BINARY_SERIALIZE_MAX_DEPTH 1000
+
+enum BinarySerializeType {
+	BIN_NIL,
+	BIN_FALSE,
+	BIN_TRUE,
+	BIN_INTEGER,
+	BIN_NUMBER,
+	BIN_STRING,
+	BIN_TABLE,
+	BIN_REF,
+};
+
+static inline void append_u32(std::string &out, u32 i)
+{
+	u8 buf[4];
+	writeU32(buf, i);
+	out.append((char *)buf, 4);
+}
+
+static void write_binary_value(lua_State *L, int index, std::string &out,
+	std::map<const void *, u32> &ids, int depth)
+{
+	int type = lua_type(L, index);
+	switch (type) {
+	case LUA_TNIL:
+	case LUA_TUSERDATA:
+	case LUA_TLIGHTUSERDATA:
+		out.push_back(BIN_NIL);
+		return;
+	case LUA_TBOOLEAN:
+		out.push_back(lua_toboolean(L, index) ? BIN_TRUE : BIN_FALSE);
+		return;
+	case LUA_TNUMBER: {
+		lua_Number x = lua_tonumber(L, index);
+		if (x >= -2147483648.0 && x <= 2147483647.0 && x == (s32)x) {
+			out.push_back(BIN_INTEGER);
+			append_u32(out, (u32)(s32)x);
+		} else {
+			double d = x;
+			u64 bits;
+			memcpy(&bits, &d, 8);
+			u8 buf[8];
+			writeU64(buf, bits);
+			out.push_back(BIN_NUMBER);
+			out.append((char *)buf, 8);
+		}
+		return;
+	}
+	case LUA_TSTRING: {
+		size_t len;
+		const char *str = lua_tolstring(L, index, &len);
+		out.push_back(BIN_STRING);
+		append_u32(out, len);
+		out.append(str, len);
+		return;
+	}
+	case LUA_TTABLE:
+		break;
+	default:
+		throw LuaError(std::string("Can't serialize data of type ") +
+			lua_typename(L, type));
+	}
+
+	const void *ptr = lua_topointer(L, index);
+	std::map<const void *, u32>::iterator it = ids.find(ptr);
+	if (it != ids.end()) {
+		out.push_back(BIN_REF);
+		append_u32(out, it->second);
+		return;
+	}
+
+	if (depth > BINARY_SERIALIZE_MAX_DEPTH || !lua_checkstack(L, 3))
+		throw LuaError("Can't serialize tables nested this deep");
+
+	u32 id = ids.size() + 1;
+	ids[ptr] = id;
+	out.push_back(BIN_TABLE);
+	lua_pushnil(L);
+	while (lua_next(L, index) != 0) {
+		int top = lua_gettop(L);
+		write_binary_value(L, top - 1, out, ids, depth + 1);
+		write_binary_value(L, top, out, ids, depth + 1);
+		lua_pop(L, 1);
+	}
+	out.push_back(BIN_NIL);
+}
+
+class LuaBinaryDeserializer {
+public:
+	LuaBinaryDeserializer(lua_State *L, const char *str, size_t len) :
+		L(L),
+		m_p((const u8 *)str),
+		m_end((const u8 *)str + len),
+		m_tables(0),
+		m_num_tables(0)
+	{
+	}
+
+	// Pushes the value, throws SerializationError on invalid data
+	void deserialize()
+	{
+		need(2);
+		if (m_p[1] != BINARY_SERIALIZE_VERSION)
+			throw SerializationError("Unsupported serialization version");
+		m_p += 2;
+
+		lua_newtable(L);
+		m_tables = lua_gettop(L);
+		readValue(0);
+		if (m_p != m_end)
+			throw SerializationError("Trailing data");
+		lua_remove(L, m_tables);
+	}
+
+private:
+	inline void need(size_t n)
+	{
+		if ((size_t)(m_end - m_p) < n)
+			throw SerializationError("Truncated data");
+	}
+
+	inline u32 readU32()
+	{
+		need(4);
+		u32 i = ::readU32(m_p);
+		m_p += 4;
+		return i;
+	}
+
+	// Pushes a value, returns false for BIN_NIL
+	bool readValue(int depth)
+	{
+		need(1);
+		switch (*m_p++) {
+		case BIN_NIL:
+			lua_pushnil(L);
+			return false;
+		case BIN_FALSE:
+			lua_pushboolean(L, false);
+			break;
+		case BIN_TRUE:
+			lua_pushboolean(L, true);
+			break;
+		case BIN_INTEGER:
+			lua_pushnumber(L, (s32)readU32());
+			break;
+		case BIN_NUMBER: {
+			need(8);
+			u64 bits = ::readU64(m_p);
+			m_p += 8;
+			double d;
+			memcpy(&d, &bits, 8);
+			lua_pushnumber(L, d);
+			break;
+		}
+		case BIN_STRING: {
+			u32 len = readU32();
+			need(len);
+			lua_pushlstring(L, (const char *)m_p, len);
+			m_p += len;
+			break;
+		}
+		case BIN_TABLE:
+			readTable(depth);
+			break;
+		case BIN_REF: {
+			u32 id = readU32();
+			if (id == 0 || id > m_num_tables)
+				throw SerializationError("Invalid table reference");
+			lua_rawgeti(L, m_tables, id);
+			break;
+		}
+		default:
+			throw SerializationError("Invalid value type");
+		}
+		return true;
+	}
+
+	void readTable(int depth)
+	{
+		if (depth > BINARY_SERIALIZE_MAX_DEPTH || !lua_checkstack(L, 3))
+			throw SerializationError("Tables nested too deep");
+
+		lua_newtable(L);
+		int table = lua_gettop(L);
+		lua_pushvalue(L, table);
+		lua_rawseti(L, m_tables, ++m_num_tables);
+
+		while (readValue(depth + 1)) {
+			if (lua_type(L, -1) == LUA_TNUMBER &&
+					lua_tonumber(L, -1) != lua_tonumber(L, -1))
+				throw SerializationError("Invalid table key");
+			readValue(depth + 1);
+			lua_rawset(L, table);
+		}
+		lua_pop(L, 1);
+	}
+
+	lua_State *L;
+	const u8 *m_p;
+	const u8 *m_end;
+	// Stack index of the tables by id
+	int m_tables;
+	u32 m_num_tables;
+};
+
+// The serializers push values, relative indices would move
+static inline int absolute_index(lua_State *L, int index)
+{
+	return index < 0 && index > LUA_REGISTRYINDEX ?
+		lua_gettop(L) + index + 1 : index;
+}
+
+bool serialize_lua_text(lua_State *L, int index, std::string &out)
+{
+	index = absolute_index(L, index);
+	LuaTextSerializer serializer(L);
+	return serializer.serialize(index, out);
+}
+
+bool deserialize_lua_text(lua_State *L, const char *str, size_t len)
+{
+	LuaTextDeserializer deserializer(L, str, len);
+	return deserializer.deserialize();
+}
+
+void serialize_lua_binary(lua_State *L, int index, std::string &out)
+{
+	out.push_back('\0');
+	out.push_back(BINARY_SERIALIZE_VERSION);
+	std::map<const void *, u32> ids;
+	write_binary_value(L, absolute_index(L, index), out, ids, 0);
+}
+
+void deserialize_lua_binary(lua_State *L, const char *str, size_t len)
+{
+	LuaBinaryDeserializer deserializer(L, str, len);
+	deserializer.deserialize();
+}
@@ -0,0 +1,57 @@
+/*
+Minetest
+Copyright (C) 2013 celeron55, Perttu Ahola <celeron55@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 3.0 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#ifndef C_SERIALIZE_H_
+#define C_SERIALIZE_H_
+
+#include <string>
+
+extern "C" {
+#include <lua.h>
+}
+
+/*
+	Native core.serialize() and core.deserialize(), used by the builtin
+	ones in builtin/common/serialize.lua. They handle the Lua code written by
+	core.serialize(), shared tables included. Whatever they do not
+	understand (functions, tables nested within themselves, arbitrary Lua
+	code...) is left to the Lua implementation, so the results stay the same.
+*/
+
+// Writes the value at index like core.serialize(), returns false if it
+// needs the Lua implementation
+bool serialize_lua_text(lua_State *L, int index, std::string &out);
+
+// Pushes the value read from the code, returns false (and leaves the stack
+// in an undefined state) if the code needs the Lua implementation
+bool deserialize_lua_text(lua_State *L, const char *str, size_t len);
+
+/*
+	Binary format of core.serialize_binary(), told apart from Lua code by its
+	first byte, which is 0. It keeps shared and recursive tables.
+*/
+
+// Appends the value at index, throws LuaError on values of other types than
+// nil, booleans, numbers, strings, tables and userdata (written as nil)
+void serialize_lua_binary(lua_State *L, int index, std::string &out);
+
+// Pushes the value, throws SerializationError on invalid data
+void deserialize_lua_binary(lua_State *L, const char *str, size_t len);
+
+#endif
@@ -31,7 +31,9 @@ extern "C" {
 #include "log.h"
 #include "filesys.h"
 #include "porting.h"
+#include "settings.h"
 #include "common/c_internal.h"
+#include "lua_api/l_vmanip.h"
 
 /******************************************************************************/
 AsyncEngine::AsyncEngine() :
@@ -82,13 +84,13 @@ void AsyncEngine::registerStateInitializer(StateInitializer func)
 }
 
 /******************************************************************************/
-void AsyncEngine::initialize(unsigned int numEngines)
+void AsyncEngine::initialize(unsigned int numEngines, IGameDef *gamedef)
 {
 	initDone = true;
 
 	for (unsigned int i = 0; i < numEngines; i++) {
 		AsyncWorkerThread *toAdd = new AsyncWorkerThread(this,
-			std::string("AsyncWorker-") + itos(i));
+			std::string("AsyncWorker-") + itos(i), gamedef);
 		workerThreads.push_back(toAdd);
 		toAdd->start();
 	}
@@ -96,13 +98,14 @@ void AsyncEngine::initialize(unsigned int numEngines)
 
 /******************************************************************************/
 unsigned int AsyncEngine::queueAsyncJob(const std::string &func,
-		const std::string &params)
+		const std::string &params, MMVManip *vmanip)
 {
 	jobQueueMutex.lock();
 	LuaJobInfo toAdd;
 	toAdd.id = jobIdCounter++;
 	toAdd.serializedFunction = func;
 	toAdd.serializedParams = params;
+	toAdd.vmanip = vmanip;
 
 	jobQueue.push_back(toAdd);
 
@@ -139,6 +142,19 @@ void AsyncEngine::putJobResult(const LuaJobInfo &result)
 	resultQueueMutex.unlock();
 }
 
+/******************************************************************************/
+bool AsyncEngine::popJobResult(LuaJobInfo *result)
+{
+	MutexAutoLock l(resultQueueMutex);
+
+	if (resultQueue.empty())
+		return false;
+
+	*result = resultQueue.front();
+	resultQueue.pop_front();
+	return true;
+}
+
 /******************************************************************************/
 void AsyncEngine::step(lua_State *L)
 {
@@ -207,13 +223,20 @@ void AsyncEngine::prepareEnvironment(lua_State* L, int top)
 
 /******************************************************************************/
 AsyncWorkerThread::AsyncWorkerThread(AsyncEngine* jobDispatcher,
-		const std::string &name) :
-	Thread(name),
+		const std::string &name, IGameDef *gamedef) :
 	ScriptApiBase(),
-	jobDispatcher(jobDispatcher)
+	Thread(name),
+	jobDispatcher(jobDispatcher),
+	sourceOnly(gamedef != NULL)
 {
 	lua_State *L = getStack();
 
+	if (gamedef) {
+		setGameDef(gamedef);
+		if (g_settings->getBool("secure.enable_security"))
+			initializeSecurity();
+	}
+
 	// Prepare job lua environment
 	lua_getglobal(L, "core");
 	int top = lua_gettop(L);
@@ -268,17 +291,45 @@ void* AsyncWorkerThread::run()
 
 		luaL_checktype(L, -1, LUA_TFUNCTION);
 
-		// Call it
-		lua_pushlstring(L,
-				toProcess.serializedFunction.data(),
-				toProcess.serializedFunction.size());
+		// Call it.  The function is loaded here, as mod security doesn't
+		// allow Lua code to load bytecode.  Only the main menu passes
+		// string.dump()ed functions, the jobs of mods are Lua source.
+		bool loaded = sourceOnly ?
+			safeLoadString(L, toProcess.serializedFunction, "=(async job)") :
+			luaL_loadbuffer(L, toProcess.serializedFunction.data(),
+				toProcess.serializedFunction.size(), "=(async job)") == 0;
+		if (!loaded) {
+			errorstream << "Loading async job failed: "
+				<< lua_tostring(L, -1) << std::endl;
+			lua_pop(L, 1);
+			lua_pushnil(L);
+		}
 		lua_pushlstring(L,
 				toProcess.serializedParams.data(),
 				toProcess.serializedParams.size());
 
-		int result = lua_pcall(L, 2, 1, error_handler);
+		LuaVoxelManip *vm_object = NULL;
+		if (toProcess.vmanip) {
+			vm_object = new LuaVoxelManip(toProcess.vmanip, true);
+			*(void **)(lua_newuserdata(L, sizeof(void *))) = vm_object;
+			luaL_getmetatable(L, "VoxelManip");
+			lua_setmetatable(L, -2);
+		}
+
+		int result = lua_pcall(L, vm_object ? 3 : 2, 1, error_handler);
+
+		// The VoxelManip goes back with the result, the Lua object might
+		// outlive the job
+		if (vm_object)
+			vm_object->releaseVManip();
+
 		if (result) {
-			PCALL_RES(result);
+			// An empty result marks the failed jobs
+			try {
+				PCALL_RES(result);
+			} catch (LuaError &e) {
+				errorstream << "Async job failed: " << e.what() << std::endl;
+			}
 			toProcess.serializedResult = "";
 		} else {
 			// Fetch result
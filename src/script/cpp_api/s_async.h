@@ -30,9 +30,12 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "debug.h"
 #include "lua.h"
 #include "cpp_api/s_base.h"
+#include "cpp_api/s_security.h"
 
 // Forward declarations
 class AsyncEngine;
+class IGameDef;
+class MMVManip;
 
 
 // Declarations
@@ -45,6 +48,7 @@ struct LuaJobInfo
 		serializedParams(""),
 		serializedResult(""),
 		id(0),
+		vmanip(NULL),
 		valid(false)
 	{}
 
@@ -56,20 +60,26 @@ struct LuaJobInfo
 	std::string serializedResult;
 	// JobID used to identify a job and match it to callback
 	unsigned int id;
+	// VoxelManip the function gets before its parameter, NULL if none.
+	// Only the worker running the job accesses it until the result is put.
+	MMVManip *vmanip;
 
 	bool valid;
 };
 
 // Asynchronous working environment
-class AsyncWorkerThread : public Thread, public ScriptApiBase {
+class AsyncWorkerThread : public Thread, public ScriptApiSecurity {
 public:
-	AsyncWorkerThread(AsyncEngine* jobDispatcher, const std::string &name);
+	AsyncWorkerThread(AsyncEngine* jobDispatcher, const std::string &name,
+		IGameDef *gamedef);
 	virtual ~AsyncWorkerThread();
 
 	void *run();
 
 private:
 	AsyncEngine *jobDispatcher;
+	// Reject bytecode jobs, set for the workers of the server
+	bool sourceOnly;
 };
 
 // Asynchornous thread and job management
@@ -89,16 +99,32 @@ class AsyncEngine {
 	/**
 	 * Create async engine tasks and lock function registration
 	 * @param numEngines Number of async threads to be started
+	 * @param gamedef Server the jobs run for, their environments are
+	 *   secured like the one of the mods if mod security is enabled
 	 */
-	void initialize(unsigned int numEngines);
+	void initialize(unsigned int numEngines, IGameDef *gamedef = NULL);
+
+	/**
+	 * Check whether initialize() was called
+	 */
+	bool isInitialized() const { return initDone; }
 
 	/**
 	 * Queue an async job
 	 * @param func Serialized lua function
 	 * @param params Serialized parameters
+	 * @param vmanip VoxelManip to pass to the function, NULL if none
 	 * @return jobid The job is queued
 	 */
-	unsigned int queueAsyncJob(const std::string &func, const std::string &params);
+	unsigned int queueAsyncJob(const std::string &func, const std::string &params,
+			MMVManip *vmanip = NULL);
+
+	/**
+	 * Take the oldest finished job, to process it without step()
+	 * @param result Set to the finished job
+	 * @return false if no job is finished
+	 */
+	bool popJobResult(LuaJobInfo *result);
 
 	/**
 	 * Engine step to process finished jobs
@@ -259,6 +259,8 @@ void ScriptApiBase::stackDump(std::ostream &o)
 void ScriptApiBase::setOriginDirect(const char *origin)
 {
 	m_last_run_mod = origin ? origin : "??";
+	if (m_profiler.isEnabled())
+		m_profiler.setMod(getStack(), m_last_run_mod);
 }
 
 void ScriptApiBase::setOriginFromTableRaw(int index, const char *fxn)
@@ -269,6 +271,8 @@ void ScriptApiBase::setOriginFromTableRaw(int index, const char *fxn)
 	m_last_run_mod = lua_istable(L, index) ?
 		getstringfield_default(L, index, "mod_origin", "") : "";
 	//printf(">>>> running %s for mod: %s\n", fxn, m_last_run_mod.c_str());
+	if (m_profiler.isEnabled())
+		m_profiler.setMod(L, m_last_run_mod);
 #endif
 }
 
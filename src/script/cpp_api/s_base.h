@@ -33,6 +33,7 @@ extern "C" {
 #include "threading/mutex_auto_lock.h"
 #include "common/c_types.h"
 #include "common/c_internal.h"
+#include "cpp_api/s_profiler.h"
 
 #define SCRIPTAPI_LOCK_DEBUG
 #define SCRIPTAPI_DEBUG
@@ -89,6 +90,8 @@ class ScriptApiBase {
 	void setOriginDirect(const char *origin);
 	void setOriginFromTableRaw(int index, const char *fxn);
 
+	ScriptProfiler &getProfiler() { return m_profiler; }
+
 protected:
 	friend class LuaABM;
 	friend class LuaLBM;
@@ -118,6 +121,7 @@ class ScriptApiBase {
 
 	RecursiveMutex  m_luastackmutex;
 	std::string     m_last_run_mod;
+	ScriptProfiler  m_profiler;
 	bool            m_secure;
 #ifdef SCRIPTAPI_LOCK_DEBUG
 	int             m_lock_recursion_count;
@@ -196,7 +196,7 @@ void ScriptApiEntity::luaentity_GetProperties(u16 id,
 	lua_pop(L, 1);
 }
 
-void ScriptApiEntity::luaentity_Step(u16 id, float dtime)
+void ScriptApiEntity::luaentity_Step(u16 id, float dtime, float slept)
 {
 	SCRIPTAPI_PRECHECKHEADER
 
@@ -217,13 +217,63 @@ void ScriptApiEntity::luaentity_Step(u16 id, float dtime)
 	luaL_checktype(L, -1, LUA_TFUNCTION);
 	lua_pushvalue(L, object); // self
 	lua_pushnumber(L, dtime); // dtime
+	lua_pushnumber(L, slept); // slept
 
 	setOriginFromTable(object);
-	PCALL_RES(lua_pcall(L, 2, 0, error_handler));
+	PCALL_RES(lua_pcall(L, 3, 0, error_handler));
 
 	lua_pop(L, 2); // Pop object and error handler
 }
 
+// Reads self.age, self.stuck and self.itemstring of a "__builtin:item"
+bool ScriptApiEntity::luaentity_GetItemState(u16 id, float *age, bool *stuck,
+		std::string *itemstring)
+{
+	SCRIPTAPI_PRECHECKHEADER
+
+	luaentity_get(L, id);
+	if (!lua_istable(L, -1)) {
+		lua_pop(L, 1);
+		return false;
+	}
+
+	lua_getfield(L, -1, "itemstring");
+	lua_getfield(L, -2, "age");
+	if (!lua_isstring(L, -2) || !lua_isnumber(L, -1)) {
+		lua_pop(L, 3);
+		return false;
+	}
+	size_t len;
+	const char *s = lua_tolstring(L, -2, &len);
+	itemstring->assign(s, len);
+	*age = lua_tonumber(L, -1);
+
+	lua_getfield(L, -3, "stuck");
+	*stuck = lua_toboolean(L, -1);
+	lua_pop(L, 4);
+	return true;
+}
+
+void ScriptApiEntity::luaentity_SetItemState(u16 id, float age, bool moving,
+		bool slippery)
+{
+	SCRIPTAPI_PRECHECKHEADER
+
+	luaentity_get(L, id);
+	if (!lua_istable(L, -1)) {
+		lua_pop(L, 1);
+		return;
+	}
+
+	lua_pushnumber(L, age);
+	lua_setfield(L, -2, "age");
+	lua_pushboolean(L, moving);
+	lua_setfield(L, -2, "moving_state");
+	lua_pushboolean(L, slippery);
+	lua_setfield(L, -2, "slippery_state");
+	lua_pop(L, 1);
+}
+
 // Calls entity:on_punch(ObjectRef puncher, time_from_last_punch,
 //                       tool_capabilities, direction, damage)
 bool ScriptApiEntity::luaentity_Punch(u16 id,
@@ -37,12 +37,18 @@ class ScriptApiEntity
 	std::string luaentity_GetStaticdata(u16 id);
 	void luaentity_GetProperties(u16 id,
 			ObjectProperties *prop);
-	void luaentity_Step(u16 id, float dtime);
+	void luaentity_Step(u16 id, float dtime, float slept = 0);
 	bool luaentity_Punch(u16 id,
 			ServerActiveObject *puncher, float time_from_last_punch,
 			const ToolCapabilities *toolcap, v3f dir, s16 damage);
 	void luaentity_Rightclick(u16 id,
 			ServerActiveObject *clicker);
+
+	// State of the builtin dropped item, see LuaEntitySAO::stepNativeItem()
+	bool luaentity_GetItemState(u16 id, float *age, bool *stuck,
+			std::string *itemstring);
+	void luaentity_SetItemState(u16 id, float age, bool moving,
+			bool slippery);
 };
 
 
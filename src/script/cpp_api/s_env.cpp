@@ -151,8 +151,20 @@ void ScriptApiEnv::initializeEnvironment(ServerEnvironment *env)
 		bool simple_catch_up = true;
 		getboolfield(L, current_abm, "catch_up", simple_catch_up);
 
+		bool batch = false;
+		getboolfield(L, current_abm, "batch", batch);
+
+		// Triggers are counted by label, like the Lua profiler does
+		std::string profiler_name;
+		if (!getstringfield(L, current_abm, "label", profiler_name)) {
+			std::string mod;
+			getstringfield(L, current_abm, "mod_origin", mod);
+			profiler_name = mod + " #" + itos(id);
+		}
+
 		LuaABM *abm = new LuaABM(L, id, trigger_contents, required_neighbors,
-			trigger_interval, trigger_chance, simple_catch_up);
+			trigger_interval, trigger_chance, simple_catch_up, batch,
+			profiler_name);
 
 		env->addActiveBlockModifier(abm);
 
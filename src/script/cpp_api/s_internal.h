@@ -80,7 +80,8 @@ class LockChecker {
 		realityCheck();                                                        \
 		lua_State *L = getStack();                                             \
 		assert(lua_checkstack(L, 20));                                         \
-		StackUnroller stack_unroller(L);
+		StackUnroller stack_unroller(L);                                       \
+		ScriptProfilerScope profiler_scope(this->m_profiler, L, __FUNCTION__);
 
 #endif /* S_INTERNAL_H_ */
 
@@ -0,0 +1,114 @@
+/*
+Minetest
+Copyright (C) 2017 MultiCraft Development Team
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 3.0 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "cpp_api/s_profiler.h"
+#include "cpp_api/s_base.h"
+#include "porting.h"
+
+static inline u64 get_lua_mem(lua_State *L)
+{
+	return (u64)lua_gc(L, LUA_GCCOUNT, 0) * 1024 + lua_gc(L, LUA_GCCOUNTB, 0);
+}
+
+ScriptProfiler::ScriptProfiler() :
+	m_enabled(false),
+	m_start_time(0),
+	m_stop_time(0),
+	m_last_time(0),
+	m_last_mem(0)
+{
+}
+
+void ScriptProfiler::setEnabled(bool enabled)
+{
+	if (enabled == m_enabled)
+		return;
+
+	// Scopes opened before the switch do not count
+	m_frames.clear();
+	m_enabled = enabled;
+
+	u64 now = porting::getTimeUs();
+	if (enabled)
+		m_start_time += now - m_stop_time;
+	else
+		m_stop_time = now;
+}
+
+void ScriptProfiler::reset()
+{
+	m_profile.clear();
+	m_start_time = m_stop_time = porting::getTimeUs();
+}
+
+u64 ScriptProfiler::getElapsedUs() const
+{
+	return (m_enabled ? porting::getTimeUs() : m_stop_time) - m_start_time;
+}
+
+void ScriptProfiler::charge(lua_State *L)
+{
+	u64 now = porting::getTimeUs();
+	u64 mem = get_lua_mem(L);
+
+	if (!m_frames.empty()) {
+		const Frame &frame = m_frames.back();
+		ScriptProfileEntry &entry =
+			m_profile[std::make_pair(frame.mod, std::string(frame.callback))];
+		entry.time_us += now - m_last_time;
+		if (mem > m_last_mem)
+			entry.alloc_bytes += mem - m_last_mem;
+	}
+
+	m_last_time = now;
+	m_last_mem = mem;
+}
+
+size_t ScriptProfiler::enter(lua_State *L, const char *callback)
+{
+	charge(L);
+
+	Frame frame;
+	frame.callback = callback;
+	frame.mod = m_frames.empty() ? BUILTIN_MOD_NAME : m_frames.back().mod;
+	m_frames.push_back(frame);
+	m_profile[std::make_pair(frame.mod, std::string(callback))].calls++;
+	return m_frames.size();
+}
+
+void ScriptProfiler::leave(lua_State *L, size_t depth)
+{
+	// The profiler was switched off and on again within the scope
+	if (m_frames.size() != depth)
+		return;
+
+	charge(L);
+	m_frames.pop_back();
+}
+
+void ScriptProfiler::setMod(lua_State *L, const std::string &mod)
+{
+	if (m_frames.empty())
+		return;
+
+	charge(L);
+	Frame &frame = m_frames.back();
+	frame.mod = mod;
+	m_profile[std::make_pair(mod, std::string(frame.callback))].calls++;
+}
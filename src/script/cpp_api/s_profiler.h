@@ -0,0 +1,121 @@
+/*
+Minetest
+Copyright (C) 2017 MultiCraft Development Team
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 3.0 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#ifndef S_PROFILER_H_
+#define S_PROFILER_H_
+
+#include <map>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include <lua.h>
+}
+
+#include "irrlichttypes.h"
+
+struct ScriptProfileEntry {
+	u32 calls;
+	u64 time_us;
+	// Growth of the Lua heap, collected garbage is not subtracted
+	u64 alloc_bytes;
+
+	ScriptProfileEntry() :
+		calls(0),
+		time_us(0),
+		alloc_bytes(0)
+	{
+	}
+};
+
+/*
+	Attributes the wall time spent in Lua and the allocations to the mod
+	whose code runs and to the engine callback (e.g. environment_Step,
+	luaentity_Step, LuaABM::trigger) that called into Lua.
+
+	Every call into Lua opens a ScriptProfilerScope and the mod of the
+	innermost scope is switched whenever the script origin is set, so nested
+	callbacks (e.g. an on_construct run by a globalstep) only count their own
+	time. Until a callback sets the origin, its time is counted for the mod
+	of the enclosing callback, or for builtin at the outermost level.
+*/
+class ScriptProfiler {
+public:
+	// Entries by mod name and callback
+	typedef std::map<std::pair<std::string, std::string>,
+		ScriptProfileEntry> Profile;
+
+	ScriptProfiler();
+
+	inline bool isEnabled() const { return m_enabled; }
+	void setEnabled(bool enabled);
+	void reset();
+
+	const Profile &getProfile() const { return m_profile; }
+	// Wall time covered by the profile
+	u64 getElapsedUs() const;
+
+	// Returns the depth to give to leave()
+	size_t enter(lua_State *L, const char *callback);
+	void leave(lua_State *L, size_t depth);
+	void setMod(lua_State *L, const std::string &mod);
+
+private:
+	struct Frame {
+		const char *callback;
+		std::string mod;
+	};
+
+	// Charges the time and allocations since the last call to the
+	// innermost callback
+	void charge(lua_State *L);
+
+	bool m_enabled;
+	std::vector<Frame> m_frames;
+	Profile m_profile;
+
+	u64 m_start_time;
+	u64 m_stop_time;
+	u64 m_last_time;
+	u64 m_last_mem;
+};
+
+class ScriptProfilerScope {
+public:
+	ScriptProfilerScope(ScriptProfiler &profiler, lua_State *L,
+			const char *callback) :
+		m_profiler(profiler.isEnabled() ? &profiler : NULL),
+		m_L(L),
+		m_depth(m_profiler ? m_profiler->enter(L, callback) : 0)
+	{
+	}
+
+	~ScriptProfilerScope()
+	{
+		if (m_profiler)
+			m_profiler->leave(m_L, m_depth);
+	}
+
+private:
+	ScriptProfiler *m_profiler;
+	lua_State *m_L;
+	size_t m_depth;
+};
+
+#endif /* S_PROFILER_H_ */
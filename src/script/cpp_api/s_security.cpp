@@ -456,6 +456,18 @@ bool ScriptApiSecurity::safeLoadFile(lua_State *L, const char *path)
 }
 
 
+bool ScriptApiSecurity::safeLoadString(lua_State *L, const std::string &code,
+		const char *chunk_name)
+{
+	if (!code.empty() && code[0] == LUA_SIGNATURE[0]) {
+		lua_pushliteral(L, "Bytecode prohibited when mod security is enabled.");
+		return false;
+	}
+
+	return luaL_loadbuffer(L, code.data(), code.size(), chunk_name) == 0;
+}
+
+
 bool ScriptApiSecurity::checkPath(lua_State *L, const char *path,
 		bool write_required, bool *write_allowed)
 {
@@ -50,12 +50,24 @@ struct EnumString ModApiEnvMod::es_ClearObjectsMode[] =
 void LuaABM::trigger(ServerEnvironment *env, v3s16 p, MapNode n,
 		u32 active_object_count, u32 active_object_count_wider)
 {
+	if (m_batch) {
+		QueuedTrigger t;
+		t.p = p;
+		t.n = n;
+		t.active_object_count = active_object_count;
+		t.active_object_count_wider = active_object_count_wider;
+		m_queue.push_back(t);
+		return;
+	}
+
 	ServerScripting *scriptIface = env->getScriptIface();
 	scriptIface->realityCheck();
 
 	lua_State *L = scriptIface->getStack();
 	sanity_check(lua_checkstack(L, 20));
 	StackUnroller stack_unroller(L);
+	ScriptProfilerScope profiler_scope(scriptIface->getProfiler(), L,
+		"LuaABM::trigger");
 
 	int error_handler = PUSH_ERROR_HANDLER(L);
 
@@ -91,6 +103,71 @@ void LuaABM::trigger(ServerEnvironment *env, v3s16 p, MapNode n,
 	lua_pop(L, 1); // Pop error handler
 }
 
+void LuaABM::flush(ServerEnvironment *env)
+{
+	if (m_queue.empty())
+		return;
+
+	// Empty the queue first, the action may throw
+	std::vector<QueuedTrigger> queue;
+	queue.swap(m_queue);
+
+	ServerScripting *scriptIface = env->getScriptIface();
+	scriptIface->realityCheck();
+
+	lua_State *L = scriptIface->getStack();
+	sanity_check(lua_checkstack(L, 20));
+	StackUnroller stack_unroller(L);
+	ScriptProfilerScope profiler_scope(scriptIface->getProfiler(), L,
+		"LuaABM::trigger");
+
+	int error_handler = PUSH_ERROR_HANDLER(L);
+
+	// Get registered_abms
+	lua_getglobal(L, "core");
+	lua_getfield(L, -1, "registered_abms");
+	luaL_checktype(L, -1, LUA_TTABLE);
+	lua_remove(L, -2); // Remove core
+
+	// Get registered_abms[m_id]
+	lua_pushnumber(L, m_id);
+	lua_gettable(L, -2);
+	FATAL_ERROR_IF(lua_isnil(L, -1), "Entry with given id not found in registered_abms table");
+	lua_remove(L, -2); // Remove registered_abms
+
+	scriptIface->setOriginFromTable(-1);
+
+	// Call action with lists of all the triggers
+	luaL_checktype(L, -1, LUA_TTABLE);
+	lua_getfield(L, -1, "action");
+	luaL_checktype(L, -1, LUA_TFUNCTION);
+	lua_remove(L, -2); // Remove registered_abms[m_id]
+
+	INodeDefManager *ndef = env->getGameDef()->ndef();
+	int count = queue.size();
+	lua_createtable(L, count, 0);
+	lua_createtable(L, count, 0);
+	lua_createtable(L, count, 0);
+	lua_createtable(L, count, 0);
+	for (int i = 0; i < count; i++) {
+		const QueuedTrigger &t = queue[i];
+		push_v3s16(L, t.p);
+		lua_rawseti(L, -5, i + 1);
+		pushnode(L, t.n, ndef);
+		lua_rawseti(L, -4, i + 1);
+		lua_pushnumber(L, t.active_object_count);
+		lua_rawseti(L, -3, i + 1);
+		lua_pushnumber(L, t.active_object_count_wider);
+		lua_rawseti(L, -2, i + 1);
+	}
+
+	int result = lua_pcall(L, 4, 0, error_handler);
+	if (result)
+		scriptIface->scriptError(result, "LuaABM::trigger");
+
+	lua_pop(L, 1); // Pop error handler
+}
+
 void LuaLBM::trigger(ServerEnvironment *env, v3s16 p, MapNode n)
 {
 	ServerScripting *scriptIface = env->getScriptIface();
@@ -99,6 +176,8 @@ void LuaLBM::trigger(ServerEnvironment *env, v3s16 p, MapNode n)
 	lua_State *L = scriptIface->getStack();
 	sanity_check(lua_checkstack(L, 20));
 	StackUnroller stack_unroller(L);
+	ScriptProfilerScope profiler_scope(scriptIface->getProfiler(), L,
+		"LuaLBM::trigger");
 
 	int error_handler = PUSH_ERROR_HANDLER(L);
 
@@ -203,6 +282,51 @@ int ModApiEnvMod::l_swap_node(lua_State *L)
 	return 1;
 }
 
+static void read_bulk_positions(lua_State *L, int index,
+	std::vector<v3s16> &positions)
+{
+	luaL_checktype(L, index, LUA_TTABLE);
+	size_t len = lua_objlen(L, index);
+	positions.reserve(len);
+	for (size_t i = 1; i <= len; i++) {
+		lua_rawgeti(L, index, i);
+		positions.push_back(read_v3s16(L, -1));
+		lua_pop(L, 1);
+	}
+}
+
+// bulk_set_node([pos1, pos2, ...], node)
+int ModApiEnvMod::l_bulk_set_node(lua_State *L)
+{
+	GET_ENV_PTR;
+
+	INodeDefManager *ndef = env->getGameDef()->ndef();
+	// parameters
+	std::vector<v3s16> positions;
+	read_bulk_positions(L, 1, positions);
+	MapNode n = readnode(L, 2, ndef);
+	// Do it
+	bool succeeded = env->setNodes(positions, n);
+	lua_pushboolean(L, succeeded);
+	return 1;
+}
+
+// bulk_swap_node([pos1, pos2, ...], node)
+int ModApiEnvMod::l_bulk_swap_node(lua_State *L)
+{
+	GET_ENV_PTR;
+
+	INodeDefManager *ndef = env->getGameDef()->ndef();
+	// parameters
+	std::vector<v3s16> positions;
+	read_bulk_positions(L, 1, positions);
+	MapNode n = readnode(L, 2, ndef);
+	// Do it
+	bool succeeded = env->swapNodes(positions, n);
+	lua_pushboolean(L, succeeded);
+	return 1;
+}
+
 // get_node(pos)
 // pos = {x=num, y=num, z=num}
 int ModApiEnvMod::l_get_node(lua_State *L)
@@ -218,6 +342,74 @@ int ModApiEnvMod::l_get_node(lua_State *L)
 	return 1;
 }
 
+// Reads the position given as numbers x, y, z at index, see read_v3s16()
+static v3s16 read_raw_pos(lua_State *L, int index)
+{
+	v3d pf(luaL_checknumber(L, index), luaL_checknumber(L, index + 1),
+		luaL_checknumber(L, index + 2));
+	return doubleToInt(pf, 1.0);
+}
+
+// Reads the node given as content_id, param1, param2 at index
+static MapNode read_raw_node(lua_State *L, int index, INodeDefManager *ndef)
+{
+	int c = luaL_checkint(L, index);
+	if (c < 0 || c > 0xffff || c == CONTENT_IGNORE)
+		throw LuaError("Invalid content id " + itos(c));
+	// Undefined ids have no name or get the features of CONTENT_UNKNOWN
+	const ContentFeatures &f = ndef->get(c);
+	if (f.name.empty() ||
+			(c != CONTENT_UNKNOWN && &f == &ndef->get(CONTENT_UNKNOWN)))
+		throw LuaError("Invalid content id " + itos(c));
+	return MapNode(c, luaL_optint(L, index + 1, 0),
+		luaL_optint(L, index + 2, 0));
+}
+
+// get_node_raw(x, y, z) -> content_id, param1, param2, pos_ok
+int ModApiEnvMod::l_get_node_raw(lua_State *L)
+{
+	GET_ENV_PTR;
+
+	// pos
+	v3s16 pos = read_raw_pos(L, 1);
+	// Do it
+	bool pos_ok;
+	MapNode n = env->getMap().getNodeNoEx(pos, &pos_ok);
+	lua_pushinteger(L, n.getContent());
+	lua_pushinteger(L, n.getParam1());
+	lua_pushinteger(L, n.getParam2());
+	lua_pushboolean(L, pos_ok);
+	return 4;
+}
+
+// set_node_raw(x, y, z, content_id, param1, param2)
+int ModApiEnvMod::l_set_node_raw(lua_State *L)
+{
+	GET_ENV_PTR;
+
+	// parameters
+	v3s16 pos = read_raw_pos(L, 1);
+	MapNode n = read_raw_node(L, 4, env->getGameDef()->ndef());
+	// Do it
+	bool succeeded = env->setNode(pos, n);
+	lua_pushboolean(L, succeeded);
+	return 1;
+}
+
+// swap_node_raw(x, y, z, content_id, param1, param2)
+int ModApiEnvMod::l_swap_node_raw(lua_State *L)
+{
+	GET_ENV_PTR;
+
+	// parameters
+	v3s16 pos = read_raw_pos(L, 1);
+	MapNode n = read_raw_node(L, 4, env->getGameDef()->ndef());
+	// Do it
+	bool succeeded = env->swapNode(pos, n);
+	lua_pushboolean(L, succeeded);
+	return 1;
+}
+
 // get_node_or_nil(pos)
 // pos = {x=num, y=num, z=num}
 int ModApiEnvMod::l_get_node_or_nil(lua_State *L)
@@ -643,7 +835,79 @@ int ModApiEnvMod::l_find_node_near(lua_State *L)
 	return 0;
 }
 
-// find_nodes_in_area(minp, maxp, nodenames) -> list of positions
+// Reads the nodenames argument of the find_nodes_* functions
+static void read_node_filter(lua_State *L, int index, INodeDefManager *ndef,
+	std::set<content_t> &filter, std::vector<bool> &filter_bits)
+{
+	if (lua_istable(L, index)) {
+		lua_pushnil(L);
+		while (lua_next(L, index) != 0) {
+			// key at index -2 and value at index -1
+			luaL_checktype(L, -1, LUA_TSTRING);
+			ndef->getIds(lua_tostring(L, -1), filter);
+			// removes value, keeps key for next iteration
+			lua_pop(L, 1);
+		}
+	} else if (lua_isstring(L, index)) {
+		ndef->getIds(lua_tostring(L, index), filter);
+	}
+
+	filter_bits.assign(0x10000, false);
+	for (std::set<content_t>::const_iterator it = filter.begin();
+			it != filter.end(); ++it)
+		filter_bits[*it] = true;
+}
+
+/*
+	Appends the found positions to the table on top of the stack, either as
+	vectors or, if flat is set, as their indices in the VoxelArea of minp
+	and maxp, which saves creating a table per position.
+*/
+class FoundNodesWriter {
+public:
+	FoundNodesWriter(lua_State *L, v3s16 minp, v3s16 maxp, bool flat) :
+		m_L(L),
+		m_minp(minp),
+		m_ystride(maxp.X - minp.X + 1),
+		m_zstride(m_ystride * (maxp.Y - minp.Y + 1)),
+		m_flat(flat),
+		m_count(0)
+	{
+	}
+
+	inline void push(v3s16 p)
+	{
+		if (m_flat) {
+			lua_pushnumber(m_L, (p.Z - m_minp.Z) * m_zstride +
+				(p.Y - m_minp.Y) * m_ystride + (p.X - m_minp.X) + 1);
+		} else {
+			push_v3s16(m_L, p);
+		}
+		lua_rawseti(m_L, -2, ++m_count);
+	}
+
+private:
+	lua_State *m_L;
+	v3s16 m_minp;
+	u32 m_ystride;
+	u32 m_zstride;
+	bool m_flat;
+	u32 m_count;
+};
+
+// Part of the area minp, maxp in the block at blockpos
+static void get_block_part(v3s16 blockpos, v3s16 minp, v3s16 maxp,
+	v3s16 *nmin, v3s16 *nmax)
+{
+	v3s16 bmin = blockpos * MAP_BLOCKSIZE;
+	v3s16 bmax = bmin + v3s16(1, 1, 1) * (MAP_BLOCKSIZE - 1);
+	*nmin = v3s16(MYMAX(bmin.X, minp.X), MYMAX(bmin.Y, minp.Y),
+		MYMAX(bmin.Z, minp.Z));
+	*nmax = v3s16(MYMIN(bmax.X, maxp.X), MYMIN(bmax.Y, maxp.Y),
+		MYMIN(bmax.Z, maxp.Z));
+}
+
+// find_nodes_in_area(minp, maxp, nodenames, [flat]) -> list of positions
 // nodenames: eg. {"ignore", "group:tree"} or "default:dirt"
 int ModApiEnvMod::l_find_nodes_in_area(lua_State *L)
 {
@@ -663,34 +927,57 @@ int ModApiEnvMod::l_find_nodes_in_area(lua_State *L)
 	}
 
 	std::set<content_t> filter;
-	if (lua_istable(L, 3)) {
-		lua_pushnil(L);
-		while (lua_next(L, 3) != 0) {
-			// key at index -2 and value at index -1
-			luaL_checktype(L, -1, LUA_TSTRING);
-			ndef->getIds(lua_tostring(L, -1), filter);
-			// removes value, keeps key for next iteration
-			lua_pop(L, 1);
-		}
-	} else if (lua_isstring(L, 3)) {
-		ndef->getIds(lua_tostring(L, 3), filter);
-	}
+	std::vector<bool> filter_bits;
+	read_node_filter(L, 3, ndef, filter, filter_bits);
+	bool flat = lua_toboolean(L, 4);
 
 	UNORDERED_MAP<content_t, u32> individual_count;
+	Map &map = env->getMap();
 
 	lua_newtable(L);
-	u64 i = 0;
-	for (s16 x = minp.X; x <= maxp.X; x++)
-	for (s16 y = minp.Y; y <= maxp.Y; y++)
-	for (s16 z = minp.Z; z <= maxp.Z; z++) {
-		v3s16 p(x, y, z);
-		content_t c = env->getMap().getNodeNoEx(p).getContent();
-		if (filter.count(c) != 0) {
-			push_v3s16(L, p);
-			lua_rawseti(L, -2, ++i);
-			individual_count[c]++;
+	FoundNodesWriter found(L, minp, maxp, flat);
+	v3s16 bpmin = getNodeBlockPos(minp);
+	v3s16 bpmax = getNodeBlockPos(maxp);
+	for (s32 bz = bpmin.Z; bz <= bpmax.Z; bz++)
+	for (s32 by = bpmin.Y; by <= bpmax.Y; by++)
+	for (s32 bx = bpmin.X; bx <= bpmax.X; bx++) {
+		v3s16 blockpos(bx, by, bz);
+		v3s16 nmin, nmax;
+		get_block_part(blockpos, minp, maxp, &nmin, &nmax);
+
+		// Nodes of missing blocks read as "ignore"
+		MapBlock *block = map.getBlockNoCreateNoEx(blockpos);
+		if (!block || block->isDummy()) {
+			if (!filter_bits[CONTENT_IGNORE])
+				continue;
+			for (s32 z = nmin.Z; z <= nmax.Z; z++)
+			for (s32 y = nmin.Y; y <= nmax.Y; y++)
+			for (s32 x = nmin.X; x <= nmax.X; x++) {
+				found.push(v3s16(x, y, z));
+				individual_count[CONTENT_IGNORE]++;
+			}
+			continue;
+		}
+
+		if (!block->containsAny(filter_bits))
+			continue;
+
+		const MapNode *data = block->getData();
+		v3s16 rel = nmin - block->getPosRelative();
+		for (s32 z = nmin.Z; z <= nmax.Z; z++)
+		for (s32 y = nmin.Y; y <= nmax.Y; y++) {
+			u32 i = (z - nmin.Z + rel.Z) * MAP_BLOCKSIZE * MAP_BLOCKSIZE +
+				(y - nmin.Y + rel.Y) * MAP_BLOCKSIZE + rel.X;
+			for (s32 x = nmin.X; x <= nmax.X; x++, i++) {
+				content_t c = data[i].getContent();
+				if (filter_bits[c]) {
+					found.push(v3s16(x, y, z));
+					individual_count[c]++;
+				}
+			}
 		}
 	}
+
 	lua_newtable(L);
 	for (std::set<content_t>::const_iterator it = filter.begin();
 			it != filter.end(); ++it) {
@@ -700,7 +987,8 @@ int ModApiEnvMod::l_find_nodes_in_area(lua_State *L)
 	return 2;
 }
 
-// find_nodes_in_area_under_air(minp, maxp, nodenames) -> list of positions
+// find_nodes_in_area_under_air(minp, maxp, nodenames, [flat])
+// -> list of positions
 // nodenames: e.g. {"ignore", "group:tree"} or "default:dirt"
 int ModApiEnvMod::l_find_nodes_in_area_under_air(lua_State *L)
 {
@@ -727,36 +1015,60 @@ int ModApiEnvMod::l_find_nodes_in_area_under_air(lua_State *L)
 	}
 
 	std::set<content_t> filter;
+	std::vector<bool> filter_bits;
+	read_node_filter(L, 3, ndef, filter, filter_bits);
+	bool flat = lua_toboolean(L, 4);
 
-	if (lua_istable(L, 3)) {
-		lua_pushnil(L);
-		while (lua_next(L, 3) != 0) {
-			// key at index -2 and value at index -1
-			luaL_checktype(L, -1, LUA_TSTRING);
-			ndef->getIds(lua_tostring(L, -1), filter);
-			// removes value, keeps key for next iteration
-			lua_pop(L, 1);
-		}
-	} else if (lua_isstring(L, 3)) {
-		ndef->getIds(lua_tostring(L, 3), filter);
-	}
+	// Air is never found, whatever the filter
+	filter_bits[CONTENT_AIR] = false;
+	Map &map = env->getMap();
 
 	lua_newtable(L);
-	u64 i = 0;
-	for (s16 x = minp.X; x <= maxp.X; x++)
-	for (s16 z = minp.Z; z <= maxp.Z; z++) {
-		s16 y = minp.Y;
-		v3s16 p(x, y, z);
-		content_t c = env->getMap().getNodeNoEx(p).getContent();
-		for (; y <= maxp.Y; y++) {
-			v3s16 psurf(x, y + 1, z);
-			content_t csurf = env->getMap().getNodeNoEx(psurf).getContent();
-			if (c != CONTENT_AIR && csurf == CONTENT_AIR &&
-					filter.count(c) != 0) {
-				push_v3s16(L, v3s16(x, y, z));
-				lua_rawseti(L, -2, ++i);
+	FoundNodesWriter found(L, minp, maxp, flat);
+	v3s16 bpmin = getNodeBlockPos(minp);
+	v3s16 bpmax = getNodeBlockPos(maxp);
+	for (s32 bz = bpmin.Z; bz <= bpmax.Z; bz++)
+	for (s32 by = bpmin.Y; by <= bpmax.Y; by++)
+	for (s32 bx = bpmin.X; bx <= bpmax.X; bx++) {
+		v3s16 blockpos(bx, by, bz);
+		v3s16 nmin, nmax;
+		get_block_part(blockpos, minp, maxp, &nmin, &nmax);
+		s32 top = blockpos.Y * MAP_BLOCKSIZE + MAP_BLOCKSIZE - 1;
+
+		MapBlock *block = map.getBlockNoCreateNoEx(blockpos);
+		if (!block || block->isDummy()) {
+			// Only the top layer of a missing block can be under air
+			if (!filter_bits[CONTENT_IGNORE] || nmax.Y != top)
+				continue;
+			for (s32 z = nmin.Z; z <= nmax.Z; z++)
+			for (s32 x = nmin.X; x <= nmax.X; x++) {
+				v3s16 p(x, nmax.Y, z);
+				if (map.getNodeNoEx(p + v3s16(0, 1, 0)).getContent() ==
+						CONTENT_AIR)
+					found.push(p);
+			}
+			continue;
+		}
+
+		if (!block->containsAny(filter_bits))
+			continue;
+
+		const MapNode *data = block->getData();
+		v3s16 rel = nmin - block->getPosRelative();
+		for (s32 z = nmin.Z; z <= nmax.Z; z++)
+		for (s32 y = nmin.Y; y <= nmax.Y; y++) {
+			u32 i = (z - nmin.Z + rel.Z) * MAP_BLOCKSIZE * MAP_BLOCKSIZE +
+				(y - nmin.Y + rel.Y) * MAP_BLOCKSIZE + rel.X;
+			for (s32 x = nmin.X; x <= nmax.X; x++, i++) {
+				if (!filter_bits[data[i].getContent()])
+					continue;
+				// The node above is in the next block for the top layer
+				content_t csurf = (y == top) ?
+					map.getNodeNoEx(v3s16(x, y + 1, z)).getContent() :
+					data[i + MAP_BLOCKSIZE].getContent();
+				if (csurf == CONTENT_AIR)
+					found.push(v3s16(x, y, z));
 			}
-			c = csurf;
 		}
 	}
 	return 1;
@@ -824,6 +1136,30 @@ int ModApiEnvMod::l_get_voxel_manip(lua_State *L)
 	return 1;
 }
 
+// do_async_vmanip(func, param, p1, p2, light)
+// func is Lua source code and param is serialized,
+// see core.handle_async_vmanip()
+int ModApiEnvMod::l_do_async_vmanip(lua_State *L)
+{
+	GET_ENV_PTR;
+
+	size_t func_length, param_length;
+	const char *func = luaL_checklstring(L, 1, &func_length);
+	if (func_length > 0 && func[0] == LUA_SIGNATURE[0])
+		throw LuaError("do_async_vmanip: bytecode is not allowed");
+	const char *param = luaL_checklstring(L, 2, &param_length);
+	v3s16 bp1 = getNodeBlockPos(check_v3s16(L, 3));
+	v3s16 bp2 = getNodeBlockPos(check_v3s16(L, 4));
+	sortBoxVerticies(bp1, bp2);
+	bool update_light = lua_isboolean(L, 5) ? lua_toboolean(L, 5) : true;
+
+	ServerScripting *script = getServer(L)->getScriptIface();
+	lua_pushinteger(L, script->queueAsyncVManip(
+		std::string(func, func_length), std::string(param, param_length),
+		bp1, bp2, update_light));
+	return 1;
+}
+
 // clear_objects([options])
 // clear all objects in the environment
 // where options = {mode = "full" or "quick"}
@@ -1113,6 +1449,11 @@ void ModApiEnvMod::Initialize(lua_State *L, int top)
 	API_FCT(set_node);
 	API_FCT(add_node);
 	API_FCT(swap_node);
+	API_FCT(bulk_set_node);
+	API_FCT(bulk_swap_node);
+	API_FCT(get_node_raw);
+	API_FCT(set_node_raw);
+	API_FCT(swap_node_raw);
 	API_FCT(add_item);
 	API_FCT(remove_node);
 	API_FCT(get_node);
@@ -1144,6 +1485,7 @@ void ModApiEnvMod::Initialize(lua_State *L, int top)
 	API_FCT(get_perlin);
 	API_FCT(get_perlin_map);
 	API_FCT(get_voxel_manip);
+	API_FCT(do_async_vmanip);
 	API_FCT(clear_objects);
 	API_FCT(spawn_tree);
 	API_FCT(find_path);
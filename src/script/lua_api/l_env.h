@@ -39,10 +39,25 @@ class ModApiEnvMod : public ModApiBase {
 	// pos = {x=num, y=num, z=num}
 	static int l_swap_node(lua_State *L);
 
+	// bulk_set_node([pos1, pos2, ...], node)
+	static int l_bulk_set_node(lua_State *L);
+
+	// bulk_swap_node([pos1, pos2, ...], node)
+	static int l_bulk_swap_node(lua_State *L);
+
 	// get_node(pos)
 	// pos = {x=num, y=num, z=num}
 	static int l_get_node(lua_State *L);
 
+	// get_node_raw(x, y, z) -> content_id, param1, param2, pos_ok
+	static int l_get_node_raw(lua_State *L);
+
+	// set_node_raw(x, y, z, content_id, param1, param2)
+	static int l_set_node_raw(lua_State *L);
+
+	// swap_node_raw(x, y, z, content_id, param1, param2)
+	static int l_swap_node_raw(lua_State *L);
+
 	// get_node_or_nil(pos)
 	// pos = {x=num, y=num, z=num}
 	static int l_get_node_or_nil(lua_State *L);
@@ -149,6 +164,10 @@ class ModApiEnvMod : public ModApiBase {
 	// returns world-specific voxel manipulator
 	static int l_get_voxel_manip(lua_State *L);
 
+	// do_async_vmanip(func, param, p1, p2, light)
+	// runs func on a copy of the area on an async worker, returns the job id
+	static int l_do_async_vmanip(lua_State *L);
+
 	// clear_objects()
 	// clear all objects in the environment
 	static int l_clear_objects(lua_State *L);
@@ -190,17 +209,31 @@ class LuaABM : public ActiveBlockModifier {
 	float m_trigger_interval;
 	u32 m_trigger_chance;
 	bool m_simple_catch_up;
+	std::string m_profiler_name;
+
+	// Triggers queued until flush() if the action takes them all at once
+	struct QueuedTrigger {
+		v3s16 p;
+		MapNode n;
+		u32 active_object_count;
+		u32 active_object_count_wider;
+	};
+	bool m_batch;
+	std::vector<QueuedTrigger> m_queue;
 public:
 	LuaABM(lua_State *L, int id,
 			const std::set<std::string> &trigger_contents,
 			const std::set<std::string> &required_neighbors,
-			float trigger_interval, u32 trigger_chance, bool simple_catch_up):
+			float trigger_interval, u32 trigger_chance, bool simple_catch_up,
+			bool batch, const std::string &profiler_name):
 		m_id(id),
 		m_trigger_contents(trigger_contents),
 		m_required_neighbors(required_neighbors),
 		m_trigger_interval(trigger_interval),
 		m_trigger_chance(trigger_chance),
-		m_simple_catch_up(simple_catch_up)
+		m_simple_catch_up(simple_catch_up),
+		m_profiler_name(profiler_name),
+		m_batch(batch)
 	{
 	}
 	virtual const std::set<std::string> &getTriggerContents() const
@@ -223,8 +256,13 @@ class LuaABM : public ActiveBlockModifier {
 	{
 		return m_simple_catch_up;
 	}
+	virtual std::string getProfilerName() const
+	{
+		return m_profiler_name;
+	}
 	virtual void trigger(ServerEnvironment *env, v3s16 p, MapNode n,
 			u32 active_object_count, u32 active_object_count_wider);
+	virtual void flush(ServerEnvironment *env);
 };
 
 class LuaLBM : public LoadingBlockModifierDef
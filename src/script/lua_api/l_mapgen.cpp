@@ -1059,7 +1059,6 @@ int ModApiMapgen::l_register_ore(lua_State *L)
 	ore->clust_scarcity = getintfield_default(L, index, "clust_scarcity", 1);
 	ore->clust_num_ores = getintfield_default(L, index, "clust_num_ores", 1);
 	ore->clust_size     = getintfield_default(L, index, "clust_size", 0);
-	ore->noise          = NULL;
 	ore->flags          = 0;
 
 	//// Get noise_threshold
@@ -1255,6 +1254,8 @@ int ModApiMapgen::l_generate_ores(lua_State *L)
 	mg.seed = emerge->mgparams->seed;
 	mg.vm   = LuaVoxelManip::checkobject(L, 1)->vm;
 	mg.ndef = getServer(L)->getNodeDefManager();
+	mg.vm->copyBlocksIn();
+	mg.vm->setModified();
 
 	v3s16 pmin = lua_istable(L, 2) ? check_v3s16(L, 2) :
 			mg.vm->m_area.MinEdge + v3s16(1,1,1) * MAP_BLOCKSIZE;
@@ -1281,6 +1282,8 @@ int ModApiMapgen::l_generate_decorations(lua_State *L)
 	mg.seed = emerge->mgparams->seed;
 	mg.vm   = LuaVoxelManip::checkobject(L, 1)->vm;
 	mg.ndef = getServer(L)->getNodeDefManager();
+	mg.vm->copyBlocksIn();
+	mg.vm->setModified();
 
 	v3s16 pmin = lua_istable(L, 2) ? check_v3s16(L, 2) :
 			mg.vm->m_area.MinEdge + v3s16(1,1,1) * MAP_BLOCKSIZE;
@@ -1411,6 +1414,8 @@ int ModApiMapgen::l_place_schematic_on_vmanip(lua_State *L)
 
 	//// Read VoxelManip object
 	MMVManip *vm = LuaVoxelManip::checkobject(L, 1)->vm;
+	vm->copyBlocksIn();
+	vm->setModified();
 
 	//// Read position
 	v3s16 p = check_v3s16(L, 2);
@@ -990,6 +990,21 @@ int ObjectRef::l_get_luaentity(lua_State *L)
 	return 1;
 }
 
+// set_native_item(self, enable, gravity, ttl)
+int ObjectRef::l_set_native_item(lua_State *L)
+{
+	NO_MAP_LOCK_REQUIRED;
+	ObjectRef *ref = checkobject(L, 1);
+	LuaEntitySAO *co = getluaobject(ref);
+	if (co == NULL) return 0;
+	// Do it
+	bool enable = lua_toboolean(L, 2);
+	float gravity = luaL_optnumber(L, 3, 9.81);
+	float ttl = luaL_optnumber(L, 4, 0);
+	co->setNativeItem(enable, gravity, ttl);
+	return 0;
+}
+
 /* Player-only */
 
 // is_player_connected(self)
@@ -1959,6 +1974,7 @@ const luaL_Reg ObjectRef::methods[] = {
 	luamethod_aliased(ObjectRef, set_sprite, setsprite),
 	luamethod(ObjectRef, get_entity_name),
 	luamethod(ObjectRef, get_luaentity),
+	luamethod(ObjectRef, set_native_item),
 	// Player-only
 	luamethod(ObjectRef, is_player),
 	luamethod(ObjectRef, is_player_connected),
@@ -178,6 +178,9 @@ class ObjectRef : public ModApiBase {
 	// get_luaentity(self)
 	static int l_get_luaentity(lua_State *L);
 
+	// set_native_item(self, enable, gravity, ttl)
+	static int l_set_native_item(lua_State *L);
+
 	/* Player-only */
 
 	// is_player_connected(self)
@@ -507,6 +507,58 @@ int ModApiServer::l_set_last_run_mod(lua_State *L)
 	return 0;
 }
 
+// set_mod_profiling(enabled)
+int ModApiServer::l_set_mod_profiling(lua_State *L)
+{
+	NO_MAP_LOCK_REQUIRED;
+	getScriptApiBase(L)->getProfiler().setEnabled(lua_toboolean(L, 1));
+	return 0;
+}
+
+// get_mod_profile()
+// returns {enabled=bool, elapsed=us, entries={{mod=, callback=, calls=,
+// time=us, alloc=bytes}, ...}}
+int ModApiServer::l_get_mod_profile(lua_State *L)
+{
+	NO_MAP_LOCK_REQUIRED;
+	const ScriptProfiler &profiler = getScriptApiBase(L)->getProfiler();
+	const ScriptProfiler::Profile &profile = profiler.getProfile();
+
+	lua_newtable(L);
+	lua_pushboolean(L, profiler.isEnabled());
+	lua_setfield(L, -2, "enabled");
+	lua_pushnumber(L, profiler.getElapsedUs());
+	lua_setfield(L, -2, "elapsed");
+
+	lua_createtable(L, profile.size(), 0);
+	int i = 0;
+	for (ScriptProfiler::Profile::const_iterator it = profile.begin();
+			it != profile.end(); ++it) {
+		lua_createtable(L, 0, 5);
+		lua_pushstring(L, it->first.first.c_str());
+		lua_setfield(L, -2, "mod");
+		lua_pushstring(L, it->first.second.c_str());
+		lua_setfield(L, -2, "callback");
+		lua_pushnumber(L, it->second.calls);
+		lua_setfield(L, -2, "calls");
+		lua_pushnumber(L, it->second.time_us);
+		lua_setfield(L, -2, "time");
+		lua_pushnumber(L, it->second.alloc_bytes);
+		lua_setfield(L, -2, "alloc");
+		lua_rawseti(L, -2, ++i);
+	}
+	lua_setfield(L, -2, "entries");
+	return 1;
+}
+
+// reset_mod_profile()
+int ModApiServer::l_reset_mod_profile(lua_State *L)
+{
+	NO_MAP_LOCK_REQUIRED;
+	getScriptApiBase(L)->getProfiler().reset();
+	return 0;
+}
+
 void ModApiServer::Initialize(lua_State *L, int top)
 {
 	API_FCT(request_shutdown);
@@ -541,4 +593,8 @@ void ModApiServer::Initialize(lua_State *L, int top)
 
 	API_FCT(get_last_run_mod);
 	API_FCT(set_last_run_mod);
+
+	API_FCT(set_mod_profiling);
+	API_FCT(get_mod_profile);
+	API_FCT(reset_mod_profile);
 }
@@ -107,6 +107,15 @@ class ModApiServer : public ModApiBase
 	// set_last_run_mod(modname)
 	static int l_set_last_run_mod(lua_State *L);
 
+	// set_mod_profiling(enabled)
+	static int l_set_mod_profiling(lua_State *L);
+
+	// get_mod_profile()
+	static int l_get_mod_profile(lua_State *L);
+
+	// reset_mod_profile()
+	static int l_reset_mod_profile(lua_State *L);
+
 public:
 	static void Initialize(lua_State *L, int top);
 };
@@ -22,6 +22,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "lua_api/l_settings.h"
 #include "common/c_converter.h"
 #include "common/c_content.h"
+#include "common/c_serialize.h"
 #include "cpp_api/s_async.h"
 #include "serialization.h"
 #include <json/json.h>
@@ -468,6 +469,61 @@ int ModApiUtil::l_sha1(lua_State *L)
 	return 1;
 }
 
+// serialize_native(value) -> string, nothing if the value needs the Lua
+// implementation
+int ModApiUtil::l_serialize_native(lua_State *L)
+{
+	NO_MAP_LOCK_REQUIRED;
+	lua_settop(L, 1);
+
+	std::string str;
+	if (!serialize_lua_text(L, 1, str))
+		return 0;
+
+	lua_pushlstring(L, str.c_str(), str.size());
+	return 1;
+}
+
+// deserialize_native(str) -> true and value, false and error message, or
+// nothing if the code needs the Lua implementation
+int ModApiUtil::l_deserialize_native(lua_State *L)
+{
+	NO_MAP_LOCK_REQUIRED;
+	size_t len;
+	const char *str = luaL_checklstring(L, 1, &len);
+	lua_settop(L, 1);
+
+	if (len != 0 && str[0] == '\0') {
+		try {
+			deserialize_lua_binary(L, str, len);
+		} catch (SerializationError &e) {
+			lua_pushboolean(L, false);
+			lua_pushstring(L, e.what());
+			return 2;
+		}
+	} else {
+		if (!deserialize_lua_text(L, str, len))
+			return 0;
+	}
+
+	lua_pushboolean(L, true);
+	lua_insert(L, -2);
+	return 2;
+}
+
+// serialize_binary(value) -> string
+int ModApiUtil::l_serialize_binary(lua_State *L)
+{
+	NO_MAP_LOCK_REQUIRED;
+	lua_settop(L, 1);
+
+	std::string str;
+	serialize_lua_binary(L, 1, str);
+
+	lua_pushlstring(L, str.c_str(), str.size());
+	return 1;
+}
+
 void ModApiUtil::Initialize(lua_State *L, int top)
 {
 	API_FCT(log);
@@ -502,6 +558,10 @@ void ModApiUtil::Initialize(lua_State *L, int top)
 	API_FCT(get_version);
 	API_FCT(sha1);
 
+	API_FCT(serialize_native);
+	API_FCT(deserialize_native);
+	API_FCT(serialize_binary);
+
 	LuaSettings::create(L, g_settings, g_settings_path);
 	lua_setfield(L, top, "settings");
 }
@@ -527,6 +587,10 @@ void ModApiUtil::InitializeClient(lua_State *L, int top)
 
 	API_FCT(get_version);
 	API_FCT(sha1);
+
+	API_FCT(serialize_native);
+	API_FCT(deserialize_native);
+	API_FCT(serialize_binary);
 }
 
 void ModApiUtil::InitializeAsync(lua_State *L, int top)
@@ -554,6 +618,10 @@ void ModApiUtil::InitializeAsync(lua_State *L, int top)
 	API_FCT(get_version);
 	API_FCT(sha1);
 
+	API_FCT(serialize_native);
+	API_FCT(deserialize_native);
+	API_FCT(serialize_binary);
+
 	LuaSettings::create(L, g_settings, g_settings_path);
 	lua_setfield(L, top, "settings");
 }
@@ -99,6 +99,15 @@ class ModApiUtil : public ModApiBase
 	// sha1(string, raw)
 	static int l_sha1(lua_State *L);
 
+	// serialize_native(value)
+	static int l_serialize_native(lua_State *L);
+
+	// deserialize_native(str)
+	static int l_deserialize_native(lua_State *L);
+
+	// serialize_binary(value)
+	static int l_serialize_binary(lua_State *L);
+
 public:
 	static void Initialize(lua_State *L, int top);
 	static void InitializeAsync(lua_State *L, int top);
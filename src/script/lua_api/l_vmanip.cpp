@@ -28,6 +28,18 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "server.h"
 #include "mapgen.h"
 #include "voxelalgorithms.h"
+#include <algorithm>
+#include <string.h>
+
+// Gets the VoxelBuffer at narg, it has to be of the given type
+static LuaVoxelBuffer *get_voxel_buffer(lua_State *L, int narg,
+	VoxelBufferType type)
+{
+	LuaVoxelBuffer *buf = LuaVoxelBuffer::toobject(L, narg);
+	if (buf && buf->getType() != type)
+		throw LuaError("VoxelBuffer has the wrong type for this data");
+	return buf;
+}
 
 // garbage collector
 int LuaVoxelManip::gc_object(lua_State *L)
@@ -40,7 +52,8 @@ int LuaVoxelManip::gc_object(lua_State *L)
 
 int LuaVoxelManip::l_read_from_map(lua_State *L)
 {
-	MAP_LOCK_REQUIRED;
+	// Not available to async jobs
+	GET_ENV_PTR;
 
 	LuaVoxelManip *o = checkobject(L, 1);
 	MMVManip *vm = o->vm;
@@ -49,7 +62,7 @@ int LuaVoxelManip::l_read_from_map(lua_State *L)
 	v3s16 bp2 = getNodeBlockPos(check_v3s16(L, 3));
 	sortBoxVerticies(bp1, bp2);
 
-	vm->initialEmerge(bp1, bp2);
+	vm->initialEmerge(bp1, bp2, true, !o->is_mapgen_vm);
 
 	push_v3s16(L, vm->m_area.MinEdge);
 	push_v3s16(L, vm->m_area.MaxEdge);
@@ -66,6 +79,15 @@ int LuaVoxelManip::l_get_data(lua_State *L)
 
 	MMVManip *vm = o->vm;
 
+	vm->copyBlocksIn();
+
+	LuaVoxelBuffer *buf = get_voxel_buffer(L, 2, VOXELBUF_CONTENT);
+	if (buf) {
+		buf->readFromVManip(vm);
+		lua_pushvalue(L, 2);
+		return 1;
+	}
+
 	u32 volume = vm->m_area.getVolume();
 
 	if (use_buffer)
@@ -89,6 +111,15 @@ int LuaVoxelManip::l_set_data(lua_State *L)
 	LuaVoxelManip *o = checkobject(L, 1);
 	MMVManip *vm = o->vm;
 
+	vm->copyBlocksIn();
+	vm->setModified();
+
+	LuaVoxelBuffer *buf = get_voxel_buffer(L, 2, VOXELBUF_CONTENT);
+	if (buf) {
+		buf->writeToVManip(vm);
+		return 0;
+	}
+
 	if (!lua_istable(L, 2))
 		return 0;
 
@@ -116,6 +147,9 @@ int LuaVoxelManip::l_write_to_map(lua_State *L)
 	if (o->is_mapgen_vm || !update_light) {
 		o->vm->blitBackAll(&(o->modified_blocks));
 	} else {
+		// The lighting is updated over the whole area
+		o->vm->copyBlocksIn();
+		o->vm->setModified();
 		voxalgo::blit_back_with_light(map, o->vm,
 			&(o->modified_blocks));
 	}
@@ -141,6 +175,7 @@ int LuaVoxelManip::l_get_node_at(lua_State *L)
 	LuaVoxelManip *o = checkobject(L, 1);
 	v3s16 pos        = check_v3s16(L, 2);
 
+	o->vm->copyBlocksIn(VoxelArea(pos, pos));
 	pushnode(L, o->vm->getNodeNoExNoEmerge(pos), ndef);
 	return 1;
 }
@@ -155,6 +190,8 @@ int LuaVoxelManip::l_set_node_at(lua_State *L)
 	v3s16 pos        = check_v3s16(L, 2);
 	MapNode n        = readnode(L, 3, ndef);
 
+	o->vm->copyBlocksIn(VoxelArea(pos, pos));
+	o->vm->setModified(VoxelArea(pos, pos));
 	o->vm->setNodeNoEmerge(pos, n);
 
 	return 0;
@@ -169,6 +206,8 @@ int LuaVoxelManip::l_update_liquids(lua_State *L)
 	Map *map = &(env->getMap());
 	INodeDefManager *ndef = getServer(L)->getNodeDefManager();
 	MMVManip *vm = o->vm;
+	vm->copyBlocksIn();
+	vm->setModified();
 
 	Mapgen mg;
 	mg.vm   = vm;
@@ -253,6 +292,15 @@ int LuaVoxelManip::l_get_light_data(lua_State *L)
 	LuaVoxelManip *o = checkobject(L, 1);
 	MMVManip *vm = o->vm;
 
+	vm->copyBlocksIn();
+
+	LuaVoxelBuffer *buf = get_voxel_buffer(L, 2, VOXELBUF_PARAM1);
+	if (buf) {
+		buf->readFromVManip(vm);
+		lua_pushvalue(L, 2);
+		return 1;
+	}
+
 	u32 volume = vm->m_area.getVolume();
 
 	lua_newtable(L);
@@ -272,6 +320,15 @@ int LuaVoxelManip::l_set_light_data(lua_State *L)
 	LuaVoxelManip *o = checkobject(L, 1);
 	MMVManip *vm = o->vm;
 
+	vm->copyBlocksIn();
+	vm->setModified();
+
+	LuaVoxelBuffer *buf = get_voxel_buffer(L, 2, VOXELBUF_PARAM1);
+	if (buf) {
+		buf->writeToVManip(vm);
+		return 0;
+	}
+
 	if (!lua_istable(L, 2))
 		return 0;
 
@@ -297,6 +354,15 @@ int LuaVoxelManip::l_get_param2_data(lua_State *L)
 
 	MMVManip *vm = o->vm;
 
+	vm->copyBlocksIn();
+
+	LuaVoxelBuffer *buf = get_voxel_buffer(L, 2, VOXELBUF_PARAM2);
+	if (buf) {
+		buf->readFromVManip(vm);
+		lua_pushvalue(L, 2);
+		return 1;
+	}
+
 	u32 volume = vm->m_area.getVolume();
 
 	if (use_buffer)
@@ -320,6 +386,15 @@ int LuaVoxelManip::l_set_param2_data(lua_State *L)
 	LuaVoxelManip *o = checkobject(L, 1);
 	MMVManip *vm = o->vm;
 
+	vm->copyBlocksIn();
+	vm->setModified();
+
+	LuaVoxelBuffer *buf = get_voxel_buffer(L, 2, VOXELBUF_PARAM2);
+	if (buf) {
+		buf->writeToVManip(vm);
+		return 0;
+	}
+
 	if (!lua_istable(L, 2))
 		return 0;
 
@@ -385,7 +460,7 @@ LuaVoxelManip::LuaVoxelManip(Map *map, v3s16 p1, v3s16 p2)
 	v3s16 bp1 = getNodeBlockPos(p1);
 	v3s16 bp2 = getNodeBlockPos(p2);
 	sortBoxVerticies(bp1, bp2);
-	vm->initialEmerge(bp1, bp2);
+	vm->initialEmerge(bp1, bp2, true, true);
 }
 
 LuaVoxelManip::~LuaVoxelManip()
@@ -394,6 +469,15 @@ LuaVoxelManip::~LuaVoxelManip()
 		delete vm;
 }
 
+void LuaVoxelManip::releaseVManip()
+{
+	if (!is_mapgen_vm)
+		return;
+
+	vm = new MMVManip(NULL);
+	is_mapgen_vm = false;
+}
+
 // LuaVoxelManip()
 // Creates an LuaVoxelManip and leaves it on top of stack
 int LuaVoxelManip::create_object(lua_State *L)
@@ -472,3 +556,362 @@ const luaL_Reg LuaVoxelManip::methods[] = {
 	luamethod(LuaVoxelManip, get_emerged_area),
 	{0,0}
 };
+
+/*
+  LuaVoxelBuffer
+ */
+
+struct EnumString es_VoxelBufferType[] =
+{
+	{VOXELBUF_CONTENT, "content"},
+	{VOXELBUF_PARAM1,  "param1"},
+	{VOXELBUF_PARAM2,  "param2"},
+	{0, NULL},
+};
+
+// garbage collector
+int LuaVoxelBuffer::gc_object(lua_State *L)
+{
+	LuaVoxelBuffer *o = *(LuaVoxelBuffer **)(lua_touserdata(L, 1));
+	delete o;
+
+	return 0;
+}
+
+// buf[i]; any other key is looked up in the method table (upvalue)
+int LuaVoxelBuffer::l_index(lua_State *L)
+{
+	NO_MAP_LOCK_REQUIRED;
+
+	LuaVoxelBuffer *o = checkobject(L, 1);
+
+	if (lua_type(L, 2) != LUA_TNUMBER) {
+		lua_pushvalue(L, 2);
+		lua_rawget(L, lua_upvalueindex(1));
+		return 1;
+	}
+
+	lua_Integer i = lua_tointeger(L, 2);
+	if (i < 1 || i > (lua_Integer)o->getSize()) {
+		lua_pushnil(L);
+		return 1;
+	}
+
+	lua_pushinteger(L, o->get(i - 1));
+	return 1;
+}
+
+// buf[i] = value
+int LuaVoxelBuffer::l_newindex(lua_State *L)
+{
+	NO_MAP_LOCK_REQUIRED;
+
+	LuaVoxelBuffer *o = checkobject(L, 1);
+	lua_Integer i     = luaL_checkinteger(L, 2);
+	lua_Integer value = luaL_checkinteger(L, 3);
+
+	if (i < 1 || i > (lua_Integer)o->getSize())
+		throw LuaError("VoxelBuffer index out of range");
+
+	o->set(i - 1, value);
+	return 0;
+}
+
+// len(self), also #self
+int LuaVoxelBuffer::l_len(lua_State *L)
+{
+	NO_MAP_LOCK_REQUIRED;
+
+	LuaVoxelBuffer *o = checkobject(L, 1);
+
+	lua_pushinteger(L, o->getSize());
+	return 1;
+}
+
+// get_type(self)
+int LuaVoxelBuffer::l_get_type(lua_State *L)
+{
+	NO_MAP_LOCK_REQUIRED;
+
+	LuaVoxelBuffer *o = checkobject(L, 1);
+
+	for (const EnumString *es = es_VoxelBufferType; es->str; es++) {
+		if (es->num == o->type) {
+			lua_pushstring(L, es->str);
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+// resize(self, size)
+int LuaVoxelBuffer::l_resize(lua_State *L)
+{
+	NO_MAP_LOCK_REQUIRED;
+
+	LuaVoxelBuffer *o = checkobject(L, 1);
+	lua_Integer size  = luaL_checkinteger(L, 2);
+
+	if (size < 0)
+		throw LuaError("VoxelBuffer size can not be negative");
+
+	o->resize(size);
+	return 0;
+}
+
+// fill(self, value, [first, last])
+int LuaVoxelBuffer::l_fill(lua_State *L)
+{
+	NO_MAP_LOCK_REQUIRED;
+
+	LuaVoxelBuffer *o = checkobject(L, 1);
+	lua_Integer value = luaL_checkinteger(L, 2);
+	lua_Integer first = luaL_optinteger(L, 3, 1);
+	lua_Integer last  = luaL_optinteger(L, 4, o->getSize());
+
+	if (first > last)
+		return 0;
+	if (first < 1 || last > (lua_Integer)o->getSize())
+		throw LuaError("VoxelBuffer range out of bounds");
+
+	if (o->type == VOXELBUF_CONTENT) {
+		std::fill(o->content.begin() + (first - 1), o->content.begin() + last,
+			(u16)value);
+	} else {
+		std::fill(o->params.begin() + (first - 1), o->params.begin() + last,
+			(u8)value);
+	}
+
+	return 0;
+}
+
+// copy_from(self, src, [dst_first, src_first, count])
+// src is a VoxelBuffer of the same type or a flat array table
+int LuaVoxelBuffer::l_copy_from(lua_State *L)
+{
+	NO_MAP_LOCK_REQUIRED;
+
+	LuaVoxelBuffer *o   = checkobject(L, 1);
+	LuaVoxelBuffer *src = toobject(L, 2);
+	if (!src)
+		luaL_checktype(L, 2, LUA_TTABLE);
+
+	lua_Integer src_size  = src ? src->getSize() : lua_objlen(L, 2);
+	lua_Integer dst_first = luaL_optinteger(L, 3, 1);
+	lua_Integer src_first = luaL_optinteger(L, 4, 1);
+	lua_Integer count     = luaL_optinteger(L, 5, src_size - src_first + 1);
+
+	if (count <= 0)
+		return 0;
+	if (dst_first < 1 || dst_first + count - 1 > (lua_Integer)o->getSize() ||
+			src_first < 1 || src_first + count - 1 > src_size)
+		throw LuaError("VoxelBuffer range out of bounds");
+
+	if (src) {
+		if (src->type != o->type)
+			throw LuaError("VoxelBuffer types do not match");
+
+		// memmove semantics, src may be this buffer
+		if (o->type == VOXELBUF_CONTENT) {
+			memmove(&o->content[dst_first - 1], &src->content[src_first - 1],
+				count * sizeof(u16));
+		} else {
+			memmove(&o->params[dst_first - 1], &src->params[src_first - 1],
+				count);
+		}
+		return 0;
+	}
+
+	for (lua_Integer i = 0; i != count; i++) {
+		lua_rawgeti(L, 2, src_first + i);
+		o->set(dst_first - 1 + i, lua_tointeger(L, -1));
+		lua_pop(L, 1);
+	}
+
+	return 0;
+}
+
+// to_table(self, [table])
+int LuaVoxelBuffer::l_to_table(lua_State *L)
+{
+	NO_MAP_LOCK_REQUIRED;
+
+	LuaVoxelBuffer *o = checkobject(L, 1);
+	u32 size = o->getSize();
+
+	if (lua_istable(L, 2))
+		lua_pushvalue(L, 2);
+	else
+		lua_createtable(L, size, 0);
+
+	for (u32 i = 0; i != size; i++) {
+		lua_pushinteger(L, o->get(i));
+		lua_rawseti(L, -2, i + 1);
+	}
+
+	return 1;
+}
+
+LuaVoxelBuffer::LuaVoxelBuffer(VoxelBufferType type, u32 size)
+{
+	this->type = type;
+	resize(size);
+}
+
+u32 LuaVoxelBuffer::getSize() const
+{
+	return type == VOXELBUF_CONTENT ? content.size() : params.size();
+}
+
+void LuaVoxelBuffer::resize(u32 size)
+{
+	if (type == VOXELBUF_CONTENT)
+		content.resize(size);
+	else
+		params.resize(size);
+}
+
+void LuaVoxelBuffer::readFromVManip(const MMVManip *vm)
+{
+	u32 volume = vm->m_area.getVolume();
+	const MapNode *data = vm->m_data;
+
+	resize(volume);
+
+	switch (type) {
+	case VOXELBUF_CONTENT:
+		for (u32 i = 0; i != volume; i++)
+			content[i] = data[i].getContent();
+		break;
+	case VOXELBUF_PARAM1:
+		for (u32 i = 0; i != volume; i++)
+			params[i] = data[i].param1;
+		break;
+	case VOXELBUF_PARAM2:
+		for (u32 i = 0; i != volume; i++)
+			params[i] = data[i].param2;
+		break;
+	}
+}
+
+void LuaVoxelBuffer::writeToVManip(MMVManip *vm) const
+{
+	u32 volume = vm->m_area.getVolume();
+	MapNode *data = vm->m_data;
+
+	if (getSize() != volume)
+		throw LuaError("VoxelBuffer size does not match the VoxelManip volume");
+
+	switch (type) {
+	case VOXELBUF_CONTENT:
+		for (u32 i = 0; i != volume; i++)
+			data[i].setContent(content[i]);
+		break;
+	case VOXELBUF_PARAM1:
+		for (u32 i = 0; i != volume; i++)
+			data[i].param1 = params[i];
+		break;
+	case VOXELBUF_PARAM2:
+		for (u32 i = 0; i != volume; i++)
+			data[i].param2 = params[i];
+		break;
+	}
+}
+
+// VoxelBuffer(type, [size])
+// Creates a LuaVoxelBuffer and leaves it on top of stack
+int LuaVoxelBuffer::create_object(lua_State *L)
+{
+	NO_MAP_LOCK_REQUIRED;
+
+	int type;
+	if (!string_to_enum(es_VoxelBufferType, type, luaL_checkstring(L, 1)))
+		throw LuaError("Invalid VoxelBuffer type");
+
+	lua_Integer size = luaL_optinteger(L, 2, 0);
+	if (size < 0)
+		throw LuaError("VoxelBuffer size can not be negative");
+
+	LuaVoxelBuffer *o = new LuaVoxelBuffer((VoxelBufferType)type, size);
+
+	*(void **)(lua_newuserdata(L, sizeof(void *))) = o;
+	luaL_getmetatable(L, className);
+	lua_setmetatable(L, -2);
+	return 1;
+}
+
+LuaVoxelBuffer *LuaVoxelBuffer::checkobject(lua_State *L, int narg)
+{
+	NO_MAP_LOCK_REQUIRED;
+
+	luaL_checktype(L, narg, LUA_TUSERDATA);
+
+	void *ud = luaL_checkudata(L, narg, className);
+	if (!ud)
+		luaL_typerror(L, narg, className);
+
+	return *(LuaVoxelBuffer **)ud;  // unbox pointer
+}
+
+LuaVoxelBuffer *LuaVoxelBuffer::toobject(lua_State *L, int narg)
+{
+	void *ud = lua_touserdata(L, narg);
+	if (!ud || !lua_getmetatable(L, narg))
+		return NULL;
+
+	luaL_getmetatable(L, className);
+	bool is_buffer = lua_rawequal(L, -1, -2);
+	lua_pop(L, 2);
+
+	return is_buffer ? *(LuaVoxelBuffer **)ud : NULL;
+}
+
+void LuaVoxelBuffer::Register(lua_State *L)
+{
+	lua_newtable(L);
+	int methodtable = lua_gettop(L);
+	luaL_newmetatable(L, className);
+	int metatable = lua_gettop(L);
+
+	lua_pushliteral(L, "__metatable");
+	lua_pushvalue(L, methodtable);
+	lua_settable(L, metatable);  // hide metatable from Lua getmetatable()
+
+	// Numeric keys are elements, anything else is looked up in the methods
+	lua_pushliteral(L, "__index");
+	lua_pushvalue(L, methodtable);
+	lua_pushcclosure(L, l_index, 1);
+	lua_settable(L, metatable);
+
+	lua_pushliteral(L, "__newindex");
+	lua_pushcfunction(L, l_newindex);
+	lua_settable(L, metatable);
+
+	lua_pushliteral(L, "__len");
+	lua_pushcfunction(L, l_len);
+	lua_settable(L, metatable);
+
+	lua_pushliteral(L, "__gc");
+	lua_pushcfunction(L, gc_object);
+	lua_settable(L, metatable);
+
+	lua_pop(L, 1);  // drop metatable
+
+	luaL_openlib(L, 0, methods, 0);  // fill methodtable
+	lua_pop(L, 1);  // drop methodtable
+
+	// Can be created from Lua (VoxelBuffer(type, [size]))
+	lua_register(L, className, create_object);
+}
+
+const char LuaVoxelBuffer::className[] = "VoxelBuffer";
+const luaL_Reg LuaVoxelBuffer::methods[] = {
+	luamethod(LuaVoxelBuffer, len),
+	luamethod(LuaVoxelBuffer, get_type),
+	luamethod(LuaVoxelBuffer, resize),
+	luamethod(LuaVoxelBuffer, fill),
+	luamethod(LuaVoxelBuffer, copy_from),
+	luamethod(LuaVoxelBuffer, to_table),
+	{0,0}
+};
@@ -21,6 +21,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #define L_VMANIP_H_
 
 #include <map>
+#include <vector>
 #include "irr_v3d.h"
 #include "lua_api/l_base.h"
 
@@ -72,6 +73,10 @@ class LuaVoxelManip : public ModApiBase
 	LuaVoxelManip(Map *map);
 	~LuaVoxelManip();
 
+	// Stops using the VoxelManip passed by a mapgen or an async job,
+	// leaving an empty one owned by this object
+	void releaseVManip();
+
 	// LuaVoxelManip()
 	// Creates a LuaVoxelManip and leaves it on top of stack
 	static int create_object(lua_State *L);
@@ -81,4 +86,75 @@ class LuaVoxelManip : public ModApiBase
 	static void Register(lua_State *L);
 };
 
+enum VoxelBufferType {
+	VOXELBUF_CONTENT,
+	VOXELBUF_PARAM1,
+	VOXELBUF_PARAM2,
+};
+
+/*
+  VoxelBuffer
+
+  Typed flat array holding one field of the nodes of a VoxelManip.
+  VoxelManip:get_data() and friends copy into it and VoxelManip:set_data()
+  copies from it in one native loop, instead of a Lua table access per node.
+ */
+class LuaVoxelBuffer : public ModApiBase
+{
+private:
+	VoxelBufferType type;
+	// Only the vector matching the type is used
+	std::vector<u16> content;
+	std::vector<u8> params;
+
+	static const char className[];
+	static const luaL_Reg methods[];
+
+	static int gc_object(lua_State *L);
+	static int l_index(lua_State *L);
+	static int l_newindex(lua_State *L);
+
+	static int l_len(lua_State *L);
+	static int l_get_type(lua_State *L);
+	static int l_resize(lua_State *L);
+	static int l_fill(lua_State *L);
+	static int l_copy_from(lua_State *L);
+	static int l_to_table(lua_State *L);
+
+public:
+	LuaVoxelBuffer(VoxelBufferType type, u32 size);
+
+	VoxelBufferType getType() const { return type; }
+	u32 getSize() const;
+	void resize(u32 size);
+
+	inline u16 get(u32 i) const
+	{
+		return type == VOXELBUF_CONTENT ? content[i] : params[i];
+	}
+
+	inline void set(u32 i, u16 value)
+	{
+		if (type == VOXELBUF_CONTENT)
+			content[i] = value;
+		else
+			params[i] = value;
+	}
+
+	// Copies the field of every node of the VoxelManip, resizing the buffer
+	void readFromVManip(const MMVManip *vm);
+	// Buffer size must match the VoxelManip volume
+	void writeToVManip(MMVManip *vm) const;
+
+	// VoxelBuffer(type, [size])
+	// Creates a LuaVoxelBuffer and leaves it on top of stack
+	static int create_object(lua_State *L);
+
+	static LuaVoxelBuffer *checkobject(lua_State *L, int narg);
+	// Returns NULL if the value at narg is not a VoxelBuffer
+	static LuaVoxelBuffer *toobject(lua_State *L, int narg);
+
+	static void Register(lua_State *L);
+};
+
 #endif /* L_VMANIP_H_ */
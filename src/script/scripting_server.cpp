@@ -20,7 +20,14 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "scripting_server.h"
 #include "server.h"
 #include "log.h"
+#include "map.h"
+#include "mapblock.h"
+#include "serverenvironment.h"
 #include "settings.h"
+#include "porting.h"
+#include "profiler.h"
+#include "voxelalgorithms.h"
+#include "cpp_api/s_async.h"
 #include "cpp_api/s_internal.h"
 #include "lua_api/l_areastore.h"
 #include "lua_api/l_base.h"
@@ -47,7 +54,13 @@ extern "C" {
 #include "lualib.h"
 }
 
-ServerScripting::ServerScripting(Server* server)
+ServerScripting::ServerScripting(Server* server) :
+	m_async(NULL),
+	m_gc_stepping(g_settings->getFloat("lua_gc_step_budget") > 0),
+	m_gc_started(false),
+	m_gc_in_cycle(false),
+	m_gc_pause(MYMAX(g_settings->getU16("lua_gc_pause"), 100)),
+	m_gc_threshold(0)
 {
 	setGameDef(server);
 
@@ -77,6 +90,9 @@ ServerScripting::ServerScripting(Server* server)
 	lua_pushstring(L, "game");
 	lua_setglobal(L, "INIT");
 
+	if (g_settings->getBool("profiler.mod_accounting"))
+		m_profiler.setEnabled(true);
+
 	infostream << "SCRIPTAPI: Initialized game modules" << std::endl;
 }
 
@@ -93,6 +109,7 @@ void ServerScripting::InitializeModApi(lua_State *L, int top)
 	LuaPcgRandom::Register(L);
 	LuaSecureRandom::Register(L);
 	LuaVoxelManip::Register(L);
+	LuaVoxelBuffer::Register(L);
 	NodeMetaRef::Register(L);
 	NodeTimerRef::Register(L);
 	ObjectRef::Register(L);
@@ -113,7 +130,255 @@ void ServerScripting::InitializeModApi(lua_State *L, int top)
 	ModApiStorage::Initialize(L, top);
 }
 
+void ServerScripting::InitializeAsyncApi(lua_State *L, int top)
+{
+	LuaPerlinNoise::Register(L);
+	LuaPerlinNoiseMap::Register(L);
+	LuaPseudoRandom::Register(L);
+	LuaPcgRandom::Register(L);
+	LuaVoxelManip::Register(L);
+	LuaVoxelBuffer::Register(L);
+
+	ModApiItemMod::InitializeAsync(L, top);
+	ModApiUtil::InitializeAsync(L, top);
+}
+
+ServerScripting::~ServerScripting()
+{
+	stopAsync();
+}
+
+void ServerScripting::stopAsync()
+{
+	// Stop the workers before freeing what they might still use
+	delete m_async;
+	m_async = NULL;
+
+	for (std::map<unsigned int, AsyncVManipJob>::iterator
+			it = m_async_vmanip_jobs.begin();
+			it != m_async_vmanip_jobs.end(); ++it) {
+		delete it->second.vm;
+		delete it->second.original;
+	}
+	m_async_vmanip_jobs.clear();
+}
+
+unsigned int ServerScripting::queueAsyncVManip(const std::string &func,
+	const std::string &param, v3s16 blockpos_min, v3s16 blockpos_max,
+	bool update_light)
+{
+	if (!m_async) {
+		m_async = new AsyncEngine();
+		m_async->registerStateInitializer(InitializeAsyncApi);
+
+		s32 num_threads = g_settings->getS32("num_async_threads");
+		if (num_threads <= 0)
+			num_threads = MYMAX((s32)Thread::getNumberOfProcessors() - 1, 1);
+		m_async->initialize(num_threads, getServer());
+	}
+
+	ServerMap *map = &((ServerEnvironment *)getEnv())->getServerMap();
+
+	AsyncVManipJob job;
+	job.vm = new MMVManip(map);
+	job.update_light = update_light;
+
+	// Copied in right away, but marked unmodified so that only the blocks
+	// the job changes are written back
+	job.vm->initialEmerge(blockpos_min, blockpos_max, true, true);
+	job.vm->copyBlocksIn();
+
+	const VoxelArea &area = job.vm->m_area;
+	job.original = new VoxelManipulator();
+	job.original->addArea(area);
+	job.original->copyFrom(job.vm->m_data, area, area.MinEdge,
+		area.MinEdge, area.getExtent());
+
+	unsigned int id = m_async->queueAsyncJob(func, param, job.vm);
+	m_async_vmanip_jobs[id] = job;
+	return id;
+}
+
+// Whether the nodes of the block at blockpos are the same in a and b,
+// which cover the same area
+static bool block_nodes_equal(const VoxelManipulator &a,
+	const VoxelManipulator &b, v3s16 blockpos)
+{
+	v3s16 p0 = blockpos * MAP_BLOCKSIZE;
+	for (s16 z = p0.Z; z < p0.Z + MAP_BLOCKSIZE; z++)
+	for (s16 y = p0.Y; y < p0.Y + MAP_BLOCKSIZE; y++) {
+		u32 i = a.m_area.index(p0.X, y, z);
+		if (memcmp(&a.m_data[i], &b.m_data[i],
+				MAP_BLOCKSIZE * sizeof(MapNode)) != 0)
+			return false;
+	}
+	return true;
+}
+
+// Same for the nodes of block and vm, ignoring the light which changes
+// with edits nearby
+static bool block_nodes_equal(MapBlock *block, const VoxelManipulator &vm)
+{
+	const MapNode *data = block->getData();
+	v3s16 p0 = block->getPosRelative();
+	for (s16 z = 0; z < MAP_BLOCKSIZE; z++)
+	for (s16 y = 0; y < MAP_BLOCKSIZE; y++) {
+		const MapNode *n = &data[(z * MAP_BLOCKSIZE + y) * MAP_BLOCKSIZE];
+		const MapNode *vn = &vm.m_data[vm.m_area.index(p0.X, p0.Y + y, p0.Z + z)];
+		for (s16 x = 0; x < MAP_BLOCKSIZE; x++) {
+			if (n[x].param0 != vn[x].param0 || n[x].param2 != vn[x].param2)
+				return false;
+		}
+	}
+	return true;
+}
+
+bool ServerScripting::blitBackAsyncVManip(const AsyncVManipJob &job)
+{
+	ServerMap *map = &((ServerEnvironment *)getEnv())->getServerMap();
+	MMVManip *vm = job.vm;
+	v3s16 bpmin = getNodeBlockPos(vm->m_area.MinEdge);
+	v3s16 bpmax = getNodeBlockPos(vm->m_area.MaxEdge);
+
+	/*
+		A block changed by the job must be unchanged in the map, else the
+		result is dropped.  The blocks only changed in the map are updated
+		in vm, the lighting update writes back all of them.
+	*/
+	std::vector<MapBlock *> refresh;
+	for (s16 z = bpmin.Z; z <= bpmax.Z; z++)
+	for (s16 y = bpmin.Y; y <= bpmax.Y; y++)
+	for (s16 x = bpmin.X; x <= bpmax.X; x++) {
+		v3s16 p(x, y, z);
+		MapBlock *block = map->getBlockNoCreateNoEx(p);
+		bool job_changed = !block_nodes_equal(*vm, *job.original, p);
+		bool map_changed = block && !block->isDummy() &&
+			!block_nodes_equal(block, *job.original);
+
+		if (job_changed && map_changed)
+			return false;
+
+		if (job_changed)
+			vm->setModified(VoxelArea(p * MAP_BLOCKSIZE,
+				(p + 1) * MAP_BLOCKSIZE - v3s16(1, 1, 1)));
+		else if (map_changed)
+			refresh.push_back(block);
+	}
+
+	std::map<v3s16, MapBlock *> modified_blocks;
+	if (job.update_light) {
+		for (size_t i = 0; i != refresh.size(); i++)
+			refresh[i]->copyTo(*vm);
+		vm->setModified();
+		voxalgo::blit_back_with_light(map, vm, &modified_blocks);
+	} else {
+		vm->blitBackAll(&modified_blocks);
+	}
+
+	MapEditEvent event;
+	event.type = MEET_OTHER;
+	for (std::map<v3s16, MapBlock *>::iterator it = modified_blocks.begin();
+			it != modified_blocks.end(); ++it)
+		event.modified_blocks.insert(it->first);
+	map->dispatchEvent(&event);
+
+	return true;
+}
+
+void ServerScripting::stepAsync()
+{
+	if (!m_async)
+		return;
+
+	SCRIPTAPI_PRECHECKHEADER
+
+	LuaJobInfo result;
+	while (m_async->popJobResult(&result)) {
+		// Failed jobs have an empty result
+		bool written = false;
+		std::map<unsigned int, AsyncVManipJob>::iterator it =
+			m_async_vmanip_jobs.find(result.id);
+		if (it != m_async_vmanip_jobs.end()) {
+			if (!result.serializedResult.empty())
+				written = blitBackAsyncVManip(it->second);
+			delete it->second.vm;
+			delete it->second.original;
+			m_async_vmanip_jobs.erase(it);
+		}
+
+		int error_handler = PUSH_ERROR_HANDLER(L);
+		lua_getglobal(L, "core");
+		lua_getfield(L, -1, "async_event_handler");
+		luaL_checktype(L, -1, LUA_TFUNCTION);
+
+		lua_pushinteger(L, result.id);
+		lua_pushlstring(L, result.serializedResult.data(),
+			result.serializedResult.size());
+		lua_pushboolean(L, written);
+		try {
+			PCALL_RES(lua_pcall(L, 3, 0, error_handler));
+		} catch (LuaError &e) {
+			getServer()->setAsyncFatalError(
+				std::string("async_event_handler: ") + e.what());
+			lua_pop(L, 1); // Pop error message
+		}
+		lua_pop(L, 2); // Pop core and error handler
+	}
+}
+
 void log_deprecated(const std::string &message)
 {
 	log_deprecated(NULL, message);
 }
+
+// Work done by the collector of Lua per allocated byte, in percent.  The
+// default is 200, the backstop should not spread its cycles too thin.
+#define LUA_GC_BACKSTOP_STEPMUL 1000
+
+static inline u64 get_lua_heap(lua_State *L)
+{
+	return (u64)lua_gc(L, LUA_GCCOUNT, 0) * 1024 + lua_gc(L, LUA_GCCOUNTB, 0);
+}
+
+void ServerScripting::stepGarbageCollector(u32 budget_us)
+{
+	SCRIPTAPI_PRECHECKHEADER
+
+	u64 heap = get_lua_heap(L);
+	g_profiler->avg("Lua: heap size [KiB]", heap / 1024);
+	if (!m_gc_stepping)
+		return;
+
+	// Once the mods are loaded, the collector of Lua only starts when the
+	// heap grew twice as much as for the stepped cycles.  It stays as a
+	// backstop for when the steps can't keep up, or don't run, and then
+	// finishes its cycles quickly.
+	if (!m_gc_started) {
+		lua_gc(L, LUA_GCSETPAUSE, 2 * m_gc_pause);
+		lua_gc(L, LUA_GCSETSTEPMUL, LUA_GC_BACKSTOP_STEPMUL);
+		m_gc_threshold = heap / 100 * m_gc_pause;
+		m_gc_started = true;
+	}
+
+	if (!m_gc_in_cycle) {
+		if (heap < m_gc_threshold)
+			return;
+		m_gc_in_cycle = true;
+	}
+
+	// Lua has no way to tell whether the backstop finished the cycle, the
+	// steps then run a new one
+	u64 start = porting::getTimeUs();
+	bool finished;
+	do {
+		finished = lua_gc(L, LUA_GCSTEP, 0) != 0;
+	} while (!finished && porting::getTimeUs() - start < budget_us);
+
+	g_profiler->avg("Lua: GC pause [ms]",
+		(porting::getTimeUs() - start) / 1000.0f);
+	if (finished) {
+		m_gc_in_cycle = false;
+		m_gc_threshold = get_lua_heap(L) / 100 * m_gc_pause;
+		g_profiler->add("Lua: GC cycles", 1);
+	}
+}
@@ -20,6 +20,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #ifndef SERVER_SCRIPTING_H_
 #define SERVER_SCRIPTING_H_
 
+#include <map>
 #include "cpp_api/s_base.h"
 #include "cpp_api/s_entity.h"
 #include "cpp_api/s_env.h"
@@ -29,6 +30,11 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "cpp_api/s_server.h"
 #include "cpp_api/s_security.h"
 #include "util/basic_macros.h"
+#include "irr_v3d.h"
+
+class AsyncEngine;
+class MMVManip;
+class VoxelManipulator;
 
 /*****************************************************************************/
 /* Scripting <-> Server Game Interface                                       */
@@ -46,11 +52,53 @@ class ServerScripting:
 {
 public:
 	ServerScripting(Server* server);
+	~ServerScripting();
 
 	// use ScriptApiBase::loadMod() to load mods
 
+	// Queues the serialized func(vm, param) to run on an async worker, vm
+	// holding a copy of the blocks blockpos_min ... blockpos_max.
+	// Returns the job id.
+	unsigned int queueAsyncVManip(const std::string &func,
+		const std::string &param, v3s16 blockpos_min, v3s16 blockpos_max,
+		bool update_light);
+
+	// Writes back the VoxelManips of the finished async jobs and runs their
+	// callbacks, needs the environment lock
+	void stepAsync();
+
+	// Stops the async workers, dropping the unfinished jobs
+	void stopAsync();
+
+	// Collects Lua garbage for about budget_us if lua_gc_step_budget is set
+	// and reports the Lua heap to the profiler, see lua_gc_step_budget
+	void stepGarbageCollector(u32 budget_us);
+
 private:
+	struct AsyncVManipJob {
+		MMVManip *vm;
+		// Nodes of vm before the job
+		VoxelManipulator *original;
+		bool update_light;
+	};
+
 	void InitializeModApi(lua_State *L, int top);
+	static void InitializeAsyncApi(lua_State *L, int top);
+
+	bool blitBackAsyncVManip(const AsyncVManipJob &job);
+
+	// Started by the first job
+	AsyncEngine *m_async;
+
+	// Incremental garbage collection driven by stepGarbageCollector()
+	bool m_gc_stepping;
+	bool m_gc_started;
+	bool m_gc_in_cycle;
+	u32 m_gc_pause;
+	// Heap size in bytes at which the next cycle starts
+	u64 m_gc_threshold;
+	std::map<unsigned int, AsyncVManipJob> m_async_vmanip_jobs;
+
 	DISABLE_CLASS_COPY(ServerScripting);
 };
 
@@ -60,6 +60,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "util/base64.h"
 #include "util/sha1.h"
 #include "util/hex.h"
+#include "util/workerpool.h"
 #include "database.h"
 
 class ClientNotFoundException : public BaseException
@@ -194,6 +195,8 @@ Server::Server(
 	m_masterserver_timer = 0.0;
 	m_emergethread_trigger_timer = 0.0;
 	m_savemap_timer = 0.0;
+	m_step_length = 0.0;
+	m_lua_gc_step_budget = 0.0;
 
 	m_step_dtime = 0.0;
 	m_lag = g_settings->getFloat("dedicated_server_step");
@@ -212,6 +215,8 @@ Server::Server(
 	infostream<<"- world:  "<<m_path_world<<std::endl;
 	infostream<<"- game:   "<<m_gamespec.path<<std::endl;
 
+	TimeTaker startup_timer("Server startup");
+
 	// Create world if it doesn't exist
 	if(!loadGameConfAndInitWorld(m_path_world, m_gamespec))
 		throw ServerError("Failed to initialize world");
@@ -242,6 +247,7 @@ Server::Server(
 
 	// Initialize scripting
 	infostream<<"Server: Initializing Lua"<<std::endl;
+	TimeTaker mods_timer("Server: Loading mods");
 
 	m_script = new ServerScripting(this);
 
@@ -268,9 +274,12 @@ Server::Server(
 				<< script_path << "\"]" << std::endl;
 		m_script->loadMod(script_path, mod.name);
 	}
+	u64 mods_ms = mods_timer.stop(true);
 
 	// Read Textures and calculate sha1 sums
+	TimeTaker media_timer("Server: Filling media cache");
 	fillMediaCache();
+	u64 media_ms = media_timer.stop(true);
 
 	// Apply item aliases in the node definition manager
 	m_nodedef->updateAliases(m_itemdef);
@@ -325,7 +334,14 @@ Server::Server(
 	add_legacy_abms(m_env, m_nodedef);
 
 	m_liquid_transform_every = g_settings->getFloat("liquid_update");
+	m_step_length = g_settings->getFloat("dedicated_server_step");
+	m_lua_gc_step_budget = MYMIN(
+		g_settings->getFloat("lua_gc_step_budget") / 1000, m_step_length);
 	m_max_chatmessage_length = g_settings->getU16("chat_message_max_size");
+
+	actionstream << "Server: Started in " << startup_timer.stop(true)
+			<< "ms (mods: " << mods_ms << "ms, media: " << media_ms
+			<< "ms)" << std::endl;
 }
 
 Server::~Server()
@@ -375,6 +391,7 @@ Server::~Server()
 	// Stop threads
 	stop();
 	delete m_thread;
+	m_script->stopAsync();
 
 	// Delete things in the reverse order of creation
 	delete m_emerge;
@@ -481,6 +498,7 @@ void Server::AsyncRunStep(bool initial_step)
 		return;
 
 	g_profiler->add("Server::AsyncRunStep with dtime (num)", 1);
+	u64 step_start_us = porting::getTimeUs();
 
 	//infostream<<"Server steps "<<dtime<<std::endl;
 	//infostream<<"Server::AsyncRunStep(): dtime="<<dtime<<std::endl;
@@ -534,6 +552,13 @@ void Server::AsyncRunStep(bool initial_step)
 		m_env->step(dtime);
 	}
 
+	{
+		MutexAutoLock lock(m_env_mutex);
+		// Write back the results of async VoxelManip jobs
+		ScopeProfiler sp(g_profiler, "Server: async jobs", SPT_AVG);
+		m_script->stepAsync();
+	}
+
 	static const float map_timer_and_unload_dtime = 2.92;
 	if(m_map_timer_and_unload_interval.step(dtime, map_timer_and_unload_dtime))
 	{
@@ -1008,6 +1033,17 @@ void Server::AsyncRunStep(bool initial_step)
 		}
 	}
 
+	// Collect Lua garbage in the rest of the step
+	if (m_lua_gc_step_budget > 0) {
+		float left = m_step_length -
+			(porting::getTimeUs() - step_start_us) / 1e6f;
+		u32 budget_us = MYMAX(MYMIN(m_lua_gc_step_budget, left), 0) * 1e6f;
+
+		MutexAutoLock lock(m_env_mutex);
+		ScopeProfiler sp(g_profiler, "Server: Lua GC", SPT_AVG);
+		m_script->stepGarbageCollector(budget_us);
+	}
+
 	// Timed shutdown
 	static const float shutdown_msg_times[] =
 	{
@@ -1257,6 +1293,8 @@ void Server::setTimeOfDay(u32 time)
 
 void Server::onMapEditEvent(MapEditEvent *event)
 {
+	m_env->wakeObjects(event);
+
 	if(m_ignore_map_edit_events)
 		return;
 	if(m_ignore_map_edit_events_area.contains(event->getArea()))
@@ -2357,6 +2395,67 @@ void Server::SendBlocks(float dtime)
 	m_clients.unlock();
 }
 
+/*
+	A media file found by Server::fillMediaCache(), the checksums of the files
+	whose size and modification time did not change are kept in the world
+	directory so they are only read again once they change.
+*/
+struct MediaFileInfo
+{
+	std::string name;
+	std::string path;
+	u64 size;
+	u64 mtime;
+	// Base64 encoded SHA1 digest, empty if the file could not be read
+	std::string sha1_digest;
+};
+
+#define MEDIA_SHA1_CACHE_FILE "media_sha1.txt"
+
+// Reads and hashes the file of a MediaFileInfo, run by WorkerPool::run()
+static void hash_media_file_job(u32 job, void *data)
+{
+	MediaFileInfo &file = *((std::vector<MediaFileInfo *> *)data)->at(job);
+
+	std::ifstream fis(file.path.c_str(), std::ios_base::binary);
+	if (!fis.good()) {
+		errorstream << "Server::fillMediaCache(): Could not open \""
+				<< file.name << "\" for reading" << std::endl;
+		return;
+	}
+	std::ostringstream tmp_os(std::ios_base::binary);
+	bool bad = false;
+	for(;;) {
+		char buf[1024];
+		fis.read(buf, 1024);
+		std::streamsize len = fis.gcount();
+		tmp_os.write(buf, len);
+		if (fis.eof())
+			break;
+		if (!fis.good()) {
+			bad = true;
+			break;
+		}
+	}
+	if(bad) {
+		errorstream<<"Server::fillMediaCache(): Failed to read \""
+				<< file.name << "\"" << std::endl;
+		return;
+	}
+	if(tmp_os.str().length() == 0) {
+		errorstream << "Server::fillMediaCache(): Empty file \""
+				<< file.path << "\"" << std::endl;
+		return;
+	}
+
+	SHA1 sha1;
+	sha1.addBytes(tmp_os.str().c_str(), tmp_os.str().length());
+
+	unsigned char *digest = sha1.getDigest();
+	file.sha1_digest = base64_encode(digest, 20);
+	free(digest);
+}
+
 void Server::fillMediaCache()
 {
 	DSTACK(FUNCTION_NAME);
@@ -2375,7 +2474,8 @@ void Server::fillMediaCache()
 	}
 	paths.push_back(porting::path_user + DIR_DELIM + "textures" + DIR_DELIM + "server");
 
-	// Collect media file information from paths into cache
+	// Collect the media files from paths
+	std::vector<MediaFileInfo> files;
 	for(std::vector<std::string>::iterator i = paths.begin();
 			i != paths.end(); ++i) {
 		std::string mediapath = *i;
@@ -2403,54 +2503,77 @@ void Server::fillMediaCache()
 						<< filename << "\"" << std::endl;
 				continue;
 			}
-			// Ok, attempt to load the file and add to cache
-			std::string filepath = mediapath + DIR_DELIM + filename;
-			// Read data
-			std::ifstream fis(filepath.c_str(), std::ios_base::binary);
-			if (!fis.good()) {
-				errorstream << "Server::fillMediaCache(): Could not open \""
-						<< filename << "\" for reading" << std::endl;
-				continue;
-			}
-			std::ostringstream tmp_os(std::ios_base::binary);
-			bool bad = false;
-			for(;;) {
-				char buf[1024];
-				fis.read(buf, 1024);
-				std::streamsize len = fis.gcount();
-				tmp_os.write(buf, len);
-				if (fis.eof())
-					break;
-				if (!fis.good()) {
-					bad = true;
-					break;
-				}
-			}
-			if(bad) {
-				errorstream<<"Server::fillMediaCache(): Failed to read \""
-						<< filename << "\"" << std::endl;
-				continue;
-			}
-			if(tmp_os.str().length() == 0) {
-				errorstream << "Server::fillMediaCache(): Empty file \""
-						<< filepath << "\"" << std::endl;
-				continue;
-			}
+			MediaFileInfo file;
+			file.name = filename;
+			file.path = mediapath + DIR_DELIM + filename;
+			if (!fs::GetFileInfo(file.path, &file.size, &file.mtime))
+				file.size = file.mtime = 0;
+			files.push_back(file);
+		}
+	}
 
-			SHA1 sha1;
-			sha1.addBytes(tmp_os.str().c_str(), tmp_os.str().length());
+	// Read the checksums kept from the last start:
+	// size mtime sha1_base64 path, one file per line
+	std::map<std::string, MediaFileInfo> cached;
+	std::string cache_path = m_path_world + DIR_DELIM MEDIA_SHA1_CACHE_FILE;
+	std::ifstream cache_is(cache_path.c_str());
+	std::string line;
+	while (std::getline(cache_is, line)) {
+		std::istringstream iss(line);
+		MediaFileInfo file;
+		iss >> file.size >> file.mtime >> file.sha1_digest;
+		iss.get();
+		std::getline(iss, file.path);
+		if (!iss.fail() && !file.path.empty())
+			cached[file.path] = file;
+	}
+	cache_is.close();
+
+	// Hash the new and the changed files in parallel
+	std::vector<MediaFileInfo *> to_hash;
+	for (size_t i = 0; i < files.size(); i++) {
+		MediaFileInfo &file = files[i];
+		std::map<std::string, MediaFileInfo>::const_iterator c =
+			cached.find(file.path);
+		if (file.mtime != 0 && c != cached.end() &&
+				c->second.size == file.size && c->second.mtime == file.mtime)
+			file.sha1_digest = c->second.sha1_digest;
+		else
+			to_hash.push_back(&file);
+	}
 
-			unsigned char *digest = sha1.getDigest();
-			std::string sha1_base64 = base64_encode(digest, 20);
-			std::string sha1_hex = hex_encode((char*)digest, 20);
-			free(digest);
+	if (!to_hash.empty()) {
+		WorkerPool pool("MediaHash", MYMIN(Thread::getNumberOfProcessors(),
+			to_hash.size()));
+		pool.run(to_hash.size(), hash_media_file_job, &to_hash);
+	}
 
-			// Put in list
-			m_media[filename] = MediaInfo(filepath, sha1_base64);
-			verbosestream << "Server: " << sha1_hex << " is " << filename
-					<< std::endl;
-		}
+	// Put in list, in the order of the paths so later files still replace
+	// earlier ones of the same name
+	std::ostringstream cache_os;
+	for (size_t i = 0; i < files.size(); i++) {
+		const MediaFileInfo &file = files[i];
+		if (file.sha1_digest.empty())
+			continue;
+
+		m_media[file.name] = MediaInfo(file.path, file.sha1_digest);
+		verbosestream << "Server: "
+				<< hex_encode(base64_decode(file.sha1_digest))
+				<< " is " << file.name << std::endl;
+
+		if (file.mtime != 0)
+			cache_os << file.size << " " << file.mtime << " "
+				<< file.sha1_digest << " " << file.path << "\n";
 	}
+
+	if (!to_hash.empty() || cached.size() != files.size()) {
+		if (!fs::safeWriteToFile(cache_path, cache_os.str()))
+			warningstream << "Server: Failed to write " << cache_path
+				<< std::endl;
+	}
+
+	infostream << "Server: " << files.size() << " media files, "
+			<< to_hash.size() << " of them hashed" << std::endl;
 }
 
 void Server::sendMediaAnnouncement(u16 peer_id)
@@ -2829,6 +2952,7 @@ void Server::DeleteClient(u16 peer_id, ClientDeletionReason reason)
 			MutexAutoLock env_lock(m_env_mutex);
 			m_clients.DeleteClient(peer_id);
 		}
+		m_emerge->removePeer(peer_id);
 	}
 
 	// Send leave chat message to all remaining clients
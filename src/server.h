@@ -537,6 +537,11 @@ class Server : public con::PeerHandler, public MapEventReceiver,
 	float m_savemap_timer;
 	IntervalLimiter m_map_timer_and_unload_interval;
 
+	// Length of a step and the part of it that may be spent collecting Lua
+	// garbage, in seconds; no collection steps if 0
+	float m_step_length;
+	float m_lua_gc_step_budget;
+
 	// Environment
 	ServerEnvironment *m_env;
 
@@ -377,6 +377,7 @@ ServerEnvironment::ServerEnvironment(ServerMap *map,
 	m_script(scriptIface),
 	m_server(server),
 	m_path_world(path_world),
+	m_sleeping_objects_reach(0),
 	m_send_recommended_timer(0),
 	m_active_block_interval_overload_skip(0),
 	m_game_time(0),
@@ -692,6 +693,8 @@ void ServerEnvironment::loadDefaultMeta()
 struct ActiveABM
 {
 	ActiveBlockModifier *abm;
+	// Index in ABMHandler::m_abms
+	u32 index;
 	int chance;
 	std::set<content_t> required_neighbors;
 };
@@ -701,6 +704,9 @@ class ABMHandler
 private:
 	ServerEnvironment *m_env;
 	std::vector<std::vector<ActiveABM> *> m_aabms;
+	// The modifiers that run and how often they were triggered
+	std::vector<ActiveBlockModifier *> m_abms;
+	std::vector<u32> m_trigger_counts;
 public:
 	ABMHandler(std::vector<ABMWithState> &abms,
 		float dtime_s, ServerEnvironment *env,
@@ -729,6 +735,7 @@ class ABMHandler
 				chance = 1;
 			ActiveABM aabm;
 			aabm.abm = abm;
+			aabm.index = m_abms.size();
 			if (abm->getSimpleCatchUp()) {
 				float intervals = actual_interval / trigger_interval;
 				if(intervals == 0)
@@ -764,7 +771,9 @@ class ABMHandler
 					m_aabms[c]->push_back(aabm);
 				}
 			}
+			m_abms.push_back(abm);
 		}
+		m_trigger_counts.resize(m_abms.size(), 0);
 	}
 
 	~ABMHandler()
@@ -861,6 +870,8 @@ class ABMHandler
 				}
 				neighbor_found:
 
+				m_trigger_counts[i->index]++;
+
 				// Call all the trigger variations
 				i->abm->trigger(m_env, p, n);
 				i->abm->trigger(m_env, p, n,
@@ -874,6 +885,23 @@ class ABMHandler
 			}
 		}
 	}
+
+	// Must be called after the last apply(), runs the queued triggers
+	void flush()
+	{
+		for (size_t i = 0; i < m_abms.size(); i++) {
+			ActiveBlockModifier *abm = m_abms[i];
+			if (m_trigger_counts[i] == 0)
+				continue;
+
+			std::string name = abm->getProfilerName();
+			if (!name.empty())
+				g_profiler->add("ABM triggers: " + name, m_trigger_counts[i]);
+			m_trigger_counts[i] = 0;
+
+			abm->flush(m_env);
+		}
+	}
 };
 
 void ServerEnvironment::activateBlock(MapBlock *block, u32 additional_dtime)
@@ -932,6 +960,7 @@ void ServerEnvironment::activateBlock(MapBlock *block, u32 additional_dtime)
 	/* Handle ActiveBlockModifiers */
 	ABMHandler abmhandler(m_abms, dtime_s, this, false);
 	abmhandler.apply(block);
+	abmhandler.flush();
 }
 
 void ServerEnvironment::addActiveBlockModifier(ActiveBlockModifier *abm)
@@ -1007,6 +1036,101 @@ bool ServerEnvironment::swapNode(v3s16 p, const MapNode &n)
 	return true;
 }
 
+// Keeps the distinct loaded positions and their nodes
+static bool get_bulk_nodes(Map *map, const std::vector<v3s16> &positions,
+	std::vector<v3s16> &nodes, std::vector<MapNode> *old_nodes)
+{
+	std::set<v3s16> seen;
+	bool all_valid = true;
+	nodes.reserve(positions.size());
+	for (std::vector<v3s16>::const_iterator it = positions.begin();
+			it != positions.end(); ++it) {
+		if (!seen.insert(*it).second)
+			continue;
+
+		bool is_valid_position;
+		MapNode n = map->getNodeNoEx(*it, &is_valid_position);
+		if (!is_valid_position) {
+			all_valid = false;
+			continue;
+		}
+		nodes.push_back(*it);
+		if (old_nodes)
+			old_nodes->push_back(n);
+	}
+	return all_valid;
+}
+
+bool ServerEnvironment::setNodes(const std::vector<v3s16> &positions,
+	const MapNode &n)
+{
+	INodeDefManager *ndef = m_server->ndef();
+	std::vector<v3s16> nodes;
+	std::vector<MapNode> old_nodes;
+	bool all_valid = get_bulk_nodes(m_map, positions, nodes, &old_nodes);
+
+	// Call destructors, reading each node again like setNode() as the
+	// destructors of the previous ones may have changed it
+	for (size_t i = 0; i < nodes.size(); i++) {
+		old_nodes[i] = m_map->getNodeNoEx(nodes[i]);
+		if (ndef->get(old_nodes[i]).has_on_destruct)
+			m_script->node_on_destruct(nodes[i], old_nodes[i]);
+	}
+
+	// Keep the nodes addNodesWithEvent() sets, the destructors may have
+	// unloaded blocks
+	size_t num_loaded = 0;
+	for (size_t i = 0; i < nodes.size(); i++) {
+		bool is_valid_position;
+		m_map->getNodeNoEx(nodes[i], &is_valid_position);
+		if (!is_valid_position) {
+			all_valid = false;
+			continue;
+		}
+		nodes[num_loaded] = nodes[i];
+		old_nodes[num_loaded] = old_nodes[i];
+		num_loaded++;
+	}
+	nodes.resize(num_loaded);
+	old_nodes.resize(num_loaded);
+
+	// Replace nodes, none are set if n can't be placed
+	if (m_map->addNodesWithEvent(nodes, n) == 0)
+		return nodes.empty() && all_valid;
+
+	for (size_t i = 0; i < nodes.size(); i++) {
+		// Update active VoxelManipulator if a mapgen thread
+		m_map->updateVManip(nodes[i]);
+
+		// Call post-destructor
+		if (ndef->get(old_nodes[i]).has_after_destruct)
+			m_script->node_after_destruct(nodes[i], old_nodes[i]);
+	}
+
+	// Call constructors
+	if (ndef->get(n).has_on_construct) {
+		for (size_t i = 0; i < nodes.size(); i++)
+			m_script->node_on_construct(nodes[i], n);
+	}
+
+	return all_valid;
+}
+
+bool ServerEnvironment::swapNodes(const std::vector<v3s16> &positions,
+	const MapNode &n)
+{
+	std::vector<v3s16> nodes;
+	bool all_valid = get_bulk_nodes(m_map, positions, nodes, NULL);
+
+	bool all_set = m_map->addNodesWithEvent(nodes, n, false) == nodes.size();
+
+	// Update active VoxelManipulator if a mapgen thread
+	for (size_t i = 0; i < nodes.size(); i++)
+		m_map->updateVManip(nodes[i]);
+
+	return all_valid && all_set;
+}
+
 void ServerEnvironment::getObjectsInsideRadius(std::vector<u16> &objects, v3f pos, float radius)
 {
 	for (ActiveObjectMap::iterator i = m_active_objects.begin();
@@ -1020,6 +1144,83 @@ void ServerEnvironment::getObjectsInsideRadius(std::vector<u16> &objects, v3f po
 	}
 }
 
+void ServerEnvironment::addSleepingObject(u16 id, v3s16 blockpos, s16 reach)
+{
+	m_sleeping_objects[blockpos].insert(id);
+	m_sleeping_objects_reach = MYMAX(m_sleeping_objects_reach, reach);
+}
+
+void ServerEnvironment::removeSleepingObject(u16 id, v3s16 blockpos)
+{
+	std::map<v3s16, std::set<u16> >::iterator it =
+		m_sleeping_objects.find(blockpos);
+	if (it == m_sleeping_objects.end())
+		return;
+	it->second.erase(id);
+	if (it->second.empty())
+		m_sleeping_objects.erase(it);
+	if (m_sleeping_objects.empty())
+		m_sleeping_objects_reach = 0;
+}
+
+void ServerEnvironment::wakeObjects(const MapEditEvent *event)
+{
+	if (m_sleeping_objects.empty())
+		return;
+
+	// The blocks of the objects whose collision box may touch the nodes
+	s16 reach = m_sleeping_objects_reach;
+	std::set<v3s16> blocks;
+	switch (event->type) {
+	case MEET_ADDNODE:
+	case MEET_REMOVENODE:
+	case MEET_SWAPNODE: {
+		v3s16 bpmin = getNodeBlockPos(event->p - v3s16(reach, reach, reach));
+		v3s16 bpmax = getNodeBlockPos(event->p + v3s16(reach, reach, reach));
+		v3s16 bp;
+		for (bp.Z = bpmin.Z; bp.Z <= bpmax.Z; bp.Z++)
+		for (bp.Y = bpmin.Y; bp.Y <= bpmax.Y; bp.Y++)
+		for (bp.X = bpmin.X; bp.X <= bpmax.X; bp.X++)
+			blocks.insert(bp);
+		break;
+	}
+	case MEET_OTHER: {
+		s16 r = (reach + MAP_BLOCKSIZE - 1) / MAP_BLOCKSIZE;
+		v3s16 d;
+		for (std::set<v3s16>::const_iterator it = event->modified_blocks.begin();
+				it != event->modified_blocks.end(); ++it) {
+			for (d.Z = -r; d.Z <= r; d.Z++)
+			for (d.Y = -r; d.Y <= r; d.Y++)
+			for (d.X = -r; d.X <= r; d.X++)
+				blocks.insert(*it + d);
+		}
+		break;
+	}
+	default:
+		return;
+	}
+
+	for (std::set<v3s16>::const_iterator it = blocks.begin();
+			it != blocks.end(); ++it) {
+		std::map<v3s16, std::set<u16> >::iterator sleeping =
+			m_sleeping_objects.find(*it);
+		if (sleeping == m_sleeping_objects.end())
+			continue;
+
+		std::set<u16> ids;
+		ids.swap(sleeping->second);
+		m_sleeping_objects.erase(sleeping);
+		if (m_sleeping_objects.empty())
+			m_sleeping_objects_reach = 0;
+		for (std::set<u16>::const_iterator id = ids.begin();
+				id != ids.end(); ++id) {
+			ServerActiveObject *obj = getActiveObject(*id);
+			if (obj && obj->getType() == ACTIVEOBJECT_TYPE_LUAENTITY)
+				((LuaEntitySAO *)obj)->wakeUp();
+		}
+	}
+}
+
 void ServerEnvironment::clearObjects(ClearObjectsMode mode)
 {
 	infostream << "ServerEnvironment::clearObjects(): "
@@ -1362,6 +1563,7 @@ void ServerEnvironment::step(float dtime)
 				/* Handle ActiveBlockModifiers */
 				abmhandler.apply(block);
 			}
+			abmhandler.flush();
 
 			u32 time_ms = timer.stop(true);
 			u32 max_time_ms = 200;
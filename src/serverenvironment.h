@@ -37,6 +37,7 @@ struct StaticObject;
 class ServerActiveObject;
 class Server;
 class ServerScripting;
+struct MapEditEvent;
 
 /*
 	{Active, Loading} block modifier interface.
@@ -66,6 +67,11 @@ class ActiveBlockModifier
 	virtual void trigger(ServerEnvironment *env, v3s16 p, MapNode n){};
 	virtual void trigger(ServerEnvironment *env, v3s16 p, MapNode n,
 		u32 active_object_count, u32 active_object_count_wider){};
+	// Called once the triggers of an interval are done, lets modifiers that
+	// queue their triggers handle them together
+	virtual void flush(ServerEnvironment *env){};
+	// Name of the trigger counter in the profiler, empty = do not count
+	virtual std::string getProfilerName() const { return ""; }
 };
 
 struct ABMWithState
@@ -311,10 +317,21 @@ class ServerEnvironment : public Environment
 	bool setNode(v3s16 p, const MapNode &n);
 	bool removeNode(v3s16 p);
 	bool swapNode(v3s16 p, const MapNode &n);
+	// Bulk versions of setNode() and swapNode(), see Map::addNodesWithEvent()
+	// Return true if all the nodes could be set
+	bool setNodes(const std::vector<v3s16> &positions, const MapNode &n);
+	bool swapNodes(const std::vector<v3s16> &positions, const MapNode &n);
 
 	// Find all active objects inside a radius around a point
 	void getObjectsInsideRadius(std::vector<u16> &objects, v3f pos, float radius);
 
+	// Sleeping LuaEntitySAOs by block, woken when nodes next to them change.
+	// reach is the distance in nodes of the farthest node their collision
+	// box can touch.
+	void addSleepingObject(u16 id, v3s16 blockpos, s16 reach);
+	void removeSleepingObject(u16 id, v3s16 blockpos);
+	void wakeObjects(const MapEditEvent *event);
+
 	// Clear objects, loading and going through every MapBlock
 	void clearObjects(ClearObjectsMode mode);
 
@@ -405,6 +422,9 @@ class ServerEnvironment : public Environment
 	const std::string m_path_world;
 	// Active object list
 	ActiveObjectMap m_active_objects;
+	std::map<v3s16, std::set<u16> > m_sleeping_objects;
+	// Largest reach of the sleeping objects
+	s16 m_sleeping_objects_reach;
 	// Outgoing network message buffer for active objects
 	std::queue<ActiveObjectMessage> m_active_object_messages;
 	// Some timers
@@ -470,6 +470,10 @@ fake_function() {
 	gettext("See http://www.sqlite.org/pragma.html#pragma_synchronous");
 	gettext("Dedicated server step");
 	gettext("Length of a server tick and the interval at which objects are generally updated over network.");
+	gettext("Lua GC step budget");
+	gettext("Time in milliseconds the server may spend collecting Lua garbage at the\nend of each server step, instead of letting Lua collect it whenever it\nallocates.  Lua still collects on its own when the heap grows twice as much\nas lua_gc_pause allows.  0 leaves the collection to Lua.");
+	gettext("Lua GC pause");
+	gettext("With a Lua GC step budget, the next garbage collection cycle starts once\nthe Lua heap has grown to this percentage of its size after the last one.");
 	gettext("Active Block Management interval");
 	gettext("Time in between active block management cycles");
 	gettext("Active Block Modifier interval");
@@ -507,11 +511,23 @@ fake_function() {
 	gettext("Absolute limit of emerge queues");
 	gettext("Maximum number of blocks that can be queued for loading.");
 	gettext("Limit of emerge queues on disk");
-	gettext("Maximum number of blocks to be queued that are to be loaded from file.\nSet to blank for an appropriate amount to be chosen automatically.");
+	gettext("Maximum number of blocks per player to be queued that are to be loaded from file.\nSet to blank for an appropriate amount to be chosen automatically.");
 	gettext("Limit of emerge queues to generate");
-	gettext("Maximum number of blocks to be queued that are to be generated.\nSet to blank for an appropriate amount to be chosen automatically.");
+	gettext("Maximum number of blocks per player to be queued that are to be generated.\nSet to blank for an appropriate amount to be chosen automatically.");
 	gettext("Number of emerge threads");
 	gettext("Number of emerge threads to use. Make this field blank, or increase this number\nto use multiple threads. On multiprocessor systems, this will improve mapgen speed greatly\nat the cost of slightly buggy caves.");
+	gettext("Number of emerge load threads");
+	gettext("Number of threads loading existing blocks from the world database.\nThese never run the mapgen, so already generated areas are not held back\nby the generation of new ones. 0 uses the number of processors.");
+	gettext("Number of async threads");
+	gettext("Number of threads running the async VoxelManip jobs of mods\n(minetest.handle_async_vmanip). 0 uses one less than the number of processors.");
+	gettext("Noise map cache size");
+	gettext("Memory in MiB used to keep computed 2D noise maps, shared by the mapgens and\nmods asking for the same noise over the same area (e.g. biome heat and\nhumidity). 0 disables the cache.");
+	gettext("Mapgen placement threads");
+	gettext("Number of threads each emerge thread uses to place the ores and decorations of\na mapchunk. 0 chooses it from the number of processors and emerge threads.");
+	gettext("Mapgen lighting threads");
+	gettext("Number of threads each emerge thread uses to light a mapchunk. Sunlight is\nspread down in slices, one per thread, the light banks at most by two threads.\n0 uses as many as mapgen_placement_threads.");
+	gettext("Mapgen chunk cache");
+	gettext("Keep generated mapchunks in the mapgen_cache directory of the world, so that\ngenerating them again after they were deleted only reads them back. Lua\non_generated callbacks still run and get the mapgen objects of the mapchunk\nas it was generated. Changing the mapgen settings, the files of the mods or\nthe nodes starts a new cache; delete old ones to free the disk space.");
 	gettext("Biome API temperature and humidity noise parameters");
 	gettext("Heat noise");
 	gettext("Temperature variation for biomes.");
@@ -730,6 +746,8 @@ fake_function() {
 	gettext("The default format in which profiles are being saved,\nwhen calling `/profiler save [format]` without format.");
 	gettext("Report path");
 	gettext("The file path relative to your worldpath in which profiles will be saved to.");
+	gettext("Mod accounting");
+	gettext("Measure the time and memory each mod spends in its callbacks from\nthe start of the server, not only after `/profile start`.\nThe results are shown by the /profile command.");
 	gettext("Instrumentation");
 	gettext("Entity methods");
 	gettext("Instrument the methods of entities on registration.");
@@ -83,7 +83,8 @@ class TestGameDef : public IGameDef {
 };
 
 
-TestGameDef::TestGameDef()
+TestGameDef::TestGameDef() :
+	m_rollbackmgr(NULL)
 {
 	m_itemdef = createItemDefManager();
 	m_nodedef = createNodeDefManager();
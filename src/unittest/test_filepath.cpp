@@ -38,6 +38,7 @@ class TestFilePath : public TestBase {
 	void testRemoveLastPathComponent();
 	void testRemoveLastPathComponentWithTrailingDelimiter();
 	void testRemoveRelativePathComponent();
+	void testGetFileInfo();
 };
 
 static TestFilePath g_test_instance;
@@ -49,6 +50,7 @@ void TestFilePath::runTests(IGameDef *gamedef)
 	TEST(testRemoveLastPathComponent);
 	TEST(testRemoveLastPathComponentWithTrailingDelimiter);
 	TEST(testRemoveRelativePathComponent);
+	TEST(testGetFileInfo);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -262,3 +264,20 @@ void TestFilePath::testRemoveRelativePathComponent()
 	result = fs::RemoveRelativePathComponents(path);
 	UASSERT(result == p("/a/e"));
 }
+
+
+void TestFilePath::testGetFileInfo()
+{
+	std::string path = getTestTempFile();
+	u64 size, mtime;
+
+	UASSERT(!fs::GetFileInfo(path, &size, &mtime));
+
+	UASSERT(fs::safeWriteToFile(path, "media"));
+	UASSERT(fs::GetFileInfo(path, &size, &mtime));
+	UASSERTEQ(u64, size, 5);
+	UASSERT(mtime != 0);
+
+	UASSERT(fs::DeleteSingleFileOrEmptyDirectory(path));
+	UASSERT(!fs::GetFileInfo(path, &size, &mtime));
+}
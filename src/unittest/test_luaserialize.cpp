@@ -0,0 +1,448 @@
+/*
+Minetest
+Copyright (C) 2013 celeron55, Perttu Ahola <celeron55@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 3.0 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "test.h"
+
+#include <map>
+
+#include "common/c_serialize.h"
+#include "common/c_types.h"
+#include "exceptions.h"
+#include "util/basic_macros.h"
+#include "util/string.h"
+
+extern "C" {
+#include <lualib.h>
+#include <lauxlib.h>
+}
+
+class TestLuaSerialize : public TestBase {
+public:
+	TestLuaSerialize() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestLuaSerialize"; }
+
+	void runTests(IGameDef *gamedef);
+
+	void testTextMatchesBuiltin();
+	void testTextRoundTrip();
+	void testTextFallback();
+	void testTableConstructor();
+	void testBinaryRoundTrip();
+	void testBinaryInvalid();
+
+private:
+	void pushValue(const std::string &expr);
+	std::string builtinSerialize(int index);
+	bool builtinDeserialize(const std::string &str);
+	bool nativeDeserialize(const std::string &str);
+	bool deepEqual(int a, int b);
+	bool deepEqual(int a, int b, std::map<const void *, const void *> &matched);
+	bool checkValue(const char *expr);
+
+	lua_State *L;
+};
+
+static TestLuaSerialize g_test_instance;
+
+// Values written as the same Lua code by the native and builtin serializers
+static const char *text_values[] = {
+	"nil",
+	"true",
+	"false",
+	"0",
+	"-7",
+	"1.5",
+	"-0.001",
+	"2^53",
+	"123456789.125",
+	"''",
+	"'plain'",
+	"'\"quoted\" \\\\ back\\\\slash\\nnew line\\rreturn\\ttab'",
+	"{}",
+	"{1, 2, 3}",
+	"{1, 2, nil, 4}",
+	"{[1.5] = 1, [-1] = 2, [0] = 3, [true] = false}",
+	"{a = {b = {c = {d = {}}}}}",
+	"{pos = {x = 1, y = -2, z = 3.25}, list = {'a', 'b', {'c'}}}",
+	"{[{1}] = {2}}",
+	"(function() local s = {1} return {s, s, k = s} end)()",
+	"(function() local s = {} return {[s] = s, {s, {s}}} end)()",
+};
+
+void TestLuaSerialize::runTests(IGameDef *gamedef)
+{
+	L = luaL_newstate();
+	luaL_openlibs(L);
+
+	// The builtin implementation, without the native functions
+	lua_newtable(L);
+	lua_setglobal(L, "core");
+	std::string path = porting::path_share + DIR_DELIM "builtin" DIR_DELIM
+		"common" DIR_DELIM "serialize.lua";
+	if (luaL_dofile(L, path.c_str())) {
+		rawstream << "TestLuaSerialize: Failed to load " << path << ": "
+			<< lua_tostring(L, -1) << std::endl;
+		num_tests_failed++;
+		lua_close(L);
+		return;
+	}
+
+	TEST(testTextMatchesBuiltin);
+	TEST(testTextRoundTrip);
+	TEST(testTextFallback);
+	TEST(testTableConstructor);
+	TEST(testBinaryRoundTrip);
+	TEST(testBinaryInvalid);
+
+	lua_close(L);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void TestLuaSerialize::pushValue(const std::string &expr)
+{
+	std::string code = "return " + expr;
+	if (luaL_loadbuffer(L, code.c_str(), code.size(), "=(test)") ||
+			lua_pcall(L, 0, 1, 0))
+		throw LuaError(lua_tostring(L, -1));
+}
+
+std::string TestLuaSerialize::builtinSerialize(int index)
+{
+	lua_pushvalue(L, index);
+	lua_getglobal(L, "core");
+	lua_getfield(L, -1, "serialize");
+	lua_pushvalue(L, -3);
+	if (lua_pcall(L, 1, 1, 0))
+		throw LuaError(lua_tostring(L, -1));
+	std::string str(lua_tostring(L, -1), lua_objlen(L, -1));
+	lua_pop(L, 3);
+	return str;
+}
+
+// Pushes the value, or the error message on failure
+bool TestLuaSerialize::builtinDeserialize(const std::string &str)
+{
+	lua_getglobal(L, "core");
+	lua_getfield(L, -1, "deserialize");
+	lua_remove(L, -2);
+	lua_pushlstring(L, str.c_str(), str.size());
+	if (lua_pcall(L, 1, 2, 0))
+		throw LuaError(lua_tostring(L, -1));
+	bool ok = lua_isnil(L, -1);
+	lua_remove(L, ok ? -1 : -2);
+	return ok;
+}
+
+// Pushes the value, keeps the stack unchanged if the Lua implementation is
+// needed
+bool TestLuaSerialize::nativeDeserialize(const std::string &str)
+{
+	int top = lua_gettop(L);
+	if (deserialize_lua_text(L, str.c_str(), str.size())) {
+		UASSERTEQ(int, lua_gettop(L), top + 1);
+		return true;
+	}
+	lua_settop(L, top);
+	return false;
+}
+
+bool TestLuaSerialize::deepEqual(int a, int b)
+{
+	std::map<const void *, const void *> matched;
+	return deepEqual(a, b, matched);
+}
+
+// Compares tables by structure, the same tables of a must be the same in b
+bool TestLuaSerialize::deepEqual(int a, int b,
+	std::map<const void *, const void *> &matched)
+{
+	if (a < 0)
+		a = lua_gettop(L) + a + 1;
+	if (b < 0)
+		b = lua_gettop(L) + b + 1;
+
+	int type = lua_type(L, a);
+	if (lua_type(L, b) != type)
+		return false;
+	if (type == LUA_TNUMBER) {
+		lua_Number x = lua_tonumber(L, a), y = lua_tonumber(L, b);
+		return x == y || (x != x && y != y);
+	}
+	if (type != LUA_TTABLE)
+		return lua_rawequal(L, a, b);
+
+	const void *pa = lua_topointer(L, a), *pb = lua_topointer(L, b);
+	std::map<const void *, const void *>::iterator it = matched.find(pa);
+	if (it != matched.end())
+		return it->second == pb;
+	matched[pa] = pb;
+
+	size_t count = 0;
+	lua_pushnil(L);
+	while (lua_next(L, b) != 0) {
+		count++;
+		lua_pop(L, 1);
+	}
+
+	lua_pushnil(L);
+	while (lua_next(L, a) != 0) {
+		count--;
+		// Table keys can't be looked up, only counted
+		if (!lua_istable(L, -2)) {
+			lua_pushvalue(L, -2);
+			lua_rawget(L, b);
+			bool equal = deepEqual(-2, -1, matched);
+			lua_pop(L, 1);
+			if (!equal) {
+				lua_pop(L, 2);
+				return false;
+			}
+		}
+		lua_pop(L, 1);
+	}
+	return count == 0;
+}
+
+// Evaluates expr with the value on top of the stack as v
+bool TestLuaSerialize::checkValue(const char *expr)
+{
+	lua_pushvalue(L, -1);
+	lua_setglobal(L, "v");
+	pushValue(expr);
+	bool result = lua_toboolean(L, -1);
+	lua_pop(L, 1);
+	return result;
+}
+
+void TestLuaSerialize::testTextMatchesBuiltin()
+{
+	for (size_t i = 0; i < ARRLEN(text_values); i++) {
+		pushValue(text_values[i]);
+		std::string str;
+		UASSERT(serialize_lua_text(L, -1, str));
+		UASSERTEQ(std::string, str, builtinSerialize(-1));
+		lua_pop(L, 1);
+	}
+}
+
+void TestLuaSerialize::testTextRoundTrip()
+{
+	std::string all_bytes;
+	for (int c = 0; c < 256; c++)
+		all_bytes.push_back(c);
+
+	for (size_t i = 0; i <= ARRLEN(text_values); i++) {
+		if (i < ARRLEN(text_values)) {
+			pushValue(text_values[i]);
+		} else {
+			lua_newtable(L);
+			lua_pushlstring(L, all_bytes.c_str(), all_bytes.size());
+			lua_rawseti(L, -2, 1);
+		}
+		int value = lua_gettop(L);
+
+		std::string str;
+		UASSERT(serialize_lua_text(L, value, str));
+
+		// Read by both implementations
+		UASSERT(nativeDeserialize(str));
+		UASSERT(deepEqual(value, -1));
+		UASSERT(builtinDeserialize(str));
+		UASSERT(deepEqual(value, -1));
+
+		// The native deserializer reads the code of the builtin serializer
+		UASSERT(nativeDeserialize(builtinSerialize(value)));
+		UASSERT(deepEqual(value, -1));
+		lua_settop(L, value - 1);
+	}
+
+	// Shared tables stay shared
+	pushValue("(function() local s = {1} return {s, s, k = s} end)()");
+	std::string str;
+	UASSERT(serialize_lua_text(L, -1, str));
+	UASSERT(str.find("local _ = {}") == 0);
+	UASSERT(nativeDeserialize(str));
+	UASSERT(checkValue("v[1] == v[2] and v[1] == v.k and v[1][1] == 1"));
+	lua_pop(L, 2);
+
+	// Escapes and quotes the serializer does not write
+	UASSERT(nativeDeserialize("return {'a\\'b', \"\\97\\0b\\255\", 'x\\\ny'}"));
+	UASSERT(checkValue("v[1] == \"a'b\" and v[2] == 'a\\0b\\255' and "
+		"v[3] == 'x\\ny'"));
+	lua_pop(L, 1);
+}
+
+void TestLuaSerialize::testTextFallback()
+{
+	// Values written by the Lua implementation
+	static const char *values[] = {
+		"0/0",
+		"1/0",
+		"-1/0",
+		"2^70",
+		"print",
+		"{f = print}",
+		"coroutine.create(function() end)",
+		"(function() local t = {} t.t = t return t end)()",
+		"(function() local t = {} t[1] = {t} return t end)()",
+	};
+	for (size_t i = 0; i < ARRLEN(values); i++) {
+		pushValue(values[i]);
+		std::string str;
+		UASSERT(!serialize_lua_text(L, -1, str));
+		lua_pop(L, 1);
+	}
+
+	// Code only the Lua implementation handles
+	static const char *code[] = {
+		"return 1 + 1",
+		"return math.huge",
+		"return nan",
+		"return {f = loadstring('')}",
+		"return [[long]]",
+		"return {[ [[k]] ] = 1}",
+		"return 0x10",
+		"return 'unterminated",
+		"return {1, 2",
+		"return {} {}",
+		"x = 1 return x",
+		"local _ = {} _[1] = {} _[1].x = _[1] return _[1]",
+		"return -- comment\n1",
+		"return {nil = 1}",
+		"return {[nil] = 1}",
+	};
+	for (size_t i = 0; i < ARRLEN(code); i++)
+		UASSERT(!nativeDeserialize(code[i]));
+
+	// Empty code returns nil
+	UASSERT(nativeDeserialize(" return "));
+	UASSERT(lua_isnil(L, -1));
+	lua_pop(L, 1);
+}
+
+void TestLuaSerialize::testTableConstructor()
+{
+	// Like the PUC Lua parser, positional values are stored after the keyed
+	// ones preceding them, by batches of 50
+	UASSERT(nativeDeserialize("return {1, [1] = 2}"));
+	UASSERT(checkValue("v[1] == 1"));
+	lua_pop(L, 1);
+
+	UASSERT(nativeDeserialize("return {[2] = 'a', 1, 2, [2] = 'b'; x = 1, 'c'}"));
+	UASSERT(checkValue("v[1] == 1 and v[2] == 2 and v[3] == 'c' and v.x == 1"));
+	lua_pop(L, 1);
+
+	std::string many = "return {[1] = 'a', ";
+	for (int i = 1; i <= 49; i++)
+		many += itos(i) + ", ";
+	many += "[50] = 'b', 50, [50] = 'c', [51] = 'd', 51, 52, [53] = 'e', 53}";
+	UASSERT(nativeDeserialize(many));
+	UASSERT(checkValue("v[1] == 1 and v[49] == 49 and v[50] == 'c' and "
+		"v[51] == 51 and v[52] == 52 and v[53] == 53 and #v == 53"));
+	lua_pop(L, 1);
+}
+
+void TestLuaSerialize::testBinaryRoundTrip()
+{
+	static const char *values[] = {
+		"nil",
+		"true",
+		"false",
+		"0",
+		"-2147483648",
+		"2147483647",
+		"2147483648",
+		"-0.1",
+		"2^70",
+		"0/0",
+		"1/0",
+		"-1/0",
+		"'\\0\\1\\255 text'",
+		"{}",
+		"{1, 2, nil, 4, a = 'b', [1.5] = {}, [true] = false}",
+		"{[{1}] = {2}, [0/0 ~= 0/0] = 1/0}",
+		"{a = {b = {c = {d = {}}}}}",
+	};
+	for (size_t i = 0; i < ARRLEN(values); i++) {
+		pushValue(values[i]);
+		std::string str;
+		serialize_lua_binary(L, -1, str);
+		UASSERT(str.size() >= 3 && str[0] == '\0');
+		deserialize_lua_binary(L, str.c_str(), str.size());
+		UASSERT(deepEqual(-2, -1));
+		lua_pop(L, 2);
+	}
+
+	// Shared and recursive tables are kept
+	pushValue("(function() local s = {} local t = {s, s} t.t = t s[t] = s "
+		"return t end)()");
+	std::string str;
+	serialize_lua_binary(L, -1, str);
+	deserialize_lua_binary(L, str.c_str(), str.size());
+	UASSERT(checkValue("v[1] == v[2] and v.t == v and v[1][v] == v[1]"));
+	UASSERT(deepEqual(-2, -1));
+	lua_pop(L, 2);
+
+	// Userdata is written as nil, functions can't be written
+	lua_newuserdata(L, 1);
+	str.clear();
+	serialize_lua_binary(L, -1, str);
+	deserialize_lua_binary(L, str.c_str(), str.size());
+	UASSERT(lua_isnil(L, -1));
+	lua_pop(L, 2);
+
+	pushValue("{f = print}");
+	str.clear();
+	EXCEPTION_CHECK(LuaError, serialize_lua_binary(L, -1, str));
+	lua_pop(L, 1);
+}
+
+void TestLuaSerialize::testBinaryInvalid()
+{
+	pushValue("{1, {2}, 'three'}");
+	std::string valid;
+	serialize_lua_binary(L, -1, valid);
+	lua_pop(L, 1);
+
+	int top = lua_gettop(L);
+	for (size_t len = 0; len < valid.size(); len++) {
+		EXCEPTION_CHECK(SerializationError,
+			deserialize_lua_binary(L, valid.c_str(), len));
+		lua_settop(L, top);
+	}
+
+	std::string invalid[] = {
+		// Unsupported version
+		std::string("\0\x7f\x01", 3),
+		// Trailing data
+		valid + "\x01",
+		// Unknown type
+		std::string("\0\x01\x42", 3),
+		// Reference to a table not read yet
+		std::string("\0\x01\x06\x07\0\0\0\x02\x01\0", 10),
+		// NaN key
+		std::string("\0\x01\x06\x04\x7f\xf8\0\0\0\0\0\0\x01\0", 14),
+	};
+	for (size_t i = 0; i < ARRLEN(invalid); i++) {
+		EXCEPTION_CHECK(SerializationError,
+			deserialize_lua_binary(L, invalid[i].c_str(), invalid[i].size()));
+		lua_settop(L, top);
+	}
+}
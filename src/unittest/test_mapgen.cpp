@@ -0,0 +1,576 @@
+/*
+Minetest
+Copyright (C) 2017 MultiCraft Development Team
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 3.0 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "test.h"
+
+#include "gamedef.h"
+#include "map.h"
+#include "mapgen.h"
+#include "mg_biome.h"
+#include "mg_ore.h"
+#include "mg_decoration.h"
+#include "cavegen.h"
+#include "dungeongen.h"
+#include "porting.h"
+#include "util/directiontables.h"
+
+class TestMapgen : public TestBase {
+public:
+	TestMapgen() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestMapgen"; }
+
+	void runTests(IGameDef *gamedef);
+
+	void testMapgenTiles();
+	void testOrePlacementThreads(IGameDef *gamedef);
+	void testDecoPlacementThreads(IGameDef *gamedef);
+	void testBiomeLookup();
+	void testCalcLighting(IGameDef *gamedef);
+	void testCalcLightingBenchmark(IGameDef *gamedef);
+	void testCaveGeneration(IGameDef *gamedef);
+
+	static const v3s16 chunk_min;
+	static const v3s16 chunk_max;
+
+	static void makeTerrain(MMVManip *vm);
+	static u32 countNodes(MMVManip *vm, content_t c);
+	static bool equalNodes(MMVManip *vm1, MMVManip *vm2);
+	static biome_t findBiome(const std::vector<Biome *> &biomes,
+		float heat, float humidity, s16 y);
+	static void makeCaves(MMVManip *vm);
+	static void lightSpreadReference(Mapgen *mg, VoxelArea &a, v3s16 p,
+		u8 light);
+	static void spreadLightReference(Mapgen *mg, v3s16 nmin, v3s16 nmax);
+	static u32 hashNodes(MMVManip *vm);
+	static void makeUndergroundStructures(INodeDefManager *ndef, MMVManip *vm);
+};
+
+static TestMapgen g_test_instance;
+
+const v3s16 TestMapgen::chunk_min(0, 0, 0);
+const v3s16 TestMapgen::chunk_max(79, 79, 79);
+
+void TestMapgen::runTests(IGameDef *gamedef)
+{
+	TEST(testMapgenTiles);
+	TEST(testOrePlacementThreads, gamedef);
+	TEST(testDecoPlacementThreads, gamedef);
+	TEST(testBiomeLookup);
+	TEST(testCalcLighting, gamedef);
+	TEST(testCalcLightingBenchmark, gamedef);
+	TEST(testCaveGeneration, gamedef);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void TestMapgen::makeTerrain(MMVManip *vm)
+{
+	vm->clear();
+	vm->addArea(VoxelArea(chunk_min - v3s16(1, 1, 1) * MAP_BLOCKSIZE,
+		chunk_max + v3s16(1, 1, 1) * MAP_BLOCKSIZE));
+
+	const VoxelArea &a = vm->m_area;
+	for (s16 z = a.MinEdge.Z; z <= a.MaxEdge.Z; z++)
+	for (s16 y = a.MinEdge.Y; y <= a.MaxEdge.Y; y++)
+	for (s16 x = a.MinEdge.X; x <= a.MaxEdge.X; x++) {
+		// Rolling hills, so the ground level differs from column to column
+		s16 ground = 30 + (x * 7 + z * 13) % 11;
+		vm->m_data[a.index(x, y, z)] =
+			MapNode(y <= ground ? t_CONTENT_STONE : CONTENT_AIR);
+	}
+}
+
+
+u32 TestMapgen::countNodes(MMVManip *vm, content_t c)
+{
+	u32 count = 0;
+	for (s32 i = 0; i != vm->m_area.getVolume(); i++)
+		count += (vm->m_data[i].getContent() == c);
+	return count;
+}
+
+
+bool TestMapgen::equalNodes(MMVManip *vm1, MMVManip *vm2)
+{
+	if (vm1->m_area.getVolume() != vm2->m_area.getVolume())
+		return false;
+
+	for (s32 i = 0; i != vm1->m_area.getVolume(); i++) {
+		if (!(vm1->m_data[i] == vm2->m_data[i]))
+			return false;
+	}
+	return true;
+}
+
+
+void TestMapgen::testMapgenTiles()
+{
+	MapgenTiles tiles(chunk_min, chunk_max);
+	UASSERTEQ(u32, tiles.count(), 25);
+
+	// Every node column belongs to the tile containing it
+	for (u32 i = 0; i != tiles.count(); i++) {
+		v3s16 tmin, tmax;
+		tiles.getTile(i, &tmin, &tmax);
+		UASSERTEQ(u32, tiles.getIndex(tmin.X, tmin.Z), i);
+		UASSERTEQ(u32, tiles.getIndex(tmax.X, tmax.Z), i);
+		UASSERT(tmin.Y == chunk_min.Y && tmax.Y == chunk_max.Y);
+	}
+
+	// Neighbours never share a color
+	UASSERT(tiles.getColor(0) != tiles.getColor(1));
+	UASSERT(tiles.getColor(0) != tiles.getColor(5));
+	UASSERT(tiles.getColor(0) != tiles.getColor(6));
+	UASSERT(tiles.getColor(1) != tiles.getColor(5));
+	UASSERTEQ(u8, tiles.getColor(0), tiles.getColor(2));
+
+	// The remainder goes to the last tile
+	MapgenTiles tiles2(v3s16(0, 0, 0), v3s16(39, 0, 9));
+	UASSERTEQ(u32, tiles2.count(), 2);
+	v3s16 tmin, tmax;
+	tiles2.getTile(1, &tmin, &tmax);
+	UASSERT(tmin == v3s16(16, 0, 0) && tmax == v3s16(39, 0, 9));
+}
+
+
+void TestMapgen::testOrePlacementThreads(IGameDef *gamedef)
+{
+	OreManager oremgr(gamedef);
+
+	OreScatter *ore = new OreScatter;
+	ore->c_ore          = t_CONTENT_BRICK;
+	ore->c_wherein.push_back(t_CONTENT_STONE);
+	ore->clust_scarcity = 8 * 8 * 8;
+	ore->clust_num_ores = 8;
+	ore->clust_size     = 3;
+	ore->y_min          = -100;
+	ore->y_max          = 100;
+	ore->ore_param2     = 0;
+	ore->nthresh        = 0;
+	oremgr.add(ore);
+
+	Mapgen mg;
+	mg.seed = 1234;
+	mg.ndef = gamedef->getNodeDefManager();
+
+	MMVManip vm1(NULL);
+	MMVManip vm2(NULL);
+	makeTerrain(&vm1);
+	makeTerrain(&vm2);
+
+	mg.vm = &vm1;
+	mg.setNumThreads(1);
+	oremgr.placeAllOres(&mg, 5678, chunk_min, chunk_max);
+
+	mg.vm = &vm2;
+	mg.setNumThreads(4);
+	oremgr.placeAllOres(&mg, 5678, chunk_min, chunk_max);
+
+	UASSERT(countNodes(&vm1, t_CONTENT_BRICK) > 0);
+	UASSERT(equalNodes(&vm1, &vm2));
+}
+
+
+void TestMapgen::testDecoPlacementThreads(IGameDef *gamedef)
+{
+	DecorationManager decomgr(gamedef);
+
+	DecoSimple *deco = new DecoSimple;
+	deco->c_place_on.push_back(t_CONTENT_STONE);
+	deco->c_decos.push_back(t_CONTENT_GRASS);
+	deco->sidelen         = 16;
+	deco->fill_ratio      = 0.05f;
+	deco->y_min           = -100;
+	deco->y_max           = 100;
+	deco->nspawnby        = -1;
+	deco->deco_height     = 1;
+	deco->deco_height_max = 3;
+	deco->deco_param2     = 0;
+	decomgr.add(deco);
+
+	Mapgen mg;
+	mg.seed = 1234;
+	mg.ndef = gamedef->getNodeDefManager();
+
+	MMVManip vm1(NULL);
+	MMVManip vm2(NULL);
+	makeTerrain(&vm1);
+	makeTerrain(&vm2);
+
+	mg.vm = &vm1;
+	mg.setNumThreads(1);
+	size_t nplaced = decomgr.placeAllDecos(&mg, 5678, chunk_min, chunk_max);
+
+	mg.vm = &vm2;
+	mg.setNumThreads(4);
+	UASSERTEQ(size_t, decomgr.placeAllDecos(&mg, 5678, chunk_min, chunk_max),
+		nplaced);
+
+	UASSERT(nplaced > 0);
+	UASSERT(countNodes(&vm1, t_CONTENT_GRASS) >= nplaced);
+	UASSERT(equalNodes(&vm1, &vm2));
+}
+
+
+// The linear search of BiomeGenOriginal::calcBiomeFromNoise
+biome_t TestMapgen::findBiome(const std::vector<Biome *> &biomes,
+	float heat, float humidity, s16 y)
+{
+	Biome *biome_closest = NULL;
+	float dist_min = FLT_MAX;
+
+	for (size_t i = 1; i < biomes.size(); i++) {
+		Biome *b = biomes[i];
+		if (!b || y > b->y_max || y < b->y_min)
+			continue;
+
+		float d_heat     = heat     - b->heat_point;
+		float d_humidity = humidity - b->humidity_point;
+		float dist = (d_heat * d_heat) +
+					 (d_humidity * d_humidity);
+		if (dist < dist_min) {
+			dist_min = dist;
+			biome_closest = b;
+		}
+	}
+
+	return biome_closest ? biome_closest->index : BIOME_NONE;
+}
+
+
+void TestMapgen::testBiomeLookup()
+{
+	static const s16 y_mins[] = {-31000, -112, 4, 50};
+	static const s16 y_maxs[] = {31000, 3, 90, 31000};
+
+	PcgRandom pr(42);
+	std::vector<Biome *> biomes;
+	biomes.push_back(NULL);
+	for (u32 i = 1; i != 64; i++) {
+		Biome *b = new Biome;
+		u32 band = pr.range(0, 3);
+		b->index          = i;
+		b->y_min          = y_mins[band];
+		b->y_max          = y_maxs[band];
+		b->heat_point     = pr.range(0, 100);
+		b->humidity_point = pr.range(0, 100);
+
+		// Ties go to the biome with the lower index
+		if (i % 7 == 0) {
+			b->heat_point     = biomes[i - 1]->heat_point;
+			b->humidity_point = biomes[i - 1]->humidity_point;
+		}
+		biomes.push_back(b);
+	}
+
+	BiomeLookup lookup(biomes);
+
+	// Points both within and outside of the lookup grid
+	static const u32 count = 20000;
+	std::vector<float> heat(count);
+	std::vector<float> humidity(count);
+	std::vector<s16> y(count);
+	for (u32 i = 0; i != count; i++) {
+		heat[i]     = pr.range(-15000, 25000) / 100.0f;
+		humidity[i] = pr.range(-15000, 25000) / 100.0f;
+		y[i]        = (i % 100) ? pr.range(-200, 200) : pr.range(-32768, 32767);
+	}
+
+	std::vector<biome_t> biomemap(count);
+	lookup.getBiomes(&heat[0], &humidity[0], &y[0], &biomemap[0], count);
+
+	for (u32 i = 0; i != count; i++) {
+		biome_t expected = findBiome(biomes, heat[i], humidity[i], y[i]);
+		UASSERTEQ(biome_t, lookup.getBiome(heat[i], humidity[i], y[i]), expected);
+		UASSERTEQ(biome_t, biomemap[i], expected);
+	}
+
+	for (size_t i = 0; i != biomes.size(); i++)
+		delete biomes[i];
+}
+
+
+// Closed rooms with a torch each below the ground of makeTerrain()
+void TestMapgen::makeCaves(MMVManip *vm)
+{
+	const VoxelArea &a = vm->m_area;
+	for (s16 z = a.MinEdge.Z; z <= a.MaxEdge.Z; z++)
+	for (s16 y = a.MinEdge.Y; y <= a.MaxEdge.Y; y++)
+	for (s16 x = a.MinEdge.X; x <= a.MaxEdge.X; x++) {
+		s16 ground = 30 + (x * 7 + z * 13) % 11;
+		if (y >= ground - 3 || (x & 15) >= 6 || (y & 15) >= 5 || (z & 15) >= 6)
+			continue;
+		bool torch = (x & 15) == 2 && (y & 15) == 1 && (z & 15) == 2;
+		vm->m_data[a.index(x, y, z)] =
+			MapNode(torch ? t_CONTENT_TORCH : CONTENT_AIR);
+	}
+}
+
+
+// The recursive spreading Mapgen::spreadLight used to do
+void TestMapgen::lightSpreadReference(Mapgen *mg, VoxelArea &a, v3s16 p,
+	u8 light)
+{
+	if (light <= 1 || !a.contains(p))
+		return;
+
+	MapNode &n = mg->vm->m_data[mg->vm->m_area.index(p)];
+
+	u8 light_day = light & 0x0F;
+	if (light_day > 0)
+		light_day -= 0x01;
+
+	u8 light_night = light & 0xF0;
+	if (light_night > 0)
+		light_night -= 0x10;
+
+	if ((light_day  <= (n.param1 & 0x0F) &&
+		light_night <= (n.param1 & 0xF0)) ||
+		!mg->ndef->get(n).light_propagates)
+		return;
+
+	light = MYMAX(light_day, n.param1 & 0x0F) |
+			MYMAX(light_night, n.param1 & 0xF0);
+
+	n.param1 = light;
+
+	for (u8 i = 0; i != 6; i++)
+		lightSpreadReference(mg, a, p + g_6dirs[i], light);
+}
+
+
+void TestMapgen::spreadLightReference(Mapgen *mg, v3s16 nmin, v3s16 nmax)
+{
+	VoxelArea a(nmin, nmax);
+
+	for (s16 z = a.MinEdge.Z; z <= a.MaxEdge.Z; z++)
+	for (s16 y = a.MinEdge.Y; y <= a.MaxEdge.Y; y++)
+	for (s16 x = a.MinEdge.X; x <= a.MaxEdge.X; x++) {
+		MapNode &n = mg->vm->m_data[mg->vm->m_area.index(x, y, z)];
+		if (n.getContent() == CONTENT_IGNORE)
+			continue;
+
+		const ContentFeatures &cf = mg->ndef->get(n);
+		if (!cf.light_propagates)
+			continue;
+
+		if (cf.light_source)
+			n.param1 = cf.light_source | (cf.light_source << 4);
+
+		for (u8 i = 0; i != 6; i++)
+			lightSpreadReference(mg, a, v3s16(x, y, z) + g_6dirs[i], n.param1);
+	}
+}
+
+
+void TestMapgen::testCalcLighting(IGameDef *gamedef)
+{
+	v3s16 nmin = chunk_min - v3s16(0, 1, 0);
+	v3s16 nmax = chunk_max + v3s16(0, 1, 0);
+	v3s16 full_nmin = chunk_min - v3s16(1, 1, 1) * MAP_BLOCKSIZE;
+	v3s16 full_nmax = chunk_max + v3s16(1, 1, 1) * MAP_BLOCKSIZE;
+
+	Mapgen mg;
+	mg.ndef = gamedef->getNodeDefManager();
+
+	MMVManip vm_ref(NULL);
+	makeTerrain(&vm_ref);
+	makeCaves(&vm_ref);
+	mg.vm = &vm_ref;
+	mg.propagateSunlight(nmin, nmax, false);
+	spreadLightReference(&mg, full_nmin, full_nmax);
+
+	for (u32 num_threads = 1; num_threads <= 4; num_threads += 3) {
+		MMVManip vm(NULL);
+		makeTerrain(&vm);
+		makeCaves(&vm);
+		mg.vm = &vm;
+		mg.setNumThreads(num_threads);
+		mg.calcLighting(nmin, nmax, full_nmin, full_nmax, false);
+
+		UASSERT(equalNodes(&vm, &vm_ref));
+	}
+
+	// Sunlight above the ground, torch light in the rooms
+	const VoxelArea &area = vm_ref.m_area;
+	UASSERTEQ(u8, vm_ref.m_data[area.index(0, 50, 0)].param1, LIGHT_SUN);
+	UASSERTEQ(u8, vm_ref.m_data[area.index(3, 1, 2)].param1,
+		(LIGHT_MAX - 2) | ((LIGHT_MAX - 2) << 4));
+}
+
+
+void TestMapgen::testCalcLightingBenchmark(IGameDef *gamedef)
+{
+	v3s16 nmin = chunk_min - v3s16(0, 1, 0);
+	v3s16 nmax = chunk_max + v3s16(0, 1, 0);
+	v3s16 full_nmin = chunk_min - v3s16(1, 1, 1) * MAP_BLOCKSIZE;
+	v3s16 full_nmax = chunk_max + v3s16(1, 1, 1) * MAP_BLOCKSIZE;
+
+	Mapgen mg;
+	mg.ndef = gamedef->getNodeDefManager();
+
+	MMVManip vm(NULL);
+	mg.vm = &vm;
+
+	// 0 threads stands for the recursive reference
+	static const u32 thread_counts[] = {0, 1, 2, 4};
+	for (size_t t = 0; t != ARRLEN(thread_counts); t++) {
+		u32 num_threads = thread_counts[t];
+		mg.setNumThreads(num_threads);
+		u64 tdiff = 0;
+		for (u32 i = 0; i != 5; i++) {
+			makeTerrain(&vm);
+			makeCaves(&vm);
+			u64 t1 = porting::getTimeMs();
+			if (num_threads) {
+				mg.calcLighting(nmin, nmax, full_nmin, full_nmax, false);
+			} else {
+				mg.propagateSunlight(nmin, nmax, false);
+				spreadLightReference(&mg, full_nmin, full_nmax);
+			}
+			tdiff += porting::getTimeMs() - t1;
+		}
+
+		infostream << "TestMapgen: 5 lighting updates (112x112x112) ";
+		if (num_threads)
+			infostream << "with " << num_threads << " thread(s)";
+		else
+			infostream << "with recursive spreading";
+		infostream << " took " << tdiff << "ms" << std::endl;
+	}
+}
+
+
+u32 TestMapgen::hashNodes(MMVManip *vm)
+{
+	// FNV-1a over content and param2, param1 is not set by the generators
+	u32 hash = 2166136261U;
+	for (s32 i = 0; i != vm->m_area.getVolume(); i++) {
+		const MapNode &n = vm->m_data[i];
+		hash = (hash ^ n.getContent()) * 16777619U;
+		hash = (hash ^ n.param2) * 16777619U;
+	}
+	return hash;
+}
+
+
+// Runs the cave and dungeon generators on the terrain of makeTerrain()
+void TestMapgen::makeUndergroundStructures(INodeDefManager *ndef, MMVManip *vm)
+{
+	static const s32 seed = 1234;
+	v3s16 csize = chunk_max - chunk_min + v3s16(1, 1, 1);
+
+	// A lake in the valleys between the hills
+	const VoxelArea &a = vm->m_area;
+	for (s16 z = a.MinEdge.Z; z <= a.MaxEdge.Z; z++)
+	for (s16 y = a.MinEdge.Y; y <= 34; y++)
+	for (s16 x = a.MinEdge.X; x <= a.MaxEdge.X; x++) {
+		MapNode &n = vm->m_data[a.index(x, y, z)];
+		if (n.getContent() == CONTENT_AIR)
+			n = MapNode(t_CONTENT_WATER);
+	}
+
+	BiomeManager bmgr(NULL);
+	Biome *biome = (Biome *)bmgr.getRaw(0);
+	biome->c_top          = t_CONTENT_GRASS;
+	biome->c_filler       = t_CONTENT_STONE;
+	biome->c_stone        = t_CONTENT_STONE;
+	biome->c_water_top    = t_CONTENT_WATER;
+	biome->c_water        = t_CONTENT_WATER;
+	biome->c_river_water  = t_CONTENT_LAVA;
+	biome->c_riverbed     = t_CONTENT_BRICK;
+	biome->depth_top      = 1;
+	biome->depth_filler   = 3;
+	biome->depth_riverbed = 2;
+	std::vector<biome_t> biomemap(csize.X * csize.Z, 0);
+
+	NoiseParams np_cave1(0, 12, v3f(61, 61, 61), 52534, 3, 0.5, 2.0);
+	NoiseParams np_cave2(0, 12, v3f(67, 67, 67), 10325, 3, 0.5, 2.0);
+	CavesNoiseIntersection caves_noise(ndef, &bmgr, csize,
+		&np_cave1, &np_cave2, seed, 0.09);
+	caves_noise.generateCaves(vm, chunk_min, chunk_max, &biomemap[0]);
+
+	NoiseParams np_cavern(0, 1, v3f(96, 32, 96), 723, 5, 0.63, 2.0);
+	CavernsNoise caverns_noise(ndef, csize, &np_cavern, seed, 20, 16, 0.5);
+	caverns_noise.generateCaverns(vm, chunk_min, chunk_max);
+
+	std::vector<s16> heightmap(csize.X * csize.Z);
+	for (s16 z = chunk_min.Z; z <= chunk_max.Z; z++)
+	for (s16 x = chunk_min.X; x <= chunk_max.X; x++)
+		heightmap[(z - chunk_min.Z) * csize.X + (x - chunk_min.X)] =
+			30 + (x * 7 + z * 13) % 11;
+
+	PseudoRandom ps(seed);
+	for (u32 i = 0; i != 6; i++) {
+		CavesRandomWalk cave(ndef, NULL, seed, 35,
+			t_CONTENT_WATER, t_CONTENT_LAVA);
+		cave.makeCave(vm, chunk_min, chunk_max, &ps, i % 2, 40, &heightmap[0]);
+	}
+
+	DungeonParams dp;
+	dp.seed                = seed;
+	dp.c_water             = t_CONTENT_WATER;
+	dp.c_river_water       = t_CONTENT_LAVA;
+	dp.c_wall              = t_CONTENT_BRICK;
+	dp.c_alt_wall          = CONTENT_IGNORE;
+	dp.c_stair             = t_CONTENT_BRICK;
+	dp.diagonal_dirs       = false;
+	dp.only_in_ground      = true;
+	dp.holesize            = v3s16(1, 2, 1);
+	dp.corridor_len_min    = 1;
+	dp.corridor_len_max    = 13;
+	dp.room_size_min       = v3s16(4, 4, 4);
+	dp.room_size_max       = v3s16(8, 6, 8);
+	dp.room_size_large_min = v3s16(8, 8, 8);
+	dp.room_size_large_max = v3s16(16, 16, 16);
+	dp.rooms_min           = 2;
+	dp.rooms_max           = 16;
+	dp.y_min               = -MAX_MAP_GENERATION_LIMIT;
+	dp.y_max               = MAX_MAP_GENERATION_LIMIT;
+	dp.notifytype          = GENNOTIFY_DUNGEON;
+	dp.np_density          = NoiseParams(3, 0, v3f(1, 1, 1), 0, 1, 0, 2.0);
+	dp.np_alt_wall         = nparams_dungeon_alt_wall;
+
+	DungeonGen dgen(ndef, NULL, &dp);
+	dgen.generate(vm, 5678, a.MinEdge, a.MaxEdge);
+}
+
+
+void TestMapgen::testCaveGeneration(IGameDef *gamedef)
+{
+	INodeDefManager *ndef = gamedef->getNodeDefManager();
+
+	MMVManip vm(NULL);
+	makeTerrain(&vm);
+	u32 nstone = countNodes(&vm, t_CONTENT_STONE);
+	makeUndergroundStructures(ndef, &vm);
+
+	// Something was carved and built
+	UASSERT(countNodes(&vm, t_CONTENT_STONE) < nstone);
+	UASSERT(countNodes(&vm, t_CONTENT_BRICK) > 0);
+
+	// The generated nodes must not change with optimizations of the
+	// generators, this hash was taken before the fast paths were added
+	UASSERTEQ(u32, hashNodes(&vm), 2736192306U);
+
+	MMVManip vm2(NULL);
+	makeTerrain(&vm2);
+	makeUndergroundStructures(ndef, &vm2);
+	UASSERT(equalNodes(&vm, &vm2));
+}
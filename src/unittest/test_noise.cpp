@@ -19,8 +19,11 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include "test.h"
 
+#include <string.h>
 #include "exceptions.h"
+#include "log.h"
 #include "noise.h"
+#include "util/basic_macros.h"
 
 class TestNoise : public TestBase {
 public:
@@ -34,6 +37,9 @@ class TestNoise : public TestBase {
 	void testNoise3dPoint();
 	void testNoise3dBulk();
 	void testNoiseInvalidParams();
+	void testNoiseSimdEquality();
+	void testNoiseSimdBenchmark();
+	void testNoiseMapCache();
 
 	static const float expected_2d_results[10 * 10];
 	static const float expected_3d_results[10 * 10 * 10];
@@ -48,6 +54,9 @@ void TestNoise::runTests(IGameDef *gamedef)
 	TEST(testNoise3dPoint);
 	TEST(testNoise3dBulk);
 	TEST(testNoiseInvalidParams);
+	TEST(testNoiseSimdEquality);
+	TEST(testNoiseSimdBenchmark);
+	TEST(testNoiseMapCache);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -120,6 +129,156 @@ void TestNoise::testNoiseInvalidParams()
 	UASSERT(exception_thrown);
 }
 
+void TestNoise::testNoiseSimdEquality()
+{
+	// Odd sizes so that the scalar tails of the vector kernels are used too
+	const u32 sx = 37, sy = 23, sz = 19;
+	const u32 flags[] = {
+		0,
+		NOISE_FLAG_DEFAULTS,
+		NOISE_FLAG_EASED,
+		NOISE_FLAG_ABSVALUE,
+		NOISE_FLAG_EASED | NOISE_FLAG_ABSVALUE,
+	};
+
+	float *persistence = new float[sx * sy * sz];
+	for (u32 i = 0; i != sx * sy * sz; i++)
+		persistence[i] = 0.3f + (i % 7) * 0.07f;
+
+	size_t size_2d = sx * sy;
+	size_t size_3d = sx * sy * sz;
+	float *expected_2d = new float[size_2d];
+	float *expected_3d = new float[size_3d];
+
+	NoiseSimdLevel prev_level = noise_get_simd_level();
+	NoiseSimdLevel max_level  = noise_get_simd_support();
+
+	// Cached maps would hide the results of the other levels
+	g_noise_map_cache->setMaxSize(0);
+
+	for (size_t f = 0; f != ARRLEN(flags); f++)
+	for (u32 use_persist = 0; use_persist != 2; use_persist++) {
+		float *pmap = use_persist ? persistence : NULL;
+
+		NoiseParams np_2d(3.5, 12.25, v3f(31.3, 17.7, 23.1), 42, 5, 0.63, 2.1, flags[f]);
+		NoiseParams np_3d(-1, 7, v3f(11.3, 47.7, 9.1), -99, 4, 0.5, 2.0, flags[f]);
+		Noise noise_2d(&np_2d, 1337, sx, sy);
+		Noise noise_3d(&np_3d, -7, sx, sy, sz);
+
+		noise_set_simd_level(NOISE_SIMD_NONE);
+		memcpy(expected_2d, noise_2d.perlinMap2D(-1234.5, 876.25, pmap),
+			size_2d * sizeof(float));
+		memcpy(expected_3d, noise_3d.perlinMap3D(-40000, 12.5, 31000, pmap),
+			size_3d * sizeof(float));
+
+		for (int level = NOISE_SIMD_NONE + 1; level <= max_level; level++) {
+			UASSERT(noise_set_simd_level((NoiseSimdLevel)level) == level);
+
+			// Results have to be bit-identical, else worlds would generate
+			// differently depending on the CPU
+			float *actual_2d = noise_2d.perlinMap2D(-1234.5, 876.25, pmap);
+			UASSERT(memcmp(actual_2d, expected_2d, size_2d * sizeof(float)) == 0);
+			float *actual_3d = noise_3d.perlinMap3D(-40000, 12.5, 31000, pmap);
+			UASSERT(memcmp(actual_3d, expected_3d, size_3d * sizeof(float)) == 0);
+		}
+	}
+
+	noise_set_simd_level(prev_level);
+
+	delete[] expected_3d;
+	delete[] expected_2d;
+	delete[] persistence;
+}
+
+void TestNoise::testNoiseSimdBenchmark()
+{
+	NoiseParams np(0, 1, v3f(250, 250, 250), 5, 5, 0.63, 2.0);
+	Noise noise(&np, 1337, 80, 80, 80);
+
+	NoiseSimdLevel prev_level = noise_get_simd_level();
+	NoiseSimdLevel max_level  = noise_get_simd_support();
+	const char *level_names[] = {"scalar", "SSE2", "AVX2"};
+
+	for (int level = NOISE_SIMD_NONE; level <= max_level; level++) {
+		noise_set_simd_level((NoiseSimdLevel)level);
+
+		u64 t1 = porting::getTimeMs();
+		for (s16 i = 0; i != 10; i++)
+			noise.perlinMap3D(i * 80, 0, 0);
+		u64 tdiff = porting::getTimeMs() - t1;
+
+		infostream << "TestNoise: 10 perlinMap3D (80x80x80, 5 octaves) with "
+			<< level_names[level] << " took " << tdiff << "ms" << std::endl;
+	}
+
+	noise_set_simd_level(prev_level);
+}
+
+void TestNoise::testNoiseMapCache()
+{
+	NoiseParams np(20, 40, v3f(50, 50, 50), 9, 5, 0.6, 2.0);
+	Noise noise_a(&np, 1337, 64, 64);
+	Noise noise_b(&np, 1337, 64, 64);
+	Noise noise_c(&np, 1338, 64, 64);
+	size_t map_size = 64 * 64;
+
+	float *expected = new float[map_size];
+	memcpy(expected, noise_a.perlinMap2D(-8, 8), map_size * sizeof(float));
+
+	// Room for two maps
+	g_noise_map_cache->setMaxSize(2 * map_size * sizeof(float));
+
+	u64 hits, misses, prev_hits, prev_misses;
+	g_noise_map_cache->getStats(&prev_hits, &prev_misses);
+
+	noise_a.perlinMap2D(-8, 8);
+	float *cached = noise_b.perlinMap2D(-8, 8);
+	UASSERT(memcmp(cached, expected, map_size * sizeof(float)) == 0);
+
+	g_noise_map_cache->getStats(&hits, &misses);
+	UASSERTEQ(u64, hits - prev_hits, 1);
+	UASSERTEQ(u64, misses - prev_misses, 1);
+
+	// Another seed, origin or persistence map must not use the cached map
+	float *other = noise_c.perlinMap2D(-8, 8);
+	UASSERT(memcmp(other, expected, map_size * sizeof(float)) != 0);
+	other = noise_b.perlinMap2D(-7, 8);
+	UASSERT(memcmp(other, expected, map_size * sizeof(float)) != 0);
+	float *persistence = new float[map_size];
+	for (size_t i = 0; i != map_size; i++)
+		persistence[i] = 0.5;
+	other = noise_b.perlinMap2D(-8, 8, persistence);
+	UASSERT(memcmp(other, expected, map_size * sizeof(float)) != 0);
+	delete[] persistence;
+
+	// The first map was evicted by the two newer ones
+	g_noise_map_cache->getStats(&prev_hits, &prev_misses);
+	cached = noise_b.perlinMap2D(-8, 8);
+	UASSERT(memcmp(cached, expected, map_size * sizeof(float)) == 0);
+	g_noise_map_cache->getStats(&hits, &misses);
+	UASSERTEQ(u64, hits - prev_hits, 0);
+	UASSERTEQ(u64, misses - prev_misses, 1);
+
+	// 3D maps are not cached
+	Noise noise_3d(&np, 1337, 16, 16, 16);
+	g_noise_map_cache->getStats(&prev_hits, &prev_misses);
+	noise_3d.perlinMap3D(-8, 0, 8);
+	noise_3d.perlinMap3D(-8, 0, 8);
+	g_noise_map_cache->getStats(&hits, &misses);
+	UASSERTEQ(u64, hits - prev_hits, 0);
+	UASSERTEQ(u64, misses - prev_misses, 0);
+
+	// Nor is anything once the cache is disabled
+	g_noise_map_cache->setMaxSize(0);
+	g_noise_map_cache->getStats(&prev_hits, &prev_misses);
+	noise_a.perlinMap2D(-8, 8);
+	g_noise_map_cache->getStats(&hits, &misses);
+	UASSERTEQ(u64, hits - prev_hits, 0);
+	UASSERTEQ(u64, misses - prev_misses, 0);
+
+	delete[] expected;
+}
+
 const float TestNoise::expected_2d_results[10 * 10] = {
 	19.11726, 18.49626, 16.48476, 15.02135, 14.75713, 16.26008, 17.54822,
 	18.06860, 18.57016, 18.48407, 18.49649, 17.89160, 15.94162, 14.54901,
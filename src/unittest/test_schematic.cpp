@@ -22,6 +22,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "mg_schematic.h"
 #include "gamedef.h"
 #include "nodedef.h"
+#include "map.h"
 
 class TestSchematic : public TestBase {
 public:
@@ -33,6 +34,10 @@ class TestSchematic : public TestBase {
 	void testMtsSerializeDeserialize(INodeDefManager *ndef);
 	void testLuaTableSerialize(INodeDefManager *ndef);
 	void testFileSerializeDeserialize(INodeDefManager *ndef);
+	void testBlitToVManip(INodeDefManager *ndef);
+
+	static u32 blitReference(Schematic *schem, MMVManip *vm, v3s16 p,
+		Rotation rot, bool force_place, PcgRandom *pr);
 
 	static const content_t test_schem1_data[7 * 6 * 4];
 	static const content_t test_schem2_data[3 * 3 * 3];
@@ -52,6 +57,7 @@ void TestSchematic::runTests(IGameDef *gamedef)
 	TEST(testMtsSerializeDeserialize, ndef);
 	TEST(testLuaTableSerialize, ndef);
 	TEST(testFileSerializeDeserialize, ndef);
+	TEST(testBlitToVManip, ndef);
 
 	ndef->resetNodeResolveState();
 }
@@ -181,6 +187,159 @@ void TestSchematic::testFileSerializeDeserialize(INodeDefManager *ndef)
 }
 
 
+// Places the schematic node by node, for comparison with the prepared
+// rotations, and returns the number of slices skipped
+u32 TestSchematic::blitReference(Schematic *schem, MMVManip *vm, v3s16 p,
+	Rotation rot, bool force_place, PcgRandom *pr)
+{
+	int xstride = 1;
+	int ystride = schem->size.X;
+	int zstride = schem->size.X * schem->size.Y;
+
+	s16 sx = schem->size.X;
+	s16 sy = schem->size.Y;
+	s16 sz = schem->size.Z;
+
+	int i_start, i_step_x, i_step_z;
+	switch (rot) {
+		case ROTATE_90:
+			i_start  = sx - 1;
+			i_step_x = zstride;
+			i_step_z = -xstride;
+			SWAP(s16, sx, sz);
+			break;
+		case ROTATE_180:
+			i_start  = zstride * (sz - 1) + sx - 1;
+			i_step_x = -xstride;
+			i_step_z = -zstride;
+			break;
+		case ROTATE_270:
+			i_start  = zstride * (sz - 1);
+			i_step_x = -zstride;
+			i_step_z = xstride;
+			SWAP(s16, sx, sz);
+			break;
+		default:
+			i_start  = 0;
+			i_step_x = xstride;
+			i_step_z = zstride;
+	}
+
+	const MapNode *schemdata = schem->schemdata;
+	u32 skipped = 0;
+	s16 y_map = p.Y;
+	for (s16 y = 0; y != sy; y++) {
+		if ((schem->slice_probs[y] != MTSCHEM_PROB_ALWAYS) &&
+			(schem->slice_probs[y] <= pr->range(1, MTSCHEM_PROB_ALWAYS))) {
+			skipped++;
+			continue;
+		}
+
+		for (s16 z = 0; z != sz; z++) {
+			u32 i = z * i_step_z + y * ystride + i_start;
+			for (s16 x = 0; x != sx; x++, i += i_step_x) {
+				// Nodes outside of the area are clipped, rather than
+				// wrapped to the next row by an index check
+				v3s16 p_map(p.X + x, y_map, p.Z + z);
+				if (!vm->m_area.contains(p_map))
+					continue;
+				u32 vi = vm->m_area.index(p_map);
+
+				if (schemdata[i].getContent() == CONTENT_IGNORE)
+					continue;
+
+				u8 placement_prob     = schemdata[i].param1 & MTSCHEM_PROB_MASK;
+				bool force_place_node = schemdata[i].param1 & MTSCHEM_FORCE_PLACE;
+
+				if (placement_prob == MTSCHEM_PROB_NEVER)
+					continue;
+
+				if (!force_place && !force_place_node) {
+					content_t c = vm->m_data[vi].getContent();
+					if (c != CONTENT_AIR && c != CONTENT_IGNORE)
+						continue;
+				}
+
+				if ((placement_prob != MTSCHEM_PROB_ALWAYS) &&
+					(placement_prob <= pr->range(1, MTSCHEM_PROB_ALWAYS)))
+					continue;
+
+				vm->m_data[vi] = schemdata[i];
+				vm->m_data[vi].param1 = 0;
+
+				if (rot)
+					vm->m_data[vi].rotateAlongYAxis(schem->m_ndef, rot);
+			}
+		}
+		y_map++;
+	}
+	return skipped;
+}
+
+
+void TestSchematic::testBlitToVManip(INodeDefManager *ndef)
+{
+	static const v3s16 size(7, 6, 4);
+	static const u32 volume = size.X * size.Y * size.Z;
+	static const content_t content_map[] = {
+		CONTENT_IGNORE,
+		t_CONTENT_STONE,
+		t_CONTENT_LAVA,
+		CONTENT_AIR,
+	};
+
+	Schematic schem;
+	schem.m_ndef      = ndef;
+	schem.flags       = 0;
+	schem.size        = size;
+	schem.schemdata   = new MapNode[volume];
+	schem.slice_probs = new u8[size.Y];
+	for (size_t i = 0; i != volume; i++) {
+		u8 param1 = MTSCHEM_PROB_ALWAYS;
+		if (i % 5 == 0)
+			param1 = 40;
+		else if (i % 11 == 0)
+			param1 = MTSCHEM_PROB_NEVER;
+		else if (i % 13 == 0)
+			param1 |= MTSCHEM_FORCE_PLACE;
+		schem.schemdata[i] = MapNode(content_map[test_schem1_data[i]], param1, 0);
+	}
+	for (s16 y = 0; y != size.Y; y++)
+		schem.slice_probs[y] = (y == 2) ? 64 : MTSCHEM_PROB_ALWAYS;
+	schem.updateRotations();
+
+	// Placed partly outside of the voxel manipulator
+	VoxelArea area(v3s16(-8, -8, -8), v3s16(15, 15, 15));
+	v3s16 p(-10, 1, 5);
+
+	for (int rot = ROTATE_0; rot <= ROTATE_270; rot++)
+	for (int force = 0; force != 2; force++) {
+		// Enough seeds for slice 2 to be both skipped and placed
+		u32 num_skipped = 0;
+		for (u64 seed = 0; seed != 16; seed++) {
+			MMVManip vm1(NULL);
+			MMVManip vm2(NULL);
+			vm1.addArea(area);
+			vm2.addArea(area);
+			for (s32 i = 0; i != area.getVolume(); i++) {
+				vm1.m_data[i] = MapNode((i % 3) ? CONTENT_AIR : t_CONTENT_WATER);
+				vm2.m_data[i] = vm1.m_data[i];
+			}
+
+			PcgRandom pr1(seed);
+			PcgRandom pr2(seed);
+			schem.blitToVManip(&vm1, p, (Rotation)rot, force, &pr1);
+			num_skipped += blitReference(&schem, &vm2, p, (Rotation)rot,
+				force, &pr2);
+
+			for (s32 i = 0; i != area.getVolume(); i++)
+				UASSERT(vm1.m_data[i] == vm2.m_data[i]);
+		}
+		UASSERT(num_skipped > 0 && num_skipped < 16);
+	}
+}
+
+
 // Should form a cross-shaped-thing...?
 const content_t TestSchematic::test_schem1_data[7 * 6 * 4] = {
 	3, 3, 1, 1, 1, 3, 3, // Y=0, Z=0
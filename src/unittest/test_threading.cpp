@@ -22,6 +22,8 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "threading/atomic.h"
 #include "threading/semaphore.h"
 #include "threading/thread.h"
+#include "util/workerpool.h"
+#include "exceptions.h"
 
 
 class TestThreading : public TestBase {
@@ -33,6 +35,7 @@ class TestThreading : public TestBase {
 	void testStartStopWait();
 	void testThreadKill();
 	void testAtomicSemaphoreThread();
+	void testWorkerPool();
 };
 
 static TestThreading g_test_instance;
@@ -42,6 +45,7 @@ void TestThreading::runTests(IGameDef *gamedef)
 	TEST(testStartStopWait);
 	TEST(testThreadKill);
 	TEST(testAtomicSemaphoreThread);
+	TEST(testWorkerPool);
 }
 
 class SimpleTestThread : public Thread {
@@ -181,3 +185,46 @@ void TestThreading::testAtomicSemaphoreThread()
 	UASSERT(val == num_threads * 0x10000);
 }
 
+
+
+static void worker_pool_test_job(u32 job, void *data)
+{
+	std::vector<u32> &counts = *(std::vector<u32> *)data;
+	if (job == 0xBAD)
+		throw BaseException("bad job");
+	counts[job]++;
+}
+
+
+void TestThreading::testWorkerPool()
+{
+	WorkerPool pool("WorkerPoolTest", 4);
+	UASSERT(pool.getNumThreads() == 4);
+
+	// The same threads run batch after batch, every job exactly once
+	std::vector<u32> counts(1000, 0);
+	for (u32 i = 0; i != 100; i++)
+		pool.run(counts.size(), worker_pool_test_job, &counts);
+	pool.run(counts.size(), worker_pool_test_job, &counts, 2);
+	pool.run(1, worker_pool_test_job, &counts);
+	pool.run(0, worker_pool_test_job, &counts);
+
+	UASSERT(counts[0] == 102);
+	for (u32 i = 1; i != counts.size(); i++)
+		UASSERT(counts[i] == 101);
+
+	// A failing job is reported to the caller, the pool keeps working
+	counts.resize(0x1000, 0);
+	bool thrown = false;
+	try {
+		pool.run(counts.size(), worker_pool_test_job, &counts);
+	} catch (BaseException &) {
+		thrown = true;
+	}
+	UASSERT(thrown);
+
+	counts.assign(8, 0);
+	pool.run(counts.size(), worker_pool_test_job, &counts);
+	for (u32 i = 0; i != counts.size(); i++)
+		UASSERT(counts[i] == 1);
+}
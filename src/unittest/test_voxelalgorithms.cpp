@@ -21,6 +21,9 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include "gamedef.h"
 #include "voxelalgorithms.h"
+#include "map.h"
+#include "mapblock.h"
+#include "mapsector.h"
 #include "util/numeric.h"
 
 class TestVoxelAlgorithms : public TestBase {
@@ -33,6 +36,12 @@ class TestVoxelAlgorithms : public TestBase {
 	void testPropogateSunlight(INodeDefManager *ndef);
 	void testClearLightAndCollectSources(INodeDefManager *ndef);
 	void testVoxelLineIterator(INodeDefManager *ndef);
+	void testLightingUpdate(IGameDef *gamedef);
+	void testAddNodesWithEvent(IGameDef *gamedef);
+
+	static void makeLitMap(Map *map, IGameDef *gamedef);
+	static void getLightingChanges(
+		std::vector<std::pair<v3s16, MapNode> > *changes);
 };
 
 static TestVoxelAlgorithms g_test_instance;
@@ -44,6 +53,8 @@ void TestVoxelAlgorithms::runTests(IGameDef *gamedef)
 	TEST(testPropogateSunlight, ndef);
 	TEST(testClearLightAndCollectSources, ndef);
 	TEST(testVoxelLineIterator, ndef);
+	TEST(testLightingUpdate, gamedef);
+	TEST(testAddNodesWithEvent, gamedef);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -261,3 +272,134 @@ void TestVoxelAlgorithms::testVoxelLineIterator(INodeDefManager *ndef)
 		UASSERTEQ(int, actual_nodecount, nodecount);
 	}
 }
+
+// Air above a stone floor, lit by the sun
+void TestVoxelAlgorithms::makeLitMap(Map *map, IGameDef *gamedef)
+{
+	MapNode air(CONTENT_AIR);
+	air.setLight(LIGHTBANK_DAY, LIGHT_SUN, gamedef->getNodeDefManager());
+	MapNode stone(t_CONTENT_STONE);
+
+	for (s16 z = -2; z <= 2; z++)
+	for (s16 x = -2; x <= 2; x++) {
+		MapSector *sector = new ServerMapSector(map, v2s16(x, z), gamedef);
+		(*map->getSectorsPtr())[v2s16(x, z)] = sector;
+		for (s16 y = -2; y <= 3; y++) {
+			MapBlock *block = sector->createBlankBlock(y);
+			MapNode *data = block->getData();
+			for (u32 i = 0; i < MapBlock::nodecount; i++) {
+				s16 node_y = y * MAP_BLOCKSIZE + (s16)((i >> 4) & 15);
+				data[i] = node_y < -20 ? stone : air;
+			}
+		}
+	}
+}
+
+void TestVoxelAlgorithms::getLightingChanges(
+	std::vector<std::pair<v3s16, MapNode> > *changes)
+{
+	// A roof with a torch under it, and a pillar next to it
+	for (s16 z = -12; z <= 12; z++)
+	for (s16 x = -12; x <= 12; x++)
+		changes->push_back(std::make_pair(v3s16(x, 40, z),
+			MapNode(t_CONTENT_STONE)));
+	changes->push_back(std::make_pair(v3s16(3, 30, -4),
+		MapNode(t_CONTENT_TORCH)));
+	for (s16 y = -20; y <= 10; y++)
+		changes->push_back(std::make_pair(v3s16(17, y, 1),
+			MapNode(t_CONTENT_STONE)));
+	// Open a hole in the roof again
+	changes->push_back(std::make_pair(v3s16(5, 40, 5), MapNode(CONTENT_AIR)));
+}
+
+void TestVoxelAlgorithms::testLightingUpdate(IGameDef *gamedef)
+{
+	std::vector<std::pair<v3s16, MapNode> > changes;
+	getLightingChanges(&changes);
+
+	// One node at a time, directly on the map
+	Map map1(dstream, gamedef);
+	makeLitMap(&map1, gamedef);
+	std::map<v3s16, MapBlock *> modified_blocks;
+	for (size_t i = 0; i < changes.size(); i++) {
+		std::vector<std::pair<v3s16, MapNode> > oldnodes;
+		oldnodes.push_back(std::make_pair(changes[i].first,
+			map1.getNodeNoEx(changes[i].first)));
+		map1.setNode(changes[i].first, changes[i].second);
+		voxalgo::update_lighting_nodes(&map1, oldnodes, modified_blocks);
+	}
+
+	// All nodes at once, in a window
+	Map map2(dstream, gamedef);
+	makeLitMap(&map2, gamedef);
+	std::vector<std::pair<v3s16, MapNode> > oldnodes;
+	for (size_t i = 0; i < changes.size(); i++) {
+		oldnodes.push_back(std::make_pair(changes[i].first,
+			map2.getNodeNoEx(changes[i].first)));
+		map2.setNode(changes[i].first, changes[i].second);
+	}
+
+	voxalgo::LightingUpdate update(gamedef->getNodeDefManager(), oldnodes);
+	std::map<v3s16, MapBlock *> modified_blocks2;
+	bool done = false;
+	while (!done && update.prepare(&map2)) {
+		if (update.compute()) {
+			update.commit(&map2, modified_blocks2);
+			done = true;
+		}
+	}
+	UASSERT(done);
+	// The sunlight removed below the roof made the window grow
+	UASSERT(update.getWindowSize() > 5 * 3 * 5);
+	UASSERT(!modified_blocks2.empty());
+
+	for (s16 z = -32; z < 48; z++)
+	for (s16 y = -32; y < 64; y++)
+	for (s16 x = -32; x < 48; x++) {
+		v3s16 p(x, y, z);
+		UASSERTEQ(u8, map2.getNodeNoEx(p).param1, map1.getNodeNoEx(p).param1);
+	}
+	UASSERT(map2.getNodeNoEx(v3s16(0, 39, 0)).getLight(LIGHTBANK_DAY,
+		gamedef->getNodeDefManager()) < LIGHT_SUN);
+}
+
+void TestVoxelAlgorithms::testAddNodesWithEvent(IGameDef *gamedef)
+{
+	// A roof with a hole in it
+	std::vector<v3s16> positions;
+	for (s16 z = -12; z <= 12; z++)
+	for (s16 x = -12; x <= 12; x++) {
+		if (x != 5 || z != 5)
+			positions.push_back(v3s16(x, 40, z));
+	}
+	MapNode stone(t_CONTENT_STONE);
+
+	// One node at a time
+	Map map1(dstream, gamedef);
+	makeLitMap(&map1, gamedef);
+	std::map<v3s16, MapBlock *> modified_blocks;
+	for (size_t i = 0; i < positions.size(); i++)
+		map1.addNodeAndUpdate(positions[i], stone, modified_blocks);
+
+	// All at once, with a position that is not loaded
+	Map map2(dstream, gamedef);
+	makeLitMap(&map2, gamedef);
+	std::vector<v3s16> positions2 = positions;
+	positions2.push_back(v3s16(0, 500, 0));
+	UASSERTEQ(u32, map2.addNodesWithEvent(positions2, stone),
+		positions.size());
+
+	for (s16 z = -32; z < 48; z++)
+	for (s16 y = -32; y < 64; y++)
+	for (s16 x = -32; x < 48; x++) {
+		v3s16 p(x, y, z);
+		MapNode n1 = map1.getNodeNoEx(p);
+		MapNode n2 = map2.getNodeNoEx(p);
+		UASSERTEQ(content_t, n2.getContent(), n1.getContent());
+		UASSERTEQ(u8, n2.param1, n1.param1);
+	}
+
+	// Nothing is set for ignore
+	UASSERTEQ(u32, map2.addNodesWithEvent(positions,
+		MapNode(CONTENT_IGNORE)), 0);
+}
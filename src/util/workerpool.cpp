@@ -0,0 +1,146 @@
+/*
+Minetest
+Copyright (C) 2010-2013 celeron55, Perttu Ahola <celeron55@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 3.0 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "workerpool.h"
+
+#include "../threading/mutex_auto_lock.h"
+#include "../threading/thread.h"
+#include "../exceptions.h"
+#include "../log.h"
+
+class WorkerThread : public Thread {
+public:
+	WorkerThread(const std::string &name, WorkerPool *pool) :
+		Thread(name),
+		m_pool(pool)
+	{
+	}
+
+protected:
+	void *run()
+	{
+		for (;;) {
+			m_pool->m_work.wait();
+			if (m_pool->m_stopping)
+				break;
+			m_pool->runJobs();
+			m_pool->m_done.post();
+		}
+		return NULL;
+	}
+
+private:
+	WorkerPool *m_pool;
+};
+
+
+WorkerPool::WorkerPool(const std::string &name, u32 num_threads) :
+	m_stopping(false),
+	m_func(NULL),
+	m_data(NULL),
+	m_num_jobs(0),
+	m_failed(false)
+{
+	m_next_job = 0;
+
+	for (u32 i = 1; i < num_threads; i++) {
+		WorkerThread *thread = new WorkerThread(name, this);
+		if (!thread->start()) {
+			errorstream << "WorkerPool: failed to start a thread of "
+				<< name << std::endl;
+			delete thread;
+			break;
+		}
+		m_threads.push_back(thread);
+	}
+}
+
+
+WorkerPool::~WorkerPool()
+{
+	// Posting the semaphore publishes m_stopping to the threads
+	m_stopping = true;
+	m_work.post(m_threads.size());
+
+	for (size_t i = 0; i != m_threads.size(); i++) {
+		m_threads[i]->wait();
+		delete m_threads[i];
+	}
+}
+
+
+void WorkerPool::run(u32 num_jobs, WorkerJobFunc func, void *data,
+	u32 max_threads)
+{
+	u32 num_threads = getNumThreads();
+	if (max_threads)
+		num_threads = MYMIN(num_threads, max_threads);
+	num_threads = MYMIN(num_threads, num_jobs);
+
+	if (num_threads <= 1) {
+		for (u32 i = 0; i != num_jobs; i++)
+			func(i, data);
+		return;
+	}
+
+	MutexAutoLock lock(m_run_mutex);
+
+	m_func     = func;
+	m_data     = data;
+	m_num_jobs = num_jobs;
+	m_next_job = 0;
+	m_failed   = false;
+	m_error.clear();
+
+	// The calling thread is one of them
+	u32 num_woken = num_threads - 1;
+	m_work.post(num_woken);
+	runJobs();
+	for (u32 i = 0; i != num_woken; i++)
+		m_done.wait();
+
+	m_func = NULL;
+	m_data = NULL;
+
+	if (m_failed)
+		throw BaseException(m_error);
+}
+
+
+void WorkerPool::runJobs()
+{
+	for (;;) {
+		u32 job = m_next_job++;
+		if (job >= m_num_jobs)
+			break;
+
+		try {
+			m_func(job, m_data);
+		} catch (std::exception &e) {
+			MutexAutoLock lock(m_error_mutex);
+			if (!m_failed) {
+				m_failed = true;
+				m_error = e.what();
+			}
+			// Skip the jobs nobody has taken yet
+			m_next_job = m_num_jobs;
+			break;
+		}
+	}
+}
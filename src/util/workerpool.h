@@ -0,0 +1,84 @@
+/*
+Minetest
+Copyright (C) 2010-2013 celeron55, Perttu Ahola <celeron55@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 3.0 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#ifndef UTIL_WORKERPOOL_HEADER
+#define UTIL_WORKERPOOL_HEADER
+
+#include "../irrlichttypes.h"
+#include "../threading/atomic.h"
+#include "../threading/mutex.h"
+#include "../threading/semaphore.h"
+#include "basic_macros.h"
+#include <string>
+#include <vector>
+
+// Function run by WorkerPool::run() for every job
+typedef void (*WorkerJobFunc)(u32 job, void *data);
+
+class WorkerThread;
+
+/*
+	A fixed set of threads running batches of independent jobs.  The threads
+	are started once, with the pool, and wait for work in between batches.
+	The thread calling run() takes part in the batch, so a pool of
+	num_threads threads starts num_threads - 1 of them.
+*/
+class WorkerPool {
+public:
+	WorkerPool(const std::string &name, u32 num_threads);
+	~WorkerPool();
+
+	inline u32 getNumThreads() const { return m_threads.size() + 1; }
+
+	/*
+		Runs func for the jobs 0 ... num_jobs - 1 on up to max_threads
+		threads (0: all of the pool) and returns once all are done.  Jobs
+		must not share mutable state.  An exception thrown by a job is
+		rethrown in the calling thread as BaseException.  Concurrent calls
+		are run one after another.
+	*/
+	void run(u32 num_jobs, WorkerJobFunc func, void *data, u32 max_threads = 0);
+
+private:
+	friend class WorkerThread;
+
+	// Takes jobs of the current batch until none is left
+	void runJobs();
+
+	std::vector<WorkerThread *> m_threads;
+	bool m_stopping;
+
+	Mutex m_run_mutex;
+	Semaphore m_work;
+	Semaphore m_done;
+
+	// The current batch
+	WorkerJobFunc m_func;
+	void *m_data;
+	u32 m_num_jobs;
+	Atomic<u32> m_next_job;
+
+	Mutex m_error_mutex;
+	bool m_failed;
+	std::string m_error;
+
+	DISABLE_CLASS_COPY(WorkerPool);
+};
+
+#endif
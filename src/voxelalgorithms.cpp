@@ -21,6 +21,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "nodedef.h"
 #include "mapblock.h"
 #include "map.h"
+#include <cstring>
 
 namespace voxalgo
 {
@@ -602,7 +603,7 @@ bool is_sunlight_above(Map *map, v3s16 pos, INodeDefManager *ndef)
 
 static const LightBank banks[] = { LIGHTBANK_DAY, LIGHTBANK_NIGHT };
 
-void update_lighting_nodes(Map *map,
+static void update_lighting_nodes_in_map(Map *map,
 	std::vector<std::pair<v3s16, MapNode> > &oldnodes,
 	std::map<v3s16, MapBlock*> &modified_blocks)
 {
@@ -780,6 +781,512 @@ void update_lighting_nodes(Map *map,
 	}
 }
 
+/*
+ * Updates with fewer changed nodes than this are done directly on the map,
+ * since copying the window would cost more than it saves.
+ */
+#define LIGHTING_WINDOW_MIN_NODES 32
+//! Larger windows fall back to the update on the map.
+#define LIGHTING_WINDOW_MAX_BLOCKS 1024
+
+/*
+ * Position of a node in the window: the index of its slot shifted left
+ * by 12, or-ed with its index in the map block.
+ * Queue entries additionally hold the bank (bit 3) and the
+ * source direction (bits 0-2).
+ */
+#define WINDOW_SLOT_SHIFT 12
+
+//! Shift of the relative coordinate changed by each direction
+static const u8 direction_shift[6] = { 0, 4, 8, 8, 4, 0 };
+
+struct LightingUpdate::Queue {
+	//! For each light level there is a vector.
+	std::vector<u32> lights[LIGHT_SUN + 1];
+	//! Light of the brightest entry in the queue.
+	u8 max_light;
+
+	Queue() :
+		max_light(0)
+	{}
+
+	bool next(u8 &light, u32 &entry)
+	{
+		while (lights[max_light].empty()) {
+			if (max_light == 0) {
+				return false;
+			}
+			max_light--;
+		}
+		light = max_light;
+		entry = lights[max_light].back();
+		lights[max_light].pop_back();
+		return true;
+	}
+
+	inline void push(u8 light, u32 index, u8 bank, direction source_dir)
+	{
+		assert(light <= LIGHT_SUN);
+		lights[light].push_back((index << 4) | (bank << 3) | source_dir);
+		if (light > max_light) {
+			max_light = light;
+		}
+	}
+};
+
+LightingUpdate::LightingUpdate(INodeDefManager *ndef,
+		const std::vector<std::pair<v3s16, MapNode> > &oldnodes) :
+	m_ndef(ndef),
+	m_oldnodes(oldnodes),
+	m_need_grow(false),
+	m_grow_dirs(0)
+{
+	for (std::vector<std::pair<v3s16, MapNode> >::const_iterator it =
+			oldnodes.begin(); it != oldnodes.end(); ++it) {
+		m_block_area.addPoint(getNodeBlockPos(it->first));
+	}
+	// Light of a node reaches at most one block further
+	if (!m_block_area.hasEmptyExtent()) {
+		m_block_area.pad(v3s16(1, 1, 1));
+	}
+}
+
+bool LightingUpdate::prepare(Map *map)
+{
+	// Double the extent of the window towards the borders light reached,
+	// so all retries together copy about twice the final window at most
+	v3s16 extent = m_block_area.getExtent();
+	for (direction d = 0; d < 6; d++) {
+		if (!(m_grow_dirs & (1 << d))) {
+			continue;
+		}
+		const v3s16 &dir = neighbor_dirs[d];
+		v3s16 grow(dir.X * MYMAX(extent.X, 2), dir.Y * MYMAX(extent.Y, 2),
+			dir.Z * MYMAX(extent.Z, 2));
+		m_block_area.addPoint((d < 3 ? m_block_area.MaxEdge :
+			m_block_area.MinEdge) + grow);
+	}
+	m_grow_dirs = 0;
+	m_need_grow = false;
+
+	u32 volume = m_block_area.hasEmptyExtent() ? 0 :
+		m_block_area.getVolume();
+	if (volume > LIGHTING_WINDOW_MAX_BLOCKS) {
+		return false;
+	}
+	m_slots.resize(volume);
+	m_data.resize(volume * MapBlock::nodecount);
+
+	const v3s16 &bmin = m_block_area.MinEdge;
+	const v3s16 &bmax = m_block_area.MaxEdge;
+	for (s16 z = bmin.Z; z <= bmax.Z; z++)
+	for (s16 y = bmin.Y; y <= bmax.Y; y++)
+	for (s16 x = bmin.X; x <= bmax.X; x++) {
+		v3s16 p(x, y, z);
+		u32 i = m_block_area.index(p);
+		Slot &slot = m_slots[i];
+		slot.pos = p;
+		slot.dirty = false;
+		slot.changed_nodes = false;
+		slot.incomplete = 0;
+
+		MapBlock *block = map->getBlockNoCreateNoEx(p);
+		slot.exists = block != NULL && !block->isDummy();
+		slot.underground = slot.exists && block->getIsUnderground();
+		if (slot.exists) {
+			memcpy(&m_data[i << WINDOW_SLOT_SHIFT], block->getData(),
+				MapBlock::nodecount * sizeof(MapNode));
+		}
+
+		for (direction d = 0; d < 6; d++) {
+			v3s16 p2 = p + neighbor_dirs[d];
+			slot.neighbors[d] = m_block_area.contains(p2) ?
+				m_block_area.index(p2) : -1;
+		}
+	}
+	return true;
+}
+
+bool LightingUpdate::getIndex(v3s16 p, u32 *index) const
+{
+	mapblock_v3 block_pos;
+	relative_v3 rel_pos;
+	getNodeBlockPosWithOffset(p, block_pos, rel_pos);
+	if (!m_block_area.contains(block_pos)) {
+		return false;
+	}
+	u32 slot = m_block_area.index(block_pos);
+	if (!m_slots[slot].exists) {
+		return false;
+	}
+	*index = (slot << WINDOW_SLOT_SHIFT) | (rel_pos.Z << 8) |
+		(rel_pos.Y << 4) | rel_pos.X;
+	return true;
+}
+
+/*!
+ * Gets the neighbor of a node in the window.
+ * Returns false if the neighbor's block is not loaded, or if it is
+ * outside the window, in which case m_need_grow is set.
+ */
+bool LightingUpdate::step(u32 index, u8 dir, u32 *neighbor_index)
+{
+	u32 rel = index & (MapBlock::nodecount - 1);
+	u8 shift = direction_shift[dir];
+	u32 coord = (rel >> shift) & (MAP_BLOCKSIZE - 1);
+	// Directions 0-2 are positive
+	if (dir < 3) {
+		if (coord < MAP_BLOCKSIZE - 1) {
+			*neighbor_index = index + (1 << shift);
+			return true;
+		}
+	} else if (coord > 0) {
+		*neighbor_index = index - (1 << shift);
+		return true;
+	}
+
+	// The neighbor is in an other block
+	const Slot &slot = m_slots[index >> WINDOW_SLOT_SHIFT];
+	s32 neighbor_slot = slot.neighbors[dir];
+	if (neighbor_slot < 0) {
+		m_need_grow = true;
+		m_grow_dirs |= 1 << dir;
+		return false;
+	}
+	if (!m_slots[neighbor_slot].exists) {
+		return false;
+	}
+	if (dir < 3) {
+		rel -= (MAP_BLOCKSIZE - 1) << shift;
+	} else {
+		rel += (MAP_BLOCKSIZE - 1) << shift;
+	}
+	*neighbor_index = ((u32)neighbor_slot << WINDOW_SLOT_SHIFT) | rel;
+	return true;
+}
+
+//! Same as is_sunlight_above(), inside the window.
+bool LightingUpdate::isSunlightAbove(u32 index)
+{
+	u32 above;
+	if (!step(index, 1, &above)) {
+		// If there is no node above, then use heuristics
+		return !m_need_grow && !m_slots[index >> WINDOW_SLOT_SHIFT].underground;
+	}
+	const MapNode &n = m_data[above];
+	if (n.getContent() == CONTENT_IGNORE) {
+		// Trust heuristics
+		return !m_slots[above >> WINDOW_SLOT_SHIFT].underground;
+	}
+	return n.getLight(LIGHTBANK_DAY, m_ndef) == LIGHT_SUN;
+}
+
+//! Same as unspread_light(), for both banks.
+void LightingUpdate::unspreadLight(Queue &from_nodes, Queue &light_sources)
+{
+	u8 current_light;
+	u32 entry;
+	while (from_nodes.next(current_light, entry)) {
+		u32 index = entry >> 4;
+		u8 b = (entry >> 3) & 1;
+		LightBank bank = banks[b];
+		direction current_source_dir = entry & 7;
+
+		// Direction of the brightest neighbor of the node
+		direction source_dir = 6;
+		const ContentFeatures &f = m_ndef->get(m_data[index]);
+		// If the node emits light, it behaves like it had a
+		// brighter neighbor.
+		u8 brightest_neighbor_light = f.light_source + 1;
+		for (direction i = 0; i < 6; i++) {
+			// The node that changed this node has already zero light
+			// and it can't give light to this node
+			if (current_source_dir + i == 5) {
+				continue;
+			}
+			u32 neighbor_index;
+			if (!step(index, i, &neighbor_index)) {
+				if (m_need_grow) {
+					return;
+				}
+				m_slots[index >> WINDOW_SLOT_SHIFT].incomplete |=
+					1 << (b * 6 + i);
+				continue;
+			}
+			MapNode &neighbor = m_data[neighbor_index];
+			const ContentFeatures &neighbor_f = m_ndef->get(neighbor);
+			u8 neighbor_light = neighbor.getLightRaw(bank, neighbor_f);
+			if (neighbor_f.light_propagates && neighbor_light < current_light) {
+				// Unlight, but only if the node has light.
+				if (neighbor_light > 0) {
+					neighbor.setLight(bank, 0, neighbor_f);
+					m_slots[neighbor_index >> WINDOW_SLOT_SHIFT].dirty = true;
+					from_nodes.push(neighbor_light, neighbor_index, b, i);
+				}
+			} else {
+				// The neighbor can light up this node.
+				if (neighbor_light < neighbor_f.light_source) {
+					neighbor_light = neighbor_f.light_source;
+				}
+				if (brightest_neighbor_light < neighbor_light) {
+					brightest_neighbor_light = neighbor_light;
+					source_dir = i;
+				}
+			}
+		}
+		// If the brightest neighbor is able to light up this node,
+		// then add this node to the output nodes.
+		if (brightest_neighbor_light > 1 && f.light_propagates) {
+			brightest_neighbor_light--;
+			light_sources.push(brightest_neighbor_light, index, b,
+				(source_dir == 6) ? 6 : 5 - source_dir);
+		}
+	}
+}
+
+//! Same as spread_light(), for both banks.
+void LightingUpdate::spreadLight(Queue &light_sources)
+{
+	u8 spreading_light;
+	u32 entry;
+	while (light_sources.next(spreading_light, entry)) {
+		u32 index = entry >> 4;
+		u8 b = (entry >> 3) & 1;
+		LightBank bank = banks[b];
+		direction source_dir = entry & 7;
+
+		spreading_light--;
+		for (direction i = 0; i < 6; i++) {
+			// This node can't light up its light source
+			if (source_dir + i == 5) {
+				continue;
+			}
+			u32 neighbor_index;
+			if (!step(index, i, &neighbor_index)) {
+				if (m_need_grow) {
+					return;
+				}
+				m_slots[index >> WINDOW_SLOT_SHIFT].incomplete |=
+					1 << (b * 6 + i);
+				continue;
+			}
+			MapNode &neighbor = m_data[neighbor_index];
+			const ContentFeatures &f = m_ndef->get(neighbor);
+			if (f.light_propagates) {
+				// Light up the neighbor, if it has less light than it should.
+				u8 neighbor_light = neighbor.getLightRaw(bank, f);
+				if (neighbor_light < spreading_light) {
+					neighbor.setLight(bank, spreading_light, f);
+					m_slots[neighbor_index >> WINDOW_SLOT_SHIFT].dirty = true;
+					light_sources.push(spreading_light, neighbor_index, b, i);
+				}
+			}
+		}
+	}
+}
+
+bool LightingUpdate::compute()
+{
+	m_need_grow = false;
+
+	// Nodes that are brighter than the brightest modified node was
+	// won't change, since they didn't get their light from a
+	// modified node.
+	u8 min_safe_light[2] = { 0, 0 };
+	for (std::vector<std::pair<v3s16, MapNode> >::const_iterator it =
+			m_oldnodes.begin(); it != m_oldnodes.end(); ++it) {
+		for (u8 b = 0; b < 2; b++) {
+			u8 old_light = it->second.getLight(banks[b], m_ndef);
+			if (old_light > min_safe_light[b]) {
+				min_safe_light[b] = old_light;
+			}
+		}
+	}
+	// If only one node changed, even nodes with the same brightness
+	// didn't get their light from the changed node.
+	if (m_oldnodes.size() > 1) {
+		min_safe_light[0]++;
+		min_safe_light[1]++;
+	}
+
+	Queue disappearing_lights;
+	Queue light_sources;
+
+	// For each changed node process sunlight and initialize
+	for (std::vector<std::pair<v3s16, MapNode> >::const_iterator it =
+			m_oldnodes.begin(); it != m_oldnodes.end(); ++it) {
+		u32 index;
+		if (!getIndex(it->first, &index)) {
+			continue;
+		}
+		Slot &slot = m_slots[index >> WINDOW_SLOT_SHIFT];
+		slot.dirty = true;
+		slot.changed_nodes = true;
+
+		for (u8 b = 0; b < 2; b++) {
+			LightBank bank = banks[b];
+			MapNode &n = m_data[index];
+			const ContentFeatures &f = m_ndef->get(n);
+			// Light of the old node
+			u8 old_light = it->second.getLight(bank, m_ndef);
+
+			// Get new light level of the node
+			u8 new_light = 0;
+			if (f.light_propagates) {
+				if (bank == LIGHTBANK_DAY && f.sunlight_propagates
+						&& isSunlightAbove(index)) {
+					new_light = LIGHT_SUN;
+				} else {
+					if (m_need_grow) {
+						return false;
+					}
+					new_light = f.light_source;
+					for (direction d = 0; d < 6; d++) {
+						u32 index2;
+						if (!step(index, d, &index2)) {
+							if (m_need_grow) {
+								return false;
+							}
+							continue;
+						}
+						u8 spread = m_data[index2].getLight(bank, m_ndef);
+						// If it is sure that the neighbor won't be
+						// unlighted, its light can spread to this node.
+						if (spread > new_light && spread >= min_safe_light[b]) {
+							new_light = spread - 1;
+						}
+					}
+				}
+			} else {
+				// If this is an opaque node, it still can emit light.
+				new_light = f.light_source;
+			}
+
+			if (new_light > 0) {
+				light_sources.push(new_light, index, b, 6);
+			}
+
+			if (new_light < old_light) {
+				// The node became opaque or doesn't provide as much
+				// light as the previous one, so it must be unlighted.
+				n.setLight(bank, 0, f);
+				disappearing_lights.push(old_light, index, b, 6);
+
+				// Remove sunlight, if there was any
+				if (bank == LIGHTBANK_DAY && old_light == LIGHT_SUN) {
+					u32 index2 = index;
+					while (step(index2, 4, &index2)) {
+						MapNode &n2 = m_data[index2];
+						// If this node doesn't have sunlight, the nodes below
+						// it don't have too.
+						if (n2.getLight(LIGHTBANK_DAY, m_ndef) != LIGHT_SUN) {
+							break;
+						}
+						// Remove sunlight and add to unlight queue.
+						n2.setLight(LIGHTBANK_DAY, 0, m_ndef);
+						m_slots[index2 >> WINDOW_SLOT_SHIFT].dirty = true;
+						disappearing_lights.push(LIGHT_SUN, index2, b,
+							4 /* The node above caused the change */);
+					}
+					if (m_need_grow) {
+						return false;
+					}
+				}
+			} else if (new_light > old_light) {
+				// It is sure that the node provides more light than the previous
+				// one, unlighting is not necessary.
+				// Propagate sunlight
+				if (bank == LIGHTBANK_DAY && new_light == LIGHT_SUN) {
+					u32 index2 = index;
+					while (step(index2, 4, &index2)) {
+						const MapNode &n2 = m_data[index2];
+						// This should not happen, but if the node has sunlight
+						// then the iteration should stop.
+						if (n2.getLight(LIGHTBANK_DAY, m_ndef) == LIGHT_SUN) {
+							break;
+						}
+						// If the node terminates sunlight, stop.
+						if (!m_ndef->get(n2).sunlight_propagates) {
+							break;
+						}
+						// Mark node for lighting.
+						light_sources.push(LIGHT_SUN, index2, b, 4);
+					}
+					if (m_need_grow) {
+						return false;
+					}
+				}
+			}
+		}
+	}
+
+	// Remove lights
+	unspreadLight(disappearing_lights, light_sources);
+	if (m_need_grow) {
+		return false;
+	}
+	// Initialize light values for light spreading.
+	for (u8 i = 0; i <= LIGHT_SUN; i++) {
+		const std::vector<u32> &lights = light_sources.lights[i];
+		for (std::vector<u32>::const_iterator it = lights.begin();
+				it != lights.end(); ++it) {
+			u32 index = *it >> 4;
+			m_data[index].setLight(banks[(*it >> 3) & 1], i, m_ndef);
+			m_slots[index >> WINDOW_SLOT_SHIFT].dirty = true;
+		}
+	}
+	// Spread lights.
+	spreadLight(light_sources);
+	return !m_need_grow;
+}
+
+void LightingUpdate::commit(Map *map,
+	std::map<v3s16, MapBlock*> &modified_blocks)
+{
+	const size_t block_size = MapBlock::nodecount * sizeof(MapNode);
+
+	for (u32 i = 0; i < m_slots.size(); i++) {
+		const Slot &slot = m_slots[i];
+		if (!slot.exists || !(slot.dirty || slot.incomplete)) {
+			continue;
+		}
+		MapBlock *block = map->getBlockNoCreateNoEx(slot.pos);
+		if (block == NULL || block->isDummy()) {
+			continue;
+		}
+		if (slot.incomplete) {
+			block->setLightingComplete(
+				block->getLightingComplete() & ~slot.incomplete);
+		}
+		// Light that was removed and spread again is often unchanged
+		const MapNode *data = &m_data[i << WINDOW_SLOT_SHIFT];
+		if (slot.dirty && memcmp(block->getData(), data, block_size) != 0) {
+			memcpy(block->getData(), data, block_size);
+			block->raiseModified(MOD_STATE_WRITE_NEEDED,
+				MOD_REASON_SET_NODE_NO_CHECK);
+			modified_blocks[slot.pos] = block;
+		} else if (slot.changed_nodes) {
+			modified_blocks[slot.pos] = block;
+		}
+	}
+}
+
+void update_lighting_nodes(Map *map,
+	std::vector<std::pair<v3s16, MapNode> > &oldnodes,
+	std::map<v3s16, MapBlock*> &modified_blocks)
+{
+	if (oldnodes.size() >= LIGHTING_WINDOW_MIN_NODES) {
+		LightingUpdate update(map->getNodeDefManager(), oldnodes);
+		while (update.prepare(map)) {
+			if (update.compute()) {
+				update.commit(map, modified_blocks);
+				return;
+			}
+		}
+	}
+	update_lighting_nodes_in_map(map, oldnodes, modified_blocks);
+}
+
 /*!
  * Borders of a map block in relative node coordinates.
  * Compatible with type 'direction'.
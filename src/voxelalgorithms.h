@@ -74,6 +74,93 @@ void update_lighting_nodes(
 	std::vector<std::pair<v3s16, MapNode> > &oldnodes,
 	std::map<v3s16, MapBlock*> &modified_blocks);
 
+/*!
+ * Does the same as update_lighting_nodes(), but on a copy of the
+ * affected map blocks (the window) instead of on the map itself.
+ * Both light banks are processed in one pass and only the blocks
+ * whose light changed are written back.
+ *
+ * If compute() returns false, light reached the border of the window:
+ * call prepare() again to load a window grown towards those borders and
+ * retry. The map must not change between prepare() and commit().
+ *
+ * Usage:
+ * \code
+ * LightingUpdate update(ndef, oldnodes);
+ * while (update.prepare(map)) {
+ *     if (update.compute()) {
+ *         update.commit(map, modified_blocks);
+ *         break;
+ *     }
+ * }
+ * \endcode
+ */
+class LightingUpdate
+{
+public:
+	//! \param oldnodes the replaced nodes, like for update_lighting_nodes()
+	LightingUpdate(INodeDefManager *ndef,
+		const std::vector<std::pair<v3s16, MapNode> > &oldnodes);
+
+	/*!
+	 * Copies the window from the map.
+	 * \returns false if the window would be too large.
+	 */
+	bool prepare(Map *map);
+
+	/*!
+	 * Calculates the new light in the window.
+	 * \returns false if the window must grow.
+	 */
+	bool compute();
+
+	/*!
+	 * Writes the modified blocks back to the map.
+	 * \param modified_blocks output, contains all map blocks that
+	 * were modified
+	 */
+	void commit(Map *map, std::map<v3s16, MapBlock*> &modified_blocks);
+
+	//! Number of map blocks in the window
+	inline u32 getWindowSize() const { return m_slots.size(); }
+
+private:
+	struct Queue;
+
+	//! A map block of the window
+	struct Slot {
+		v3s16 pos;
+		bool exists;
+		bool underground;
+		bool dirty;
+		//! Contains one of the changed nodes
+		bool changed_nodes;
+		//! Lighting complete flags (see MapBlock) to be cleared
+		u16 incomplete;
+		//! Slots of the neighbor blocks, -1 if outside the window
+		s32 neighbors[6];
+	};
+
+	bool getIndex(v3s16 p, u32 *index) const;
+	bool step(u32 index, u8 dir, u32 *neighbor_index);
+	bool isSunlightAbove(u32 index);
+	void unspreadLight(Queue &from_nodes, Queue &light_sources);
+	void spreadLight(Queue &light_sources);
+
+	INodeDefManager *m_ndef;
+	std::vector<std::pair<v3s16, MapNode> > m_oldnodes;
+
+	//! Window in block coordinates
+	VoxelArea m_block_area;
+	std::vector<Slot> m_slots;
+	//! Nodes of the window, one MapBlock after the other
+	std::vector<MapNode> m_data;
+
+	bool m_need_grow;
+	//! Directions (bit i for direction i) in which light left the window
+	u8 m_grow_dirs;
+};
+
 /*!
  * Updates borders of the given mapblock.
  * Only updates if the block was marked with incomplete